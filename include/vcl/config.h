@@ -19,4 +19,10 @@
 
 #define VCL_UNUSED(X) (void)(X)
 
+#ifdef __GNUC__
+#define VCL_PREFETCH(X) __builtin_prefetch(X)
+#else
+#define VCL_PREFETCH(X) VCL_UNUSED(X)
+#endif  // __GNUC__
+
 #endif  // CONFIG_H_
@@ -4,6 +4,7 @@
 
 #include <inttypes.h>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <limits>
 #include <list>
@@ -26,12 +27,17 @@
 #include <vcl/config.h>
 #include <vcl/util.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif  // __SSE2__
+
 namespace vcl {
 class Value;
 class Object;
 class String;
 class List;
 class Dict;
+class DictShape;
 class ACL;
 class Function;
 class Extension;
@@ -47,6 +53,7 @@ template <typename T>
 class Handle;
 
 class GC;
+class GCVisitor;
 class ContextGC;
 class ImmutableGC;
 class InternalAllocator;
@@ -61,6 +68,7 @@ namespace vm {
 namespace ast {
 struct File;
 }  // namespace ast
+class ExecutionProfile;
 class IPPattern;
 class Procedure;
 class Runtime;
@@ -87,6 +95,9 @@ class Runtime;
 // Then the outer most code catch this exception to know this context is using
 // too
 // much memory and then kill this context.
+//
+// Objects are carved from slab pages , so the hook sees page sized requests
+// instead of one request per object , see detail::SlabAllocator.
 
 class AllocatorHook {
  public:
@@ -376,27 +387,34 @@ class Handle VCL_FINAL {
 
 // Value represents anything inside of VCL script. It is a holder that can be
 // used to store any types of value and also it is the type that is used inside
-// of the interpreter's stack. Internally , Value object is represented as
-// nan-tagging
-// pointer compared to our older version , which directly uses boost::variant.
-// This new representation makes our assembly based interepter easier to write
-// and
-// also the memory footprint is smaller which leads to better cache efficiency.
+// of the interpreter's stack. Internally , Value object is a plain tagged
+// union : a 16 bytes payload plus the type tag, 24 bytes in total. Primitive
+// values are stored inline and heap objects are stored as pointer. Copying a
+// Value is just a memcpy and checking a type is a single compare against the
+// tag , which matters since the interpreter copies Value all the time.
+//
+// Size and Duration are the widest primitives , each of them has 4 32 bits
+// fields which are all visible to user script so we keep them as is instead
+// of normalizing them into a single integer.
 class Value VCL_FINAL {
  public:
-  Value() : m_value(), m_type(TYPE_NULL) {}
+  Value() : m_type(TYPE_NULL) { m_value.object = NULL; }
 
-  explicit Value(int32_t value) : m_value(value), m_type(TYPE_INTEGER) {}
+  explicit Value(int32_t value) : m_type(TYPE_INTEGER) {
+    m_value.integer = value;
+  }
 
-  explicit Value(double value) : m_value(value), m_type(TYPE_REAL) {}
+  explicit Value(double value) : m_type(TYPE_REAL) { m_value.real = value; }
 
-  explicit Value(bool value) : m_value(value), m_type(TYPE_BOOLEAN) {}
+  explicit Value(bool value) : m_type(TYPE_BOOLEAN) { m_value.boolean = value; }
 
-  explicit Value(const vcl::util::Size& value)
-      : m_value(value), m_type(TYPE_SIZE) {}
+  explicit Value(const vcl::util::Size& value) : m_type(TYPE_SIZE) {
+    StoreSize(value);
+  }
 
-  explicit Value(const vcl::util::Duration& value)
-      : m_value(value), m_type(TYPE_DURATION) {}
+  explicit Value(const vcl::util::Duration& value) : m_type(TYPE_DURATION) {
+    StoreDuration(value);
+  }
 
   inline explicit Value(String* value);
   inline explicit Value(List*);
@@ -415,17 +433,7 @@ class Value VCL_FINAL {
   template <typename E>
   inline explicit Value(const Handle<E>&);
 
-  Value(const Value& value) : m_value(value.m_value), m_type(value.m_type) {}
-
-  Value& operator=(const Value& value) {
-    if (this == &value)
-      return *this;
-    else {
-      m_value = value.m_value;
-      m_type = value.m_type;
-      return *this;
-    }
-  }
+  // Copy constructor and assignment operator are the trivial ones
 
  public:  // Type
 // Type Check IsXXX() function
@@ -437,23 +445,25 @@ class Value VCL_FINAL {
   // Getters
   int32_t GetInteger() const {
     DCHECK(IsInteger());
-    return boost::get<int32_t>(m_value);
+    return m_value.integer;
   }
   double GetReal() const {
     DCHECK(IsReal());
-    return boost::get<double>(m_value);
+    return m_value.real;
   }
   bool GetBoolean() const {
     DCHECK(IsBoolean());
-    return boost::get<bool>(m_value);
+    return m_value.boolean;
   }
-  const vcl::util::Size& GetSize() const {
+  vcl::util::Size GetSize() const {
     DCHECK(IsSize());
-    return boost::get<vcl::util::Size>(m_value);
+    const Quad& q = m_value.quad;
+    return vcl::util::Size(q.v0, q.v1, q.v2, q.v3);
   }
-  const vcl::util::Duration& GetDuration() const {
+  vcl::util::Duration GetDuration() const {
     DCHECK(IsDuration());
-    return boost::get<vcl::util::Duration>(m_value);
+    const Quad& q = m_value.quad;
+    return vcl::util::Duration(q.v0, q.v1, q.v2, q.v3);
   }
   inline String* GetString() const;
   inline ACL* GetACL() const;
@@ -468,25 +478,25 @@ class Value VCL_FINAL {
 
   // Setters
   void SetInteger(int32_t value) {
-    m_value = value;
+    m_value.integer = value;
     m_type = TYPE_INTEGER;
   }
   void SetReal(double value) {
-    m_value = value;
+    m_value.real = value;
     m_type = TYPE_REAL;
   }
   void SetBoolean(bool value) {
-    m_value = value;
+    m_value.boolean = value;
     m_type = TYPE_BOOLEAN;
   }
   void SetTrue() { SetBoolean(true); }
   void SetFalse() { SetBoolean(false); }
   void SetSize(const vcl::util::Size& value) {
-    m_value = value;
+    StoreSize(value);
     m_type = TYPE_SIZE;
   }
   void SetDuration(const vcl::util::Duration& value) {
-    m_value = value;
+    StoreDuration(value);
     m_type = TYPE_DURATION;
   }
   void SetNull() { m_type = TYPE_NULL; }
@@ -586,20 +596,49 @@ class Value VCL_FINAL {
   static inline void CastSizeToValueNoLostPrecision(Context*, size_t, Value*);
 
  private:
-  Object* object() const { return boost::get<Object*>(m_value); }
+  Object* object() const { return m_value.object; }
+
+  void StoreSize(const vcl::util::Size& value) {
+    Quad& q = m_value.quad;
+    q.v0 = value.gigabytes;
+    q.v1 = value.megabytes;
+    q.v2 = value.kilobytes;
+    q.v3 = value.bytes;
+  }
+
+  void StoreDuration(const vcl::util::Duration& value) {
+    Quad& q = m_value.quad;
+    q.v0 = value.hour;
+    q.v1 = value.minute;
+    q.v2 = value.second;
+    q.v3 = value.millisecond;
+  }
 
  private:
-  boost::variant<Object*,
-                 int32_t,
-                 double,
-                 bool,
-                 vcl::util::Duration,
-                 vcl::util::Size>
-      m_value;
+  // Storage for Size and Duration
+  struct Quad {
+    uint32_t v0;
+    uint32_t v1;
+    uint32_t v2;
+    uint32_t v3;
+  };
 
+  union Payload {
+    Object* object;
+    int32_t integer;
+    double real;
+    bool boolean;
+    Quad quad;
+  };
+
+  Payload m_value;
   ValueType m_type;
+
+  friend class GCVisitor;
 };
 
+BOOST_STATIC_ASSERT(sizeof(Value) <= 24);
+
 // Specialized for Value objects when we want to Mark a certain Value object
 // as root object to prevent it from being collected.
 template <>
@@ -623,11 +662,26 @@ class Handle<Value> VCL_FINAL {
   RootNodeListIterator m_iterator;
 };
 
+// Passed to Object::Trace while GC is marking , an object reports every
+// object it references to the visitor. The visitor only queues them , so
+// tracing never recurses on the C stack.
+class GCVisitor {
+ public:
+  inline void Visit(const Object* object);
+  inline void Visit(const Value& value);
+
+ private:
+  explicit GCVisitor(GC* gc) : m_gc(gc) {}
+  GC* m_gc;
+
+  friend class GC;
+  VCL_DISALLOW_COPY_AND_ASSIGN(GCVisitor);
+};
+
 // An object is something that resides on heap and controlled by GC.
 // All object will be derived from Object base class which provides
-// basical facilities for handling the GC stuff. Our GC is a simple
-// stop the world GC . All managed object will be put on top of a linked
-// list *owned* by its Context object.
+// basical facilities for handling the GC stuff. All managed object will
+// be put on top of a linked list *owned* by its Context object.
 class Object {
  public:
   virtual ~Object() = 0;
@@ -702,17 +756,13 @@ class Object {
   // Iterator
   virtual MethodStatus NewIterator(Context*, Iterator**);
 
-  // GC
-  void Mark() {
-    if (is_white()) {
-      set_gray();
-      DoMark();
-      set_black();
-    }
-  }
+  // GC , shade the object gray and queue it on the mark stack of the GC that
+  // is marking , see GC. It must only be called while GC is marking
+  inline void Mark();
 
  protected:
-  Object(ValueType type) : m_type(type), m_gc_state(GC_WHITE), m_next(NULL) {}
+  Object(ValueType type)
+      : m_type(type), m_gc_state(GC_WHITE), m_gc_flag(0), m_next(NULL) {}
 
   // This API is used to extend the GC reachability. User that writes extended
   // type needs to overwrite DoMark function to mark its internal data structure
@@ -742,6 +792,19 @@ class Object {
   // actually do the real Mark.
   virtual void DoMark() {}
 
+  // GC calls Trace to find the objects referenced by this object , the
+  // default one forwards to DoMark. A type can override Trace instead of
+  // DoMark and report its references to the visitor:
+  //
+  // void MyFoo::Trace(GCVisitor* visitor) {
+  //   visitor->Visit(m_internal_string);
+  //   visitor->Visit(m_other_object);
+  // }
+  virtual void Trace(GCVisitor* visitor) {
+    VCL_UNUSED(visitor);
+    DoMark();
+  }
+
   enum { GC_WHITE, GC_BLACK, GC_GRAY };
 
   void set_gc_state(int value) { m_gc_state = value; }
@@ -760,14 +823,24 @@ class Object {
 
   bool is_gray() const { return m_gc_state == GC_GRAY; }
 
+  // Generation of the object , see ContextGC. An old object stays black
+  // between collections and a remembered one is traced by minor collection
+  enum { GC_FLAG_OLD = 1, GC_FLAG_REMEMBERED = 2 };
+
+  bool is_old() const { return (m_gc_flag & GC_FLAG_OLD) != 0; }
+
+  bool is_remembered() const { return (m_gc_flag & GC_FLAG_REMEMBERED) != 0; }
+
  private:
   ValueType m_type;
-  uint32_t m_gc_state;
+  uint16_t m_gc_state;
+  uint16_t m_gc_flag;
   Object* m_next;
 
  private:
   friend class Value;
   friend class GC;
+  friend class GCVisitor;
   friend class ContextGC;
   friend class ImmutableGC;
 
@@ -800,6 +873,14 @@ class Iterator : public Object {
 // A string representation inside of the *script* environment. In C++ side, you
 // may still use std::string or whatever string you want to have. This string
 // is sololy operated by virtual machine.
+//
+// A string allocated by ImmutableGC is an atom. Atoms are interned , so the
+// same content is only allocated once per atom table and it is never changed
+// after its creation. An atom has its hash value computed when it is created
+// and two atoms can be compared by pointer first.
+//
+// The hash value of any string is cached once it is computed , and it is
+// dropped when the string is changed.
 class String VCL_FINAL : public Object {
  public:
   const char* data() const { return m_data.c_str(); }
@@ -810,6 +891,12 @@ class String VCL_FINAL : public Object {
 
   const std::string& ToStdString() const { return m_data; }
 
+  // Whether this string is interned
+  bool is_atom() const { return m_atom; }
+
+  // Hash value of detail::DefaultStringHasher
+  inline uint64_t hash() const;
+
  public:
   virtual MethodStatus Add(Context*, const Value&, Value*) const;
   virtual MethodStatus SelfAdd(Context*, const Value&);
@@ -827,6 +914,7 @@ class String VCL_FINAL : public Object {
   virtual MethodStatus Unset(Context* context) {
     VCL_UNUSED(context);
     m_data.clear();
+    m_hashed = false;
     return MethodStatus::kOk;
   }
 
@@ -841,7 +929,11 @@ class String VCL_FINAL : public Object {
   virtual MethodStatus ToDisplay(Context*, std::ostream*) const;
 
  public:  // Compatible Interfaces to Ease the use
-  bool operator==(const String& rhs) const { return m_data == rhs.m_data; }
+  bool operator==(const String& rhs) const {
+    if (this == &rhs) return true;
+    if (m_hashed && rhs.m_hashed && m_hash != rhs.m_hash) return false;
+    return m_data == rhs.m_data;
+  }
   bool operator==(const char* str) const { return m_data == str; }
   bool operator==(const std::string& str) const { return m_data == str; }
   bool operator!=(const String& rhs) const { return !(*this == rhs); }
@@ -861,10 +953,21 @@ class String VCL_FINAL : public Object {
   bool operator>=(const std::string& rhs) const { return m_data >= rhs; }
 
  private:
-  String(const char* str) : Object(TYPE_STRING), m_data(str), m_regex() {}
+  String(const char* str)
+      : Object(TYPE_STRING),
+        m_data(str),
+        m_hash(0),
+        m_hashed(false),
+        m_atom(false),
+        m_regex() {}
 
   String(const std::string& str)
-      : Object(TYPE_STRING), m_data(str), m_regex() {}
+      : Object(TYPE_STRING),
+        m_data(str),
+        m_hash(0),
+        m_hashed(false),
+        m_atom(false),
+        m_regex() {}
 
   virtual ~String() {}
 
@@ -875,6 +978,11 @@ class String VCL_FINAL : public Object {
  private:
   std::string m_data;
 
+  // Cached hash value , valid when m_hashed is true
+  mutable uint64_t m_hash;
+  mutable bool m_hashed;
+  bool m_atom;
+
   // Regex operations
   class Regex {
    public:
@@ -902,15 +1010,100 @@ class String VCL_FINAL : public Object {
 
 namespace detail {
 
+// Allocate a process wide unique stamp , used by Dict and Module to tell the
+// inline cache of the interpreter that its layout has been changed. A stamp is
+// never reused so a stale cache entry can never be hit even if the object is
+// collected and another object is allocated at the same address.
+uint64_t NewObjectStamp();
+
+// 64 bits string hash. It consumes 8 bytes at a time and folds each of them
+// with a 64x64 to 128 bits multiplication , the low 7 bits end up as well
+// mixed as the high bits which is what the control byte of StringDict uses.
 struct DefaultStringHasher {
-  uint32_t operator()(const char* string, size_t length) const {
-    uint32_t ret = 17771;
-    size_t i;
-    for (i = 0; i < length; ++i) {
-      ret = (ret ^ ((ret << 5) + (ret >> 2))) + (uint32_t)(string[i]);
+  uint64_t operator()(const char* string, size_t length) const {
+    static const uint64_t kSeed0 = 0xa0761d6478bd642fULL;
+    static const uint64_t kSeed1 = 0xe7037ed1a0b428dbULL;
+    uint64_t ret = kSeed0 ^ (static_cast<uint64_t>(length) * kSeed1);
+    uint64_t word;
+    for (; length >= 8; length -= 8, string += 8) {
+      memcpy(&word, string, 8);
+      ret = Mix(ret ^ word, kSeed1);
+    }
+    word = 0;
+    memcpy(&word, string, length);
+    return Mix(Mix(ret ^ word, kSeed1), kSeed0);
+  }
+
+  static uint64_t Mix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#else
+    a *= b;
+    return a ^ (a >> 29);
+#endif  // __SIZEOF_INT128__
+  }
+};
+
+// A group of control bytes of StringDict which is probed at once. A full slot
+// has the low 7 bits of its hash as control byte , an empty or deleted slot
+// has the sign bit set.
+class StringDictGroup {
+ public:
+  static const size_t kWidth = 16;
+
+  static const int8_t kEmpty = -128;
+  static const int8_t kDeleted = -2;
+
+  explicit StringDictGroup(const int8_t* ctrl)
+#ifdef __SSE2__
+      : m_ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))) {
+  }
+#else
+      : m_ctrl(ctrl) {
+  }
+#endif  // __SSE2__
+
+  // Bit mask of the control bytes equal to the input one
+  uint32_t Match(int8_t ctrl) const {
+#ifdef __SSE2__
+    return static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(ctrl), m_ctrl)));
+#else
+    uint32_t ret = 0;
+    for (size_t i = 0; i < kWidth; ++i) {
+      if (m_ctrl[i] == ctrl) ret |= (1u << i);
+    }
+    return ret;
+#endif  // __SSE2__
+  }
+
+  uint32_t MatchEmpty() const { return Match(kEmpty); }
+
+  uint32_t MatchEmptyOrDeleted() const {
+#ifdef __SSE2__
+    return static_cast<uint32_t>(_mm_movemask_epi8(m_ctrl));
+#else
+    uint32_t ret = 0;
+    for (size_t i = 0; i < kWidth; ++i) {
+      if (m_ctrl[i] < 0) ret |= (1u << i);
     }
     return ret;
+#endif  // __SSE2__
   }
+
+  // Index of the lowest bit of a non zero mask
+  static size_t LowestBit(uint32_t mask) {
+    DCHECK(mask);
+    return static_cast<size_t>(__builtin_ctz(mask));
+  }
+
+ private:
+#ifdef __SSE2__
+  __m128i m_ctrl;
+#else
+  const int8_t* m_ctrl;
+#endif  // __SSE2__
 };
 
 }  // namespace detail
@@ -926,113 +1119,130 @@ struct DefaultStringHasher {
 //    table size and chain resolution.
 // 2. Deletion is not very frequent in general. Prefering open addressing hash
 //    table makes read and search operation relative fast and efficient.
+//
+// The layout follows the swiss table. Besides the slot array there's one
+// control byte per slot holding 7 bits of the hash , a lookup compares a
+// group of 16 control bytes against the key with one SIMD instruction and
+// only touches the slots whose control byte matches. The probe stops at the
+// first group having an empty slot , so unlike a chain it never walks into
+// the entries of other keys. The control bytes are followed by a copy of the
+// first group , so a group can start at any slot without wrapping around.
+//
+// A table smaller than a group is scanned by one group load , so it is
+// allowed to be full ; a larger one grows when it is 7/8 occupied. The hash
+// of a String key is cached inside of the String , see String::hash.
+//
+// A StringDict created with capacity 0 allocates nothing until the first key
+// is inserted.
 template <typename T, typename Hasher = detail::DefaultStringHasher>
 class StringDict VCL_FINAL {
  public:
   typedef std::pair<const String*, T> ValueType;
 
  private:
-  struct HashEntry {
-    ValueType pair;
-    uint32_t full_hash;
-    uint32_t next : 29;
-    uint32_t more : 1;
-    uint32_t used : 1;
-    uint32_t del : 1;
-
-    bool Equal(const char* string, uint32_t hash) const {
-      return full_hash == hash && *pair.first == string;
-    }
+  typedef detail::StringDictGroup Group;
 
-    HashEntry() : pair(), full_hash(0), next(0), more(0), used(0), del(0) {}
-  };
+  static const size_t kNotFound = static_cast<size_t>(-1);
 
-  static uint32_t HashKey(const char* string, size_t length) {
+  static uint64_t HashKey(const char* string, size_t length) {
     return Hasher()(string, length);
   }
 
-  typedef std::vector<HashEntry> HashVector;
+  // String caches its hash value of the default hasher
+  static uint64_t HashKey(const String& key) {
+    if (boost::is_same<Hasher, detail::DefaultStringHasher>::value)
+      return key.hash();
+    return HashKey(key.data(), key.size());
+  }
 
-  template <typename Iter, typename VT>
+  static int8_t HashCtrl(uint64_t hash) {
+    return static_cast<int8_t>(hash & 0x7f);
+  }
+
+  // The key is NULL when only raw string is at hand , otherwise it is
+  // compared by pointer first which is what an atom key hits. The raw string
+  // is compared with its length so it may contain '\0'
+  static bool KeyEqual(const ValueType& pair,
+                       const String* key,
+                       const char* string,
+                       size_t length) {
+    if (pair.first == key) return true;
+    if (key) return *pair.first == *key;
+    return pair.first->size() == length &&
+           memcmp(pair.first->data(), string, length) == 0;
+  }
+
+  template <typename VT>
   class IteratorImpl {
    public:
     typedef VT ValueType;
-    IteratorImpl(const Iter& iter, const Iter& end)
-        : m_iterator(iter), m_end(end) {
+    IteratorImpl(const int8_t* ctrl, VT* slot, VT* end)
+        : m_ctrl(ctrl), m_slot(slot), m_end(end) {
       NextAvailable();
     }
 
-    IteratorImpl() : m_iterator(), m_end() {}
-
-    IteratorImpl(const IteratorImpl& that)
-        : m_iterator(that.m_iterator), m_end(that.m_end) {}
-
-    IteratorImpl& operator=(const IteratorImpl& that) {
-      if (this != &that) {
-        m_iterator = that.m_iterator;
-        m_end = that.m_end;
-      }
-      return *this;
-    }
+    IteratorImpl() : m_ctrl(NULL), m_slot(NULL), m_end(NULL) {}
 
     bool operator==(const IteratorImpl& that) const {
       DCHECK(m_end == that.m_end);
-      return m_iterator == that.m_iterator;
+      return m_slot == that.m_slot;
     }
 
     bool operator!=(const IteratorImpl& that) const {
       DCHECK(m_end == that.m_end);
-      return m_iterator != that.m_iterator;
+      return m_slot != that.m_slot;
     }
 
     IteratorImpl operator++(int) {
-      DCHECK(m_iterator != m_end);
       IteratorImpl v(*this);
-      ++m_iterator;
-      NextAvailable();
+      ++(*this);
       return v;
     }
 
     IteratorImpl& operator++() {
-      DCHECK(m_iterator != m_end);
-      ++m_iterator;
+      DCHECK(m_slot != m_end);
+      ++m_slot;
+      ++m_ctrl;
       NextAvailable();
       return *this;
     }
 
     ValueType& operator*() {
-      DCHECK(m_iterator != m_end);
-      return m_iterator->pair;
+      DCHECK(m_slot != m_end);
+      return *m_slot;
     }
 
     ValueType* operator->() {
-      DCHECK(m_iterator != m_end);
-      return &(m_iterator->pair);
+      DCHECK(m_slot != m_end);
+      return m_slot;
     }
 
    private:
     void NextAvailable() {
-      while (m_iterator != m_end) {
-        typename Iter::reference v = *m_iterator;
-        if (v.used && !v.del) break;
-        ++m_iterator;
+      while (m_slot != m_end && *m_ctrl < 0) {
+        ++m_slot;
+        ++m_ctrl;
       }
     }
 
-    Iter m_iterator;
-    Iter m_end;
+    const int8_t* m_ctrl;
+    VT* m_slot;
+    VT* m_end;
   };
 
   static const size_t kDefaultCapSize = 4;
 
  public:
-  StringDict(size_t cap = kDefaultCapSize) : m_entry(), m_used(0), m_size(0) {
-    DCHECK(!(cap & (cap - 1)));
-    m_entry.resize(cap);
+  StringDict(size_t cap = kDefaultCapSize)
+      : m_ctrl(), m_slot(), m_used(0), m_size(0) {
+    Reset(cap);
   }
 
   StringDict(const StringDict& sd)
-      : m_entry(sd.m_entry), m_used(sd.m_used), m_size(sd.m_size) {}
+      : m_ctrl(sd.m_ctrl),
+        m_slot(sd.m_slot),
+        m_used(sd.m_used),
+        m_size(sd.m_size) {}
 
   StringDict& operator=(const StringDict& sd) {
     if (this != &sd) {
@@ -1045,7 +1255,8 @@ class StringDict VCL_FINAL {
   void Swap(StringDict* that) {
     std::swap(m_used, that->m_used);
     std::swap(m_size, that->m_size);
-    m_entry.swap(that->m_entry);
+    m_ctrl.swap(that->m_ctrl);
+    m_slot.swap(that->m_slot);
   }
 
   bool empty() const { return size() == 0; }
@@ -1054,7 +1265,7 @@ class StringDict VCL_FINAL {
 
   size_t used() const { return m_used; }
 
-  size_t capacity() const { return m_entry.size(); }
+  size_t capacity() const { return m_slot.size(); }
 
   bool Insert(const String&, const T&);
 
@@ -1085,8 +1296,11 @@ class StringDict VCL_FINAL {
   }
 
   T* Find(const String& key) const;
-  T* Find(const char* key) const;
-  T* Find(const std::string& key) const { return Find(key.c_str()); }
+  T* Find(const char* key) const { return Find(key, strlen(key)); }
+  T* Find(const char* key, size_t length) const;
+  T* Find(const std::string& key) const {
+    return Find(key.data(), key.size());
+  }
 
   bool Remove(const String&, T* output);
   bool Remove(const char*, T* output);
@@ -1097,10 +1311,29 @@ class StringDict VCL_FINAL {
   void Clear();
 
  private:
-  enum { OPT_FIND, OPT_INSERT };
+  // Index of the slot holding the key , kNotFound if it is not existed
+  size_t FindSlot(const String*, const char*, size_t, uint64_t) const;
+
+  // Index of a empty or deleted slot for a new key , the table must not be
+  // full
+  size_t FindFreeSlot(uint64_t) const;
+
+  // Put a new key into a free slot , grows the table if needed
+  void InsertSlot(const String*, uint64_t, const T&);
+
+  // Remove the key in the slot
+  void RemoveSlot(size_t);
+
+  // Set a control byte and its copy after the end of the control bytes
+  void SetCtrl(size_t, int8_t);
+
+  // How many slots can be used before the table grows
+  size_t MaxLoad() const {
+    const size_t cap = capacity();
+    return cap < Group::kWidth ? cap : cap - cap / 8;
+  }
 
-  template <int OPTION>
-  HashEntry* FindEntry(const char*, uint32_t) const;
+  void Reset(size_t cap);
 
   void Rehash();
 
@@ -1108,29 +1341,49 @@ class StringDict VCL_FINAL {
   static void DoGCMark(StringDict<T, Hasher>*);
   static void DoDelete(StringDict<T, Hasher>*);
 
-  typedef IteratorImpl<typename HashVector::iterator, ValueType> Iterator;
+  typedef IteratorImpl<ValueType> Iterator;
 
-  typedef IteratorImpl<typename HashVector::const_iterator, const ValueType>
-      ConstIterator;
+  typedef IteratorImpl<const ValueType> ConstIterator;
 
-  Iterator Begin() { return Iterator(m_entry.begin(), m_entry.end()); }
-  Iterator End() { return Iterator(m_entry.end(), m_entry.end()); }
+  Iterator Begin() {
+    if (m_slot.empty()) return Iterator();
+    return Iterator(&m_ctrl[0], &m_slot[0], &m_slot[0] + m_slot.size());
+  }
+  Iterator End() {
+    if (m_slot.empty()) return Iterator();
+    ValueType* end = &m_slot[0] + m_slot.size();
+    return Iterator(&m_ctrl[0] + m_slot.size(), end, end);
+  }
   ConstIterator Begin() const {
-    const HashVector& hv = m_entry;
-    return ConstIterator(hv.begin(), hv.end());
+    if (m_slot.empty()) return ConstIterator();
+    return ConstIterator(&m_ctrl[0], &m_slot[0], &m_slot[0] + m_slot.size());
   }
   ConstIterator End() const {
-    const HashVector& hv = m_entry;
-    return ConstIterator(hv.end(), hv.end());
+    if (m_slot.empty()) return ConstIterator();
+    const ValueType* end = &m_slot[0] + m_slot.size();
+    return ConstIterator(&m_ctrl[0] + m_slot.size(), end, end);
   }
 
  private:
-  mutable HashVector m_entry;
+  // Control bytes , with a copy of the first group appended
+  std::vector<int8_t> m_ctrl;
+  mutable std::vector<ValueType> m_slot;
   uint32_t m_used;  // How many slots are occupied, used to decide whether we
                     // need to do a rehash
   uint32_t m_size;  // How many slots are actually used
 };
 
+// List represents a list type inside of the VCL script environment
+//
+// A List that only holds integers , reals or strings keeps them in a packed
+// array of int32_t , double or String* instead of an array of Value , which
+// is what lookup tables in scripts look like. The first value pushed into an
+// empty List decides its kind , storing a value of any other type moves all
+// the elements into the generic Value array and the List stays generic until
+// it is cleared.
+//
+// Since the elements are not always stored as Value , they are read by value
+// with Index and written by Set.
 class List VCL_FINAL : public Object {
  public:
   static const size_t kMaximumListSize =
@@ -1143,39 +1396,121 @@ class List VCL_FINAL : public Object {
 
   BOOST_STATIC_ASSERT(kMaximumListSize < std::numeric_limits<int32_t>::max());
 
+  // Storage kind of the elements
+  enum Kind {
+    KIND_EMPTY,    // Nothing stored yet
+    KIND_INTEGER,  // m_integer
+    KIND_REAL,     // m_real
+    KIND_STRING,   // m_string
+    KIND_GENERIC   // m_list
+  };
+
   virtual MethodStatus GetIndex(Context*, const Value&, Value*) const;
   virtual MethodStatus SetIndex(Context*, const Value&, const Value&);
 
   virtual MethodStatus Unset(Context* context) {
     VCL_UNUSED(context);
-    m_list.clear();
+    Clear();
     return MethodStatus::kOk;
   }
   virtual MethodStatus ToDisplay(Context*, std::ostream*) const;
   virtual MethodStatus NewIterator(Context*, Iterator**);
 
  public:  // List interfaces
-  void Push(const Value& value) { m_list.push_back(value); }
-  void Pop() { m_list.pop_back(); }
-  void Reserve(size_t cap) { m_list.reserve(cap); }
-  void Resize(size_t cap) { m_list.resize(cap); }
-  void Clear() { m_list.clear(); }
-  size_t size() const { return m_list.size(); }
-  bool empty() const { return m_list.empty(); }
-  Value& operator[](size_t idx) { return m_list[idx]; }
-  const Value& operator[](size_t idx) const { return m_list[idx]; }
-  Value& Index(size_t idx) { return m_list[idx]; }
-  const Value& Index(size_t idx) const { return m_list[idx]; }
+  void Push(const Value& value) {
+    if (m_kind != KindOf(value) && !Adapt(value)) {
+      m_list.push_back(value);
+    } else {
+      switch (m_kind) {
+        case KIND_INTEGER:
+          m_integer.push_back(value.GetInteger());
+          break;
+        case KIND_REAL:
+          m_real.push_back(value.GetReal());
+          break;
+        case KIND_STRING:
+          m_string.push_back(value.GetString());
+          break;
+        default:
+          m_list.push_back(value);
+          break;
+      }
+    }
+    if (value.IsObject()) WriteBarrier();
+  }
+  void Pop();
+  void Reserve(size_t cap);
+  void Resize(size_t cap);
+  void Clear();
+  size_t size() const {
+    switch (m_kind) {
+      case KIND_INTEGER:
+        return m_integer.size();
+      case KIND_REAL:
+        return m_real.size();
+      case KIND_STRING:
+        return m_string.size();
+      default:
+        return m_list.size();
+    }
+  }
+  bool empty() const { return size() == 0; }
+  Value operator[](size_t idx) const { return Index(idx); }
+  inline Value Index(size_t idx) const;
+  void Set(size_t idx, const Value& value);
+
+  Kind kind() const { return m_kind; }
+
+  // Packed arrays , only the one of the current kind is not empty
+  const int32_t* integer_array() const {
+    return vcl::util::VectorAsArray(m_integer);
+  }
+  const double* real_array() const { return vcl::util::VectorAsArray(m_real); }
+  String* const* string_array() const {
+    return vcl::util::VectorAsArray(m_string);
+  }
 
  private:
-  virtual void DoMark();
+  virtual void Trace(GCVisitor* visitor);
+
+  // Kind a value can be packed into , KIND_GENERIC if it cannot be packed
+  static Kind KindOf(const Value& value) {
+    switch (value.type()) {
+      case TYPE_INTEGER:
+        return KIND_INTEGER;
+      case TYPE_REAL:
+        return KIND_REAL;
+      case TYPE_STRING:
+        return KIND_STRING;
+      default:
+        return KIND_GENERIC;
+    }
+  }
+
+  // Change the kind so the value can be stored , an empty List takes the
+  // kind of the value and others are generalized. Returns false if it ends
+  // up in KIND_GENERIC
+  bool Adapt(const Value& value);
+
+  // Move all the elements into m_list
+  void Generalize();
+
+  // Called after an object is stored , see GC::WriteBarrier
+  inline void WriteBarrier();
 
  private:
-  List() : Object(TYPE_LIST), m_list() {}
+  List() : Object(TYPE_LIST), m_gc(NULL), m_kind(KIND_EMPTY), m_reserve(0) {}
 
-  List(size_t cap) : Object(TYPE_LIST), m_list() { m_list.reserve(cap); }
+  List(size_t cap)
+      : Object(TYPE_LIST), m_gc(NULL), m_kind(KIND_EMPTY), m_reserve(cap) {}
 
   typedef std::vector<Value> ListType;
+  GC* m_gc;  // Owner GC , NULL until the List is linked
+  Kind m_kind;
+  size_t m_reserve;  // Reservation of an empty List applied once it has kind
+  std::vector<int32_t> m_integer;
+  std::vector<double> m_real;
+  std::vector<String*> m_string;
   ListType m_list;
 
   friend class GC;
@@ -1185,44 +1520,186 @@ class List VCL_FINAL : public Object {
 
 class ListIterator : public Iterator {
  public:
-  ListIterator(List* list) : m_list(list), m_itr(list->m_list.begin()) {}
+  ListIterator(List* list) : m_list(list), m_index(0) {}
 
   // Mark the list if the iterator existed
-  virtual void DoMark() { m_list->Mark(); }
+  virtual void Trace(GCVisitor* visitor) { visitor->Visit(m_list); }
 
   // Iterator public interfaces
   virtual bool Has(Context* context) const {
     VCL_UNUSED(context);
-    return m_itr != m_list->m_list.end();
+    return m_index < m_list->size();
   }
 
   virtual bool Next(Context* context) {
     VCL_UNUSED(context);
-    ++m_itr;
-    return m_itr != m_list->m_list.end();
+    ++m_index;
+    return m_index < m_list->size();
   }
 
   virtual void GetKey(Context* context, Value* value) const {
     VCL_UNUSED(context);
-    value->SetInteger(std::distance(m_list->m_list.begin(), m_itr));
+    value->SetInteger(static_cast<int32_t>(m_index));
   }
 
   virtual void GetValue(Context* context, Value* value) const {
     VCL_UNUSED(context);
-    *value = *m_itr;
+    switch (m_list->m_kind) {
+      case List::KIND_INTEGER:
+        value->SetInteger(m_list->m_integer[m_index]);
+        break;
+      case List::KIND_REAL:
+        value->SetReal(m_list->m_real[m_index]);
+        break;
+      case List::KIND_STRING:
+        value->SetString(m_list->m_string[m_index]);
+        break;
+      default:
+        *value = m_list->m_list[m_index];
+        break;
+    }
   }
 
  private:
   List* m_list;
-  typedef List::ListType::iterator Iterator;
-  mutable Iterator m_itr;
+  size_t m_index;
   VCL_DISALLOW_COPY_AND_ASSIGN(ListIterator);
 };
 
+// DictShape is the layout of a dict literal whose keys are all constant
+// strings , { a : 1 , b : 2 }. It is computed by the compiler and shared by
+// all the Dict created by that literal , such a Dict starts in the small form
+// with the keys of the shape in order , see Dict. Only a literal with no more
+// than Dict::kSmallSize keys has a shape.
+//
+// A shape is never changed once the compiler is done with it. Its keys are
+// atoms of the ImmutableGC of the CompiledCode so they are never collected.
+class DictShape VCL_FINAL {
+ public:
+  static const size_t kNotFound = static_cast<size_t>(-1);
+
+  DictShape() : m_key(), m_index(), m_stamp(detail::NewObjectStamp()) {}
+
+  // Append a key to the layout , returns false if it is already existed
+  bool Add(const String& key) {
+    if (!m_index.Insert(key, static_cast<uint32_t>(m_key.size())))
+      return false;
+    m_key.push_back(&key);
+    return true;
+  }
+
+  // Index of the key inside of the layout , kNotFound if not existed
+  size_t Find(const String& key) const {
+    const uint32_t* index = m_index.Find(key);
+    return index ? *index : kNotFound;
+  }
+
+  size_t Find(const char* key) const {
+    const uint32_t* index = m_index.Find(key);
+    return index ? *index : kNotFound;
+  }
+
+  const String* key(size_t index) const {
+    DCHECK(index < m_key.size());
+    return m_key[index];
+  }
+
+  // All the keys in order , shared by the Dict of this shape
+  const String* const* keys() const { return m_key.empty() ? NULL : &m_key[0]; }
+
+  size_t size() const { return m_key.size(); }
+
+  // Unique stamp of the shape , it never collides with the stamp of a Dict or
+  // Module , see Dict::stamp
+  uint64_t stamp() const { return m_stamp; }
+
+ private:
+  std::vector<const String*> m_key;
+  StringDict<uint32_t> m_index;
+  uint64_t m_stamp;
+
+  VCL_DISALLOW_COPY_AND_ASSIGN(DictShape);
+};
+
 // Dict represents a dictionary type inside of the VCL script environment
+//
+// Most dictionaries only have a few keys , so a Dict starts in the small
+// form : up to kSmallSize keys and values are stored in one array sized to
+// the keys actually added , and a lookup is a linear scan comparing the key
+// pointer first , which is what an atom key hits , and the content next. Once
+// a key is added to a full small form all the entries move into a hash table
+// allocated at that point , and the Dict stays in hash form until it is
+// cleared. An empty Dict allocates nothing besides itself.
+//
+// A Dict created from a dict literal with constant keys is a small form that
+// also refers to the DictShape of the literal , its keys are exactly the
+// keys of the shape in the same order and are read from the shape , the
+// Dict only stores the values. Reading and updating an existed key keeps the
+// shape , adding or removing a key drops it and copies the keys into the
+// Dict.
 class Dict VCL_FINAL : public Object {
   typedef StringDict<Value> DictType;
 
+  // Iterator over either form. The key and value are accessed by key() and
+  // value() since the small form doesn't store key value pairs , removed
+  // slots of the small form are skipped
+  template <typename Iter, typename VT>
+  class IteratorImpl {
+   public:
+    IteratorImpl(const String* const* key,
+                 VT* value,
+                 size_t index,
+                 size_t end)
+        : m_key(key), m_value(value), m_index(index), m_end(end), m_iterator() {
+      Skip();
+    }
+
+    IteratorImpl(const Iter& iter)
+        : m_key(NULL), m_value(NULL), m_index(0), m_end(0), m_iterator(iter) {}
+
+    IteratorImpl()
+        : m_key(NULL), m_value(NULL), m_index(0), m_end(0), m_iterator() {}
+
+    bool operator==(const IteratorImpl& that) const {
+      return m_index == that.m_index && m_iterator == that.m_iterator;
+    }
+
+    bool operator!=(const IteratorImpl& that) const { return !(*this == that); }
+
+    IteratorImpl operator++(int) {
+      IteratorImpl v(*this);
+      ++(*this);
+      return v;
+    }
+
+    IteratorImpl& operator++() {
+      if (m_key) {
+        ++m_index;
+        Skip();
+      } else {
+        ++m_iterator;
+      }
+      return *this;
+    }
+
+    const String* key() const {
+      return m_key ? m_key[m_index] : m_iterator->first;
+    }
+
+    VT& value() const { return m_key ? m_value[m_index] : m_iterator->second; }
+
+   private:
+    void Skip() {
+      while (m_index < m_end && !m_key[m_index]) ++m_index;
+    }
+
+    const String* const* m_key;
+    VT* m_value;
+    size_t m_index;
+    size_t m_end;
+    mutable Iter m_iterator;
+  };
+
  public:
   static const size_t kMaximumDictSize =
 #ifdef VCL_MAXIMUM_DICT_SIZE
@@ -1234,6 +1711,16 @@ class Dict VCL_FINAL : public Object {
 
   BOOST_STATIC_ASSERT(kMaximumDictSize < std::numeric_limits<int32_t>::max());
 
+  // Maximum number of keys of the small form , it is also the maximum size
+  // of a DictShape
+  static const size_t kSmallSize =
+#ifdef VCL_SMALL_DICT_SIZE
+      VCL_SMALL_DICT_SIZE
+#else
+      8
+#endif  // VCL_SMALL_DICT_SIZE
+      ;
+
   // Property
   virtual MethodStatus GetProperty(Context*, const String&, Value*) const;
   virtual MethodStatus SetProperty(Context*, const String&, const Value&);
@@ -1256,7 +1743,7 @@ class Dict VCL_FINAL : public Object {
 
   virtual MethodStatus Unset(Context* context) {
     VCL_UNUSED(context);
-    m_dict.Clear();
+    Clear();
     return MethodStatus::kOk;
   }
 
@@ -1266,13 +1753,32 @@ class Dict VCL_FINAL : public Object {
 
  public:  // Delegated APIs
   bool Insert(const String& key, const Value& v) {
-    return m_dict.Insert(key, v);
+    if (!m_dict) {
+      if (SmallFind(key) != kNotFound) return false;
+      SmallAdd(key, v);
+      return true;
+    }
+    // Insert may rehash the table even if the key is already existed
+    m_stamp = detail::NewObjectStamp();
+    if (!m_dict->Insert(key, v)) return false;
+    WriteBarrier();
+    return true;
   }
   void InsertOrUpdate(const String& key, const Value& v) {
-    m_dict.InsertOrUpdate(key, v);
+    Value* slot = const_cast<Value*>(Lookup(key));
+    if (slot) {
+      *slot = v;
+      WriteBarrier();
+    } else if (!m_dict) {
+      SmallAdd(key, v);
+    } else {
+      m_stamp = detail::NewObjectStamp();
+      m_dict->InsertOrUpdate(key, v);
+      WriteBarrier();
+    }
   }
   bool Find(const String& key, Value* output) const {
-    Value* result = m_dict.Find(key);
+    const Value* result = Lookup(key);
     if (!result) {
       return false;
     } else {
@@ -1280,18 +1786,57 @@ class Dict VCL_FINAL : public Object {
       return true;
     }
   }
-  bool Remove(const String& key, Value* output) {
-    return m_dict.Remove(key, output);
+  bool Remove(const String& key, Value* output);
+  void Clear();
+
+  size_t size() const {
+    return m_dict ? m_dict->size() : m_small_size - m_small_dead;
+  }
+  bool empty() const { return size() == 0; }
+
+  // Address of the value slot of a key or NULL if not existed. The address
+  // stays valid as long as stamp() is not changed , this is what the inline
+  // cache of the interpreter relies on
+  const Value* Lookup(const String& key) const {
+    if (!m_dict) {
+      size_t index = SmallFind(key);
+      return index == kNotFound ? NULL : m_small_value + index;
+    }
+    return m_dict->Find(key);
+  }
+
+  const Value* Lookup(const char* key) const {
+    if (!m_dict) {
+      size_t index = SmallFind(key);
+      return index == kNotFound ? NULL : m_small_value + index;
+    }
+    return m_dict->Find(key);
+  }
+
+  // Stamp of the dictionary layout , changed whenever a key is added or
+  // removed. Updating value of an existed key doesn't change it
+  uint64_t stamp() const { return m_stamp; }
+
+  // Shape of the Dict , NULL once a key is added or removed. The value of a
+  // key is at the key's index of the shape
+  const DictShape* shape() const { return m_shape; }
+
+  const Value& shape_value(size_t index) const {
+    DCHECK(m_shape && index < m_small_size);
+    return m_small_value[index];
   }
-  void Clear() { m_dict.Clear(); }
 
-  size_t size() const { return m_dict.size(); }
-  bool empty() const { return m_dict.empty(); }
+  // The returned slot is expected to be written right away
+  Value& shape_value(size_t index) {
+    DCHECK(m_shape && index < m_small_size);
+    WriteBarrier();
+    return m_small_value[index];
+  }
 
  public:
   // For unittest purpose
   bool Find(const char* key, Value* output) const {
-    Value* result = m_dict.Find(key);
+    const Value* result = Lookup(key);
     if (!result) {
       return false;
     } else {
@@ -1303,58 +1848,220 @@ class Dict VCL_FINAL : public Object {
     return Find(key.c_str(), output);
   }
 
+  // Whether the Dict is in the small form
+  bool is_small() const { return !m_dict; }
+
+  // Bytes used by the Dict and the storage of its entries
+  size_t footprint() const;
+
  public:
-  typedef DictType::Iterator Iterator;
-  typedef DictType::ConstIterator ConstIterator;
-  Iterator Begin() { return m_dict.Begin(); }
-  Iterator End() { return m_dict.End(); }
-  ConstIterator Begin() const { return m_dict.Begin(); }
-  ConstIterator End() const { return m_dict.End(); }
+  typedef IteratorImpl<DictType::Iterator, Value> Iterator;
+  typedef IteratorImpl<DictType::ConstIterator, const Value> ConstIterator;
+  Iterator Begin() {
+    if (!m_dict) return Iterator(small_key(), m_small_value, 0, m_small_size);
+    return Iterator(m_dict->Begin());
+  }
+  Iterator End() {
+    if (!m_dict) {
+      return Iterator(small_key(), m_small_value, m_small_size, m_small_size);
+    }
+    return Iterator(m_dict->End());
+  }
+  ConstIterator Begin() const {
+    if (!m_dict) {
+      return ConstIterator(small_key(), m_small_value, 0, m_small_size);
+    }
+    const DictType& dict = *m_dict;
+    return ConstIterator(dict.Begin());
+  }
+  ConstIterator End() const {
+    if (!m_dict) {
+      return ConstIterator(
+          small_key(), m_small_value, m_small_size, m_small_size);
+    }
+    const DictType& dict = *m_dict;
+    return ConstIterator(dict.End());
+  }
 
  private:
-  virtual void DoMark() { DictType::DoGCMark(&m_dict); }
+  static const size_t kNotFound = static_cast<size_t>(-1);
+
+  virtual void Trace(GCVisitor* visitor);
+
+  // Keys of the small form , they belong to the shape if there is one
+  const String* const* small_key() const {
+    return m_shape ? m_shape->keys() : m_small_key;
+  }
+
+  // Index of a key inside of the small form , kNotFound if not existed
+  size_t SmallFind(const String& key) const {
+    const String* const* small = small_key();
+    for (size_t i = 0; i < m_small_size; ++i) {
+      if (small[i] == &key) return i;
+    }
+    for (size_t i = 0; i < m_small_size; ++i) {
+      if (small[i] && *small[i] == key) return i;
+    }
+    return kNotFound;
+  }
+
+  size_t SmallFind(const char* key) const {
+    const String* const* small = small_key();
+    for (size_t i = 0; i < m_small_size; ++i) {
+      if (small[i] && *small[i] == key) return i;
+    }
+    return kNotFound;
+  }
+
+  // Add a new key to the small form , a full small form drops its removed
+  // slots , grows or moves to the hash form
+  void SmallAdd(const String& key, const Value& value);
+
+  // Move the small form into a block of the given capacity , the keys are
+  // copied from the shape if there is one and the shape is dropped
+  void SmallReserve(size_t capacity);
+
+  // Drop the removed slots of the small form
+  void SmallCompact();
+
+  // Move the small form into the hash table
+  void ToHash(size_t reserve);
+
+  // Called after a key or value is stored , see GC::WriteBarrier
+  inline void WriteBarrier();
 
  private:
-  Dict(size_t reserve) : Object(TYPE_DICT), m_dict(reserve) {}
+  Dict(size_t reserve)
+      : Object(TYPE_DICT),
+        m_gc(NULL),
+        m_small_key(NULL),
+        m_small_value(NULL),
+        m_small_size(0),
+        m_small_dead(0),
+        m_small_capacity(0),
+        m_shape(NULL),
+        m_dict(NULL),
+        m_stamp(detail::NewObjectStamp()) {
+    if (reserve > kSmallSize) {
+      ToHash(reserve);
+    } else if (reserve) {
+      SmallReserve(reserve);
+    }
+  }
 
-  Dict() : Object(TYPE_DICT), m_dict() {}
+  Dict()
+      : Object(TYPE_DICT),
+        m_gc(NULL),
+        m_small_key(NULL),
+        m_small_value(NULL),
+        m_small_size(0),
+        m_small_dead(0),
+        m_small_capacity(0),
+        m_shape(NULL),
+        m_dict(NULL),
+        m_stamp(detail::NewObjectStamp()) {}
+
+  // The values are all null , they are filled by the creator in the order of
+  // the shape's keys. Only the values are allocated , see small_key
+  Dict(const DictShape* shape)
+      : Object(TYPE_DICT),
+        m_gc(NULL),
+        m_small_key(NULL),
+        m_small_value(NULL),
+        m_small_size(0),
+        m_small_dead(0),
+        m_small_capacity(0),
+        m_shape(shape),
+        m_dict(NULL),
+        m_stamp(detail::NewObjectStamp()) {
+    DCHECK(shape->size() > 0 && shape->size() <= kSmallSize);
+    m_small_size = m_small_capacity = static_cast<uint32_t>(shape->size());
+    m_small_value = static_cast<Value*>(::malloc(m_small_size * sizeof(Value)));
+    for (size_t i = 0; i < m_small_size; ++i) ::new (m_small_value + i) Value();
+  }
 
-  DictType m_dict;
+  virtual ~Dict();
+
+  GC* m_gc;  // Owner GC , NULL until the Dict is linked
+
+  // Small form , the keys and values live in one block of m_small_capacity
+  // slots , a block of a shaped Dict has the values only and m_small_key is
+  // NULL. A removed key leaves a NULL slot behind so that a running iterator
+  // keeps its position , the slots are compacted by SmallAdd once the block
+  // is full
+  const String** m_small_key;
+  Value* m_small_value;
+  uint32_t m_small_size;
+  uint32_t m_small_dead;
+  uint32_t m_small_capacity;
+  const DictShape* m_shape;
+
+  // Hash form , NULL in the small form
+  DictType* m_dict;
+  uint64_t m_stamp;
 
   friend class GC;
   friend class DictIterator;
   VCL_DISALLOW_COPY_AND_ASSIGN(Dict);
 };
 
+// The Dict may be changed by the loop body. A small form is iterated by slot
+// index , a removed key leaves its slot behind so the iteration goes on with
+// the next key. A key added to a full small form may compact the slots , the
+// iteration then stays in bounds but may skip or repeat a key. Once the Dict
+// moves to the other form the iteration stops
 class DictIterator : public Iterator {
  public:
-  DictIterator(Dict* dict) : m_dict(dict), m_itr(dict->Begin()) {}
+  DictIterator(Dict* dict)
+      : m_dict(dict),
+        m_small(dict->is_small()),
+        m_index(0),
+        m_itr(m_small ? Dict::Iterator() : dict->Begin()) {
+    Skip();
+  }
 
-  virtual void DoMark() { m_dict->Mark(); }
+  virtual void Trace(GCVisitor* visitor) { visitor->Visit(m_dict); }
 
   virtual bool Has(Context* context) const {
     VCL_UNUSED(context);
+    if (m_small != m_dict->is_small()) return false;
+    if (m_small) return m_index < m_dict->m_small_size;
     return m_itr != m_dict->End();
   }
 
   virtual bool Next(Context* context) {
-    VCL_UNUSED(context);
-    ++m_itr;
-    return m_itr != m_dict->End();
+    if (!Has(context)) return false;
+    if (m_small) {
+      ++m_index;
+      Skip();
+    } else {
+      ++m_itr;
+    }
+    return Has(context);
   }
 
   virtual void GetKey(Context* context, Value* value) const {
     VCL_UNUSED(context);
-    value->SetString(const_cast<String*>(m_itr->first));
+    const String* key =
+        m_small ? m_dict->small_key()[m_index] : m_itr.key();
+    value->SetString(const_cast<String*>(key));
   }
 
   virtual void GetValue(Context* context, Value* value) const {
     VCL_UNUSED(context);
-    *value = m_itr->second;
+    *value = m_small ? m_dict->m_small_value[m_index] : m_itr.value();
   }
 
  private:
+  void Skip() {
+    if (!m_small) return;
+    while (m_index < m_dict->m_small_size && !m_dict->small_key()[m_index])
+      ++m_index;
+  }
+
   Dict* m_dict;
+  bool m_small;  // Form of the Dict when the iteration starts
+  size_t m_index;
   mutable Dict::Iterator m_itr;
 
   VCL_DISALLOW_COPY_AND_ASSIGN(DictIterator);
@@ -1419,18 +2126,64 @@ class Function : public Object {
 
   const std::string& name() const { return m_name; }
 
+  // Whether it is a LeafFunction
+  bool is_leaf() const { return m_leaf; }
+
  protected:
   // Prototype string needs to be provided for the function
   // and it will be compiled into a function prototype objects
   // later on for checking the input argument
-  Function(const std::string& name) : Object(TYPE_FUNCTION), m_name(name) {}
+  Function(const std::string& name)
+      : Object(TYPE_FUNCTION), m_name(name), m_leaf(false) {}
+
+  Function(const std::string& name, bool leaf)
+      : Object(TYPE_FUNCTION), m_name(name), m_leaf(leaf) {}
 
   std::string m_name;
+  bool m_leaf;
 
   friend class GC;
   VCL_DISALLOW_COPY_AND_ASSIGN(Function);
 };
 
+// Arguments of a LeafFunction call. It refers to the value stack of the
+// virtual machine directly so it is only valid during the call.
+class Arguments {
+ public:
+  Arguments(const Value* data, size_t size) : m_data(data), m_size(size) {}
+
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  const Value& operator[](size_t index) const {
+    DCHECK(index < m_size);
+    return m_data[index];
+  }
+
+ private:
+  const Value* m_data;
+  size_t m_size;
+};
+
+// A LeafFunction is a Function that never calls back into the script , ie
+// it doesn't invoke any SubRoutine or yield in the middle. The virtual machine
+// calls it with the arguments sitting on its value stack and writes the
+// result in place , no calling frame is pushed for it , so it is much cheaper
+// than a normal Function for short helpers. All the builtin functions are
+// LeafFunction. It can still be invoked as a normal Function from C++.
+class LeafFunction : public Function {
+ public:
+  virtual MethodStatus Call(Context*, const Arguments&, Value*) = 0;
+
+  // Gather the arguments from the calling frame and forward to Call
+  virtual MethodStatus Invoke(Context*, Value*);
+
+ protected:
+  LeafFunction(const std::string& name) : Function(name, true) {}
+
+  VCL_DISALLOW_COPY_AND_ASSIGN(LeafFunction);
+};
+
 // Extension is used to define compound type , well, if user defined it .
 // If user doesn't define the extension compound type, then the
 // virtual machine will tell an error about the type user tries to register.
@@ -1547,6 +2300,7 @@ class Module VCL_FINAL : public Object {
 
   // Internal APIs for user to compose a module
   void AddProperty(const String& key, const Value& value) {
+    m_stamp = detail::NewObjectStamp();
     m_map.InsertOrUpdate(key, value);
   }
 
@@ -1560,9 +2314,22 @@ class Module VCL_FINAL : public Object {
     }
   }
 
-  bool RemoveProperty(const String& key) { return m_map.Remove(key, NULL); }
+  bool RemoveProperty(const String& key) {
+    m_stamp = detail::NewObjectStamp();
+    return m_map.Remove(key, NULL);
+  }
 
-  void ClearProperty() { m_map.Clear(); }
+  void ClearProperty() {
+    m_stamp = detail::NewObjectStamp();
+    m_map.Clear();
+  }
+
+  // Same as Dict::Lookup and Dict::stamp. Module is only composed during setup
+  // so its stamp basically never changes once script starts to run
+  const Value* LookupProperty(const String& key) const {
+    return m_map.Find(key);
+  }
+  uint64_t stamp() const { return m_stamp; }
 
   virtual void DoMark() { Map::DoGCMark(&m_map); }
 
@@ -1570,9 +2337,13 @@ class Module VCL_FINAL : public Object {
 
  private:
   Module(const std::string& name)
-      : Object(TYPE_MODULE), m_map(), m_name(name) {}
+      : Object(TYPE_MODULE),
+        m_map(),
+        m_stamp(detail::NewObjectStamp()),
+        m_name(name) {}
 
   Map m_map;
+  uint64_t m_stamp;
   std::string m_name;
 
   friend class GC;
@@ -1612,13 +2383,160 @@ class SubRoutine VCL_FINAL : public Object {
   VCL_DISALLOW_COPY_AND_ASSIGN(SubRoutine);
 };
 
-// A stop the world mark and trace GC. User should mostly never have GC kicks in
-// since we don't have loop at all, the time GC kicks in should be extreamly
-// rare and also the GC should be mostly fast.
+// A mark and trace GC. User should mostly never have GC kicks in
+// since we don't have loop at all, the time GC kicks in should be extreamly
+// rare and also the GC should be mostly fast.
+//
+// With a nursery size the GC is generational. New objects are linked into the
+// young chain and a minor collection only traces the young objects reachable
+// from the roots and the remembered set , the survivors are promoted into the
+// old chain. Objects never move since native code holds raw pointers to them.
+// Old objects stay black between collections so marking stops at them , an
+// old object that may point to a young one must be in the remembered set:
+//
+//   1. List and Dict call WriteBarrier after a store , which remembers them
+//      until the next collection.
+//   2. Any other type has no barrier , a promoted one is remembered until it
+//      dies since its DoMark may reach anything.
+//
+// Global variables , the VM stack and the root list are roots , they are
+// scanned by every collection. A full collection traces everything.
+//
+// Marking is tri-color with an explicit mark stack , Object::Mark and
+// GCVisitor only shade an object and queue it. Popped objects wait in a small
+// buffer after their header is prefetched , so several cache misses are in
+// flight while the tracer works. The mark stack is bounded , once it is full
+// the shaded objects are left gray and the heap is scanned for them when the
+// stack drains. With a step budget a full collection is
+// incremental , TryCollect starts the cycle and then every allocation traces
+// at most budget gray objects until the worklist is empty. The mutator runs
+// between the steps so:
+//
+//   1. Objects allocated during the cycle are white , the final step finds
+//      the live ones from the roots.
+//   2. List and Dict WriteBarrier turns a black container gray again , so a
+//      reference stored into it after it is traced is not lost.
+//   3. Types without barrier are traced again by the final step.
+//
+// The final step rescans the roots and the types without barrier , drains the
+// worklist and sweeps , it is atomic. Minor collections are deferred while a
+// cycle is running. ForceCollect abandons a running cycle and does a stop the
+// world collection.
+class GC;
+
+namespace detail {
+// The GC that is marking on this thread , Object::Mark queues objects onto its
+// mark stack
+extern __thread GC* kMarkingGC;
+
+// Size class allocator for the objects of a GC. Each size class owns pages of
+// kPageSize bytes carved into equal slots , freed slots are kept in a free
+// list per page. A slot starts with a pointer to its page so freeing an object
+// finds its page without knowing its size. Pages come from GC::Malloc , so an
+// AllocatorHook sees page sized requests , and a page whose slots are all
+// freed is handed back to GC::Free unless it is the last page of its class.
+//
+// Objects that don't fit the largest class or need an alignment above 8 are
+// allocated from GC::Malloc directly , with a NULL page pointer.
+class SlabAllocator {
+ public:
+  static const size_t kPageSize =
+#ifdef VCL_SLAB_PAGE_SIZE
+      VCL_SLAB_PAGE_SIZE
+#else
+      16384
+#endif  // VCL_SLAB_PAGE_SIZE
+      ;
+
+  static const size_t kAlignment = 16;
+  static const size_t kMaxSlotSize = 512;
+
+  explicit SlabAllocator(GC* gc) : m_gc(gc), m_class(), m_pages(0) {}
+
+  ~SlabAllocator() { DCHECK(m_pages == 0); }
+
+  inline void* Allocate(size_t size, size_t alignment);
+
+  inline void Free(void* ptr);
+
+  // Hand the empty pages back , all objects must be freed already
+  void Release();
+
+  // Number of pages held
+  size_t pages() const { return m_pages; }
+
+ private:
+  struct Page {
+    Page* prev;  // Pages of the class that have free slots
+    Page* next;
+    char* free;  // Freed slots , linked through their first word
+    char* bump;  // Slots never used
+    uint32_t used;
+    uint32_t capacity;
+    uint32_t size_class;
+  };
+
+  struct SizeClass {
+    Page* partial;
+    size_t pages;
+  };
+
+  static const size_t kClassSize = kMaxSlotSize / kAlignment;
+
+  static size_t HeaderSize() {
+    return (sizeof(Page) + kAlignment - 1) & ~(kAlignment - 1);
+  }
+
+  Page* NewPage(size_t size_class);
+
+  // Called once a page has no used slot
+  void ReleasePage(Page* page);
+
+  void* AllocateLarge(size_t size);
+  void FreeLarge(void* ptr);
+
+  void LinkPartial(Page* page) {
+    SizeClass* c = m_class + page->size_class;
+    page->prev = NULL;
+    page->next = c->partial;
+    if (c->partial) c->partial->prev = page;
+    c->partial = page;
+  }
+
+  void UnlinkPartial(Page* page) {
+    SizeClass* c = m_class + page->size_class;
+    if (page->prev) {
+      page->prev->next = page->next;
+    } else {
+      c->partial = page->next;
+    }
+    if (page->next) page->next->prev = page->prev;
+  }
+
+  GC* m_gc;
+  SizeClass m_class[kClassSize];
+  size_t m_pages;
+
+  VCL_DISALLOW_COPY_AND_ASSIGN(SlabAllocator);
+};
+
+}  // namespace detail
+
 class GC {
  protected:
   virtual ~GC();
 
+  static const size_t kMarkStackLimit =
+#ifdef VCL_GC_MARK_STACK_LIMIT
+      VCL_GC_MARK_STACK_LIMIT
+#else
+      65536
+#endif  // VCL_GC_MARK_STACK_LIMIT
+      ;
+
+  // Number of popped objects prefetched ahead of tracing , a power of 2
+  static const size_t kPrefetchDistance = 8;
+
   static const size_t kMinimumGCGap =
 #ifdef VCL_MINIMUM_GC_GAP
       VCL_MINIMUM_GC_GAP
@@ -1632,10 +2550,23 @@ class GC {
      const size_t minimum_gc_gap = kMinimumGCGap)
       : m_gc_start(NULL),
         m_gc_size(0),
+        m_young_start(NULL),
+        m_young_size(0),
+        m_nursery_size(0),
+        m_slab(this),
+        m_remembered(),
+        m_marking(false),
+        m_step_budget(0),
+        m_gray(),
+        m_mark_overflow(false),
+        m_prefetch_head(0),
+        m_prefetch_size(0),
+        m_rescan(),
         m_next_gc(next_gc_trigger),
         m_gc_ratio(gc_ratio),
         m_minimum_gc_gap(minimum_gc_gap),
-        m_gc_times(0) {
+        m_gc_times(0),
+        m_minor_gc_times(0) {
     DCHECK(gc_ratio >= 0.0 && gc_ratio <= 1.0);
     m_next_gc = m_next_gc < minimum_gc_gap ? minimum_gc_gap : m_next_gc;
   }
@@ -1643,28 +2574,114 @@ class GC {
   // Try to do the GC collection based on the internal trigger mechanism
   // if a GC process is triggered , it returns true ; otherwise returns false
   bool TryCollect() {
+    if (m_marking) {
+      if (MarkStep(m_step_budget)) FinishCollect();
+      return true;
+    }
     if (CanCollect()) {
-      ForceCollect();
+      if (m_step_budget) {
+        StartMark();
+      } else {
+        ForceCollect();
+      }
+      return true;
+    }
+    if (CanMinorCollect()) {
+      ForceMinorCollect();
       return true;
     }
     return false;
   }
 
+  // A stop the world full collection , a running incremental cycle is
+  // abandoned since objects it traced may be dead now
   void ForceCollect() {
-    ++m_gc_times;
+    if (m_marking) AbortMark();
+    StartMark();
+    FinishCollect();
+  }
+
+  // Collect the young generation at the end of a region , it is skipped
+  // while an incremental cycle is running since that cycle collects it
+  void CollectRegion() {
+    if (m_nursery_size && m_young_size && !m_marking) ForceMinorCollect();
+  }
+
+  // Collect the young generation only , it is a full collection if the GC
+  // is not generational or an incremental cycle is running
+  void ForceMinorCollect() {
+    if (!m_nursery_size || m_marking) {
+      ForceCollect();
+      return;
+    }
+    ++m_minor_gc_times;
+    MarkScope scope(this);
+    GCVisitor visitor(this);
     Mark();
-    Collect();
+    for (size_t i = 0; i < m_remembered.size(); ++i) {
+      m_remembered[i]->Trace(&visitor);
+    }
+    MarkStep(0);
+    m_gc_size -= CollectYoung();
   }
 
+  // Start a full collection cycle by shading the roots
+  void StartMark();
+
+  // Trace at most budget gray objects , 0 means until the worklist is empty.
+  // Returns true when the worklist is empty
+  bool MarkStep(size_t budget);
+
+  // The atomic final step of a cycle , rescan and sweep
+  void FinishCollect();
+
+  // Drop a running cycle and paint every object white
+  void AbortMark();
+
   // Force to do a GC collect operation. It will return how many objects have
   // been collected. Be cautious this process is not very fast
   size_t Collect();
 
+  // Sweep the young chain and promote the survivors , returns how many
+  // objects have been collected
+  size_t CollectYoung();
+
   // Mark all the managed object
   virtual void Mark() = 0;
 
   size_t gc_size() const { return m_gc_size; }
 
+  // Number of objects in the young generation
+  size_t young_size() const { return m_young_size; }
+
+  // Number of young objects that triggers a minor collection , 0 means the
+  // GC is not generational
+  size_t nursery_size() const { return m_nursery_size; }
+
+  // Number of gray objects traced per allocation during a full collection
+  // cycle , 0 means full collections stop the world
+  size_t step_budget() const { return m_step_budget; }
+
+  void set_step_budget(size_t budget) { m_step_budget = budget; }
+
+  // Whether an incremental full collection cycle is running
+  bool marking() const { return m_marking; }
+
+  // Turning the nursery off does a full collection to empty the young chain
+  void set_nursery_size(size_t size) {
+    if (m_marking) AbortMark();
+    if (!size && m_nursery_size) {
+      ForceCollect();
+      m_nursery_size = 0;
+      PaintOld(Object::GC_WHITE);
+    } else if (size && !m_nursery_size) {
+      m_nursery_size = size;
+      PaintOld(Object::GC_BLACK);
+    } else {
+      m_nursery_size = size;
+    }
+  }
+
   size_t next_gc_trigger() const { return m_next_gc; }
 
   double gc_ratio() const { return m_gc_ratio; }
@@ -1677,16 +2694,28 @@ class GC {
   void set_next_gc_trigger(size_t gc_trigger) { m_next_gc = gc_trigger; }
 
  protected:
-  // Virtual function for customization of these malloc stuff. User could
-  // then write a slab based Malloc and Free to even minimize the GC cost
+  // Virtual function for customization of these malloc stuff. Objects are
+  // allocated from the slab pages , only the pages and the large objects go
+  // through Malloc and Free
   virtual void* Malloc(size_t length) { return ::malloc(length); }
   virtual void Free(void* ptr) { ::free(ptr); }
   template <typename T>
+  void* Allocate() {
+    return m_slab.Allocate(sizeof(T), boost::alignment_of<T>::value);
+  }
+  template <typename T>
   void Delete(T* ptr) {
     vcl::util::Destruct(ptr);
-    Free(static_cast<void*>(ptr));
+    m_slab.Free(static_cast<void*>(ptr));
   }
 
+  // Delete all the objects and release the slab pages. A GC that overrides
+  // Malloc and Free calls it in its destructor
+  void DeleteAll();
+
+  // Number of slab pages held
+  size_t slab_pages() const { return m_slab.pages(); }
+
  public:  // General purpose object that user could use to allocate object
           // from managed heap. The following APIs will *not* trigger GC
           // procedure so it is mostly safe for anybody to use. However since
@@ -1699,7 +2728,7 @@ class GC {
   template <typename T>
   T* New() {
     BOOST_STATIC_ASSERT(boost::is_base_of<Object, T>::value);
-    return LinkObject<T>(::new (Malloc(sizeof(T))) T());
+    return LinkObject<T>(::new (Allocate<T>()) T());
   }
 
   // If we have C++ 11 as default, then we could migrate to use variadic
@@ -1707,25 +2736,25 @@ class GC {
   template <typename T, typename A1>
   T* New(const A1& a1) {
     BOOST_STATIC_ASSERT(boost::is_base_of<Object, T>::value);
-    return LinkObject<T>(::new (Malloc(sizeof(T))) T(a1));
+    return LinkObject<T>(::new (Allocate<T>()) T(a1));
   }
 
   template <typename T, typename A1, typename A2>
   T* New(const A1& a1, const A2& a2) {
     BOOST_STATIC_ASSERT(boost::is_base_of<Object, T>::value);
-    return LinkObject<T>(::new (Malloc(sizeof(T))) T(a1, a2));
+    return LinkObject<T>(::new (Allocate<T>()) T(a1, a2));
   }
 
   template <typename T, typename A1, typename A2, typename A3>
   T* New(const A1& a1, const A2& a2, const A3& a3) {
     BOOST_STATIC_ASSERT(boost::is_base_of<Object, T>::value);
-    return LinkObject<T>(::new (Malloc(sizeof(T))) T(a1, a2, a3));
+    return LinkObject<T>(::new (Allocate<T>()) T(a1, a2, a3));
   }
 
   template <typename T, typename A1, typename A2, typename A3, typename A4>
   T* New(const A1& a1, const A2& a2, const A3& a3, const A4& a4) {
     BOOST_STATIC_ASSERT(boost::is_base_of<Object, T>::value);
-    return LinkObject<T>(::new (Malloc(sizeof(T))) T(a1, a2, a3, a4));
+    return LinkObject<T>(::new (Allocate<T>()) T(a1, a2, a3, a4));
   }
 
   template <typename T,
@@ -1736,7 +2765,7 @@ class GC {
             typename A5>
   T* New(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5) {
     BOOST_STATIC_ASSERT(boost::is_base_of<Object, T>::value);
-    return LinkObject<T>(::new (Malloc(sizeof(T))) T(a1, a2, a3, a4, a5));
+    return LinkObject<T>(::new (Allocate<T>()) T(a1, a2, a3, a4, a5));
   }
 
   template <typename T,
@@ -1753,7 +2782,7 @@ class GC {
          const A5& a5,
          const A6& a6) {
     BOOST_STATIC_ASSERT(boost::is_base_of<Object, T>::value);
-    return LinkObject<T>(::new (Malloc(sizeof(T))) T(a1, a2, a3, a4, a5, a6));
+    return LinkObject<T>(::new (Allocate<T>()) T(a1, a2, a3, a4, a5, a6));
   }
 
   template <typename T,
@@ -1772,7 +2801,7 @@ class GC {
          const A6& a6,
          const A7& a7) {
     BOOST_STATIC_ASSERT(boost::is_base_of<Object, T>::value);
-    return LinkObject<T>(::new (Malloc(sizeof(T)))
+    return LinkObject<T>(::new (Allocate<T>())
                              T(a1, a2, a3, a4, a5, a6, a7));
   }
 
@@ -1794,7 +2823,7 @@ class GC {
          const A7& a7,
          const A8& a8) {
     BOOST_STATIC_ASSERT(boost::is_base_of<Object, T>::value);
-    return LinkObject<T>(::new (Malloc(sizeof(T)))
+    return LinkObject<T>(::new (Allocate<T>())
                              T(a1, a2, a3, a4, a5, a6, a7, a8));
   }
 
@@ -1814,16 +2843,89 @@ class GC {
  public:
   size_t gc_times() const { return m_gc_times; }
 
+  size_t minor_gc_times() const { return m_minor_gc_times; }
+
  private:
   template <typename T>
   T* LinkObject(Object* object) {
-    object->m_next = m_gc_start;
-    m_gc_start = object;
+    if (object->type() == TYPE_LIST) {
+      static_cast<List*>(object)->m_gc = this;
+    } else if (object->type() == TYPE_DICT) {
+      static_cast<Dict*>(object)->m_gc = this;
+    }
+    if (m_nursery_size) {
+      object->m_next = m_young_start;
+      m_young_start = object;
+      ++m_young_size;
+    } else {
+      object->m_next = m_gc_start;
+      m_gc_start = object;
+    }
     ++m_gc_size;
     return static_cast<T*>(object);
   }
 
-  bool CanCollect() const { return m_gc_size >= m_next_gc; }
+  // Make the worklist of this GC the target of Object::Mark for the scope
+  class MarkScope {
+   public:
+    explicit MarkScope(GC* gc) : m_saved(detail::kMarkingGC) {
+      detail::kMarkingGC = gc;
+    }
+    ~MarkScope() { detail::kMarkingGC = m_saved; }
+
+   private:
+    GC* m_saved;
+  };
+
+  // Queue a gray object , it is left for RescanGray if the stack is full
+  void PushGray(Object* object) {
+    if (m_gray.size() < kMarkStackLimit) {
+      m_gray.push_back(object);
+    } else {
+      m_mark_overflow = true;
+    }
+  }
+
+  // Queue the gray objects left by an overflow of the mark stack
+  void RescanGray();
+
+  // Called by List and Dict after a store
+  void WriteBarrier(Object* object) {
+    if (m_marking && object->is_black()) {
+      object->set_gray();
+      PushGray(object);
+    }
+    if (object->is_old() && !object->is_remembered()) Remember(object);
+  }
+
+  // Remember an old object that may point to a young object now , it is
+  // traced by the next minor collection
+  void Remember(Object* object) {
+    DCHECK(object->is_old());
+    object->m_gc_flag |= Object::GC_FLAG_REMEMBERED;
+    m_remembered.push_back(object);
+  }
+
+  // Whether a promoted object stays in the remembered set , see the comment
+  // of GC
+  static bool IsSticky(const Object* object) {
+    return object->type() != TYPE_STRING && object->type() != TYPE_LIST &&
+           object->type() != TYPE_DICT;
+  }
+
+  // Move a surviving young object into the old chain
+  void Promote(Object* object);
+
+  // Set the color of all the objects in the old chain
+  void PaintOld(int state);
+
+  static void Paint(Object* chain, int state);
+
+  bool CanCollect() const { return m_gc_size - m_young_size >= m_next_gc; }
+
+  bool CanMinorCollect() const {
+    return m_nursery_size && m_young_size >= m_nursery_size;
+  }
 
   void Recalculate(size_t collected) {
     if (m_gc_size) {
@@ -1852,9 +2954,30 @@ class GC {
   // The start pointer of the GC managed chain
   Object* m_gc_start;
 
-  // Current GC chain size
+  // Current GC chain size , including the young chain
   size_t m_gc_size;
 
+  // The young chain , only used when the GC is generational
+  Object* m_young_start;
+  size_t m_young_size;
+  size_t m_nursery_size;
+
+  detail::SlabAllocator m_slab;
+
+  // Old objects that may point to young objects
+  std::vector<Object*> m_remembered;
+
+  // Marking , m_rescan holds the objects without barrier traced by the
+  // running incremental cycle
+  bool m_marking;
+  size_t m_step_budget;
+  std::vector<Object*> m_gray;
+  bool m_mark_overflow;
+  Object* m_prefetch[kPrefetchDistance];
+  size_t m_prefetch_head;
+  size_t m_prefetch_size;
+  std::vector<Object*> m_rescan;
+
   // Next GC size which will be used to trigger a collect
   size_t m_next_gc;
 
@@ -1867,27 +2990,130 @@ class GC {
   // GC trigger times
   size_t m_gc_times;
 
+  // Minor GC times
+  size_t m_minor_gc_times;
+
+  friend class Object;
+  friend class GCVisitor;
+  friend class detail::SlabAllocator;
+  friend class List;
+  friend class Dict;
   friend class Context;
   friend class Engine;
   friend class InternalAllocator;
 };
 
+inline void Object::Mark() {
+  DCHECK(detail::kMarkingGC);
+  if (is_white()) {
+    set_gray();
+    detail::kMarkingGC->PushGray(this);
+  }
+}
+
+namespace detail {
+
+inline void* SlabAllocator::Allocate(size_t size, size_t alignment) {
+  const size_t slot =
+      (size + sizeof(Page*) + kAlignment - 1) & ~(kAlignment - 1);
+  if (slot > kMaxSlotSize || alignment > sizeof(Page*)) {
+    return AllocateLarge(size);
+  }
+  const size_t size_class = slot / kAlignment - 1;
+  Page* page = m_class[size_class].partial;
+  if (!page) page = NewPage(size_class);
+
+  char* result;
+  if (page->free) {
+    result = page->free;
+    page->free = *reinterpret_cast<char**>(result);
+  } else {
+    result = page->bump;
+    page->bump += slot;
+  }
+  if (++page->used == page->capacity) UnlinkPartial(page);
+
+  *reinterpret_cast<Page**>(result) = page;
+  return result + sizeof(Page*);
+}
+
+inline void SlabAllocator::Free(void* ptr) {
+  char* slot = static_cast<char*>(ptr) - sizeof(Page*);
+  Page* page = *reinterpret_cast<Page**>(slot);
+  if (!page) {
+    FreeLarge(ptr);
+    return;
+  }
+  *reinterpret_cast<char**>(slot) = page->free;
+  page->free = slot;
+  if (page->used-- == page->capacity) LinkPartial(page);
+  if (!page->used) ReleasePage(page);
+}
+
+}  // namespace detail
+
+inline void GCVisitor::Visit(const Object* object) {
+  Object* o = const_cast<Object*>(object);
+  if (o->is_white()) {
+    o->set_gray();
+    m_gc->PushGray(o);
+  }
+}
+
+inline void GCVisitor::Visit(const Value& value) {
+  if (value.IsObject()) Visit(value.object());
+}
+
 // A specific GC that is sololy used by *Context* object in an isolated
 // execution
 // environment. Each context will have its *own* GC. The engine object will not
 // use ContextGC but ImmutableGC.
 class ContextGC VCL_FINAL : public GC {
  public:
-  ContextGC(size_t trigger, double ratio, Context* ctx)
-      : GC(trigger, ratio), m_root_list(), m_context(ctx), m_hook() {}
+  static const size_t kDefaultNurserySize =
+#ifdef VCL_DEFAULT_NURSERY_SIZE
+      VCL_DEFAULT_NURSERY_SIZE
+#else
+      1024
+#endif  // VCL_DEFAULT_NURSERY_SIZE
+      ;
+
+  static const size_t kDefaultStepBudget =
+#ifdef VCL_DEFAULT_GC_STEP_BUDGET
+      VCL_DEFAULT_GC_STEP_BUDGET
+#else
+      256
+#endif  // VCL_DEFAULT_GC_STEP_BUDGET
+      ;
 
-  virtual ~ContextGC() {}
+  // A standalone ContextGC is not generational unless a nursery size is
+  // given and its full collections stop the world unless a step budget is
+  // given , Context uses the ContextOption
+  ContextGC(size_t trigger,
+            double ratio,
+            Context* ctx,
+            size_t nursery = 0,
+            size_t step_budget = 0)
+      : GC(trigger, ratio), m_root_list(), m_context(ctx), m_hook() {
+    set_nursery_size(nursery);
+    set_step_budget(step_budget);
+  }
+
+  virtual ~ContextGC() { DeleteAll(); }
 
   // Make those APIs to public users
   using GC::TryCollect;
   using GC::ForceCollect;
+  using GC::ForceMinorCollect;
 
   using GC::gc_size;
+  using GC::young_size;
+  using GC::nursery_size;
+  using GC::set_nursery_size;
+  using GC::slab_pages;
+  using GC::step_budget;
+  using GC::set_step_budget;
+  using GC::marking;
   using GC::next_gc_trigger;
   using GC::gc_ratio;
   using GC::set_gc_ratio;
@@ -1922,6 +3148,11 @@ class ContextGC VCL_FINAL : public GC {
     return New<Dict>();
   }
 
+  Dict* NewDict(const DictShape* shape) {
+    TryCollect();
+    return New<Dict>(shape);
+  }
+
   // Action
   Action* NewAction(ActionType act_code) {
     TryCollect();
@@ -1989,25 +3220,48 @@ class ContextGC VCL_FINAL : public GC {
   VCL_DISALLOW_COPY_AND_ASSIGN(ContextGC);
 };
 
+inline void List::WriteBarrier() {
+  if (m_gc) m_gc->WriteBarrier(this);
+}
+
+inline void Dict::WriteBarrier() {
+  if (m_gc) m_gc->WriteBarrier(this);
+}
+
 // ImmutableGC is a bump allocator that traces all the allocated resources.
 // It will not have any GC cycle. The gc trigger is not exposed here.
 // And also for engine level Value, the only heap value is String object.
+//
+// Since nothing allocated here is ever freed , the strings are interned into
+// an atom table. A ImmutableGC can use the atom table of another one , this is
+// how CompiledCode shares the atoms of its Engine , so a literal string in the
+// script is the same object as the name of a module's property or a global
+// variable registered into the Engine.
 class ImmutableGC VCL_FINAL : public GC {
  public:
-  ImmutableGC() : GC(1, 1.0) {}
+  explicit ImmutableGC(ImmutableGC* atom_table = NULL)
+      : GC(1, 1.0), m_atom(), m_atom_table(atom_table) {}
   ~ImmutableGC() {}
 
   using GC::gc_size;
 
   String* NewString(const char* str) {
-    String* ret = New<String>(str);
-    ret->set_black();
-    return ret;
+    if (m_atom_table) return m_atom_table->NewString(str);
+    String** atom = m_atom.Find(str);
+    if (atom) return *atom;
+    return NewAtom(New<String>(str));
   }
+  // Looked up with the size of the string , it may contain '\0'
   String* NewString(const std::string& str) {
-    String* ret = New<String>(str);
-    ret->set_black();
-    return ret;
+    if (m_atom_table) return m_atom_table->NewString(str);
+    String** atom = m_atom.Find(str);
+    if (atom) return *atom;
+    return NewAtom(New<String>(str));
+  }
+
+  // Number of atoms in the atom table used by this ImmutableGC
+  size_t atom_size() const {
+    return m_atom_table ? m_atom_table->atom_size() : m_atom.size();
   }
 
   ACL* NewACL(vm::IPPattern* pattern) {
@@ -2025,6 +3279,18 @@ class ImmutableGC VCL_FINAL : public GC {
  private:
   virtual void Mark() {}
 
+  StringDict<String*> m_atom;
+  ImmutableGC* m_atom_table;
+
+  // Mark a new string as an atom and put it into the atom table
+  String* NewAtom(String* str) {
+    str->set_black();
+    str->hash();
+    str->m_atom = true;
+    m_atom.Insert(*str, str);
+    return str;
+  }
+
   VCL_DISALLOW_COPY_AND_ASSIGN(ImmutableGC);
 };
 
@@ -2072,23 +3338,73 @@ class Environment {
   // Clear all global variables
   void ClearGlobalVariables();
 
-  size_t GlobalVariableSize() const { return m_gvar_map.size(); }
+  size_t GlobalVariableSize() const { return m_gvar_size; }
+
+ public:
+  // Global variables are stored inside of slots and the name is mapped to its
+  // slot index. A slot is never released once it is reserved , removing a
+  // global variable just marks its slot as undefined. So the compiled code is
+  // able to resolve a global variable to its slot once and then access it
+  // via an indexed load , see CompiledCode::global_slot_size.
+
+  // Reserve a slot for the name , the name will be copied
+  uint32_t ReserveGlobalSlot(const char* name);
+
+  // Reserve a slot for the name , the name is referenced directly so it must
+  // outlive this object
+  uint32_t ReserveGlobalSlot(const String& name);
+
+  // Returns NULL if the global variable in slot is not defined
+  const Value* GetGlobalSlot(uint32_t slot) const {
+    DCHECK(slot < m_gvar_slot.size());
+    const GVarSlot& gvar = m_gvar_slot[slot];
+    return gvar.defined ? &gvar.value : NULL;
+  }
+
+  void SetGlobalSlot(uint32_t slot, const Value& value) {
+    DCHECK(slot < m_gvar_slot.size());
+    GVarSlot& gvar = m_gvar_slot[slot];
+    if (!gvar.defined) {
+      gvar.defined = true;
+      ++m_gvar_size;
+    }
+    gvar.value = value;
+  }
+
+  size_t GlobalSlotSize() const { return m_gvar_slot.size(); }
 
  protected:
-  Environment() : m_gvar_map(), m_ext_map(), m_mod_map() {}
+  Environment()
+      : m_gvar_map(), m_gvar_slot(), m_gvar_size(0), m_ext_map(), m_mod_map() {}
 
   void Mark();
 
  private:
   GCType* gc() { return static_cast<T*>(this)->gc(); }
 
+  // Find the defined slot for name , returns NULL if not found
+  template <typename KEY>
+  Value* FindGlobalVariable(const KEY& name) const;
+
+  struct GVarSlot {
+    Value value;
+    bool defined;
+    GVarSlot() : value(), defined(false) {}
+  };
+
   typedef StringDict<ExtensionFactory*> ExtensionMap;
-  typedef StringDict<Value> GVarMap;
+  typedef StringDict<uint32_t> GVarMap;
   typedef StringDict<Module*> ModuleMap;
 
-  // Global variable map
+  // Global variable name to slot index
   GVarMap m_gvar_map;
 
+  // Global variable slots
+  std::vector<GVarSlot> m_gvar_slot;
+
+  // How many slots are defined
+  size_t m_gvar_size;
+
   // ExtensionFactory map
   ExtensionMap m_ext_map;
 
@@ -2107,6 +3423,8 @@ class Environment {
 class CompiledCode VCL_FINAL
     : public boost::enable_shared_from_this<CompiledCode> {
  public:
+  // Strings are interned into the atom table of the Engine if it is not NULL ,
+  // so the Engine must outlive the CompiledCode
   CompiledCode(Engine* engine);
   ~CompiledCode();
 
@@ -2119,15 +3437,47 @@ class CompiledCode VCL_FINAL
   Engine* engine() const { return m_engine; }
   ImmutableGC* gc() const { return &m_gc; }
 
+ public:
+  // Global variable slots. Each global variable name used by the script is
+  // resolved to a slot at compile time. Each Context created from this object
+  // reserves these slots first , in the same order , so the slot index can be
+  // used to index the Context's global variable directly. A slot is also
+  // reserved inside of the Engine and its index is recorded as well.
+  static const uint32_t kInvalidGlobalSlot = static_cast<uint32_t>(-1);
+
+  size_t global_slot_size() const { return m_global_slot.size(); }
+
+  const String& global_slot_name(uint32_t slot) const {
+    DCHECK(slot < m_global_slot.size());
+    return *m_global_slot[slot].name;
+  }
+
+  uint32_t engine_global_slot(uint32_t slot) const {
+    DCHECK(slot < m_global_slot.size());
+    return m_global_slot[slot].engine_slot;
+  }
+
+  // Number of property lookup sites of all procedures , each Context keeps an
+  // inline cache for every site
+  uint32_t inline_cache_size() const { return m_inline_cache_size; }
+
  public:
   // Debug
   void Dump(std::ostream&) const;
 
  private:
+  struct GlobalSlot {
+    const String* name;
+    uint32_t engine_slot;
+    GlobalSlot(const String* n, uint32_t es) : name(n), engine_slot(es) {}
+  };
+
   // A list of SourceCode object that contributes to this CompiledCode
   // object
   std::vector<boost::shared_ptr<SourceCodeInfo> > m_source_code_list;
   boost::ptr_vector<vm::Procedure> m_sub_routine_list;
+  std::vector<GlobalSlot> m_global_slot;
+  uint32_t m_inline_cache_size;
   vm::Procedure* m_entry;
   Engine* m_engine;
   mutable ImmutableGC m_gc;
@@ -2145,12 +3495,28 @@ struct ContextOption {
   double gc_ratio;
   // Maximum Gap
   size_t gc_maximum_gap;
+  // Number of young objects that triggers a minor GC , 0 disables the
+  // generational GC and every GC is a full one
+  size_t gc_nursery_size;
+  // Number of objects a full GC traces per allocation , 0 makes the full GC
+  // stop the world instead of incremental
+  size_t gc_step_budget;
+  // Region mode for contexts that run one request per Invoke , 0 disables it.
+  // The objects allocated by an Invoke form a region that is collected once
+  // the outermost Invoke returns , only the objects reachable from globals ,
+  // the root list , Handles and the returned value survive and are promoted.
+  // The region replaces the nursery , a minor GC runs inside of the request
+  // only when it has more than gc_region_size objects
+  size_t gc_region_size;
 
   ContextOption()
       : max_calling_stack_size(16),
         gc_trigger(1000),
         gc_ratio(0.5),
-        gc_maximum_gap(0) {}
+        gc_maximum_gap(0),
+        gc_nursery_size(ContextGC::kDefaultNurserySize),
+        gc_step_budget(ContextGC::kDefaultStepBudget),
+        gc_region_size(0) {}
 };
 
 class Context VCL_FINAL : public detail::Environment<Context, ContextGC> {
@@ -2189,6 +3555,16 @@ class Context VCL_FINAL : public detail::Environment<Context, ContextGC> {
   // multiple Yield operations built in.
   MethodStatus Resume(Value*);
 
+ public:  // Execution profile
+  // Count of executed instructions per opcode , per sub routine and per
+  // source line. It is only collected when the library is built with
+  // VCL_EXECUTION_PROFILE , otherwise it returns NULL. See vm/execution-profile.h
+  vm::ExecutionProfile* execution_profile() const;
+
+  // Dump the report of execution profile , nothing is dumped when it is not
+  // collected
+  void DumpExecutionProfile(std::ostream&) const;
+
  public:
   // Invoke a sub_routine defined in the script side with certain arguments
   // This API is not very efficient but may be good enough for us to integrate
@@ -2267,6 +3643,12 @@ class Context VCL_FINAL : public detail::Environment<Context, ContextGC> {
   vm::Runtime* runtime() const { return m_runtime.get(); }
 
  private:
+  MethodStatus FinishRun(SubRoutine*, Value*);
+
+  // Collect the region once the outermost run returns , see
+  // ContextOption::gc_region_size
+  MethodStatus CollectRegion(const MethodStatus& status, Value* output);
+
   // Runtime object related to this context
   boost::scoped_ptr<vm::Runtime> m_runtime;
 
@@ -2276,6 +3658,9 @@ class Context VCL_FINAL : public detail::Environment<Context, ContextGC> {
   // Its own GC
   mutable ContextGC m_gc;
 
+  // Whether the context is in region mode
+  bool m_region;
+
   friend class GC;
   friend class ContextGC;
 
@@ -2303,6 +3688,31 @@ struct ScriptOption {
         allow_loop(true) {}
 };
 
+// Which virtual machine is used to execute the script
+enum VirtualMachineType {
+  // The classic stack based bytecode interpreter
+  VM_STACK,
+  // Register based interpreter. The stack bytecode will be lowered into three
+  // address register code after compilation , which needs much less dispatch
+  VM_REGISTER
+};
+
+// Tunable engine options , it affects all the CompiledCode loaded by the
+// engine
+struct EngineOption {
+  // Virtual machine used for all the code loaded by this engine
+  VirtualMachineType vm_type;
+
+  // Baseline JIT for the stack virtual machine. A Procedure is translated into
+  // native code once it has been entered jit_threshold times , it is only
+  // available on x86-64 and ignored elsewhere. The native code has no unwind
+  // information , so an AllocatorHook that throws cannot be used with it
+  bool jit;
+  uint32_t jit_threshold;
+
+  EngineOption() : vm_type(VM_STACK), jit(false), jit_threshold(64) {}
+};
+
 // A engine represents a central repository to store all the parsed/compiled
 // code and other stuff. The engine doesn't mean runtime feature but just a
 // place to hold shared resources.
@@ -2312,8 +3722,10 @@ class Engine VCL_FINAL : public detail::Environment<Engine, ImmutableGC> {
  public:
   typedef ImmutableGC GCType;
   Engine();
+  explicit Engine(const EngineOption&);
 
   ImmutableGC* gc() const { return &m_gc; }
+  const EngineOption& option() const { return m_option; }
 
  public:
   // This is the core API to load a script. After loading the script, user
@@ -2331,6 +3743,7 @@ class Engine VCL_FINAL : public detail::Environment<Engine, ImmutableGC> {
                                              std::string* error);
 
  private:
+  EngineOption m_option;
   mutable ImmutableGC m_gc;
   VCL_DISALLOW_COPY_AND_ASSIGN(Engine);
 };
@@ -2580,33 +3993,55 @@ inline Handle<Value>::Handle(const Handle<Value>& h)
   }
 }
 
-inline Value::Value(String* value) : m_value(value), m_type(TYPE_STRING) {}
+inline Value::Value(String* value) : m_type(TYPE_STRING) {
+  m_value.object = value;
+}
 
-inline Value::Value(List* value) : m_value(value), m_type(TYPE_LIST) {}
+inline Value::Value(List* value) : m_type(TYPE_LIST) {
+  m_value.object = value;
+}
 
-inline Value::Value(Dict* value) : m_value(value), m_type(TYPE_DICT) {}
+inline Value::Value(Dict* value) : m_type(TYPE_DICT) {
+  m_value.object = value;
+}
 
-inline Value::Value(ACL* value) : m_value(value), m_type(TYPE_ACL) {}
+inline Value::Value(ACL* value) : m_type(TYPE_ACL) {
+  m_value.object = value;
+}
 
-inline Value::Value(Function* value) : m_value(value), m_type(TYPE_FUNCTION) {}
+inline Value::Value(Function* value) : m_type(TYPE_FUNCTION) {
+  m_value.object = value;
+}
 
-inline Value::Value(Action* value) : m_value(value), m_type(TYPE_ACTION) {}
+inline Value::Value(Action* value) : m_type(TYPE_ACTION) {
+  m_value.object = value;
+}
 
-inline Value::Value(Extension* value)
-    : m_value(value), m_type(TYPE_EXTENSION) {}
+inline Value::Value(Extension* value) : m_type(TYPE_EXTENSION) {
+  m_value.object = value;
+}
 
-inline Value::Value(Module* value) : m_value(value), m_type(TYPE_MODULE) {}
+inline Value::Value(Module* value) : m_type(TYPE_MODULE) {
+  m_value.object = value;
+}
 
-inline Value::Value(SubRoutine* value)
-    : m_value(value), m_type(TYPE_SUB_ROUTINE) {}
+inline Value::Value(SubRoutine* value) : m_type(TYPE_SUB_ROUTINE) {
+  m_value.object = value;
+}
 
-inline Value::Value(Iterator* value) : m_value(value), m_type(TYPE_ITERATOR) {}
+inline Value::Value(Iterator* value) : m_type(TYPE_ITERATOR) {
+  m_value.object = value;
+}
 
 template <typename E>
-inline Value::Value(Handle<E>& h) : m_value(h.get()), m_type(h->type()) {}
+inline Value::Value(Handle<E>& h) : m_type(h->type()) {
+  m_value.object = h.get();
+}
 
 template <typename E>
-inline Value::Value(const Handle<E>& h) : m_value(h.get()), m_type(h->type()) {}
+inline Value::Value(const Handle<E>& h) : m_type(h->type()) {
+  m_value.object = h.get();
+}
 
 inline void Value::Mark() {
   if (IsObject()) {
@@ -2666,52 +4101,52 @@ inline Iterator* Value::GetIterator() const {
 
 inline void Value::SetString(String* value) {
   m_type = TYPE_STRING;
-  m_value = static_cast<Object*>(value);
+  m_value.object = value;
 }
 
 inline void Value::SetACL(ACL* value) {
   m_type = TYPE_ACL;
-  m_value = static_cast<Object*>(value);
+  m_value.object = value;
 }
 
 inline void Value::SetList(List* value) {
   m_type = TYPE_LIST;
-  m_value = static_cast<Object*>(value);
+  m_value.object = value;
 }
 
 inline void Value::SetDict(Dict* value) {
   m_type = TYPE_DICT;
-  m_value = static_cast<Object*>(value);
+  m_value.object = value;
 }
 
 inline void Value::SetFunction(Function* value) {
   m_type = TYPE_FUNCTION;
-  m_value = static_cast<Object*>(value);
+  m_value.object = value;
 }
 
 inline void Value::SetExtension(Extension* value) {
   m_type = TYPE_EXTENSION;
-  m_value = static_cast<Object*>(value);
+  m_value.object = value;
 }
 
 inline void Value::SetAction(Action* value) {
   m_type = TYPE_ACTION;
-  m_value = static_cast<Object*>(value);
+  m_value.object = value;
 }
 
 inline void Value::SetModule(Module* value) {
   m_type = TYPE_MODULE;
-  m_value = static_cast<Object*>(value);
+  m_value.object = value;
 }
 
 inline void Value::SetSubRoutine(SubRoutine* value) {
   m_type = TYPE_SUB_ROUTINE;
-  m_value = static_cast<Object*>(value);
+  m_value.object = value;
 }
 
 inline void Value::SetIterator(Iterator* value) {
   m_type = TYPE_ITERATOR;
-  m_value = static_cast<Object*>(value);
+  m_value.object = value;
 }
 
 inline void Value::CastSizeToValueNoLostPrecision(Context* context,
@@ -2724,77 +4159,109 @@ inline void Value::CastSizeToValueNoLostPrecision(Context* context,
   }
 }
 
+inline Value List::Index(size_t idx) const {
+  switch (m_kind) {
+    case KIND_INTEGER:
+      return Value(m_integer[idx]);
+    case KIND_REAL:
+      return Value(m_real[idx]);
+    case KIND_STRING:
+      return Value(m_string[idx]);
+    default:
+      return m_list[idx];
+  }
+}
+
 template <typename T, typename Hasher>
-template <int OPTION>
-typename StringDict<T, Hasher>::HashEntry* StringDict<T, Hasher>::FindEntry(
-    const char* string, uint32_t full_hash) const {
-  const size_t mask = m_entry.size() - 1;
-  size_t index = full_hash & mask;
-  HashEntry* entry = &(m_entry[index]);
-
-  if (!(entry->used)) {
-    if (OPTION == OPT_FIND) {
-      return NULL;
-    } else {
-      return entry;
-    }
-  } else {
-    do {
-      if (entry->del) {
-        if (OPTION == OPT_INSERT) return entry;
-      } else if (entry->Equal(string, full_hash)) {
-        return entry;
-      }
-      if (!entry->more) {
-        break;
-      }
-      entry = &(m_entry[entry->next]);
-    } while (true);
-
-    if (OPTION == OPT_FIND)
-      return NULL;  // no alive entry
-    else {
-      HashEntry* new_entry;
-      uint32_t h = full_hash;
-      uint32_t idx;
-
-      // linear probing
-      do {
-        idx = (++h & mask);
-        new_entry = &(m_entry[idx]);
-      } while (new_entry->used);
-
-      entry->more = 1;
-      entry->next = idx;
-
-      return new_entry;
-    }
+void StringDict<T, Hasher>::Reset(size_t cap) {
+  DCHECK(!(cap & (cap - 1)));
+  m_used = 0;
+  m_size = 0;
+  if (!cap) {
+    m_ctrl.clear();
+    m_slot.clear();
+    return;
   }
+  m_ctrl.assign(cap + Group::kWidth, static_cast<int8_t>(Group::kEmpty));
+  m_slot.assign(cap, ValueType());
 }
 
 template <typename T, typename Hasher>
-bool StringDict<T, Hasher>::Insert(const String& string, const T& value) {
-  uint32_t full_hash = HashKey(string.data(), string.size());
-  if (m_entry.size() == m_used) Rehash();
-  HashEntry* entry = FindEntry<OPT_INSERT>(string.data(), full_hash);
-
-  if (entry->del) {
-    entry->pair = ValueType(&string, value);
-    entry->full_hash = full_hash;
-    entry->del = 0;
-  } else {
-    if (entry->used) {
-      DCHECK(*entry->pair.first == string);
-      return false;
-    } else {
-      entry->pair = ValueType(&string, value);
-      entry->full_hash = full_hash;
-      entry->used = 1;
-      ++m_used;
+void StringDict<T, Hasher>::SetCtrl(size_t index, int8_t ctrl) {
+  // A table smaller than a group has its control bytes copied more than once
+  for (size_t i = index; i < m_ctrl.size(); i += m_slot.size()) {
+    m_ctrl[i] = ctrl;
+  }
+}
+
+template <typename T, typename Hasher>
+size_t StringDict<T, Hasher>::FindSlot(const String* key,
+                                       const char* string,
+                                       size_t length,
+                                       uint64_t hash) const {
+  if (m_slot.empty()) return kNotFound;
+  const size_t mask = m_slot.size() - 1;
+  const int8_t ctrl = HashCtrl(hash);
+  size_t pos = static_cast<size_t>(hash >> 7) & mask;
+
+  // Triangular probing visits each group once before the table wraps around
+  for (size_t probe = 0; probe <= mask / Group::kWidth; ++probe) {
+    Group group(&m_ctrl[pos]);
+    for (uint32_t match = group.Match(ctrl); match; match &= match - 1) {
+      const size_t index = (pos + Group::LowestBit(match)) & mask;
+      if (KeyEqual(m_slot[index], key, string, length)) return index;
     }
+    if (group.MatchEmpty()) break;
+    pos = (pos + Group::kWidth * (probe + 1)) & mask;
   }
+  return kNotFound;
+}
+
+template <typename T, typename Hasher>
+size_t StringDict<T, Hasher>::FindFreeSlot(uint64_t hash) const {
+  const size_t mask = m_slot.size() - 1;
+  size_t pos = static_cast<size_t>(hash >> 7) & mask;
+
+  for (size_t probe = 0;; ++probe) {
+    DCHECK(probe <= mask / Group::kWidth);
+    uint32_t match = Group(&m_ctrl[pos]).MatchEmptyOrDeleted();
+    if (match) return (pos + Group::LowestBit(match)) & mask;
+    pos = (pos + Group::kWidth * (probe + 1)) & mask;
+  }
+}
 
+template <typename T, typename Hasher>
+void StringDict<T, Hasher>::InsertSlot(const String* key,
+                                       uint64_t hash,
+                                       const T& value) {
+  if (m_used >= MaxLoad()) Rehash();
+  const size_t index = FindFreeSlot(hash);
+  if (m_ctrl[index] == Group::kEmpty) ++m_used;
+  SetCtrl(index, HashCtrl(hash));
+  m_slot[index] = ValueType(key, value);
   ++m_size;
+}
+
+template <typename T, typename Hasher>
+void StringDict<T, Hasher>::RemoveSlot(size_t index) {
+  // A table smaller than a group is always scanned in full , so the slot can
+  // just be emptied. Otherwise a tombstone keeps the probe sequence of the
+  // other keys going through it
+  if (capacity() < Group::kWidth) {
+    SetCtrl(index, Group::kEmpty);
+    --m_used;
+  } else {
+    SetCtrl(index, Group::kDeleted);
+  }
+  m_slot[index] = ValueType();
+  --m_size;
+}
+
+template <typename T, typename Hasher>
+bool StringDict<T, Hasher>::Insert(const String& string, const T& value) {
+  const uint64_t hash = HashKey(string);
+  if (FindSlot(&string, string.data(), string.size(), hash) != kNotFound) return false;
+  InsertSlot(&string, hash, value);
   return true;
 }
 
@@ -2817,16 +4284,10 @@ bool StringDict<T, Hasher>::Insert(ALLOC* gc,
 
 template <typename T, typename Hasher>
 bool StringDict<T, Hasher>::Update(const String& string, const T& value) {
-  uint32_t full_hash = HashKey(string.data(), string.size());
-
-  if (m_entry.size() == m_used) Rehash();
-  HashEntry* entry = FindEntry<OPT_INSERT>(string.data(), full_hash);
-  if (entry->used && !entry->del) {
-    entry->pair.second = value;
-    entry->full_hash = full_hash;
-    return true;
-  }
-  return false;
+  const size_t index = FindSlot(&string, string.data(), string.size(), HashKey(string));
+  if (index == kNotFound) return false;
+  m_slot[index].second = value;
+  return true;
 }
 
 template <typename T, typename Hasher>
@@ -2834,40 +4295,23 @@ template <typename ALLOC>
 bool StringDict<T, Hasher>::Update(ALLOC* gc,
                                    const char* string,
                                    const T& value) {
-  uint32_t full_hash = HashKey(string, strlen(string));
-
-  if (m_entry.size() == m_used) Rehash();
-  HashEntry* entry = FindEntry<OPT_INSERT>(string, full_hash);
-  if (entry->used && !entry->del) {
-    entry->pair.second = value;
-    entry->full_hash = full_hash;
-    return true;
-  }
-  return false;
+  VCL_UNUSED(gc);
+  const size_t length = strlen(string);
+  const size_t index = FindSlot(NULL, string, length, HashKey(string, length));
+  if (index == kNotFound) return false;
+  m_slot[index].second = value;
+  return true;
 }
 
 template <typename T, typename Hasher>
 void StringDict<T, Hasher>::InsertOrUpdate(const String& key, const T& value) {
-  uint32_t full_hash = HashKey(key.data(), key.size());
-
-  if (m_entry.size() == m_used) Rehash();
-  HashEntry* entry = FindEntry<OPT_INSERT>(key.data(), full_hash);
-  entry->full_hash = full_hash;
-
-  if (entry->used && !entry->del) {
-    entry->pair.second = value;
+  const uint64_t hash = HashKey(key);
+  const size_t index = FindSlot(&key, key.data(), key.size(), hash);
+  if (index != kNotFound) {
+    m_slot[index].second = value;
   } else {
-    if (!entry->used) {
-      entry->pair = ValueType(&key, value);
-      entry->used = 1;
-      ++m_used;
-    } else {
-      entry->pair = ValueType(&key, value);
-      entry->del = 0;
-    }
+    InsertSlot(&key, hash, value);
   }
-
-  ++m_size;
 }
 
 template <typename T, typename Hasher>
@@ -2875,106 +4319,76 @@ template <typename ALLOC>
 void StringDict<T, Hasher>::InsertOrUpdate(ALLOC* gc,
                                            const char* string,
                                            const T& value) {
-  uint32_t full_hash = HashKey(string, strlen(string));
-
-  if (m_entry.size() == m_used) Rehash();
-  HashEntry* entry = FindEntry<OPT_INSERT>(string, full_hash);
-  entry->full_hash = full_hash;
-
-  if (entry->used && !entry->del) {
-    entry->pair.second = value;
+  const size_t length = strlen(string);
+  const uint64_t hash = HashKey(string, length);
+  const size_t index = FindSlot(NULL, string, length, hash);
+  if (index != kNotFound) {
+    m_slot[index].second = value;
   } else {
-    String* key =
-        gc->NewString(string);  // Do it here since this prevent GC mark
-                                // hitting *this* dictionary with an empty
-                                // slot
-    if (!entry->used) {
-      entry->pair = ValueType(key, value);
-      entry->used = 1;
-      ++m_used;
-    } else {
-      entry->pair = ValueType(key, value);
-      entry->del = 0;
-    }
+    // Do it before the slot is taken since this prevent GC mark hitting
+    // *this* dictionary with an empty slot
+    String* key = gc->NewString(string);
+    InsertSlot(key, hash, value);
   }
-
-  ++m_size;
 }
 
 template <typename T, typename Hasher>
 T* StringDict<T, Hasher>::Find(const String& key) const {
-  HashEntry* entry =
-      FindEntry<OPT_FIND>(key.data(), HashKey(key.data(), key.size()));
-  return entry ? &(entry->pair.second) : NULL;
+  const size_t index = FindSlot(&key, key.data(), key.size(), HashKey(key));
+  return index == kNotFound ? NULL : &(m_slot[index].second);
 }
 
 template <typename T, typename Hasher>
-T* StringDict<T, Hasher>::Find(const char* string) const {
-  HashEntry* entry =
-      FindEntry<OPT_FIND>(string, HashKey(string, strlen(string)));
-  return entry ? &(entry->pair.second) : NULL;
+T* StringDict<T, Hasher>::Find(const char* string, size_t length) const {
+  const size_t index = FindSlot(NULL, string, length, HashKey(string, length));
+  return index == kNotFound ? NULL : &(m_slot[index].second);
 }
 
 template <typename T, typename Hasher>
 bool StringDict<T, Hasher>::Remove(const String& key, T* output) {
-  HashEntry* entry =
-      FindEntry<OPT_FIND>(key.data(), HashKey(key.data(), key.size()));
-  if (entry) {
-    if (output) *output = entry->pair.second;
-    --m_size;
-    entry->del = 1;
-    return true;
-  }
-
-  return false;
+  const size_t index = FindSlot(&key, key.data(), key.size(), HashKey(key));
+  if (index == kNotFound) return false;
+  if (output) *output = m_slot[index].second;
+  RemoveSlot(index);
+  return true;
 }
 
 template <typename T, typename Hasher>
 bool StringDict<T, Hasher>::Remove(const char* string, T* output) {
-  HashEntry* entry =
-      FindEntry<OPT_FIND>(string, HashKey(string, strlen(string)));
-  if (entry) {
-    if (output) *output = entry->pair.second;
-    --m_size;
-    entry->del = 1;
-    return true;
-  }
-
-  return false;
+  const size_t length = strlen(string);
+  const size_t index = FindSlot(NULL, string, length, HashKey(string, length));
+  if (index == kNotFound) return false;
+  if (output) *output = m_slot[index].second;
+  RemoveSlot(index);
+  return true;
 }
 
 template <typename T, typename Hasher>
 void StringDict<T, Hasher>::Rehash() {
-  uint32_t size = 0;
-  HashVector vec;
-
-  vec.resize(m_entry.size() * 2);
-  m_entry.swap(vec);
-
-  for (size_t i = 0; i < vec.size(); ++i) {
-    HashEntry& entry = vec[i];
-    DCHECK(entry.used);
-    if (entry.del) continue;
-
-    HashEntry* new_entry =
-        FindEntry<OPT_INSERT>(entry.pair.first->data(), entry.full_hash);
-    DCHECK(!new_entry->used);
-    new_entry->used = 1;
-    new_entry->pair = entry.pair;
-    new_entry->full_hash = entry.full_hash;
-    ++size;
+  // Only grow when the live entries take more than half of the load , the
+  // rest are tombstones which are simply dropped
+  size_t cap = m_size >= MaxLoad() / 2 ? capacity() * 2 : capacity();
+  if (!cap) cap = kDefaultCapSize;
+  std::vector<int8_t> ctrl;
+  std::vector<ValueType> slot;
+  m_ctrl.swap(ctrl);
+  m_slot.swap(slot);
+  Reset(cap);
+
+  for (size_t i = 0; i < slot.size(); ++i) {
+    if (ctrl[i] < 0) continue;
+    const uint64_t hash = HashKey(*slot[i].first);
+    const size_t index = FindFreeSlot(hash);
+    SetCtrl(index, HashCtrl(hash));
+    m_slot[index] = slot[i];
+    ++m_used;
+    ++m_size;
   }
-
-  m_size = size;
-  m_used = size;
 }
 
 template <typename T, typename Hasher>
 void StringDict<T, Hasher>::Clear() {
-  m_size = 0;
-  m_used = 0;
-  m_entry.clear();
-  m_entry.resize(kDefaultCapSize);
+  Reset(kDefaultCapSize);
 }
 
 namespace detail {
@@ -3016,6 +4430,14 @@ void StringDict<T, Hasher>::DoDelete(StringDict<T, Hasher>* dict) {
   }
 }
 
+inline uint64_t String::hash() const {
+  if (!m_hashed) {
+    m_hash = detail::DefaultStringHasher()(data(), size());
+    m_hashed = true;
+  }
+  return m_hash;
+}
+
 // Leave this function out for future string internalization implementation
 inline String* ContextGC::NewStringImpl(const char* string) {
   return New<String>(string);
@@ -3066,52 +4488,88 @@ ExtensionFactory* Environment<T, GCType>::GetExtensionFactory(
   return factory ? *factory : NULL;
 }
 
+template <typename T, typename GCType>
+uint32_t Environment<T, GCType>::ReserveGlobalSlot(const char* name) {
+  uint32_t* slot = m_gvar_map.Find(name);
+  if (slot) return *slot;
+  uint32_t index = static_cast<uint32_t>(m_gvar_slot.size());
+  m_gvar_map.Insert(gc(), name, index);
+  m_gvar_slot.push_back(GVarSlot());
+  return index;
+}
+
+template <typename T, typename GCType>
+uint32_t Environment<T, GCType>::ReserveGlobalSlot(const String& name) {
+  uint32_t* slot = m_gvar_map.Find(name);
+  if (slot) return *slot;
+  uint32_t index = static_cast<uint32_t>(m_gvar_slot.size());
+  m_gvar_map.Insert(name, index);
+  m_gvar_slot.push_back(GVarSlot());
+  return index;
+}
+
+template <typename T, typename GCType>
+template <typename KEY>
+Value* Environment<T, GCType>::FindGlobalVariable(const KEY& name) const {
+  uint32_t* slot = m_gvar_map.Find(name);
+  if (slot) {
+    GVarSlot& gvar = const_cast<GVarSlot&>(m_gvar_slot[*slot]);
+    if (gvar.defined) return &gvar.value;
+  }
+  return NULL;
+}
+
 template <typename T, typename GCType>
 void Environment<T, GCType>::AddOrUpdateGlobalVariable(const std::string& name,
                                                        const Value& value) {
   Handle<Value> v(value, gc());
-  m_gvar_map.InsertOrUpdate(gc(), name, value);
+  SetGlobalSlot(ReserveGlobalSlot(name.c_str()), value);
 }
 
 template <typename T, typename GCType>
 void Environment<T, GCType>::AddOrUpdateGlobalVariable(const char* name,
                                                        const Value& value) {
   Handle<Value> v(value, gc());
-  m_gvar_map.InsertOrUpdate(gc(), name, value);
+  SetGlobalSlot(ReserveGlobalSlot(name), value);
 }
 
 template <typename T, typename GCType>
 void Environment<T, GCType>::AddOrUpdateGlobalVariable(const String& name,
                                                        const Value& value) {
   Handle<Value> v(value, gc());
-  m_gvar_map.InsertOrUpdate(name, value);
+  SetGlobalSlot(ReserveGlobalSlot(name), value);
 }
 
 template <typename T, typename GCType>
 bool Environment<T, GCType>::AddGlobalVariable(const std::string& name,
                                                const Value& value) {
-  Handle<Value> v(value, gc());
-  return m_gvar_map.Insert(gc(), name, value);
+  return AddGlobalVariable(name.c_str(), value);
 }
 
 template <typename T, typename GCType>
 bool Environment<T, GCType>::AddGlobalVariable(const char* name,
                                                const Value& value) {
   Handle<Value> v(value, gc());
-  return m_gvar_map.Insert(gc(), name, value);
+  uint32_t slot = ReserveGlobalSlot(name);
+  if (GetGlobalSlot(slot)) return false;
+  SetGlobalSlot(slot, value);
+  return true;
 }
 
 template <typename T, typename GCType>
 bool Environment<T, GCType>::AddGlobalVariable(const String& name,
                                                const Value& value) {
   Handle<Value> v(value, gc());
-  return m_gvar_map.Insert(name, value);
+  uint32_t slot = ReserveGlobalSlot(name);
+  if (GetGlobalSlot(slot)) return false;
+  SetGlobalSlot(slot, value);
+  return true;
 }
 
 template <typename T, typename GCType>
 bool Environment<T, GCType>::GetGlobalVariable(const std::string& name,
                                                Value* output) const {
-  Value* result = m_gvar_map.Find(name);
+  Value* result = FindGlobalVariable(name);
   if (result) {
     *output = *result;
     return true;
@@ -3122,7 +4580,7 @@ bool Environment<T, GCType>::GetGlobalVariable(const std::string& name,
 template <typename T, typename GCType>
 bool Environment<T, GCType>::GetGlobalVariable(const char* name,
                                                Value* output) const {
-  Value* result = m_gvar_map.Find(name);
+  Value* result = FindGlobalVariable(name);
   if (result) {
     *output = *result;
     return true;
@@ -3133,7 +4591,7 @@ bool Environment<T, GCType>::GetGlobalVariable(const char* name,
 template <typename T, typename GCType>
 bool Environment<T, GCType>::GetGlobalVariable(const String& name,
                                                Value* output) const {
-  Value* result = m_gvar_map.Find(name);
+  Value* result = FindGlobalVariable(name);
   if (result) {
     *output = *result;
     return true;
@@ -3143,12 +4601,18 @@ bool Environment<T, GCType>::GetGlobalVariable(const String& name,
 
 template <typename T, typename GCType>
 bool Environment<T, GCType>::RemoveGlobalVariable(const std::string& name) {
-  return m_gvar_map.Remove(name, NULL);
+  uint32_t* slot = m_gvar_map.Find(name);
+  if (!slot || !m_gvar_slot[*slot].defined) return false;
+  m_gvar_slot[*slot] = GVarSlot();
+  --m_gvar_size;
+  return true;
 }
 
 template <typename T, typename GCType>
 void Environment<T, GCType>::ClearGlobalVariables() {
-  m_gvar_map.Clear();
+  // Keep the reserved slots since they can be cached by compiled code
+  for (size_t i = 0; i < m_gvar_slot.size(); ++i) m_gvar_slot[i] = GVarSlot();
+  m_gvar_size = 0;
 }
 
 template <typename T, typename GCType>
@@ -3184,12 +4648,21 @@ Module* Environment<T, GCType>::GetModule(const char* name) const {
 
 template <typename T, typename GCType>
 Module* Environment<T, GCType>::RemoveModule(const std::string& name) {
-  return m_mod_map.Remove(name, NULL);
+  Module* module = NULL;
+  m_mod_map.Remove(name.c_str(), &module);
+  return module;
 }
 
 template <typename T, typename GCType>
 void Environment<T, GCType>::Mark() {
-  GVarMap::DoGCMark(&m_gvar_map);
+  for (typename GVarMap::Iterator itr = m_gvar_map.Begin();
+       itr != m_gvar_map.End();
+       ++itr) {
+    const_cast<String*>(itr->first)->Mark();
+  }
+  for (size_t i = 0; i < m_gvar_slot.size(); ++i) {
+    if (m_gvar_slot[i].defined) m_gvar_slot[i].value.Mark();
+  }
   ModuleMap::DoGCMark(&m_mod_map);
 }
 
@@ -30,28 +30,32 @@ namespace {
 // 9. max
 // 10. loop
 // =======================================================================
-class FunctionType : public Function {
+class FunctionType : public LeafFunction {
  public:
-  FunctionType() : Function("type") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1) {
+  FunctionType() : LeafFunction("type") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1) {
       return MethodStatus::NewFail("function::type expects 1 argument!");
     }
     output->SetString(
-        context->gc()->NewString(context->GetArgument(0).type_name()));
+        context->gc()->NewString(args[0].type_name()));
     return MethodStatus::kOk;
   }
 };
 
-class FunctionToString : public Function {
+class FunctionToString : public LeafFunction {
  public:
-  FunctionToString() : Function("to_string") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1) {
+  FunctionToString() : LeafFunction("to_string") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1) {
       return MethodStatus::NewFail("function::to_string expects 1 argument!");
     }
 
-    Value arg = context->GetArgument(0);
+    Value arg = args[0];
     String* pstring = NULL;
 
     if (Value::ConvertToString(context, arg, &pstring)) {
@@ -65,15 +69,17 @@ class FunctionToString : public Function {
   }
 };
 
-class FunctionToInteger : public Function {
+class FunctionToInteger : public LeafFunction {
  public:
-  FunctionToInteger() : Function("to_integer") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1) {
+  FunctionToInteger() : LeafFunction("to_integer") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1) {
       return MethodStatus::NewFail("function::to_integer expects 1 argument!");
     }
 
-    Value arg = context->GetArgument(0);
+    Value arg = args[0];
     int32_t ival;
     if (Value::ConvertToInteger(context, arg, &ival)) {
       output->SetInteger(ival);
@@ -86,15 +92,17 @@ class FunctionToInteger : public Function {
   }
 };
 
-class FunctionToReal : public Function {
+class FunctionToReal : public LeafFunction {
  public:
-  FunctionToReal() : Function("to_real") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1) {
+  FunctionToReal() : LeafFunction("to_real") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1) {
       return MethodStatus::NewFail("function::to_real expects 1 argument!");
     }
 
-    Value arg = context->GetArgument(0);
+    Value arg = args[0];
     double dval;
     if (Value::ConvertToReal(context, arg, &dval)) {
       output->SetReal(dval);
@@ -108,15 +116,17 @@ class FunctionToReal : public Function {
   }
 };
 
-class FunctionToBoolean : public Function {
+class FunctionToBoolean : public LeafFunction {
  public:
-  FunctionToBoolean() : Function("to_boolean") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1) {
+  FunctionToBoolean() : LeafFunction("to_boolean") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1) {
       return MethodStatus::NewFail("function::to_boolean expects 1 argument!");
     }
     bool bval;
-    if (Value::ConvertToBoolean(context, context->GetArgument(0), &bval)) {
+    if (Value::ConvertToBoolean(context, args[0], &bval)) {
       output->SetBoolean(bval);
     } else {
       output->SetNull();
@@ -125,13 +135,15 @@ class FunctionToBoolean : public Function {
   }
 };
 
-class FunctionDump : public Function {
+class FunctionDump : public LeafFunction {
  public:
-  FunctionDump() : Function("dump") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    const size_t len = context->GetArgumentSize();
+  FunctionDump() : LeafFunction("dump") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    const size_t len = args.size();
     for (size_t i = 0; i < len; ++i) {
-      context->GetArgument(i).ToDisplay(context, &std::cerr);
+      args[i].ToDisplay(context, &std::cerr);
       std::cerr << " ";
     }
     std::cerr << '\n';
@@ -140,13 +152,15 @@ class FunctionDump : public Function {
   }
 };
 
-class FunctionPrintln : public Function {
+class FunctionPrintln : public LeafFunction {
  public:
-  FunctionPrintln() : Function("println") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    const size_t len = context->GetArgumentSize();
+  FunctionPrintln() : LeafFunction("println") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    const size_t len = args.size();
     for (size_t i = 0; i < len; ++i) {
-      Value v = context->GetArgument(i);
+      Value v = args[i];
       switch (v.type()) {
         case TYPE_INTEGER:
           std::cout << v.GetInteger() << ' ';
@@ -190,21 +204,23 @@ class FunctionPrintln : public Function {
   }
 };
 
-class FunctionMin : public Function {
+class FunctionMin : public LeafFunction {
  public:
-  FunctionMin() : Function("min") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    const size_t len = context->GetArgumentSize();
+  FunctionMin() : LeafFunction("min") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    const size_t len = args.size();
     if (len == 0) {
       return MethodStatus::NewFail(
           "function::min requires at least 1 argument!");
     } else if (len == 1) {
-      *output = context->GetArgument(0);
+      *output = args[0];
       return MethodStatus::kOk;
     } else {
-      Value current = context->GetArgument(0);
+      Value current = args[0];
       for (size_t i = 1; i < len; ++i) {
-        Value v = context->GetArgument(i);
+        Value v = args[i];
         bool result;
         if (v.Less(context, current, &result)) {
           if (result) current = v;
@@ -222,21 +238,23 @@ class FunctionMin : public Function {
   }
 };
 
-class FunctionMax : public Function {
+class FunctionMax : public LeafFunction {
  public:
-  FunctionMax() : Function("max") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    const size_t len = context->GetArgumentSize();
+  FunctionMax() : LeafFunction("max") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    const size_t len = args.size();
     if (len == 0) {
       return MethodStatus::NewFail(
           "function::max requires at least 1 argument!");
     } else if (len == 1) {
-      *output = context->GetArgument(0);
+      *output = args[0];
       return MethodStatus::kOk;
     } else {
-      Value current = context->GetArgument(0);
+      Value current = args[0];
       for (size_t i = 1; i < len; ++i) {
-        Value v = context->GetArgument(i);
+        Value v = args[i];
         bool result;
         if (v.Greater(context, current, &result)) {
           if (result) current = v;
@@ -323,17 +341,19 @@ class ForeverLoop : public Iterator {
   int32_t m_index;
 };
 
-class FunctionLoop : public Function {
+class FunctionLoop : public LeafFunction {
  public:
-  FunctionLoop() : Function("loop") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() == 0) {
+  FunctionLoop() : LeafFunction("loop") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() == 0) {
       output->SetIterator(context->gc()->New<ForeverLoop>());
       return MethodStatus::kOk;
     } else {
-      if (context->GetArgumentSize() == 2) {
-        Value start = context->GetArgument(0);
-        Value end = context->GetArgument(1);
+      if (args.size() == 2) {
+        Value start = args[0];
+        Value end = args[1];
         if (!start.IsInteger() || !end.IsInteger()) {
           return MethodStatus::NewFail(
               "function::loop's can accept 0,2 or 3 "
@@ -352,10 +372,10 @@ class FunctionLoop : public Function {
         }
         output->SetIterator(itr.get());
         return MethodStatus::kOk;
-      } else if (context->GetArgumentSize() == 3) {
-        Value start = context->GetArgument(0);
-        Value end = context->GetArgument(1);
-        Value step = context->GetArgument(2);
+      } else if (args.size() == 3) {
+        Value start = args[0];
+        Value end = args[1];
+        Value step = args[2];
         if (!start.IsInteger() || !end.IsInteger() || !step.IsInteger()) {
           return MethodStatus::NewFail(
               "function::loop's can accept 0,2 or 3 "
@@ -390,16 +410,18 @@ class FunctionLoop : public Function {
 // =========================================================================
 namespace list {
 
-class ListPush : public Function {
+class ListPush : public LeafFunction {
  public:
-  ListPush() : Function("list.push") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 2 || !context->GetArgument(0).IsList()) {
+  ListPush() : LeafFunction("list.push") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 2 || !args[0].IsList()) {
       return MethodStatus::NewFail(
           "function::list.push requires 2 arguments, "
           "first argument must be a list");
     }
-    List* l = context->GetArgument(0).GetList();
+    List* l = args[0].GetList();
     if (l->size() >= List::kMaximumListSize) {
       return MethodStatus::NewFail(
           "function::list.push cannot push more to list,"
@@ -407,22 +429,24 @@ class ListPush : public Function {
           "no longer than %zu",
           List::kMaximumListSize);
     }
-    l->Push(context->GetArgument(1));
+    l->Push(args[1]);
     output->SetTrue();
     return MethodStatus::kOk;
   }
 };
 
-class ListPop : public Function {
+class ListPop : public LeafFunction {
  public:
-  ListPop() : Function("list.pop") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 || !context->GetArgument(0).IsList()) {
+  ListPop() : LeafFunction("list.pop") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 || !args[0].IsList()) {
       return MethodStatus::NewFail(
           "function::list.pop requires 1 argument and "
           "it must be a list");
     }
-    List* l = context->GetArgument(0).GetList();
+    List* l = args[0].GetList();
     if (!l->empty()) {
       l->Pop();
       output->SetNull();
@@ -434,20 +458,22 @@ class ListPop : public Function {
   }
 };
 
-class ListIndex : public Function {
+class ListIndex : public LeafFunction {
  public:
-  ListIndex() : Function("list.index") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 2 ||
-        (!context->GetArgument(0).IsList() ||
-         !context->GetArgument(1).IsInteger())) {
+  ListIndex() : LeafFunction("list.index") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 2 ||
+        (!args[0].IsList() ||
+         !args[1].IsInteger())) {
       return MethodStatus::NewFail(
           "function::list.index requires 2 arguments "
           "and first argument must be a list , second "
           "argument must be an integer");
     }
-    List* l = context->GetArgument(0).GetList();
-    size_t idx = static_cast<size_t>(context->GetArgument(1).GetInteger());
+    List* l = args[0].GetList();
+    size_t idx = static_cast<size_t>(args[1].GetInteger());
     if (idx >= l->size()) {
       return MethodStatus::NewFail(
           "function::list.index index value out of boundary!");
@@ -458,16 +484,18 @@ class ListIndex : public Function {
   }
 };
 
-class ListFront : public Function {
+class ListFront : public LeafFunction {
  public:
-  ListFront() : Function("list.front") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 || !context->GetArgument(0).IsList()) {
+  ListFront() : LeafFunction("list.front") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 || !args[0].IsList()) {
       return MethodStatus::NewFail(
           "function::list.front requires 1 argument,"
           "first argument must be a list");
     }
-    List* l = context->GetArgument(0).GetList();
+    List* l = args[0].GetList();
     if (l->empty()) {
       return MethodStatus::NewFail("function::list.front list is empty!");
     } else {
@@ -477,16 +505,18 @@ class ListFront : public Function {
   }
 };
 
-class ListBack : public Function {
+class ListBack : public LeafFunction {
  public:
-  ListBack() : Function("list.back") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 || !context->GetArgument(0).IsList()) {
+  ListBack() : LeafFunction("list.back") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 || !args[0].IsList()) {
       return MethodStatus::NewFail(
           "function::list.back requires 1 argument,"
           "first argument must be a list");
     }
-    List* l = context->GetArgument(0).GetList();
+    List* l = args[0].GetList();
     if (l->empty()) {
       return MethodStatus::NewFail("function::list.back list is empty!");
     } else {
@@ -496,22 +526,24 @@ class ListBack : public Function {
   }
 };
 
-class ListSlice : public Function {
+class ListSlice : public LeafFunction {
  public:
-  ListSlice() : Function("list.slice") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 3 ||
-        (!context->GetArgument(0).IsList() ||
-         !context->GetArgument(1).IsInteger() ||
-         !context->GetArgument(2).IsInteger())) {
+  ListSlice() : LeafFunction("list.slice") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 3 ||
+        (!args[0].IsList() ||
+         !args[1].IsInteger() ||
+         !args[2].IsInteger())) {
       return MethodStatus::NewFail(
           "function::list.slice requires 3 arguments,"
           "first argument must be a list,"
           "second and third argument must be a integer");
     }
-    List* l = context->GetArgument(0).GetList();
-    int32_t start = context->GetArgument(1).GetInteger();
-    int32_t end = context->GetArgument(2).GetInteger();
+    List* l = args[0].GetList();
+    int32_t start = args[1].GetInteger();
+    int32_t end = args[2].GetInteger();
     int32_t len = static_cast<int32_t>(l->size());
 
     // Clamp the value to be in valid range
@@ -531,22 +563,24 @@ class ListSlice : public Function {
   }
 };
 
-class ListRange : public Function {
+class ListRange : public LeafFunction {
  public:
-  ListRange() : Function("list.range") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 3 ||
-        (!context->GetArgument(0).IsInteger() ||
-         !context->GetArgument(1).IsInteger() ||
-         !context->GetArgument(2).IsInteger())) {
+  ListRange() : LeafFunction("list.range") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 3 ||
+        (!args[0].IsInteger() ||
+         !args[1].IsInteger() ||
+         !args[2].IsInteger())) {
       return MethodStatus::NewFail(
           "function::list.range requires 3 arguments,"
           "first,second and third arguments must be "
           "integer!");
     }
-    int32_t start = context->GetArgument(0).GetInteger();
-    int32_t end = context->GetArgument(1).GetInteger();
-    int32_t step = context->GetArgument(2).GetInteger();
+    int32_t start = args[0].GetInteger();
+    int32_t end = args[1].GetInteger();
+    int32_t step = args[2].GetInteger();
 
     // Check whether the loop will stop or not
     if (std::abs(end - (start + step)) >= std::abs(end - start)) {
@@ -573,20 +607,22 @@ class ListRange : public Function {
   }
 };
 
-class ListResize : public Function {
+class ListResize : public LeafFunction {
  public:
-  ListResize() : Function("list.resize") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 2 ||
-        (!context->GetArgument(0).IsList() ||
-         !context->GetArgument(1).IsInteger())) {
+  ListResize() : LeafFunction("list.resize") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 2 ||
+        (!args[0].IsList() ||
+         !args[1].IsInteger())) {
       return MethodStatus::NewFail(
           "function::list.resize requires 2 arguments "
           "and first argument must be a list , second "
           "argument must be an integer");
     }
-    List* l = context->GetArgument(0).GetList();
-    size_t sz = static_cast<size_t>(context->GetArgument(1).GetInteger());
+    List* l = args[0].GetList();
+    size_t sz = static_cast<size_t>(args[1].GetInteger());
     if (sz >= List::kMaximumListSize) {
       return MethodStatus::NewFail(
           "function::list.resize tries to resize too "
@@ -601,68 +637,100 @@ class ListResize : public Function {
   }
 };
 
-class ListClear : public Function {
+class ListClear : public LeafFunction {
  public:
-  ListClear() : Function("list.clear") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 ||
-        (!context->GetArgument(0).IsList())) {
+  ListClear() : LeafFunction("list.clear") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 ||
+        (!args[0].IsList())) {
       return MethodStatus::NewFail(
           "function::list.clear requires 1 argument,"
           "and first argument must be a list");
     }
-    List* l = context->GetArgument(0).GetList();
+    List* l = args[0].GetList();
     l->Clear();
     output->SetNull();
     return MethodStatus::kOk;
   }
 };
 
-class ListSize : public Function {
+class ListSize : public LeafFunction {
  public:
-  ListSize() : Function("list.size") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 || !context->GetArgument(0).IsList()) {
+  ListSize() : LeafFunction("list.size") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 || !args[0].IsList()) {
       return MethodStatus::NewFail(
           "function::list.size requires 1 argument,"
           "and first argument must be a list");
     }
-    List* l = context->GetArgument(0).GetList();
+    List* l = args[0].GetList();
     output->SetInteger(static_cast<int32_t>(l->size()));
     return MethodStatus::kOk;
   }
 };
 
-class ListEmpty : public Function {
+class ListEmpty : public LeafFunction {
  public:
-  ListEmpty() : Function("list.empty") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 || !context->GetArgument(0).IsList()) {
+  ListEmpty() : LeafFunction("list.empty") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 || !args[0].IsList()) {
       return MethodStatus::NewFail(
           "function::list.empty requires 1 argument,"
           "and first argument must be a list");
     }
-    List* l = context->GetArgument(0).GetList();
+    List* l = args[0].GetList();
     output->SetBoolean(l->empty());
     return MethodStatus::kOk;
   }
 };
 
-class ListJoin : public Function {
+class ListJoin : public LeafFunction {
  public:
-  ListJoin() : Function("list.join") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 || !context->GetArgument(0).IsList()) {
+  ListJoin() : LeafFunction("list.join") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 || !args[0].IsList()) {
       return MethodStatus::NewFail(
           "function::list.join requires 1 argument,"
           "and it must be list");
     }
-    List* l = context->GetArgument(0).GetList();
-    if (l->size() == 0) {
+    List* l = args[0].GetList();
+    const size_t len = l->size();
+    if (len == 0) {
       output->SetNull();
+    } else if (len == 1) {
+      *output = l->Index(0);
+    } else if (l->kind() == List::KIND_INTEGER) {
+      const int32_t* array = l->integer_array();
+      int32_t sum = array[0];
+      for (size_t i = 1; i < len; ++i) sum += array[i];
+      output->SetInteger(sum);
+    } else if (l->kind() == List::KIND_REAL) {
+      const double* array = l->real_array();
+      double sum = array[0];
+      for (size_t i = 1; i < len; ++i) sum += array[i];
+      output->SetReal(sum);
+    } else if (l->kind() == List::KIND_STRING) {
+      // Concatenate into one buffer instead of a new string per element
+      String* const* array = l->string_array();
+      std::string buffer;
+      size_t total = 0;
+      for (size_t i = 0; i < len; ++i) total += array[i]->size();
+      buffer.reserve(total);
+      for (size_t i = 0; i < len; ++i) {
+        buffer.append(array[i]->ToStdString());
+      }
+      output->SetString(context->gc()->NewString(buffer));
     } else {
       Value current = l->Index(0);
-      for (size_t i = 1; i < l->size(); ++i) {
+      for (size_t i = 1; i < len; ++i) {
         Value v = l->Index(i);
         Value temp;
         if (current.Add(context, v, &temp)) {
@@ -682,11 +750,13 @@ class ListJoin : public Function {
   }
 };
 
-class ListMaxSize : public Function {
+class ListMaxSize : public LeafFunction {
  public:
-  ListMaxSize() : Function("list.max_size") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 || !context->GetArgument(0).IsList()) {
+  ListMaxSize() : LeafFunction("list.max_size") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 || !args[0].IsList()) {
       return MethodStatus::NewFail(
           "function::list.max_size requires 1 argument,"
           "and it must be list");
@@ -732,11 +802,13 @@ Module* CreateListModule(T* target) {
 // =========================================================================
 namespace gc {
 
-class FunctionGCSize : public Function {
+class FunctionGCSize : public LeafFunction {
  public:
-  FunctionGCSize() : Function("gc.gc_size") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 0) {
+  FunctionGCSize() : LeafFunction("gc.gc_size") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 0) {
       return MethodStatus::NewFail("function::gc.gc_size requires 0 argument");
     }
     Value::CastSizeToValueNoLostPrecision(
@@ -745,11 +817,13 @@ class FunctionGCSize : public Function {
   }
 };
 
-class FunctionGCTrigger : public Function {
+class FunctionGCTrigger : public LeafFunction {
  public:
-  FunctionGCTrigger() : Function("gc.gc_trigger") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 0) {
+  FunctionGCTrigger() : LeafFunction("gc.gc_trigger") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 0) {
       return MethodStatus::NewFail(
           "function::gc.gc_trigger requires 0 argument");
     }
@@ -759,11 +833,13 @@ class FunctionGCTrigger : public Function {
   }
 };
 
-class FunctionGCTimes : public Function {
+class FunctionGCTimes : public LeafFunction {
  public:
-  FunctionGCTimes() : Function("gc.gc_times") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 0) {
+  FunctionGCTimes() : LeafFunction("gc.gc_times") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 0) {
       return MethodStatus::NewFail("function::gc.gc_times requires 0 argument");
     }
     output->SetInteger(static_cast<int32_t>(context->gc()->gc_times()));
@@ -773,11 +849,13 @@ class FunctionGCTimes : public Function {
   }
 };
 
-class FunctionGCRatio : public Function {
+class FunctionGCRatio : public LeafFunction {
  public:
-  FunctionGCRatio() : Function("gc.gc_ratio") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 0) {
+  FunctionGCRatio() : LeafFunction("gc.gc_ratio") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 0) {
       return MethodStatus::NewFail("function::gc.gc_ratio requires 0 argument");
     }
     output->SetReal(context->gc()->gc_ratio());
@@ -785,11 +863,13 @@ class FunctionGCRatio : public Function {
   }
 };
 
-class FunctionForceCollect : public Function {
+class FunctionForceCollect : public LeafFunction {
  public:
-  FunctionForceCollect() : Function("gc.force_collect") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 0) {
+  FunctionForceCollect() : LeafFunction("gc.force_collect") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 0) {
       return MethodStatus::NewFail(
           "function::gc.force_collect requires 0 argument");
     }
@@ -799,11 +879,13 @@ class FunctionForceCollect : public Function {
   }
 };
 
-class FunctionTryCollect : public Function {
+class FunctionTryCollect : public LeafFunction {
  public:
-  FunctionTryCollect() : Function("gc.try_collect") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 0) {
+  FunctionTryCollect() : LeafFunction("gc.try_collect") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 0) {
       return MethodStatus::NewFail(
           "function::gc.try_collect requires 0 argument");
     }
@@ -841,74 +923,82 @@ Module* CreateGCModule(T* engine) {
 // =========================================================================
 namespace dict {
 
-class FunctionUpdate : public Function {
+class FunctionUpdate : public LeafFunction {
  public:
-  FunctionUpdate() : Function("dict.update") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 3 || !context->GetArgument(0).IsDict() ||
-        !context->GetArgument(1).IsString()) {
+  FunctionUpdate() : LeafFunction("dict.update") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 3 || !args[0].IsDict() ||
+        !args[1].IsString()) {
       return MethodStatus::NewFail(
           "function::dict.update expects 3 arguments, "
           "first argument must be a dictionary,"
           "second argument must be a string");
     }
-    Dict* d = context->GetArgument(0).GetDict();
-    String* k = context->GetArgument(1).GetString();
-    d->InsertOrUpdate(*k, context->GetArgument(2));
+    Dict* d = args[0].GetDict();
+    String* k = args[1].GetString();
+    d->InsertOrUpdate(*k, args[2]);
     output->SetNull();
     return MethodStatus::kOk;
   }
 };
 
-class FunctionInsert : public Function {
+class FunctionInsert : public LeafFunction {
  public:
-  FunctionInsert() : Function("dict.insert") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 3 || !context->GetArgument(0).IsDict() ||
-        !context->GetArgument(1).IsString()) {
+  FunctionInsert() : LeafFunction("dict.insert") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 3 || !args[0].IsDict() ||
+        !args[1].IsString()) {
       return MethodStatus::NewFail(
           "function::dict.insert expects 3 arguments,"
           "first argument must be a dictionary,"
           "second argument must be a string");
     }
-    Dict* d = context->GetArgument(0).GetDict();
-    String* k = context->GetArgument(1).GetString();
-    output->SetBoolean(d->Insert(*k, context->GetArgument(2)));
+    Dict* d = args[0].GetDict();
+    String* k = args[1].GetString();
+    output->SetBoolean(d->Insert(*k, args[2]));
     return MethodStatus::kOk;
   }
 };
 
-class FunctionFind : public Function {
+class FunctionFind : public LeafFunction {
  public:
-  FunctionFind() : Function("dict.find") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 2 || !context->GetArgument(0).IsDict() ||
-        !context->GetArgument(1).IsString()) {
+  FunctionFind() : LeafFunction("dict.find") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 2 || !args[0].IsDict() ||
+        !args[1].IsString()) {
       return MethodStatus::NewFail(
           "function::dict.find expects 2 arguments,"
           "first argument must be a dictionary,"
           "second argument must be a string");
     }
-    Dict* d = context->GetArgument(0).GetDict();
-    String* key = context->GetArgument(1).GetString();
+    Dict* d = args[0].GetDict();
+    String* key = args[1].GetString();
     if (!d->Find(*key, output)) output->SetNull();
     return MethodStatus::kOk;
   }
 };
 
-class FunctionExist : public Function {
+class FunctionExist : public LeafFunction {
  public:
-  FunctionExist() : Function("dict.exist") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 2 || !context->GetArgument(0).IsDict() ||
-        !context->GetArgument(1).IsString()) {
+  FunctionExist() : LeafFunction("dict.exist") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 2 || !args[0].IsDict() ||
+        !args[1].IsString()) {
       return MethodStatus::NewFail(
           "function::dict.exist expects 2 arguments,"
           "first argument must be a dictionary,"
           "second argument must be a string");
     }
-    Dict* d = context->GetArgument(0).GetDict();
-    String* k = context->GetArgument(1).GetString();
+    Dict* d = args[0].GetDict();
+    String* k = args[1].GetString();
     Value dull;
     output->SetBoolean(d->Find(*k, &dull));
     VCL_UNUSED(dull);
@@ -916,73 +1006,83 @@ class FunctionExist : public Function {
   }
 };
 
-class FunctionRemove : public Function {
+class FunctionRemove : public LeafFunction {
  public:
-  FunctionRemove() : Function("dict.remove") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 2 || !context->GetArgument(0).IsDict() ||
-        !context->GetArgument(1).IsString()) {
+  FunctionRemove() : LeafFunction("dict.remove") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 2 || !args[0].IsDict() ||
+        !args[1].IsString()) {
       return MethodStatus::NewFail(
           "function::dict.remove expects 2 arguments,"
           "first argument must be a dictionary,"
           "second argument must be a string");
     }
-    Dict* d = context->GetArgument(0).GetDict();
-    String* k = context->GetArgument(1).GetString();
+    Dict* d = args[0].GetDict();
+    String* k = args[1].GetString();
     output->SetBoolean(d->Remove(*k, NULL));
     return MethodStatus::kOk;
   }
 };
 
-class FunctionClear : public Function {
+class FunctionClear : public LeafFunction {
  public:
-  FunctionClear() : Function("dict.clear") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 || !context->GetArgument(0).IsDict()) {
+  FunctionClear() : LeafFunction("dict.clear") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 || !args[0].IsDict()) {
       return MethodStatus::NewFail(
           "function::dict.clear expects 1 argument,"
           "and it must be a dictionary");
     }
-    context->GetArgument(0).GetDict()->Clear();
+    args[0].GetDict()->Clear();
     output->SetNull();
     return MethodStatus::kOk;
   }
 };
 
-class FunctionSize : public Function {
+class FunctionSize : public LeafFunction {
  public:
-  FunctionSize() : Function("dict.size") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 || !context->GetArgument(0).IsDict()) {
+  FunctionSize() : LeafFunction("dict.size") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 || !args[0].IsDict()) {
       return MethodStatus::NewFail(
           "function::dict.size expects 1 argument,"
           "and it must be a dictionary");
     }
     output->SetInteger(
-        static_cast<int32_t>(context->GetArgument(0).GetDict()->size()));
+        static_cast<int32_t>(args[0].GetDict()->size()));
     return MethodStatus::kOk;
   }
 };
 
-class FunctionEmpty : public Function {
+class FunctionEmpty : public LeafFunction {
  public:
-  FunctionEmpty() : Function("dict.empty") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 || !context->GetArgument(0).IsDict()) {
+  FunctionEmpty() : LeafFunction("dict.empty") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 || !args[0].IsDict()) {
       return MethodStatus::NewFail(
           "function::dict.empty expects 1 argument,"
           "and it must be a dictionary");
     }
-    output->SetBoolean(context->GetArgument(0).GetDict()->empty());
+    output->SetBoolean(args[0].GetDict()->empty());
     return MethodStatus::kOk;
   }
 };
 
-class FunctionMaxSize : public Function {
+class FunctionMaxSize : public LeafFunction {
  public:
-  FunctionMaxSize() : Function("dict.max_size") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 || !context->GetArgument(0).IsDict()) {
+  FunctionMaxSize() : LeafFunction("dict.max_size") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 || !args[0].IsDict()) {
       return MethodStatus::NewFail(
           "function::dict.max_size expects 1 argument,"
           "and it must be a dictionary");
@@ -1024,155 +1124,173 @@ Module* CreateDictModule(T* engine) {
 // =========================================================================
 namespace string {
 
-class FunctionSize : public Function {
+class FunctionSize : public LeafFunction {
  public:
-  FunctionSize() : Function("string.size") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 ||
-        !context->GetArgument(0).IsString()) {
+  FunctionSize() : LeafFunction("string.size") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 ||
+        !args[0].IsString()) {
       return MethodStatus::NewFail(
           "function::string.size expects 1 argument,"
           "and it must be string");
     }
     output->SetInteger(
-        static_cast<int32_t>(context->GetArgument(0).GetString()->size()));
+        static_cast<int32_t>(args[0].GetString()->size()));
     return MethodStatus::kOk;
   }
 };
 
-class FunctionEmpty : public Function {
+class FunctionEmpty : public LeafFunction {
  public:
-  FunctionEmpty() : Function("string.empty") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 ||
-        !context->GetArgument(0).IsString()) {
+  FunctionEmpty() : LeafFunction("string.empty") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 ||
+        !args[0].IsString()) {
       return MethodStatus::NewFail(
           "function::string.empty expects 1 argument,"
           "and it must be string");
     }
-    output->SetBoolean(context->GetArgument(0).GetString()->empty());
+    output->SetBoolean(args[0].GetString()->empty());
     return MethodStatus::kOk;
   }
 };
 
-class FunctionLeftTrim : public Function {
+class FunctionLeftTrim : public LeafFunction {
  public:
-  FunctionLeftTrim() : Function("string.left_trim") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 ||
-        !context->GetArgument(0).IsString()) {
+  FunctionLeftTrim() : LeafFunction("string.left_trim") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 ||
+        !args[0].IsString()) {
       return MethodStatus::NewFail(
           "function::string.left_trim expects 1 argument,"
           "and it must be string");
     }
-    std::string target = context->GetArgument(0).GetString()->ToStdString();
+    std::string target = args[0].GetString()->ToStdString();
     boost::algorithm::trim_left(target);
     output->SetString(context->gc()->NewString(target));
     return MethodStatus::kOk;
   }
 };
 
-class FunctionRightTrim : public Function {
+class FunctionRightTrim : public LeafFunction {
  public:
-  FunctionRightTrim() : Function("string.right_trim") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 ||
-        !context->GetArgument(0).IsString()) {
+  FunctionRightTrim() : LeafFunction("string.right_trim") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 ||
+        !args[0].IsString()) {
       return MethodStatus::NewFail(
           "function::string.right_trim expects 1 argument,"
           "and it must be string");
     }
-    std::string target = context->GetArgument(0).GetString()->ToStdString();
+    std::string target = args[0].GetString()->ToStdString();
     boost::algorithm::trim_right(target);
     output->SetString(context->gc()->NewString(target));
     return MethodStatus::kOk;
   }
 };
 
-class FunctionTrim : public Function {
+class FunctionTrim : public LeafFunction {
  public:
-  FunctionTrim() : Function("string.trim") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 ||
-        !context->GetArgument(0).IsString()) {
+  FunctionTrim() : LeafFunction("string.trim") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 ||
+        !args[0].IsString()) {
       return MethodStatus::NewFail(
           "function::string.trim expects 1 argument,"
           "and it must be string");
     }
-    std::string target = context->GetArgument(0).GetString()->ToStdString();
+    std::string target = args[0].GetString()->ToStdString();
     boost::algorithm::trim(target);
     output->SetString(context->gc()->NewString(target));
     return MethodStatus::kOk;
   }
 };
 
-class FunctionDup : public Function {
+class FunctionDup : public LeafFunction {
  public:
-  FunctionDup() : Function("string.dup") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 ||
-        !context->GetArgument(0).IsString()) {
+  FunctionDup() : LeafFunction("string.dup") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 ||
+        !args[0].IsString()) {
       return MethodStatus::NewFail(
           "function::string.dup expects 1 argument,"
           "and it must be string");
     }
     output->SetString(
-        context->gc()->NewString(context->GetArgument(0).GetString()->data()));
+        context->gc()->NewString(args[0].GetString()->data()));
     return MethodStatus::kOk;
   }
 };
 
-class FunctionUpper : public Function {
+class FunctionUpper : public LeafFunction {
  public:
-  FunctionUpper() : Function("string.upper") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 ||
-        !context->GetArgument(0).IsString()) {
+  FunctionUpper() : LeafFunction("string.upper") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 ||
+        !args[0].IsString()) {
       return MethodStatus::NewFail(
           "function::string.upper expects 1 argument,"
           "and it must be string");
     }
     output->SetString(
         context->gc()->NewString(boost::algorithm::to_upper_copy<std::string>(
-            context->GetArgument(0).GetString()->data())));
+            args[0].GetString()->data())));
     return MethodStatus::kOk;
   }
 };
 
-class FunctionLower : public Function {
+class FunctionLower : public LeafFunction {
  public:
-  FunctionLower() : Function("string.lower") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 1 ||
-        !context->GetArgument(0).IsString()) {
+  FunctionLower() : LeafFunction("string.lower") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 1 ||
+        !args[0].IsString()) {
       return MethodStatus::NewFail(
           "function::string.lower expects 1 argument,"
           "and it must be string");
     }
     output->SetString(
         context->gc()->NewString(boost::algorithm::to_lower_copy<std::string>(
-            context->GetArgument(0).GetString()->data())));
+            args[0].GetString()->data())));
     return MethodStatus::kOk;
   }
 };
 
-class FunctionSlice : public Function {
+class FunctionSlice : public LeafFunction {
  public:
-  FunctionSlice() : Function("string.slice") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 3 ||
-        !context->GetArgument(0).IsString() ||
-        !context->GetArgument(1).IsInteger() ||
-        !context->GetArgument(2).IsInteger()) {
+  FunctionSlice() : LeafFunction("string.slice") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 3 ||
+        !args[0].IsString() ||
+        !args[1].IsInteger() ||
+        !args[2].IsInteger()) {
       return MethodStatus::NewFail(
           "function::string.slice expects 3 argument,"
           "first argument must be string,"
           "second and third argument must be integer");
     }
-    String* str = context->GetArgument(0).GetString();
+    String* str = args[0].GetString();
     int32_t len = static_cast<int32_t>(str->size());
-    int32_t start = context->GetArgument(1).GetInteger();
-    int32_t end = context->GetArgument(2).GetInteger();
+    int32_t start = args[1].GetInteger();
+    int32_t end = args[2].GetInteger();
 
     // Clamp the value to be in valid range
     if (start < 0) start = 0;
@@ -1186,20 +1304,22 @@ class FunctionSlice : public Function {
   }
 };
 
-class FunctionIndex : public Function {
+class FunctionIndex : public LeafFunction {
  public:
-  FunctionIndex() : Function("string.index") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 2 ||
-        !context->GetArgument(0).IsString() ||
-        !context->GetArgument(1).IsInteger()) {
+  FunctionIndex() : LeafFunction("string.index") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 2 ||
+        !args[0].IsString() ||
+        !args[1].IsInteger()) {
       return MethodStatus::NewFail(
           "function::string.index expects 2 argument,"
           "first argument must be string,"
           "second argument must be integer");
     }
-    String* str = context->GetArgument(0).GetString();
-    int32_t index = context->GetArgument(1).GetInteger();
+    String* str = args[0].GetString();
+    int32_t index = args[1].GetInteger();
     int32_t len = static_cast<int32_t>(str->size());
     if (index >= len || index < 0) {
       return MethodStatus::NewFail("function::string.index out of bound!");
@@ -1241,11 +1361,13 @@ Module* CreateStringModule(T* engine) {
 
 namespace time {
 
-class FunctionNowInMicroSeconds : public Function {
+class FunctionNowInMicroSeconds : public LeafFunction {
  public:
-  FunctionNowInMicroSeconds() : Function("time.now_in_micro_seconds") {}
-  virtual MethodStatus Invoke(Context* context, Value* output) {
-    if (context->GetArgumentSize() != 0) {
+  FunctionNowInMicroSeconds() : LeafFunction("time.now_in_micro_seconds") {}
+  virtual MethodStatus Call(Context* context,
+                            const Arguments& args,
+                            Value* output) {
+    if (args.size() != 0) {
       return MethodStatus::NewFail(
           "function::time.now_in_micro_seconds expects "
           "no arguments");
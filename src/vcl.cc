@@ -25,6 +25,17 @@ const MethodStatus MethodStatus::kYield(MethodStatus::METHOD_YIELD);
 const MethodStatus MethodStatus::kUnimplemented(
     MethodStatus::METHOD_UNIMPLEMENTED);
 
+namespace detail {
+
+uint64_t NewObjectStamp() {
+  // Object can be created by multiple threads , ie each thread has its own
+  // Context , so the counter must be bumped atomically
+  static uint64_t kStamp = 0;
+  return __sync_add_and_fetch(&kStamp, 1);
+}
+
+}  // namespace detail
+
 MethodStatus Value::GetProperty(Context* context,
                                 const String& key,
                                 Value* output) const {
@@ -312,6 +323,8 @@ MethodStatus Value::SelfAdd(Context* context, const Value& value) {
   MethodStatus status;
   if (OperatorImpl<AddOp>(context, *this, value, this, &status))
     return status;
+  else if (IsString() && GetString()->is_atom())
+    return GetString()->Add(context, value, this);  // Atom is never changed
   else
     return object()->SelfAdd(context, value);
 }
@@ -392,6 +405,12 @@ MethodStatus Value::Unset(Context* context) {
       break;
     case TYPE_NULL:
       break;
+    case TYPE_STRING:
+      if (GetString()->is_atom()) {
+        SetString(context->gc()->NewString(""));  // Atom is never changed
+        break;
+      }
+      return object()->Unset(context);
     default:
       return object()->Unset(context);
   }
@@ -1068,6 +1087,7 @@ MethodStatus String::SelfAdd(Context* context, const Value& value) {
   std::string temp;
   if (!(result = value.ToString(context, &temp))) return result;
   m_data += temp;
+  m_hashed = false;
   return MethodStatus::kOk;
 }
 
@@ -1238,11 +1258,15 @@ MethodStatus List::GetIndex(Context* context,
                             Value* output) const {
   MethodStatus result;
   int32_t idx;
-  if (!(result = index.ToInteger(context, &idx))) return result;
-  if (idx < 0 || static_cast<size_t>(idx) >= m_list.size())
-    return MethodStatus::NewFail("index out of range ,list size is:%zu",
-                                 m_list.size());
-  *output = m_list[idx];
+  if (index.IsInteger()) {
+    idx = index.GetInteger();
+  } else if (!(result = index.ToInteger(context, &idx))) {
+    return result;
+  }
+  const size_t len = size();
+  if (idx < 0 || static_cast<size_t>(idx) >= len)
+    return MethodStatus::NewFail("index out of range ,list size is:%zu", len);
+  *output = Index(static_cast<size_t>(idx));
   return MethodStatus::kOk;
 }
 
@@ -1251,33 +1275,167 @@ MethodStatus List::SetIndex(Context* context,
                             const Value& value) {
   MethodStatus result;
   int32_t idx;
-  if (!(result = index.ToInteger(context, &idx))) return result;
-  if (idx < 0 || static_cast<size_t>(idx) >= m_list.size())
-    return MethodStatus::NewFail("index out of range ,list size is:%zu",
-                                 m_list.size());
-  m_list[idx] = value;
+  if (index.IsInteger()) {
+    idx = index.GetInteger();
+  } else if (!(result = index.ToInteger(context, &idx))) {
+    return result;
+  }
+  const size_t len = size();
+  if (idx < 0 || static_cast<size_t>(idx) >= len)
+    return MethodStatus::NewFail("index out of range ,list size is:%zu", len);
+  Set(static_cast<size_t>(idx), value);
   return MethodStatus::kOk;
 }
 
 MethodStatus List::ToDisplay(Context* context, std::ostream* output) const {
   (*output) << "list(";
-  for (size_t i = 0; i < m_list.size(); ++i) {
-    m_list[i].ToDisplay(context, output);
+  for (size_t i = 0; i < size(); ++i) {
+    Index(i).ToDisplay(context, output);
     (*output) << ',';
   }
   (*output) << ')';
   return MethodStatus::kOk;
 }
 
-void List::DoMark() {
-  for (size_t i = 0; i < m_list.size(); ++i) {
-    m_list[i].Mark();
+void List::Pop() {
+  switch (m_kind) {
+    case KIND_INTEGER:
+      m_integer.pop_back();
+      break;
+    case KIND_REAL:
+      m_real.pop_back();
+      break;
+    case KIND_STRING:
+      m_string.pop_back();
+      break;
+    default:
+      m_list.pop_back();
+      break;
+  }
+}
+
+void List::Reserve(size_t cap) {
+  switch (m_kind) {
+    case KIND_EMPTY:
+      m_reserve = std::max(m_reserve, cap);
+      break;
+    case KIND_INTEGER:
+      m_integer.reserve(cap);
+      break;
+    case KIND_REAL:
+      m_real.reserve(cap);
+      break;
+    case KIND_STRING:
+      m_string.reserve(cap);
+      break;
+    default:
+      m_list.reserve(cap);
+      break;
+  }
+}
+
+void List::Resize(size_t cap) {
+  if (cap <= size()) {
+    switch (m_kind) {
+      case KIND_INTEGER:
+        m_integer.resize(cap);
+        return;
+      case KIND_REAL:
+        m_real.resize(cap);
+        return;
+      case KIND_STRING:
+        m_string.resize(cap);
+        return;
+      default:
+        m_list.resize(cap);
+        return;
+    }
+  }
+  // Grown elements are null which cannot be packed
+  Generalize();
+  m_list.resize(cap);
+}
+
+void List::Clear() {
+  m_integer.clear();
+  m_real.clear();
+  m_string.clear();
+  m_list.clear();
+  m_kind = KIND_EMPTY;
+}
+
+void List::Set(size_t idx, const Value& value) {
+  if (m_kind != KindOf(value)) Generalize();
+  switch (m_kind) {
+    case KIND_INTEGER:
+      m_integer[idx] = value.GetInteger();
+      break;
+    case KIND_REAL:
+      m_real[idx] = value.GetReal();
+      break;
+    case KIND_STRING:
+      m_string[idx] = value.GetString();
+      break;
+    default:
+      m_list[idx] = value;
+      break;
+  }
+  if (value.IsObject()) WriteBarrier();
+}
+
+bool List::Adapt(const Value& value) {
+  if (!empty()) {
+    Generalize();
+    return false;
+  }
+
+  // Keep the capacity the List already has for the new kind
+  size_t cap = std::max(m_reserve, m_list.capacity());
+  cap = std::max(cap, std::max(m_integer.capacity(), m_real.capacity()));
+  cap = std::max(cap, m_string.capacity());
+  std::vector<int32_t>().swap(m_integer);
+  std::vector<double>().swap(m_real);
+  std::vector<String*>().swap(m_string);
+  ListType().swap(m_list);
+  m_reserve = 0;
+  m_kind = KindOf(value);
+  Reserve(cap);
+  return m_kind != KIND_GENERIC;
+}
+
+void List::Generalize() {
+  if (m_kind == KIND_GENERIC) return;
+  const size_t len = size();
+  m_list.reserve(std::max(len, m_reserve));
+  for (size_t i = 0; i < len; ++i) m_list.push_back(Index(i));
+  std::vector<int32_t>().swap(m_integer);
+  std::vector<double>().swap(m_real);
+  std::vector<String*>().swap(m_string);
+  m_reserve = 0;
+  m_kind = KIND_GENERIC;
+}
+
+void List::Trace(GCVisitor* visitor) {
+  switch (m_kind) {
+    case KIND_STRING:
+      for (size_t i = 0; i < m_string.size(); ++i) visitor->Visit(m_string[i]);
+      break;
+    case KIND_GENERIC:
+      for (size_t i = 0; i < m_list.size(); ++i) visitor->Visit(m_list[i]);
+      break;
+    default:
+      break;
   }
 }
 
 // =======================================================================
 // Dict Implementation
 // =======================================================================
+Dict::~Dict() {
+  ::free(m_small_value);
+  delete m_dict;
+}
+
 MethodStatus Dict::NewIterator(Context* context, ::vcl::Iterator** iterator) {
   *iterator = context->gc()->New<DictIterator>(this);
   return MethodStatus::kOk;
@@ -1287,7 +1445,7 @@ MethodStatus Dict::GetProperty(Context* context,
                                const String& key,
                                Value* output) const {
   VCL_UNUSED(context);
-  const Value* result = m_dict.Find(key);
+  const Value* result = Lookup(key);
   if (result) {
     *output = *result;
     return MethodStatus::kOk;
@@ -1300,14 +1458,14 @@ MethodStatus Dict::SetProperty(Context* context,
                                const String& key,
                                const Value& value) {
   VCL_UNUSED(context);
-  if (m_dict.size() >= kMaximumDictSize) {
+  if (size() >= kMaximumDictSize) {
     return MethodStatus::NewFail(
         "Cannot add more entry into dictionary,"
         "user can have a dictionary with no more "
         "than %zu entries",
         kMaximumDictSize);
   }
-  m_dict.InsertOrUpdate(key, value);
+  InsertOrUpdate(key, value);
   return MethodStatus::kOk;
 }
 
@@ -1321,7 +1479,7 @@ MethodStatus Dict::GetIndex(Context* context,
         "required as a key for dictionary!",
         key.type_name());
   }
-  const Value* rval = m_dict.Find(k);
+  const Value* rval = Lookup(k.c_str());
   if (!rval) {
     return MethodStatus::NewFail("key \"%s\" not found", k.c_str());
   } else {
@@ -1340,24 +1498,174 @@ MethodStatus Dict::SetIndex(Context* context,
         "required as a key for dictionary!",
         key.type_name());
   }
-  if (m_dict.size() >= kMaximumDictSize) {
+  if (size() >= kMaximumDictSize) {
     return MethodStatus::NewFail(
         "Cannot add more entry into dictionary,"
         "user can have a dictionary with no more "
         "than %zu entries",
         kMaximumDictSize);
   }
-  m_dict.InsertOrUpdate(context->gc(), k, value);
+  Value* slot = const_cast<Value*>(Lookup(k.c_str()));
+  if (slot) {
+    *slot = value;
+    WriteBarrier();
+  } else if (!m_dict) {
+    SmallAdd(*context->gc()->NewString(k), value);
+  } else {
+    // The key is allocated inside , which may promote this Dict
+    m_stamp = detail::NewObjectStamp();
+    m_dict->InsertOrUpdate(context->gc(), k, value);
+    WriteBarrier();
+  }
   return MethodStatus::kOk;
 }
 
+bool Dict::Remove(const String& key, Value* output) {
+  if (m_dict) {
+    if (m_dict->Remove(key, output)) {
+      m_stamp = detail::NewObjectStamp();
+      return true;
+    }
+    return false;
+  }
+
+  size_t index = SmallFind(key);
+  if (index == kNotFound) return false;
+  if (output) *output = m_small_value[index];
+
+  // Leave the slot behind , a running iterator may point after it
+  if (m_shape) SmallReserve(m_small_capacity);
+  m_small_key[index] = NULL;
+  m_small_value[index].SetNull();
+  ++m_small_dead;
+  m_shape = NULL;
+  m_stamp = detail::NewObjectStamp();
+  return true;
+}
+
+size_t Dict::footprint() const {
+  if (m_dict) {
+    return sizeof(Dict) + sizeof(DictType) +
+           m_dict->capacity() * (sizeof(DictType::ValueType) + 1);
+  }
+  if (m_shape) return sizeof(Dict) + m_small_capacity * sizeof(Value);
+  return sizeof(Dict) +
+         m_small_capacity * (sizeof(Value) + sizeof(const String*));
+}
+
+void Dict::Clear() {
+  m_stamp = detail::NewObjectStamp();
+  ::free(m_small_value);
+  delete m_dict;
+  m_small_key = NULL;
+  m_small_value = NULL;
+  m_small_size = 0;
+  m_small_dead = 0;
+  m_small_capacity = 0;
+  m_shape = NULL;
+  m_dict = NULL;
+}
+
+void Dict::SmallAdd(const String& key, const Value& v) {
+  DCHECK(!m_dict);
+  const Value value(v);  // v may be a slot of the block being moved
+  if (m_small_size == m_small_capacity && m_small_dead) SmallCompact();
+  if (m_small_size == kSmallSize) {
+    ToHash(kSmallSize + 1);
+    m_dict->Insert(key, value);
+  } else {
+    // A shaped Dict is always full , growing it copies the keys of the shape
+    if (m_small_size == m_small_capacity) {
+      size_t capacity = m_small_size ? m_small_size * 2 : 2;
+      SmallReserve(capacity > kSmallSize ? kSmallSize : capacity);
+    }
+    m_small_key[m_small_size] = &key;
+    m_small_value[m_small_size] = value;
+    ++m_small_size;
+    m_shape = NULL;
+    m_stamp = detail::NewObjectStamp();
+  }
+  WriteBarrier();
+}
+
+void Dict::SmallReserve(size_t capacity) {
+  DCHECK(capacity >= m_small_size && capacity <= kSmallSize);
+  // Values first since they have the stricter alignment
+  Value* value = static_cast<Value*>(
+      ::malloc(capacity * (sizeof(Value) + sizeof(const String*))));
+  const String** key = reinterpret_cast<const String**>(value + capacity);
+  const String* const* small = small_key();
+  for (size_t i = 0; i < m_small_size; ++i) {
+    ::new (value + i) Value(m_small_value[i]);
+    key[i] = small[i];
+  }
+  for (size_t i = m_small_size; i < capacity; ++i) ::new (value + i) Value();
+  ::free(m_small_value);
+  m_small_key = key;
+  m_small_value = value;
+  m_small_capacity = static_cast<uint32_t>(capacity);
+  m_shape = NULL;
+}
+
+void Dict::SmallCompact() {
+  // Shift the keys down to keep the insertion order
+  size_t size = 0;
+  for (size_t i = 0; i < m_small_size; ++i) {
+    if (!m_small_key[i]) continue;
+    m_small_key[size] = m_small_key[i];
+    m_small_value[size] = m_small_value[i];
+    ++size;
+  }
+  for (size_t i = size; i < m_small_size; ++i) m_small_value[i].SetNull();
+  m_small_size = static_cast<uint32_t>(size);
+  m_small_dead = 0;
+}
+
+void Dict::ToHash(size_t reserve) {
+  DCHECK(!m_dict);
+  size_t cap = kSmallSize * 2;
+  while (cap - cap / 8 < reserve) cap <<= 1;
+
+  DictType* dict = new DictType(cap);
+  const String* const* small = small_key();
+  for (size_t i = 0; i < m_small_size; ++i) {
+    if (small[i]) dict->Insert(*small[i], m_small_value[i]);
+  }
+  ::free(m_small_value);
+  m_small_key = NULL;
+  m_small_value = NULL;
+  m_small_size = 0;
+  m_small_dead = 0;
+  m_small_capacity = 0;
+  m_dict = dict;
+  m_shape = NULL;
+  m_stamp = detail::NewObjectStamp();
+}
+
+void Dict::Trace(GCVisitor* visitor) {
+  if (m_dict) {
+    for (DictType::Iterator itr = m_dict->Begin(); itr != m_dict->End();
+         ++itr) {
+      visitor->Visit(itr->first);
+      visitor->Visit(itr->second);
+    }
+  } else {
+    const String* const* small = small_key();
+    for (size_t i = 0; i < m_small_size; ++i) {
+      if (!small[i]) continue;
+      visitor->Visit(small[i]);
+      visitor->Visit(m_small_value[i]);
+    }
+  }
+}
+
 MethodStatus Dict::ToDisplay(Context* context, std::ostream* output) const {
-  StringDict<Value>::ConstIterator itr = m_dict.Begin();
+  ConstIterator itr = Begin();
   (*output) << "map(";
-  for (; itr != m_dict.End(); ++itr) {
-    itr->first->ToDisplay(context, output);
+  for (; itr != End(); ++itr) {
+    itr.key()->ToDisplay(context, output);
     (*output) << ':';
-    itr->second.ToDisplay(context, output);
+    itr.value().ToDisplay(context, output);
     (*output) << ",";
   }
   (*output) << ')';
@@ -1414,6 +1722,16 @@ MethodStatus Function::ToDisplay(Context* context, std::ostream* output) const {
   return MethodStatus::kOk;
 }
 
+MethodStatus LeafFunction::Invoke(Context* context, Value* output) {
+  std::vector<Value> argument;
+  argument.reserve(context->GetArgumentSize());
+  for (size_t i = 0; i < context->GetArgumentSize(); ++i)
+    argument.push_back(context->GetArgument(i));
+  return Call(context,
+              Arguments(vcl::util::VectorAsArray(argument), argument.size()),
+              output);
+}
+
 // ========================================================================
 // Action Implementation
 // ========================================================================
@@ -1492,11 +1810,98 @@ SubRoutine::~SubRoutine() {}
 // ========================================================================
 // GC
 // ========================================================================
+namespace detail {
+__thread GC* kMarkingGC = NULL;
+}  // namespace detail
+
+void GC::StartMark() {
+  DCHECK(!m_marking && m_gray.empty() && m_rescan.empty());
+  ++m_gc_times;
+  m_marking = true;
+  if (m_nursery_size) PaintOld(Object::GC_WHITE);
+  MarkScope scope(this);
+  Mark();
+}
+
+bool GC::MarkStep(size_t budget) {
+  MarkScope scope(this);
+  GCVisitor visitor(this);
+  for (size_t traced = 0;;) {
+    // Refill the prefetch buffer , an object is traced kPrefetchDistance pops
+    // after its header is prefetched
+    while (!m_gray.empty() && m_prefetch_size < kPrefetchDistance) {
+      Object* object = m_gray.back();
+      m_gray.pop_back();
+      VCL_PREFETCH(object);
+      m_prefetch[(m_prefetch_head + m_prefetch_size) &
+                 (kPrefetchDistance - 1)] = object;
+      ++m_prefetch_size;
+    }
+
+    if (!m_prefetch_size) {
+      if (!m_mark_overflow) return true;
+      RescanGray();
+      continue;
+    }
+
+    if (budget && traced == budget) return false;
+
+    Object* object = m_prefetch[m_prefetch_head];
+    m_prefetch_head = (m_prefetch_head + 1) & (kPrefetchDistance - 1);
+    --m_prefetch_size;
+
+    object->Trace(&visitor);
+    object->set_black();
+    // A type without barrier may be changed once it is black
+    if (m_marking && IsSticky(object)) m_rescan.push_back(object);
+    ++traced;
+  }
+}
+
+void GC::RescanGray() {
+  m_mark_overflow = false;
+  Object* chain[] = {m_young_start, m_gc_start};
+  for (size_t i = 0; i < 2; ++i) {
+    for (Object* object = chain[i]; object; object = object->m_next) {
+      if (object->is_gray()) PushGray(object);
+    }
+  }
+}
+
+void GC::FinishCollect() {
+  DCHECK(m_marking);
+  {
+    MarkScope scope(this);
+    GCVisitor visitor(this);
+    Mark();
+    for (size_t i = 0; i < m_rescan.size(); ++i) {
+      m_rescan[i]->Trace(&visitor);
+    }
+    m_rescan.clear();
+    m_marking = false;
+    MarkStep(0);
+  }
+  Collect();
+}
+
+void GC::AbortMark() {
+  m_gray.clear();
+  m_mark_overflow = false;
+  m_prefetch_size = 0;
+  m_rescan.clear();
+  m_marking = false;
+  Paint(m_young_start, Object::GC_WHITE);
+  PaintOld(m_nursery_size ? Object::GC_BLACK : Object::GC_WHITE);
+}
+
 size_t GC::Collect() {
   Object* start = m_gc_start;
   Object** prev = &(m_gc_start);
   size_t collected = 0;
 
+  // The remembered set is rebuilt , nothing is young after a full collection
+  m_remembered.clear();
+
   // Swapping loop
   while (start) {
     Object* next;
@@ -1518,8 +1923,14 @@ size_t GC::Collect() {
       // so keep it alive. The color of this object must be black
       DCHECK(start->is_black());
 
-      // Reset the GC collection status
-      start->set_gc_state(Object::GC_WHITE);
+      if (m_nursery_size) {
+        // Old objects stay black , see the comment of GC
+        start->m_gc_flag &= ~Object::GC_FLAG_REMEMBERED;
+        if (IsSticky(start)) Remember(start);
+      } else {
+        // Reset the GC collection status
+        start->set_gc_state(Object::GC_WHITE);
+      }
 
       // Change the previous pointer to this one
       prev = &(start->m_next);
@@ -1531,65 +1942,195 @@ size_t GC::Collect() {
     start = next;
   }
 
+  collected += CollectYoung();
+
   DCHECK(m_gc_size >= collected);
   Recalculate(collected);
   m_gc_size -= collected;
   return collected;
 }
 
-GC::~GC() {
+size_t GC::CollectYoung() {
+  Object* start = m_young_start;
+  size_t collected = 0;
+
+  // Only the sticky objects are left in the remembered set since all the
+  // young objects are either dead or promoted
+  size_t sticky = 0;
+  for (size_t i = 0; i < m_remembered.size(); ++i) {
+    Object* object = m_remembered[i];
+    if (IsSticky(object)) {
+      m_remembered[sticky++] = object;
+    } else {
+      object->m_gc_flag &= ~Object::GC_FLAG_REMEMBERED;
+    }
+  }
+  m_remembered.resize(sticky);
+
+  while (start) {
+    Object* next = start->m_next;
+    if (start->is_white()) {
+      Delete(start);
+      ++collected;
+    } else {
+      Promote(start);
+    }
+    start = next;
+  }
+
+  m_young_start = NULL;
+  m_young_size = 0;
+  return collected;
+}
+
+void GC::Promote(Object* object) {
+  DCHECK(object->is_black() && !object->is_old());
+  object->m_gc_flag |= Object::GC_FLAG_OLD;
+  object->m_next = m_gc_start;
+  m_gc_start = object;
+  if (IsSticky(object)) Remember(object);
+}
+
+void GC::PaintOld(int state) { Paint(m_gc_start, state); }
+
+void GC::Paint(Object* chain, int state) {
+  for (Object* object = chain; object; object = object->m_next) {
+    object->set_gc_state(state);
+  }
+}
+
+void GC::DeleteAll() {
   size_t count = 0;
-  while (m_gc_start) {
-    Object* next = m_gc_start->m_next;
-    Delete(m_gc_start);
-    m_gc_start = next;
-    ++count;
+  Object* chain[] = {m_young_start, m_gc_start};
+  for (size_t i = 0; i < 2; ++i) {
+    Object* start = chain[i];
+    while (start) {
+      Object* next = start->m_next;
+      Delete(start);
+      start = next;
+      ++count;
+    }
   }
   DCHECK(count == m_gc_size);
+  m_young_start = m_gc_start = NULL;
+  m_young_size = m_gc_size = 0;
+  m_remembered.clear();
+  m_gray.clear();
+  m_rescan.clear();
+  m_prefetch_size = 0;
+  m_marking = false;
+  m_slab.Release();
+}
+
+GC::~GC() { DeleteAll(); }
+
+namespace detail {
+
+SlabAllocator::Page* SlabAllocator::NewPage(size_t size_class) {
+  const size_t slot = (size_class + 1) * kAlignment;
+  Page* page = static_cast<Page*>(m_gc->Malloc(kPageSize));
+  char* start = reinterpret_cast<char*>(page) + HeaderSize();
+  page->free = NULL;
+  page->bump = start;
+  page->used = 0;
+  page->capacity = static_cast<uint32_t>((kPageSize - HeaderSize()) / slot);
+  page->size_class = static_cast<uint32_t>(size_class);
+  DCHECK(page->capacity > 0);
+  LinkPartial(page);
+  ++m_class[size_class].pages;
+  ++m_pages;
+  return page;
+}
+
+void SlabAllocator::ReleasePage(Page* page) {
+  // The last page of a class is kept so a class that allocates and frees
+  // around a page boundary doesn't keep asking for pages
+  SizeClass* c = m_class + page->size_class;
+  if (c->pages == 1) return;
+  UnlinkPartial(page);
+  --c->pages;
+  --m_pages;
+  m_gc->Free(page);
+}
+
+void SlabAllocator::Release() {
+  for (size_t i = 0; i < kClassSize; ++i) {
+    SizeClass* c = m_class + i;
+    while (c->partial) {
+      Page* page = c->partial;
+      DCHECK(page->used == 0);
+      c->partial = page->next;
+      --c->pages;
+      --m_pages;
+      m_gc->Free(page);
+    }
+    DCHECK(c->pages == 0);
+  }
 }
 
+void* SlabAllocator::AllocateLarge(size_t size) {
+  // The prefix keeps the alignment of Malloc , the page pointer is its last
+  // word
+  char* block = static_cast<char*>(m_gc->Malloc(size + kAlignment));
+  char* result = block + kAlignment;
+  *reinterpret_cast<Page**>(result - sizeof(Page*)) = NULL;
+  return result;
+}
+
+void SlabAllocator::FreeLarge(void* ptr) {
+  m_gc->Free(static_cast<char*>(ptr) - kAlignment);
+}
+
+}  // namespace detail
+
 void GC::Dump(std::ostream* output) const {
-  Object* obj = m_gc_start;
+  // Young chain first , then the old chain
+  Object* chain[] = {m_young_start, m_gc_start};
   size_t i = 0;
-  while (obj) {
-    switch (obj->type()) {
-      case TYPE_STRING:
-        *output << i << ". str(" << static_cast<String*>(obj)->data() << ")\n";
-        break;
-      case TYPE_LIST:
-        *output << i << ". " << '[' << static_cast<List*>(obj)->size() << "]\n";
-        break;
-      case TYPE_DICT:
-        *output << i << ". " << '{' << static_cast<Dict*>(obj)->size() << "}\n";
-        break;
-      case TYPE_ACL:
-        *output << i << ". "
-                << "ACL\n";
-        break;
-      case TYPE_FUNCTION:
-        *output << i << ". func(" << static_cast<Function*>(obj)->name()
-                << ")\n";
-        break;
-      case TYPE_EXTENSION:
-        *output << i << ". ext("
-                << static_cast<Extension*>(obj)->extension_name() << ")\n";
-        break;
-      case TYPE_ACTION:
-        *output << i << ". act("
-                << static_cast<Action*>(obj)->action_code_name() << ")\n";
-        break;
-      case TYPE_MODULE:
-        *output << i << ". mod(" << static_cast<Module*>(obj)->name() << ")\n";
-        break;
-      case TYPE_SUB_ROUTINE:
-        *output << i << ". sub(" << static_cast<SubRoutine*>(obj)->name()
-                << ")\n";
-        break;
-      default:
-        VCL_UNREACHABLE();
+  for (size_t c = 0; c < 2; ++c) {
+    for (Object* obj = chain[c]; obj; obj = obj->m_next) {
+      switch (obj->type()) {
+        case TYPE_STRING:
+          *output << i << ". str(" << static_cast<String*>(obj)->data()
+                  << ")\n";
+          break;
+        case TYPE_LIST:
+          *output << i << ". " << '[' << static_cast<List*>(obj)->size()
+                  << "]\n";
+          break;
+        case TYPE_DICT:
+          *output << i << ". " << '{' << static_cast<Dict*>(obj)->size()
+                  << "}\n";
+          break;
+        case TYPE_ACL:
+          *output << i << ". "
+                  << "ACL\n";
+          break;
+        case TYPE_FUNCTION:
+          *output << i << ". func(" << static_cast<Function*>(obj)->name()
+                  << ")\n";
+          break;
+        case TYPE_EXTENSION:
+          *output << i << ". ext("
+                  << static_cast<Extension*>(obj)->extension_name() << ")\n";
+          break;
+        case TYPE_ACTION:
+          *output << i << ". act("
+                  << static_cast<Action*>(obj)->action_code_name() << ")\n";
+          break;
+        case TYPE_MODULE:
+          *output << i << ". mod(" << static_cast<Module*>(obj)->name()
+                  << ")\n";
+          break;
+        case TYPE_SUB_ROUTINE:
+          *output << i << ". sub(" << static_cast<SubRoutine*>(obj)->name()
+                  << ")\n";
+          break;
+        default:
+          VCL_UNREACHABLE();
+      }
+      ++i;
     }
-    ++i;
-    obj = obj->m_next;
   }
 }
 
@@ -1623,7 +2164,12 @@ Context::Context(const ContextOption& opt,
                  const boost::shared_ptr<CompiledCode>& cc)
     : m_runtime(),
       m_compiled_code(cc),
-      m_gc(opt.gc_trigger, opt.gc_ratio, this) {
+      m_gc(opt.gc_trigger,
+           opt.gc_ratio,
+           this,
+           opt.gc_region_size ? opt.gc_region_size : opt.gc_nursery_size,
+           opt.gc_step_budget),
+      m_region(opt.gc_region_size != 0) {
   m_runtime.reset(new vm::Runtime(this, opt.max_calling_stack_size));
 }
 
@@ -1647,14 +2193,14 @@ MethodStatus Context::Invoke(SubRoutine* sub_routine,
   }
   for (size_t i = 0; i < argument.size(); ++i)
     m_runtime->AddArgument(argument[i]);
-  return m_runtime->FinishRun(sub_routine, output);
+  return FinishRun(sub_routine, output);
 }
 
 MethodStatus Context::Invoke(SubRoutine* sub_routine, Value* output) {
   DCHECK(sub_routine->argument_size() == 0);
   MethodStatus result;
   if (!(result = m_runtime->BeginRun(sub_routine))) return result;
-  return m_runtime->FinishRun(sub_routine, output);
+  return FinishRun(sub_routine, output);
 }
 
 MethodStatus Context::Invoke(SubRoutine* sub_routine,
@@ -1664,7 +2210,7 @@ MethodStatus Context::Invoke(SubRoutine* sub_routine,
   MethodStatus result;
   if (!(result = m_runtime->BeginRun(sub_routine))) return result;
   m_runtime->AddArgument(a1);
-  return m_runtime->FinishRun(sub_routine, output);
+  return FinishRun(sub_routine, output);
 }
 
 MethodStatus Context::Invoke(SubRoutine* sub_routine,
@@ -1676,7 +2222,7 @@ MethodStatus Context::Invoke(SubRoutine* sub_routine,
   if (!(result = m_runtime->BeginRun(sub_routine))) return result;
   m_runtime->AddArgument(a1);
   m_runtime->AddArgument(a2);
-  return m_runtime->FinishRun(sub_routine, output);
+  return FinishRun(sub_routine, output);
 }
 
 MethodStatus Context::Invoke(SubRoutine* sub_routine,
@@ -1690,7 +2236,7 @@ MethodStatus Context::Invoke(SubRoutine* sub_routine,
   m_runtime->AddArgument(a1);
   m_runtime->AddArgument(a2);
   m_runtime->AddArgument(a3);
-  return m_runtime->FinishRun(sub_routine, output);
+  return FinishRun(sub_routine, output);
 }
 
 MethodStatus Context::Invoke(SubRoutine* sub_routine,
@@ -1706,7 +2252,7 @@ MethodStatus Context::Invoke(SubRoutine* sub_routine,
   m_runtime->AddArgument(a2);
   m_runtime->AddArgument(a3);
   m_runtime->AddArgument(a4);
-  return m_runtime->FinishRun(sub_routine, output);
+  return FinishRun(sub_routine, output);
 }
 
 MethodStatus Context::Invoke(SubRoutine* sub_routine,
@@ -1724,7 +2270,7 @@ MethodStatus Context::Invoke(SubRoutine* sub_routine,
   m_runtime->AddArgument(a3);
   m_runtime->AddArgument(a4);
   m_runtime->AddArgument(a5);
-  return m_runtime->FinishRun(sub_routine, output);
+  return FinishRun(sub_routine, output);
 }
 
 MethodStatus Context::Invoke(SubRoutine* sub_routine,
@@ -1744,7 +2290,7 @@ MethodStatus Context::Invoke(SubRoutine* sub_routine,
   m_runtime->AddArgument(a4);
   m_runtime->AddArgument(a5);
   m_runtime->AddArgument(a6);
-  return m_runtime->FinishRun(sub_routine, output);
+  return FinishRun(sub_routine, output);
 }
 
 MethodStatus Context::Invoke(SubRoutine* sub_routine,
@@ -1766,7 +2312,7 @@ MethodStatus Context::Invoke(SubRoutine* sub_routine,
   m_runtime->AddArgument(a5);
   m_runtime->AddArgument(a6);
   m_runtime->AddArgument(a7);
-  return m_runtime->FinishRun(sub_routine, output);
+  return FinishRun(sub_routine, output);
 }
 
 MethodStatus Context::Invoke(SubRoutine* sub_routine,
@@ -1790,7 +2336,7 @@ MethodStatus Context::Invoke(SubRoutine* sub_routine,
   m_runtime->AddArgument(a6);
   m_runtime->AddArgument(a7);
   m_runtime->AddArgument(a8);
-  return m_runtime->FinishRun(sub_routine, output);
+  return FinishRun(sub_routine, output);
 }
 
 size_t Context::GetArgumentSize() const { return m_runtime->GetArgumentSize(); }
@@ -1804,18 +2350,49 @@ bool Context::Yield() { return m_runtime->Yield(); }
 bool Context::is_yield() const { return m_runtime->is_yield(); }
 
 MethodStatus Context::Resume(Value* output) {
-  return m_runtime->Resume(output);
+  return CollectRegion(m_runtime->Resume(output), output);
+}
+
+MethodStatus Context::FinishRun(SubRoutine* sub_routine, Value* output) {
+  return CollectRegion(m_runtime->FinishRun(sub_routine, output), output);
+}
+
+MethodStatus Context::CollectRegion(const MethodStatus& status,
+                                    Value* output) {
+  // A yielded run or a nested Invoke from native code leaves frames behind ,
+  // their objects are still in use
+  if (m_region && !m_runtime->is_running()) {
+    // A terminated run returns the Action it just allocated , keep it too
+    Value result;
+    if (status) result = *output;
+    Handle<Value> root(result, &m_gc);
+    m_gc.CollectRegion();
+  }
+  return status;
+}
+
+vm::ExecutionProfile* Context::execution_profile() const {
+  return m_runtime->execution_profile();
+}
+
+void Context::DumpExecutionProfile(std::ostream& output) const {
+  vm::ExecutionProfile* profile = execution_profile();
+  if (profile) profile->Dump(output);
 }
 
 // ==========================================================================
 // CompiledCode
 // ==========================================================================
+const uint32_t CompiledCode::kInvalidGlobalSlot;
+
 CompiledCode::CompiledCode(Engine* engine)
     : m_source_code_list(),
       m_sub_routine_list(),
+      m_global_slot(),
+      m_inline_cache_size(0),
       m_entry(NULL),
       m_engine(engine),
-      m_gc() {
+      m_gc(engine ? engine->gc() : NULL) {
   m_entry = InternalAllocator(&m_gc).NewEntryProcedure();
   m_sub_routine_list.push_back(m_entry);
 }
@@ -1850,7 +2427,11 @@ void CompiledCode::Dump(std::ostream& output) const {
 // ==========================================================================
 // Engine
 // ==========================================================================
-Engine::Engine() : Base(), m_gc() { AddBuiltin(this); }
+Engine::Engine() : Base(), m_option(), m_gc() { AddBuiltin(this); }
+
+Engine::Engine(const EngineOption& option) : Base(), m_option(option), m_gc() {
+  AddBuiltin(this);
+}
 
 boost::shared_ptr<CompiledCode> Engine::LoadFile(const std::string& filename,
                                                  const ScriptOption& option,
@@ -0,0 +1,74 @@
+#include "bytecode-profile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+namespace vcl {
+namespace vm {
+
+namespace {
+
+typedef std::pair<uint64_t, uint32_t> Entry;
+
+void DumpTop(std::ostream& output,
+             const char* title,
+             std::vector<Entry>* entries,
+             size_t length,
+             size_t top) {
+  std::sort(entries->begin(), entries->end(), std::greater<Entry>());
+  output << title << ":\n";
+  for (size_t i = 0; i < entries->size() && i < top; ++i) {
+    const Entry& e = (*entries)[i];
+    output << "  " << e.first << "  ";
+    for (size_t j = 0; j < length; ++j) {
+      Bytecode bc =
+          static_cast<Bytecode>((e.second >> (8 * (length - j - 1))) & 0xff);
+      output << (j ? " " : "") << BytecodeGetName(bc);
+    }
+    output << '\n';
+  }
+}
+
+}  // namespace
+
+BytecodeProfile* BytecodeProfile::Get() {
+  static BytecodeProfile* kProfile = new BytecodeProfile();
+  return kProfile;
+}
+
+void BytecodeProfile::Clear() {
+  memset(m_single, 0, sizeof(m_single));
+  memset(m_pair, 0, sizeof(m_pair));
+  m_triple.clear();
+  Enter();
+}
+
+void BytecodeProfile::Dump(std::ostream& output, size_t top) const {
+  std::vector<Entry> entries;
+
+  for (int i = 0; i < SIZE_OF_BYTECODE; ++i) {
+    if (m_single[i]) entries.push_back(Entry(m_single[i], i));
+  }
+  DumpTop(output, "Instruction", &entries, 1, top);
+
+  entries.clear();
+  for (int i = 0; i < SIZE_OF_BYTECODE; ++i) {
+    for (int j = 0; j < SIZE_OF_BYTECODE; ++j) {
+      if (m_pair[i][j]) entries.push_back(Entry(m_pair[i][j], (i << 8) | j));
+    }
+  }
+  DumpTop(output, "Pair", &entries, 2, top);
+
+  entries.clear();
+  for (std::map<uint32_t, uint64_t>::const_iterator itr = m_triple.begin();
+       itr != m_triple.end();
+       ++itr) {
+    entries.push_back(Entry(itr->second, itr->first));
+  }
+  DumpTop(output, "Triple", &entries, 3, top);
+}
+
+}  // namespace vm
+}  // namespace vcl
@@ -0,0 +1,83 @@
+#ifndef BYTECODE_PROFILE_H_
+#define BYTECODE_PROFILE_H_
+#include <vcl/util.h>
+#include <iostream>
+#include <map>
+
+#include "bytecode.h"
+
+namespace vcl {
+namespace vm {
+
+// Opcode pair and triple profiler for the stack interpreter. It is used to
+// find out which bytecode sequences are worth being fused as superinstruction
+// , see VCL_SUPERINSTRUCTION_LIST.
+//
+// It is only compiled into Runtime::Main when VCL_BYTECODE_PROFILE is
+// defined, otherwise it costs nothing. The profile is process wide and not
+// protected by any lock , so the numbers are only approximated when multiple
+// threads run scripts at the same time , which is fine for its purpose.
+class BytecodeProfile {
+ public:
+  static BytecodeProfile* Get();
+
+  // Mark the start of a new instruction stream , sequences don't cross the
+  // boundary of a Runtime::Main invocation
+  void Enter() {
+    m_prev = SIZE_OF_BYTECODE;
+    m_prev2 = SIZE_OF_BYTECODE;
+  }
+
+  // Record a dispatched instruction
+  void Record(Bytecode bc) {
+    ++m_single[bc];
+    if (m_prev != SIZE_OF_BYTECODE) {
+      ++m_pair[m_prev][bc];
+      if (m_prev2 != SIZE_OF_BYTECODE) ++m_triple[Key(m_prev2, m_prev, bc)];
+    }
+    m_prev2 = m_prev;
+    m_prev = bc;
+  }
+
+  void Clear();
+
+  // Dump the top most frequent instructions , pairs and triples
+  void Dump(std::ostream& output, size_t top = 20) const;
+
+ public:
+  uint64_t single(Bytecode bc) const { return m_single[bc]; }
+
+  uint64_t pair(Bytecode first, Bytecode second) const {
+    return m_pair[first][second];
+  }
+
+  uint64_t triple(Bytecode first, Bytecode second, Bytecode third) const {
+    std::map<uint32_t, uint64_t>::const_iterator itr =
+        m_triple.find(Key(first, second, third));
+    return itr == m_triple.end() ? 0 : itr->second;
+  }
+
+ private:
+  BytecodeProfile() { Clear(); }
+
+  static uint32_t Key(Bytecode first, Bytecode second, Bytecode third) {
+    return (static_cast<uint32_t>(first) << 16) |
+           (static_cast<uint32_t>(second) << 8) | static_cast<uint32_t>(third);
+  }
+
+  uint64_t m_single[SIZE_OF_BYTECODE];
+  uint64_t m_pair[SIZE_OF_BYTECODE][SIZE_OF_BYTECODE];
+
+  // Triple is sparse
+  std::map<uint32_t, uint64_t> m_triple;
+
+  Bytecode m_prev;
+  Bytecode m_prev2;
+
+  VCL_DISALLOW_COPY_AND_ASSIGN(BytecodeProfile);
+};
+
+}  // namespace vm
+}  // namespace vcl
+
+#endif  // BYTECODE_PROFILE_H_
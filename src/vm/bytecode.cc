@@ -29,6 +29,30 @@ bool BytecodeHasOperand(Bytecode bc) {
   return kOperandTable[static_cast<uint8_t>(bc)];
 }
 
+Bytecode BytecodeUnfuse(Bytecode bc) {
+  switch (bc) {
+#define __(A, B, C, D, E) \
+  case A:                 \
+    return C;
+    VCL_SUPERINSTRUCTION_LIST(__)
+    default:
+      return bc;
+#undef __  // __
+  }
+}
+
+size_t BytecodeFusedLength(Bytecode bc) {
+  switch (bc) {
+#define __(A, B, C, D, E) \
+  case A:                 \
+    return B;
+    VCL_SUPERINSTRUCTION_LIST(__)
+    default:
+      return 1;
+#undef __  // __
+  }
+}
+
 IntrinsicFunctionIndex GetIntrinsicFunctionIndex(const char* data) {
 #define __(A, B, C, D) \
   if (strcmp(B, data) == 0) return INTRINSIC_FUNCTION_##A;
@@ -86,6 +86,7 @@ namespace vm {
   __(BC_LSIZE, 1, lsize)                           \
   __(BC_LDURATION, 1, lduration)                   \
   __(BC_LDICT, 1, ldict)                           \
+  __(BC_LSDICT, 1, lsdict)                         \
   __(BC_LLIST, 1, llist)                           \
   __(BC_LEXT, 1, lext)                             \
   __(BC_LACL, 1, lacl)                             \
@@ -148,6 +149,7 @@ namespace vm {
   __(BC_IMPORT, 1, import)                         \
   /* Call/Return */                                \
   __(BC_CALL, 1, call)                             \
+  __(BC_TAILCALL, 1, tailcall)                     \
   __(BC_TERM, 1, term)                             \
   __(BC_RET, 0, ret)                               \
   /* Sub */                                        \
@@ -160,7 +162,36 @@ namespace vm {
   __(BC_CBOOL, 0, cbool)                           \
   __(BC_TYPE, 0, type)                             \
   /* For string interpolation */                   \
-  __(BC_SCAT, 1, scat)
+  __(BC_SCAT, 1, scat)                             \
+  /* For + chain of string */                      \
+  __(BC_CONCAT, 1, concat)                         \
+  /* Superinstructions , see below */              \
+  __(BC_SLOAD_PGET, 1, sload_pget)                 \
+  __(BC_SLOAD_EQVI, 1, sload_eqvi)                 \
+  __(BC_GLOAD_PGET, 1, gload_pget)                 \
+  __(BC_GLOAD_PGET_CALL, 1, gload_pget_call)       \
+  __(BC_LSTR_MATCH_JF, 1, lstr_match_jf)           \
+  /* Quickened bytecode , see below */             \
+  __(BC_ADD_INT, 0, add_int)                       \
+  __(BC_ADD_REAL, 0, add_real)                     \
+  __(BC_SUB_INT, 0, sub_int)                       \
+  __(BC_SUB_REAL, 0, sub_real)                     \
+  __(BC_MUL_INT, 0, mul_int)                       \
+  __(BC_MUL_REAL, 0, mul_real)                     \
+  __(BC_LT_INT, 0, lt_int)                         \
+  __(BC_LT_REAL, 0, lt_real)                       \
+  __(BC_LE_INT, 0, le_int)                         \
+  __(BC_LE_REAL, 0, le_real)                       \
+  __(BC_GT_INT, 0, gt_int)                         \
+  __(BC_GT_REAL, 0, gt_real)                       \
+  __(BC_GE_INT, 0, ge_int)                         \
+  __(BC_GE_REAL, 0, ge_real)                       \
+  __(BC_EQ_INT, 0, eq_int)                         \
+  __(BC_EQ_REAL, 0, eq_real)                       \
+  __(BC_EQ_STR, 0, eq_str)                         \
+  __(BC_NE_INT, 0, ne_int)                         \
+  __(BC_NE_REAL, 0, ne_real)                       \
+  __(BC_NE_STR, 0, ne_str)
 
 enum Bytecode {
 #define __(A, B, C) A,
@@ -168,6 +199,32 @@ enum Bytecode {
 #undef __  // __
 };
 
+// Superinstructions. A superinstruction replaces the *first* bytecode of a
+// common sequence and carries that bytecode's operand , the rest of the
+// sequence stays in the BytecodeBuffer untouched and works as the operand
+// holder for the superinstruction. So any pass that doesn't care about them
+// can simply treat a superinstruction as its first component , see
+// BytecodeUnfuse. The interpreter executes the whole sequence with one
+// dispatch.
+//
+// The list is picked from the bytecode pair/triple profile , see
+// BytecodeProfile , and the fusion is done by the peephole pass in compiler.
+//
+// __(SUPERINSTRUCTION, LENGTH, FIRST, SECOND, THIRD)
+
+#define VCL_SUPERINSTRUCTION_LIST(__)                                       \
+  __(BC_SLOAD_PGET, 2, BC_SLOAD, BC_PGET, SIZE_OF_BYTECODE)                 \
+  __(BC_SLOAD_EQVI, 2, BC_SLOAD, BC_EQVI, SIZE_OF_BYTECODE)                 \
+  __(BC_GLOAD_PGET, 2, BC_GLOAD, BC_PGET, SIZE_OF_BYTECODE)                 \
+  __(BC_GLOAD_PGET_CALL, 3, BC_GLOAD, BC_PGET, BC_CALL)                     \
+  __(BC_LSTR_MATCH_JF, 3, BC_LSTR, BC_MATCH, BC_JF)
+
+// Quickened bytecode. They are never generated by the compiler , a generic
+// arithmetic or comparison instruction rewrites its own handler inside of the
+// ThreadedCode to the typed version once it sees both operands have the same
+// type , see ThreadedCode::Quicken. The typed version checks the operand types
+// as guard and falls back to the generic one when the guard fails.
+
 // Intrinsic function index
 
 #define INTRINSIC_FUNCTION_LIST(__)             \
@@ -189,6 +246,13 @@ IntrinsicFunctionIndex GetIntrinsicFunctionIndex(const char*);
 const char* BytecodeGetName(Bytecode);
 bool BytecodeHasOperand(Bytecode);
 
+// Returns the first component of a superinstruction , or the input bytecode
+// if it is not a superinstruction
+Bytecode BytecodeUnfuse(Bytecode);
+
+// Returns how many bytecode a superinstruction covers , 1 for others
+size_t BytecodeFusedLength(Bytecode);
+
 static const uint32_t kMaxArg = (~0xff000000 - 1);
 
 // A buffer object to hold the bytecode and also provides method to encode
@@ -317,6 +381,16 @@ class BytecodeBuffer {
     return Label(Put(loc, BC_FOREND) + 1, this);
   }
 
+ public:  // Peephole
+  // Replace the bytecode at position with a superinstruction whose first
+  // component is the original bytecode , operand is kept as is
+  void Fuse(size_t position, Bytecode superinstruction) {
+    DCHECK(position < m_size);
+    DCHECK(BytecodeUnfuse(superinstruction) ==
+           static_cast<Bytecode>(m_buffer[position]));
+    m_buffer[position] = static_cast<uint8_t>(superinstruction);
+  }
+
  public:  // Accessors
   size_t size() const { return m_size; }
 
@@ -3,9 +3,14 @@
 #include "compilation-unit.h"
 #include "ip-address.h"
 #include "procedure.h"
+#include "register-code.h"
+#include "runtime.h"
+#include "threaded-code.h"
 #include "vcl-pri.h"
 #include "zone.h"
 
+#include <map>
+
 // A macro to explicit mark where we emit the bytecode
 #define __ m_procedure->code_buffer().
 
@@ -68,6 +73,10 @@ class Compiler {
   bool Compile(const ast::ExtensionLiteral&);
   bool Compile(const ast::List&);
   bool Compile(const ast::Dict&);
+
+  // Compute the DictShape of a dict literal , output is NULL when the literal
+  // cannot have a shape
+  bool CompileShape(const ast::Dict&, vcl::DictShape** output);
   bool Compile(const ast::Size&);
   bool Compile(const ast::Duration&);
   bool Compile(const ast::String&);
@@ -90,6 +99,15 @@ class Compiler {
   bool Compile(const ast::Unary&);
   bool Compile(const ast::Binary&);
   bool CompileLogic(const ast::Binary&);
+
+  // A chain of + whose leftmost operand is a string , "a" + b + c , is a
+  // string concatenation since String::Add always returns a string. All the
+  // operands are concatenated by one BC_CONCAT instead of creating an
+  // intermediate String for each +
+  bool CompileConcat(const ast::Binary&);
+
+  // Whether the expression always evaluates to a string
+  static bool IsStringExpression(const ast::AST&);
   bool Compile(const ast::Ternary&);
   bool CompileLHSPrefix(const ast::Prefix&);
   bool Compile(const ast::Prefix&);
@@ -127,7 +145,12 @@ class Compiler {
     return CompileVariable(var.location, var.value);
   }
 
-  bool CompileFuncCall(const ast::FuncCall&);
+  // A call in tail position is emitted as BC_TAILCALL , the BC_RET after it
+  // is still generated and only executed when the callee is not a sub
+  bool CompileFuncCall(const ast::FuncCall&, bool tail = false);
+
+  // Whether the return value is a sub call , return { foo(a) };
+  static bool IsTailCall(const ast::AST&);
 
   template <typename T>
   int CompileString(const vcl::util::CodeLocation& loc, const T& value) {
@@ -139,6 +162,17 @@ class Compiler {
     return index;
   }
 
+  // Resolve a global variable to its slot inside of the CompiledCode
+  int CompileGlobal(const vcl::util::CodeLocation& loc,
+                    zone::ZoneString* name) {
+    uint32_t slot = CompiledCodeBuilder(m_cc).AddGlobalSlot(name);
+    if (!BytecodeBuffer::CheckOperand(slot)) {
+      ReportError(loc, "too many global variables!");
+      return -1;
+    }
+    return static_cast<int>(slot);
+  }
+
   template <typename T>
   int CompileLiteral(const vcl::util::CodeLocation& loc, const T& value) {
     int index = m_procedure->Add(value);
@@ -421,6 +455,26 @@ bool Compiler::Compile(const ast::List& list) {
 }
 
 bool Compiler::Compile(const ast::Dict& dict) {
+  // A literal whose keys are distinct constant strings gets a DictShape ,
+  // only its values are pushed and BC_LSDICT creates the Dict in shaped form
+  vcl::DictShape* shape = NULL;
+  if (!CompileShape(dict, &shape)) return false;
+  if (shape) {
+    for (size_t i = 0; i < dict.list.size(); ++i) {
+      if (!Compile(*dict.list[i].value)) {
+        delete shape;
+        return false;
+      }
+    }
+    int index = m_procedure->AddShape(shape);
+    if (!BytecodeBuffer::CheckOperand(index)) {
+      ReportError(dict.location, "too many dictionary literals!");
+      return false;
+    }
+    __ lsdict(dict.location, index);
+    return true;
+  }
+
   // Generate dict's literal
   for (size_t i = 0; i < dict.list.size(); ++i) {
     const ast::Dict::Entry& e = dict.list[i];
@@ -431,6 +485,34 @@ bool Compiler::Compile(const ast::Dict& dict) {
   return true;
 }
 
+bool Compiler::CompileShape(const ast::Dict& dict, vcl::DictShape** output) {
+  *output = NULL;
+  // A shaped Dict lives in the small form , larger literals are generic
+  if (dict.list.empty() || dict.list.size() > vcl::Dict::kSmallSize) {
+    return true;
+  }
+  for (size_t i = 0; i < dict.list.size(); ++i) {
+    if (dict.list[i].key->type != ast::AST_STRING) return true;
+  }
+
+  vcl::DictShape* shape = new vcl::DictShape();
+  for (size_t i = 0; i < dict.list.size(); ++i) {
+    const ast::String& key =
+        static_cast<const ast::String&>(*dict.list[i].key);
+    int index = CompileString(key.location, key.value);
+    if (index < 0) {
+      delete shape;
+      return false;
+    }
+    if (!shape->Add(*m_procedure->IndexString(index))) {
+      delete shape;  // Duplicated key , the last one wins in generic form
+      return true;
+    }
+  }
+  *output = shape;
+  return true;
+}
+
 bool Compiler::Compile(const ast::ExtensionInitializer& initializer) {
   for (size_t i = 0; i < initializer.list.size(); ++i) {
     const ast::ExtensionInitializer::ExtensionField& field =
@@ -477,8 +559,8 @@ bool Compiler::Compile(const ast::StringInterpolation& node) {
       if (index < 0) return false;
       __ lstr(e->location, index);
     } else {
+      // Converted to string by BC_SCAT directly
       if (!Compile(*e)) return false;
-      __ cstr(e->location);
     }
   }
   __ scat(node.location, static_cast<uint32_t>(node.list.size()));
@@ -506,9 +588,44 @@ bool Compiler::Compile(const ast::Unary& unary) {
   return true;
 }
 
+bool Compiler::IsStringExpression(const ast::AST& node) {
+  switch (node.type) {
+    case ast::AST_STRING:
+    case ast::AST_STRING_CONCAT:
+    case ast::AST_STRING_INTERPOLATION:
+      return true;
+    case ast::AST_BINARY: {
+      const ast::Binary& binary = static_cast<const ast::Binary&>(node);
+      return binary.op == TK_ADD && IsStringExpression(*binary.lhs);
+    }
+    default:
+      return false;
+  }
+}
+
+bool Compiler::CompileConcat(const ast::Binary& binary) {
+  // Operands from the right most one
+  std::vector<const ast::AST*> operand;
+  const ast::AST* node = &binary;
+  while (node->type == ast::AST_BINARY &&
+         static_cast<const ast::Binary*>(node)->op == TK_ADD) {
+    operand.push_back(static_cast<const ast::Binary*>(node)->rhs);
+    node = static_cast<const ast::Binary*>(node)->lhs;
+  }
+  operand.push_back(node);
+
+  for (size_t i = operand.size(); i > 0; --i) {
+    if (!Compile(*operand[i - 1])) return false;
+  }
+  __ concat(binary.location, static_cast<uint32_t>(operand.size()));
+  return true;
+}
+
 bool Compiler::Compile(const ast::Binary& binary) {
   if (TokenIsLogicOperator(binary.op)) {
     return CompileLogic(binary);
+  } else if (binary.op == TK_ADD && IsStringExpression(binary)) {
+    return CompileConcat(binary);
   } else {
     // Check whether at least one of the operand is a constant integer value
     // which has specialized instruction to fasten the operations later on
@@ -680,7 +797,7 @@ bool Compiler::Compile(const ast::Ternary& ternary) {
   if (!Compile(*ternary.condition)) return false;
 
   // 1. Jump if condition is false
-  BytecodeBuffer::Label forward_label = __ brf(ternary.location);
+  BytecodeBuffer::Label forward_label = __ jf(ternary.location);
 
   // 2. Fall througth to condition is true
   if (!Compile(*ternary.first)) return false;
@@ -807,7 +924,7 @@ bool Compiler::Compile(const ast::Unset& unset) {
     int id = m_lex_scope->Lookup(lhs.variable);
     if (id < 0) {
       // Global varialbes
-      id = CompileString(unset.location, lhs.variable);
+      id = CompileGlobal(unset.location, lhs.variable);
       if (id < 0) return false;
       __ gunset(unset.location, id);
     } else {
@@ -855,7 +972,7 @@ bool Compiler::Compile(const ast::Set& set) {
       }
     } else {
       // Global variables
-      id = CompileString(set.location, lhs.variable);
+      id = CompileGlobal(set.location, lhs.variable);
       if (id < 0) return false;
 
       // Compile the right hand side value
@@ -924,7 +1041,7 @@ bool Compiler::CompileVariable(const vcl::util::CodeLocation& loc,
   int index = -1;
   if (m_lex_scope) index = m_lex_scope->Lookup(var);
   if (index < 0) {
-    int id = CompileString(loc, var);
+    int id = CompileGlobal(loc, var);
     if (id < 0) return false;
     __ gload(loc, id);
   } else {
@@ -933,7 +1050,7 @@ bool Compiler::CompileVariable(const vcl::util::CodeLocation& loc,
   return true;
 }
 
-bool Compiler::CompileFuncCall(const ast::FuncCall& fc) {
+bool Compiler::CompileFuncCall(const ast::FuncCall& fc, bool tail) {
   IntrinsicFunctionIndex intrinsic = INTRINSIC_FUNCTION_UNKNOWN;
   if (fc.name) {
     intrinsic = GetIntrinsicFunctionIndex(fc.name->data());
@@ -956,7 +1073,10 @@ bool Compiler::CompileFuncCall(const ast::FuncCall& fc) {
   switch (intrinsic) {
     INTRINSIC_FUNCTION_LIST(XX)
     default:
-      __ call(fc.location, static_cast<uint32_t>(fc.argument.size()));
+      if (tail)
+        __ tailcall(fc.location, static_cast<uint32_t>(fc.argument.size()));
+      else
+        __ call(fc.location, static_cast<uint32_t>(fc.argument.size()));
   }
 
 #undef XX  // XX
@@ -970,9 +1090,21 @@ bool Compiler::CompileFuncCall(const ast::FuncCall& fc) {
   return true;
 }
 
+bool Compiler::IsTailCall(const ast::AST& node) {
+  if (node.type != ast::AST_PREFIX) return false;
+  const ast::Prefix& pref = static_cast<const ast::Prefix&>(node);
+  const ast::Prefix::Component& last = pref.list.Last();
+  return last.tag == ast::Prefix::Component::CALL && !last.funccall->name;
+}
+
 bool Compiler::Compile(const ast::Return& ret) {
   if (!ret.value) {
     __ lnull(ret.location);
+  } else if (IsTailCall(*ret.value)) {
+    const ast::Prefix& pref = static_cast<const ast::Prefix&>(*ret.value);
+    if (!CompilePrefixList(pref.location, pref.list, pref.list.size() - 1))
+      return false;
+    if (!CompileFuncCall(*pref.list.Last().funccall, true)) return false;
   } else {
     if (!Compile(*ret.value)) return false;
   }
@@ -1180,7 +1312,7 @@ bool Compiler::Compile(const ast::Import& import) {
 
 bool Compiler::Compile(const ast::Global& global) {
   if (!Compile(*global.value)) return false;
-  int id = CompileString(global.location, global.name);
+  int id = CompileGlobal(global.location, global.name);
   if (id < 0) return false;
   __ gset(global.location, id);
   return true;
@@ -1193,7 +1325,7 @@ bool Compiler::Compile(const ast::Extension& ext) {
   if (!Compile(*ext.initializer)) return false;
 
   {
-    int name_id = CompileString(ext.location, ext.instance_name);
+    int name_id = CompileGlobal(ext.location, ext.instance_name);
     if (name_id < 0) return false;
     __ gset(ext.location, name_id);
   }
@@ -1291,7 +1423,7 @@ bool Compiler::Compile(const ast::ACL& acl) {
   if (pattern) {
     int acl_index = m_procedure->Add(m_cc->gc(), pattern);
     __ lacl(acl.location, acl_index);
-    int var_index = CompileString(acl.location, acl.name);
+    int var_index = CompileGlobal(acl.location, acl.name);
     if (var_index < 0) return false;
     __ gset(acl.location, var_index);
     return true;
@@ -1422,6 +1554,982 @@ bool Compiler::DoCompile() {
   }
 }
 
+// Peephole pass to fuse common bytecode sequences into superinstructions ,
+// see VCL_SUPERINSTRUCTION_LIST. Only the first bytecode of a sequence gets
+// rewritten so no jump needs to be patched. A jump landing in the middle of
+// a fused sequence is fine as well , since the rest of the sequence is still
+// there and can be executed as normal bytecode.
+class Peephole {
+ public:
+  explicit Peephole(Procedure* procedure) : m_procedure(procedure) {}
+
+  void DoFuse();
+
+ private:
+  // Try to fuse the sequence starting at index , returns how many bytecode
+  // are consumed
+  size_t Fuse(size_t index);
+
+  Procedure* m_procedure;
+  std::vector<Bytecode> m_code;
+  std::vector<size_t> m_position;
+
+  VCL_DISALLOW_COPY_AND_ASSIGN(Peephole);
+};
+
+void Peephole::DoFuse() {
+  const BytecodeBuffer& bb = m_procedure->code_buffer();
+  for (BytecodeBuffer::Iterator itr = bb.Begin(); itr != bb.End(); ++itr) {
+    Bytecode bc = *itr;
+    if (BytecodeHasOperand(bc)) itr.arg();
+    // A tail call is just a call for the sequence , the superinstruction
+    // handler dispatches to whichever its last component is
+    m_code.push_back(bc == BC_TAILCALL ? BC_CALL : bc);
+    m_position.push_back(itr.index());
+  }
+
+  for (size_t i = 0; i < m_code.size();) i += Fuse(i);
+}
+
+size_t Peephole::Fuse(size_t index) {
+  size_t left = m_code.size() - index;
+
+  // The list is short , just try each of them and prefer the longer one
+  Bytecode fused = SIZE_OF_BYTECODE;
+  size_t length = 1;
+
+#define XX(A, B, C, D, E)                                                \
+  if (B > length && B <= left && m_code[index] == C &&                   \
+      m_code[index + 1] == D && (B == 2 || m_code[index + 2] == E)) {    \
+    fused = A;                                                           \
+    length = B;                                                          \
+  }
+
+  VCL_SUPERINSTRUCTION_LIST(XX)
+
+#undef XX  // XX
+
+  if (fused != SIZE_OF_BYTECODE)
+    m_procedure->code_buffer().Fuse(m_position[index], fused);
+  return length;
+}
+
+
+// Compute the maximum depth of the value stack a Procedure needs , counted
+// from the frame base so the arguments are included. The Runtime reserves it
+// once the frame is entered , then the interpreter pushes and pops without any
+// capacity check. Superinstructions are analyzed component by component since
+// the rest of a fused sequence is still in the code.
+class StackDepth {
+ public:
+  explicit StackDepth(const Procedure* procedure) : m_procedure(procedure) {}
+
+  size_t Compute();
+
+ private:
+  // How many values an instruction pops and pushes when it falls through
+  void GetEffect(Bytecode bc, uint32_t arg, size_t* pop, size_t* push) const;
+
+  const Procedure* m_procedure;
+
+  VCL_DISALLOW_COPY_AND_ASSIGN(StackDepth);
+};
+
+void StackDepth::GetEffect(Bytecode bc,
+                           uint32_t arg,
+                           size_t* pop,
+                           size_t* push) const {
+  *pop = 0;
+  *push = 0;
+  switch (bc) {
+    case BC_ADD:
+    case BC_SUB:
+    case BC_MUL:
+    case BC_DIV:
+    case BC_MOD:
+    case BC_LT:
+    case BC_LE:
+    case BC_GT:
+    case BC_GE:
+    case BC_EQ:
+    case BC_NE:
+    case BC_MATCH:
+    case BC_NOT_MATCH:
+    case BC_IGET:
+      *pop = 2;
+      *push = 1;
+      break;
+    case BC_LINT:
+    case BC_LREAL:
+    case BC_LTRUE:
+    case BC_LFALSE:
+    case BC_LNULL:
+    case BC_LSTR:
+    case BC_LSIZE:
+    case BC_LDURATION:
+    case BC_LACL:
+    case BC_SLOAD:
+    case BC_GLOAD:
+    case BC_ITERK:
+    case BC_ITERV:
+    case BC_LSUB:
+      *push = 1;
+      break;
+    case BC_SADD:
+    case BC_SSUB:
+    case BC_SMUL:
+    case BC_SDIV:
+    case BC_SMOD:
+    case BC_SSTORE:
+    case BC_JT:
+    case BC_JF:
+    case BC_BRT:
+    case BC_BRF:
+    case BC_GSET:
+    case BC_GSADD:
+    case BC_GSSUB:
+    case BC_GSMUL:
+    case BC_GSDIV:
+    case BC_GSMOD:
+    case BC_PUNSET:
+    case BC_AUNSET:
+      *pop = 1;
+      break;
+    case BC_PSET:
+    case BC_PSADD:
+    case BC_PSSUB:
+    case BC_PSMUL:
+    case BC_PSDIV:
+    case BC_PSMOD:
+    case BC_ASET:
+    case BC_ASADD:
+    case BC_ASSUB:
+    case BC_ASMUL:
+    case BC_ASDIV:
+    case BC_ASMOD:
+    case BC_IUNSET:
+      *pop = 2;
+      break;
+    case BC_ISET:
+    case BC_ISADD:
+    case BC_ISSUB:
+    case BC_ISMUL:
+    case BC_ISDIV:
+    case BC_ISMOD:
+      *pop = 3;
+      break;
+    case BC_LDICT:
+      *pop = 2 * arg;
+      *push = 1;
+      break;
+    case BC_LSDICT:
+      *pop = m_procedure->IndexShape(arg)->size();
+      *push = 1;
+      break;
+    case BC_LLIST:
+    case BC_SCAT:
+    case BC_CONCAT:
+      *pop = arg;
+      *push = 1;
+      break;
+    case BC_LEXT:
+      *pop = 2 * arg + 1;
+      *push = 1;
+      break;
+    case BC_CALL:
+    case BC_TAILCALL:
+      *pop = arg + 1;
+      *push = 1;
+      break;
+    case BC_SPOP:
+      *pop = arg;
+      break;
+    case BC_UNSET:
+    case BC_JMP:
+    case BC_GUNSET:
+    case BC_FOREND:
+    case BC_BRK:
+    case BC_CONT:
+    case BC_DEBUG:
+    case BC_IMPORT:
+    case BC_GSUB:
+    case BC_TERM:
+    case BC_RET:
+      break;
+    default:
+      // Typed arithmetic and comparison , unary , conversion , property and
+      // attribute get , they just replace the top of the stack
+      *pop = 1;
+      *push = 1;
+      break;
+  }
+}
+
+size_t StackDepth::Compute() {
+  const BytecodeBuffer& bb = m_procedure->code_buffer();
+  std::vector<Bytecode> code;
+  std::vector<uint32_t> operand;
+  std::map<size_t, size_t> position;
+
+  for (BytecodeBuffer::Iterator itr = bb.Begin(); itr != bb.End(); ++itr) {
+    Bytecode bc = BytecodeUnfuse(*itr);
+    position[itr.index()] = code.size();
+    code.push_back(bc);
+    operand.push_back(BytecodeHasOperand(bc) ? itr.arg() : 0);
+  }
+  position[bb.size()] = code.size();
+
+  // Depth before each instruction , -1 means not visited yet. The bytecode
+  // is well structured so every path reaches an instruction with the same
+  // depth , we still take the maximum to be safe.
+  std::vector<int64_t> depth(code.size(), -1);
+  std::vector<std::pair<size_t, size_t> > worklist;
+  size_t max_depth = m_procedure->argument_size();
+
+  worklist.push_back(std::make_pair(0, m_procedure->argument_size()));
+  while (!worklist.empty()) {
+    size_t index = worklist.back().first;
+    size_t current = worklist.back().second;
+    worklist.pop_back();
+
+    while (index < code.size() &&
+           depth[index] < static_cast<int64_t>(current)) {
+      depth[index] = static_cast<int64_t>(current);
+
+      Bytecode bc = code[index];
+      size_t pop, push;
+      GetEffect(bc, operand[index], &pop, &push);
+      size_t next = (pop > current ? 0 : current - pop) + push;
+      if (next > max_depth) max_depth = next;
+
+      switch (bc) {
+        case BC_JMP:
+        case BC_JT:
+        case BC_JF:
+        case BC_BRT:
+        case BC_BRF:
+        case BC_FORPREP:
+        case BC_FOREND:
+        case BC_BRK:
+        case BC_CONT: {
+          std::map<size_t, size_t>::const_iterator target =
+              position.find(operand[index]);
+          DCHECK(target != position.end());
+          // BRT/BRF keep the condition on the stack when jump and FORPREP
+          // jumps with the value that is not replaced by the iterator
+          worklist.push_back(std::make_pair(
+              target->second,
+              bc == BC_BRT || bc == BC_BRF ? current : next));
+          break;
+        }
+        default:
+          break;
+      }
+
+      if (bc == BC_JMP || bc == BC_BRK || bc == BC_CONT || bc == BC_RET ||
+          bc == BC_TERM)
+        break;
+
+      ++index;
+      current = next;
+    }
+  }
+  return max_depth;
+}
+
+// Lower the stack bytecode of a Procedure into register code. The stack
+// bytecode is generated in a well structured way, so each stack slot has a
+// static depth at each instruction and the depth simply becomes the register
+// number. We walk the bytecode linearly and keep a *virtual stack*, loads of
+// locals and literals are not emitted but recorded on the virtual stack, and
+// then the instruction that consumes them names the local/constant directly
+// as its operand. Whenever we hit a basic block boundary, the virtual stack
+// is flushed so every slot sits in its home register.
+class RegisterCodeGenerator {
+ public:
+  RegisterCodeGenerator(const Procedure* procedure, RegisterCode* output)
+      : m_procedure(procedure),
+        m_code(output),
+        m_stack(),
+        m_max_depth(0),
+        m_label(),
+        m_fixup(),
+        m_constant(),
+        m_last_def(kNoDef),
+        m_cur_pc(0) {}
+
+  bool DoGenerate();
+
+ private:
+  static const size_t kNoDef = static_cast<size_t>(-1);
+
+  // A virtual stack slot , either it is already in its home register or it
+  // is a delayed load of another register or a constant
+  struct Operand {
+    enum { HOME, REGISTER, CONSTANT };
+    int type;
+    uint32_t index;
+
+    Operand(int t = HOME, uint32_t i = 0) : type(t), index(i) {}
+  };
+
+  size_t depth() const { return m_stack.size(); }
+
+  void Push(const Operand& operand) {
+    m_stack.push_back(operand);
+    if (m_stack.size() > m_max_depth) m_max_depth = m_stack.size();
+  }
+
+  bool Pop(size_t count) {
+    if (count > m_stack.size()) return false;
+    m_stack.resize(m_stack.size() - count);
+    return true;
+  }
+
+  uint32_t RK(size_t slot) const {
+    const Operand& operand = m_stack[slot];
+    switch (operand.type) {
+      case Operand::HOME:
+        return static_cast<uint32_t>(slot);
+      case Operand::REGISTER:
+        return operand.index;
+      default:
+        return RKConstant(operand.index);
+    }
+  }
+
+  uint32_t TopRK(size_t index) const { return RK(depth() - index - 1); }
+
+  size_t Emit(RegisterBytecode op, uint32_t a = 0, uint32_t b = 0,
+              uint32_t c = 0) {
+    m_last_def = kNoDef;
+    return m_code->Emit(m_cur_pc, op, a, b, c);
+  }
+
+  // Emit an instruction that only writes R(A) and which can have its
+  // destination register rewritten by a following local store
+  void EmitDef(RegisterBytecode op, uint32_t a, uint32_t b = 0,
+               uint32_t c = 0) {
+    m_last_def = m_code->Emit(m_cur_pc, op, a, b, c);
+  }
+
+  void EmitJump(RegisterBytecode op, uint32_t a, uint32_t target) {
+    m_fixup.push_back(std::make_pair(Emit(op, a), target));
+  }
+
+  void Materialize(size_t slot) {
+    Operand& operand = m_stack[slot];
+    if (operand.type != Operand::HOME) {
+      Emit(RBC_MOVE, static_cast<uint32_t>(slot), RK(slot));
+      operand = Operand();
+    }
+  }
+
+  void Materialize(size_t start, size_t end) {
+    for (; start < end; ++start) Materialize(start);
+  }
+
+  void Flush() { Materialize(0, depth()); }
+
+  // Before a register gets overwritten, all the delayed loads that reference
+  // it must be done
+  void PrepareWrite(uint32_t reg) {
+    for (size_t i = 0; i < m_stack.size(); ++i) {
+      if (m_stack[i].type == Operand::REGISTER && m_stack[i].index == reg)
+        Materialize(i);
+    }
+  }
+
+  bool AddTarget(uint32_t target, size_t target_depth) {
+    std::map<size_t, int>::iterator itr = m_label.find(target);
+    DCHECK(itr != m_label.end());
+    if (itr->second < 0) {
+      itr->second = static_cast<int>(target_depth);
+      return true;
+    }
+    return itr->second == static_cast<int>(target_depth);
+  }
+
+  Operand Constant(Bytecode bc, uint32_t index);
+
+  bool CollectLabel();
+  bool Lower(Bytecode, uint32_t arg, bool* reachable);
+
+  const Procedure* m_procedure;
+  RegisterCode* m_code;
+
+  // Virtual stack
+  std::vector<Operand> m_stack;
+  size_t m_max_depth;
+
+  // Jump target in stack bytecode and its stack depth , -1 means not known
+  std::map<size_t, int> m_label;
+
+  // Stack bytecode jump target to register code position
+  std::map<size_t, size_t> m_label_position;
+
+  // Pending jump instructions that need to be patched
+  std::vector<std::pair<size_t, uint32_t> > m_fixup;
+
+  // Literal (bytecode,index) to constant table index
+  std::map<std::pair<int, uint32_t>, uint32_t> m_constant;
+
+  // Last emitted instruction that can be retargeted
+  size_t m_last_def;
+
+  // Current stack bytecode position
+  size_t m_cur_pc;
+
+  VCL_DISALLOW_COPY_AND_ASSIGN(RegisterCodeGenerator);
+};
+
+RegisterCodeGenerator::Operand RegisterCodeGenerator::Constant(Bytecode bc,
+                                                               uint32_t index) {
+  std::pair<int, uint32_t> key(bc, index);
+  std::map<std::pair<int, uint32_t>, uint32_t>::iterator itr =
+      m_constant.find(key);
+  if (itr != m_constant.end()) return Operand(Operand::CONSTANT, itr->second);
+
+  Value value;
+  switch (bc) {
+    case BC_LTRUE:
+      value.SetTrue();
+      break;
+    case BC_LFALSE:
+      value.SetFalse();
+      break;
+    case BC_LNULL:
+      break;
+    default:
+      value = m_procedure->IndexLiteral(index);
+      break;
+  }
+  uint32_t kindex = m_code->AddConstant(value);
+  m_constant.insert(std::make_pair(key, kindex));
+  return Operand(Operand::CONSTANT, kindex);
+}
+
+bool RegisterCodeGenerator::CollectLabel() {
+  const BytecodeBuffer& bb = m_procedure->code_buffer();
+  for (BytecodeBuffer::Iterator itr = bb.Begin(); itr != bb.End(); ++itr) {
+    Bytecode bc = *itr;
+    uint32_t arg = BytecodeHasOperand(bc) ? itr.arg() : 0;
+    switch (bc) {
+      case BC_JMP:
+      case BC_JT:
+      case BC_JF:
+      case BC_BRT:
+      case BC_BRF:
+      case BC_BRK:
+      case BC_CONT:
+      case BC_FORPREP:
+      case BC_FOREND:
+        if (arg > bb.size()) return false;
+        m_label.insert(std::make_pair(static_cast<size_t>(arg), -1));
+        break;
+      default:
+        break;
+    }
+  }
+  return true;
+}
+
+bool RegisterCodeGenerator::Lower(Bytecode bc, uint32_t arg, bool* reachable) {
+#define BINARY(BC, RBC)                        \
+  case BC: {                                   \
+    uint32_t rhs = TopRK(0);                   \
+    uint32_t lhs = TopRK(1);                   \
+    if (!Pop(2)) return false;                 \
+    EmitDef(RBC, depth(), lhs, rhs);           \
+    Push(Operand());                           \
+    return true;                               \
+  }
+
+#define BINARY_IV(BC, RBC)                          \
+  case BC: {                                        \
+    uint32_t k = RKConstant(Constant(BC_LINT, arg).index); \
+    uint32_t v = TopRK(0);                          \
+    if (!Pop(1)) return false;                      \
+    EmitDef(RBC, depth(), k, v);                    \
+    Push(Operand());                                \
+    return true;                                    \
+  }
+
+#define BINARY_VI(BC, RBC)                          \
+  case BC: {                                        \
+    uint32_t k = RKConstant(Constant(BC_LINT, arg).index); \
+    uint32_t v = TopRK(0);                          \
+    if (!Pop(1)) return false;                      \
+    EmitDef(RBC, depth(), v, k);                    \
+    Push(Operand());                                \
+    return true;                                    \
+  }
+
+#define UNARY(BC, RBC)                         \
+  case BC: {                                   \
+    uint32_t v = TopRK(0);                     \
+    if (!Pop(1)) return false;                 \
+    EmitDef(RBC, depth(), v);                  \
+    Push(Operand());                           \
+    return true;                               \
+  }
+
+#define SELF(BC, RBC)                          \
+  case BC: {                                   \
+    uint32_t v = TopRK(0);                     \
+    if (!Pop(1) || arg >= depth()) return false; \
+    Materialize(arg);                          \
+    PrepareWrite(arg);                         \
+    Emit(RBC, arg, v);                         \
+    return true;                               \
+  }
+
+#define LITERAL(BC)                            \
+  case BC:                                     \
+    Push(Constant(BC, arg));                   \
+    return true;
+
+#define PROPERTY_GET(BC, RBC)                  \
+  case BC: {                                   \
+    uint32_t obj = TopRK(0);                   \
+    if (!Pop(1)) return false;                 \
+    EmitDef(RBC, depth(), obj, arg);           \
+    Push(Operand());                           \
+    return true;                               \
+  }
+
+#define PROPERTY_SET(BC, RBC)                  \
+  case BC: {                                   \
+    uint32_t obj = TopRK(0);                   \
+    uint32_t v = TopRK(1);                     \
+    if (!Pop(2)) return false;                 \
+    Emit(RBC, v, obj, arg);                    \
+    return true;                               \
+  }
+
+#define INDEX_SET(BC, RBC)                     \
+  case BC: {                                   \
+    uint32_t key = TopRK(0);                   \
+    uint32_t obj = TopRK(1);                   \
+    uint32_t v = TopRK(2);                     \
+    if (!Pop(3)) return false;                 \
+    Emit(RBC, v, obj, key);                    \
+    return true;                               \
+  }
+
+#define GLOBAL_SET(BC, RBC)                    \
+  case BC: {                                   \
+    uint32_t v = TopRK(0);                     \
+    if (!Pop(1)) return false;                 \
+    Emit(RBC, v, 0, arg);                      \
+    return true;                               \
+  }
+
+  // All the operands of an instruction must be on the virtual stack
+  switch (bc) {
+    case BC_SPOP:
+    case BC_JMP:
+    case BC_BRK:
+    case BC_CONT:
+    case BC_DEBUG:
+    case BC_IMPORT:
+    case BC_GSUB:
+    case BC_LSUB:
+    case BC_GLOAD:
+    case BC_GUNSET:
+    case BC_LDICT:
+    case BC_LLIST:
+    case BC_TERM:
+    case BC_LINT:
+    case BC_LREAL:
+    case BC_LTRUE:
+    case BC_LFALSE:
+    case BC_LNULL:
+    case BC_LSTR:
+    case BC_LSIZE:
+    case BC_LDURATION:
+    case BC_LACL:
+    case BC_SLOAD:
+      break;
+    default:
+      if (depth() == 0) return false;
+      break;
+  }
+
+  switch (bc) {
+    BINARY(BC_ADD, RBC_ADD)
+    BINARY(BC_SUB, RBC_SUB)
+    BINARY(BC_MUL, RBC_MUL)
+    BINARY(BC_DIV, RBC_DIV)
+    BINARY(BC_MOD, RBC_MOD)
+    BINARY(BC_LT, RBC_LT)
+    BINARY(BC_LE, RBC_LE)
+    BINARY(BC_GT, RBC_GT)
+    BINARY(BC_GE, RBC_GE)
+    BINARY(BC_EQ, RBC_EQ)
+    BINARY(BC_NE, RBC_NE)
+    BINARY(BC_MATCH, RBC_MATCH)
+    BINARY(BC_NOT_MATCH, RBC_NOT_MATCH)
+
+    BINARY_IV(BC_ADDIV, RBC_ADD)
+    BINARY_IV(BC_SUBIV, RBC_SUB)
+    BINARY_IV(BC_MULIV, RBC_MUL)
+    BINARY_IV(BC_DIVIV, RBC_DIV)
+    BINARY_IV(BC_MODIV, RBC_MOD)
+    BINARY_IV(BC_LTIV, RBC_LT)
+    BINARY_IV(BC_LEIV, RBC_LE)
+    BINARY_IV(BC_GTIV, RBC_GT)
+    BINARY_IV(BC_GEIV, RBC_GE)
+    BINARY_IV(BC_EQIV, RBC_EQ)
+    BINARY_IV(BC_NEIV, RBC_NE)
+
+    BINARY_VI(BC_ADDVI, RBC_ADD)
+    BINARY_VI(BC_SUBVI, RBC_SUB)
+    BINARY_VI(BC_MULVI, RBC_MUL)
+    BINARY_VI(BC_DIVVI, RBC_DIV)
+    BINARY_VI(BC_MODVI, RBC_MOD)
+    BINARY_VI(BC_LTVI, RBC_LT)
+    BINARY_VI(BC_LEVI, RBC_LE)
+    BINARY_VI(BC_GTVI, RBC_GT)
+    BINARY_VI(BC_GEVI, RBC_GE)
+    BINARY_VI(BC_EQVI, RBC_EQ)
+    BINARY_VI(BC_NEVI, RBC_NE)
+
+    UNARY(BC_NEGATE, RBC_NEGATE)
+    UNARY(BC_TEST, RBC_TEST)
+    UNARY(BC_FLIP, RBC_FLIP)
+    UNARY(BC_CSTR, RBC_CSTR)
+    UNARY(BC_CINT, RBC_CINT)
+    UNARY(BC_CREAL, RBC_CREAL)
+    UNARY(BC_CBOOL, RBC_CBOOL)
+    UNARY(BC_TYPE, RBC_TYPE)
+
+    SELF(BC_SADD, RBC_SADD)
+    SELF(BC_SSUB, RBC_SSUB)
+    SELF(BC_SMUL, RBC_SMUL)
+    SELF(BC_SDIV, RBC_SDIV)
+    SELF(BC_SMOD, RBC_SMOD)
+
+    case BC_UNSET:
+      if (arg >= depth()) return false;
+      Materialize(arg);
+      PrepareWrite(arg);
+      Emit(RBC_UNSET, arg);
+      return true;
+
+    LITERAL(BC_LINT)
+    LITERAL(BC_LREAL)
+    LITERAL(BC_LTRUE)
+    LITERAL(BC_LFALSE)
+    LITERAL(BC_LNULL)
+    LITERAL(BC_LSTR)
+    LITERAL(BC_LSIZE)
+    LITERAL(BC_LDURATION)
+    LITERAL(BC_LACL)
+
+    case BC_LDICT:
+    case BC_LSDICT:
+    case BC_LLIST:
+    case BC_LEXT:
+    case BC_SCAT:
+    case BC_CONCAT: {
+      size_t count = arg;
+      RegisterBytecode op = RBC_SCAT;
+      if (bc == BC_CONCAT) {
+        op = RBC_CONCAT;
+      } else if (bc == BC_LDICT) {
+        count = 2 * arg;
+        op = RBC_LDICT;
+      } else if (bc == BC_LSDICT) {
+        count = m_procedure->IndexShape(arg)->size();
+        op = RBC_LSDICT;
+      } else if (bc == BC_LEXT) {
+        count = 2 * arg + 1;
+        op = RBC_LEXT;
+      } else if (bc == BC_LLIST) {
+        op = RBC_LLIST;
+      }
+      if (count > depth()) return false;
+      size_t start = depth() - count;
+      Materialize(start, depth());
+      Pop(count);
+      Emit(op, start, 0, arg);
+      Push(Operand());
+      return true;
+    }
+
+    case BC_SLOAD: {
+      if (arg >= depth()) return false;
+      Operand operand = m_stack[arg];
+      if (operand.type == Operand::HOME) operand = Operand(Operand::REGISTER, arg);
+      Push(operand);
+      return true;
+    }
+
+    case BC_SSTORE: {
+      if (arg + 1 >= depth()) return false;
+      const size_t slot = depth() - 1;
+      const uint32_t v = TopRK(0);
+      const bool retarget = m_stack[slot].type == Operand::HOME &&
+                            m_last_def != kNoDef &&
+                            m_code->Index(m_last_def).a == slot;
+      const size_t last_def = m_last_def;
+      Pop(1);
+
+      const size_t before = m_code->size();
+      PrepareWrite(arg);
+      if (retarget && before == m_code->size()) {
+        // The value is computed by the previous instruction , just let it
+        // write into the local variable directly
+        m_code->Index(last_def).a = arg;
+      } else {
+        Emit(RBC_MOVE, arg, v);
+      }
+      m_stack[arg] = Operand();
+      return true;
+    }
+
+    case BC_SPOP:
+      return Pop(arg);
+
+    case BC_JMP:
+    case BC_BRK:
+    case BC_CONT:
+      Flush();
+      EmitJump(RBC_JMP, 0, arg);
+      *reachable = false;
+      return AddTarget(arg, depth());
+
+    case BC_JT:
+    case BC_JF: {
+      uint32_t cond = TopRK(0);
+      Pop(1);
+      Flush();
+      EmitJump(bc == BC_JT ? RBC_JT : RBC_JF, cond, arg);
+      return AddTarget(arg, depth());
+    }
+
+    case BC_BRT:
+    case BC_BRF: {
+      // The condition stays on the stack when the jump is taken
+      Flush();
+      EmitJump(bc == BC_BRT ? RBC_BRT : RBC_BRF, depth() - 1, arg);
+      if (!AddTarget(arg, depth())) return false;
+      Pop(1);
+      return true;
+    }
+
+    PROPERTY_GET(BC_PGET, RBC_PGET)
+    PROPERTY_SET(BC_PSET, RBC_PSET)
+    PROPERTY_SET(BC_PSADD, RBC_PSADD)
+    PROPERTY_SET(BC_PSSUB, RBC_PSSUB)
+    PROPERTY_SET(BC_PSMUL, RBC_PSMUL)
+    PROPERTY_SET(BC_PSDIV, RBC_PSDIV)
+    PROPERTY_SET(BC_PSMOD, RBC_PSMOD)
+
+    PROPERTY_GET(BC_AGET, RBC_AGET)
+    PROPERTY_SET(BC_ASET, RBC_ASET)
+    PROPERTY_SET(BC_ASADD, RBC_ASADD)
+    PROPERTY_SET(BC_ASSUB, RBC_ASSUB)
+    PROPERTY_SET(BC_ASMUL, RBC_ASMUL)
+    PROPERTY_SET(BC_ASDIV, RBC_ASDIV)
+    PROPERTY_SET(BC_ASMOD, RBC_ASMOD)
+
+    case BC_PUNSET:
+    case BC_AUNSET: {
+      uint32_t obj = TopRK(0);
+      if (!Pop(1)) return false;
+      Emit(bc == BC_PUNSET ? RBC_PUNSET : RBC_AUNSET, 0, obj, arg);
+      return true;
+    }
+
+    case BC_IGET: {
+      uint32_t key = TopRK(0);
+      uint32_t obj = TopRK(1);
+      if (!Pop(2)) return false;
+      EmitDef(RBC_IGET, depth(), obj, key);
+      Push(Operand());
+      return true;
+    }
+
+    INDEX_SET(BC_ISET, RBC_ISET)
+    INDEX_SET(BC_ISADD, RBC_ISADD)
+    INDEX_SET(BC_ISSUB, RBC_ISSUB)
+    INDEX_SET(BC_ISMUL, RBC_ISMUL)
+    INDEX_SET(BC_ISDIV, RBC_ISDIV)
+    INDEX_SET(BC_ISMOD, RBC_ISMOD)
+
+    case BC_IUNSET: {
+      uint32_t key = TopRK(0);
+      uint32_t obj = TopRK(1);
+      if (!Pop(2)) return false;
+      Emit(RBC_IUNSET, 0, obj, key);
+      return true;
+    }
+
+    case BC_GLOAD:
+      EmitDef(RBC_GLOAD, depth(), 0, arg);
+      Push(Operand());
+      return true;
+
+    GLOBAL_SET(BC_GSET, RBC_GSET)
+    GLOBAL_SET(BC_GSADD, RBC_GSADD)
+    GLOBAL_SET(BC_GSSUB, RBC_GSSUB)
+    GLOBAL_SET(BC_GSMUL, RBC_GSMUL)
+    GLOBAL_SET(BC_GSDIV, RBC_GSDIV)
+    GLOBAL_SET(BC_GSMOD, RBC_GSMOD)
+
+    case BC_GUNSET:
+      Emit(RBC_GUNSET, 0, 0, arg);
+      return true;
+
+    case BC_FORPREP:
+    case BC_FOREND:
+      Flush();
+      EmitJump(bc == BC_FORPREP ? RBC_FORPREP : RBC_FOREND, depth() - 1, arg);
+      return AddTarget(arg, depth());
+
+    case BC_ITERK:
+      Emit(RBC_ITERK, depth(), depth() - 1);
+      Push(Operand());
+      return true;
+
+    case BC_ITERV:
+      if (depth() < 2) return false;
+      Emit(RBC_ITERV, depth(), depth() - 2);
+      Push(Operand());
+      return true;
+
+    case BC_DEBUG:
+      Emit(RBC_DEBUG, 0, 0, arg);
+      return true;
+
+    case BC_IMPORT:
+      Emit(RBC_IMPORT, 0, 0, arg);
+      return true;
+
+    case BC_CALL: {
+      if (arg + 1 > depth()) return false;
+      size_t start = depth() - arg - 1;
+      Materialize(start, depth());
+      Pop(arg + 1);
+      Emit(RBC_CALL, start, 0, arg);
+      Push(Operand());
+      return true;
+    }
+
+    case BC_TAILCALL: {
+      if (arg + 1 > depth()) return false;
+      size_t start = depth() - arg - 1;
+      Materialize(start, depth());
+      Pop(arg + 1);
+      Emit(RBC_TAILCALL, start, 0, arg);
+      Push(Operand());
+      return true;
+    }
+
+    case BC_TERM:
+      if (static_cast<ActionType>(arg) == ACT_EXTENSION) {
+        if (depth() == 0) return false;
+        uint32_t v = TopRK(0);
+        Pop(1);
+        Emit(RBC_TERM, v, 0, arg);
+      } else {
+        Emit(RBC_TERM, 0, 0, arg);
+      }
+      *reachable = false;
+      return true;
+
+    case BC_RET: {
+      uint32_t v = TopRK(0);
+      Pop(1);
+      Emit(RBC_RET, v);
+      *reachable = false;
+      return true;
+    }
+
+    case BC_GSUB:
+      Emit(RBC_GSUB, 0, 0, arg);
+      return true;
+
+    case BC_LSUB:
+      Emit(RBC_LSUB, depth(), 0, arg);
+      Push(Operand());
+      return true;
+
+    default:
+      return false;
+  }
+
+#undef BINARY        // BINARY
+#undef BINARY_IV     // BINARY_IV
+#undef BINARY_VI     // BINARY_VI
+#undef UNARY         // UNARY
+#undef SELF          // SELF
+#undef LITERAL       // LITERAL
+#undef PROPERTY_GET  // PROPERTY_GET
+#undef PROPERTY_SET  // PROPERTY_SET
+#undef INDEX_SET     // INDEX_SET
+#undef GLOBAL_SET    // GLOBAL_SET
+}
+
+bool RegisterCodeGenerator::DoGenerate() {
+  const BytecodeBuffer& bb = m_procedure->code_buffer();
+
+  // 1. Find out all the basic block boundary
+  if (!CollectLabel()) return false;
+
+  // 2. Arguments sit at the bottom of the frame
+  m_stack.resize(m_procedure->argument_size());
+  m_max_depth = m_stack.size();
+
+  bool reachable = true;
+  for (BytecodeBuffer::Iterator itr = bb.Begin(); itr != bb.End(); ++itr) {
+    // Superinstructions are lowered component by component
+    Bytecode bc = BytecodeUnfuse(*itr);
+    uint32_t arg = BytecodeHasOperand(bc) ? itr.arg() : 0;
+    m_cur_pc = itr.index();
+
+    std::map<size_t, int>::iterator label = m_label.find(m_cur_pc);
+    if (label != m_label.end()) {
+      if (reachable) {
+        Flush();
+        if (label->second < 0)
+          label->second = static_cast<int>(depth());
+        else if (label->second != static_cast<int>(depth()))
+          return false;
+      } else {
+        // No live jump targets this label so far , it is still dead code. If
+        // a later backward jump targets it , the fixup cannot be resolved
+        // and we give up lowering this procedure.
+        if (label->second < 0) continue;
+        m_stack.clear();
+        m_stack.resize(label->second);
+      }
+      m_label_position[m_cur_pc] = m_code->size();
+      m_last_def = kNoDef;
+      reachable = true;
+    }
+
+    // Dead code after an unconditional jump , like the stack cleanup after a
+    // break , nothing can reach it so just skip it
+    if (!reachable) continue;
+
+    if (!Lower(bc, arg, &reachable)) return false;
+  }
+
+  // 3. Patch all the jump instructions
+  m_label_position[bb.size()] = m_code->size();
+  for (size_t i = 0; i < m_fixup.size(); ++i) {
+    std::map<size_t, size_t>::iterator itr =
+        m_label_position.find(m_fixup[i].second);
+    if (itr == m_label_position.end()) return false;
+    m_code->Index(m_fixup[i].first).b = static_cast<uint32_t>(itr->second);
+  }
+
+  m_code->set_register_size(m_max_depth + 1);
+  return true;
+}
 }  // namespace
 
 namespace vcl {
@@ -1432,7 +2540,50 @@ bool Compile(CompiledCode* cc,
              const CompilationUnit& cu,
              std::string* error) {
   ::Compiler compiler(cc, zone, cu, error);
-  return compiler.DoCompile();
+  if (!compiler.DoCompile()) return false;
+
+  // Fuse superinstructions and link all the procedures for the interpreter
+  {
+    CompiledCodeBuilder builder(cc);
+    Procedure* procedure;
+    uint32_t inline_cache_size = 0;
+    for (uint32_t i = 0; (procedure = builder.IndexSubRoutine(i)) != NULL;
+         ++i) {
+      ::Peephole(procedure).DoFuse();
+      procedure->set_max_stack_size(::StackDepth(procedure).Compute());
+      Runtime::Link(procedure, inline_cache_size);
+      inline_cache_size += procedure->threaded_code()->inline_cache_size();
+    }
+    builder.set_inline_cache_size(inline_cache_size);
+  }
+
+  if (cc->engine() && cc->engine()->option().vm_type == VM_REGISTER) {
+    CompileRegisterCode(cc);
+  }
+  return true;
+}
+
+bool CompileRegisterCode(CompiledCode* cc) {
+  CompiledCodeBuilder builder(cc);
+  Procedure* procedure;
+  uint32_t index = 0;
+
+  for (; (procedure = builder.IndexSubRoutine(index)) != NULL; ++index) {
+    RegisterCode* code = new RegisterCode();
+    procedure->set_register_code(code);
+    if (!::RegisterCodeGenerator(procedure, code).DoGenerate()) break;
+  }
+
+  if (procedure) {
+    // We cannot lower this procedure , since the runtime cannot mix
+    // different types of frames, just fallback to stack virtual machine
+    // for the whole CompiledCode object.
+    for (uint32_t i = 0; i <= index; ++i) {
+      builder.IndexSubRoutine(i)->set_register_code(NULL);
+    }
+    return false;
+  }
+  return true;
 }
 
 }  // namespace vm
@@ -15,6 +15,12 @@ class Zone;
 // VCL source code unit
 bool Compile(CompiledCode*, zone::Zone*, const CompilationUnit&, std::string*);
 
+// Lower all the compiled stack bytecode inside of the CompiledCode object into
+// register code for register virtual machine. If any procedure cannot be
+// lowered , none of the procedures will have register code and false is
+// returned.
+bool CompileRegisterCode(CompiledCode*);
+
 }  // namespace vm
 }  // namespace vcl
 
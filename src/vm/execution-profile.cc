@@ -0,0 +1,142 @@
+#include "execution-profile.h"
+#include "procedure.h"
+#include "threaded-code.h"
+
+#include <algorithm>
+#include <functional>
+#include <sstream>
+
+namespace vcl {
+namespace vm {
+
+namespace {
+
+typedef std::pair<uint64_t, std::string> Entry;
+
+void DumpTop(std::ostream& output,
+             const char* title,
+             std::vector<Entry>* entries,
+             uint64_t total,
+             size_t top) {
+  std::sort(entries->begin(), entries->end(), std::greater<Entry>());
+  output << title << ":\n";
+  for (size_t i = 0; i < entries->size() && i < top; ++i) {
+    const Entry& e = (*entries)[i];
+    output << "  " << e.first << "  ";
+    output << (total ? e.first * 100 / total : 0) << "%  ";
+    output << e.second << '\n';
+  }
+}
+
+}  // namespace
+
+uint64_t* ExecutionProfile::Counter(const Procedure* procedure) {
+  std::vector<uint64_t>& counter = m_counter[procedure];
+  if (counter.empty()) {
+    DCHECK(procedure->threaded_code());
+    counter.resize(procedure->threaded_code()->size());
+  }
+  return vcl::util::VectorAsArray(counter);
+}
+
+void ExecutionProfile::Clear() {
+  for (CounterMap::iterator itr = m_counter.begin(); itr != m_counter.end();
+       ++itr) {
+    std::fill(itr->second.begin(), itr->second.end(), 0);
+  }
+}
+
+int ExecutionProfile::LineOf(const Procedure* procedure, size_t index) {
+  return procedure->code_buffer()
+      .code_location(procedure->threaded_code()->offset(index))
+      .line;
+}
+
+uint64_t ExecutionProfile::total() const {
+  uint64_t count = 0;
+  for (CounterMap::const_iterator itr = m_counter.begin();
+       itr != m_counter.end();
+       ++itr) {
+    for (size_t i = 0; i < itr->second.size(); ++i) count += itr->second[i];
+  }
+  return count;
+}
+
+uint64_t ExecutionProfile::opcode(Bytecode bc) const {
+  uint64_t count = 0;
+  for (CounterMap::const_iterator itr = m_counter.begin();
+       itr != m_counter.end();
+       ++itr) {
+    const ThreadedCode* tc = itr->first->threaded_code();
+    for (size_t i = 0; i < itr->second.size(); ++i) {
+      if (tc->At(i)->bytecode == bc) count += itr->second[i];
+    }
+  }
+  return count;
+}
+
+uint64_t ExecutionProfile::procedure(const Procedure* procedure) const {
+  CounterMap::const_iterator itr = m_counter.find(procedure);
+  if (itr == m_counter.end()) return 0;
+  uint64_t count = 0;
+  for (size_t i = 0; i < itr->second.size(); ++i) count += itr->second[i];
+  return count;
+}
+
+uint64_t ExecutionProfile::line(const Procedure* procedure, int line) const {
+  CounterMap::const_iterator itr = m_counter.find(procedure);
+  if (itr == m_counter.end()) return 0;
+  uint64_t count = 0;
+  for (size_t i = 0; i < itr->second.size(); ++i) {
+    if (LineOf(procedure, i) == line) count += itr->second[i];
+  }
+  return count;
+}
+
+void ExecutionProfile::Dump(std::ostream& output, size_t top) const {
+  const uint64_t count = total();
+  output << "Total:" << count << '\n';
+
+  uint64_t opcode[SIZE_OF_BYTECODE] = {0};
+  std::vector<Entry> procedure;
+  std::map<std::string, uint64_t> line;
+
+  for (CounterMap::const_iterator itr = m_counter.begin();
+       itr != m_counter.end();
+       ++itr) {
+    const Procedure* p = itr->first;
+    const ThreadedCode* tc = p->threaded_code();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < itr->second.size(); ++i) {
+      const uint64_t c = itr->second[i];
+      if (!c) continue;
+      sum += c;
+      opcode[tc->At(i)->bytecode] += c;
+      std::ostringstream key;
+      key << p->name() << ':' << LineOf(p, i);
+      line[key.str()] += c;
+    }
+    if (sum) procedure.push_back(Entry(sum, p->name()));
+  }
+
+  std::vector<Entry> entries;
+  for (int i = 0; i < SIZE_OF_BYTECODE; ++i) {
+    if (opcode[i]) {
+      entries.push_back(
+          Entry(opcode[i], BytecodeGetName(static_cast<Bytecode>(i))));
+    }
+  }
+  DumpTop(output, "Opcode", &entries, count, top);
+  DumpTop(output, "Sub", &procedure, count, top);
+
+  entries.clear();
+  for (std::map<std::string, uint64_t>::const_iterator itr = line.begin();
+       itr != line.end();
+       ++itr) {
+    entries.push_back(Entry(itr->second, itr->first));
+  }
+  DumpTop(output, "Line", &entries, count, top);
+}
+
+}  // namespace vm
+}  // namespace vcl
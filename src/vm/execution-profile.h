@@ -0,0 +1,74 @@
+#ifndef EXECUTION_PROFILE_H_
+#define EXECUTION_PROFILE_H_
+#include <vcl/util.h>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "bytecode.h"
+
+namespace vcl {
+namespace vm {
+class Procedure;
+
+// Execution profiler of the stack interpreter. It counts how many times each
+// instruction of each Procedure is executed , the count per opcode , per
+// Procedure and per source line are all aggregated from it when asked. So
+// the interpreter only does one increment per dispatch , the counter array
+// of the current Procedure is cached inside of Runtime::Main and refreshed
+// when the frame changes.
+//
+// It is only compiled into Runtime::Main when VCL_EXECUTION_PROFILE is
+// defined , otherwise it costs nothing. Unlike BytecodeProfile it is per
+// Runtime , so it is owned by a Context and needs no lock. When it is enabled
+// the JIT is turned off , otherwise instructions run as native code are not
+// counted. Instructions fused into a superinstruction are counted as the
+// superinstruction.
+class ExecutionProfile {
+ public:
+  ExecutionProfile() : m_counter() {}
+
+  // Whether Runtime::Main is built with the profiler
+  static bool IsEnabled() {
+#ifdef VCL_EXECUTION_PROFILE
+    return true;
+#else
+    return false;
+#endif  // VCL_EXECUTION_PROFILE
+  }
+
+  // Counter array of a Procedure , indexed by the index of ThreadedCode
+  uint64_t* Counter(const Procedure*);
+
+  // Reset all the counts. The counter arrays are kept since Runtime::Main
+  // may still hold one , e.g. when it is called from a native function
+  void Clear();
+
+ public:
+  // Total number of executed instructions
+  uint64_t total() const;
+
+  uint64_t opcode(Bytecode) const;
+
+  uint64_t procedure(const Procedure*) const;
+
+  uint64_t line(const Procedure*, int line) const;
+
+  // Dump the top most executed opcodes , sub routines and source lines
+  void Dump(std::ostream& output, size_t top = 20) const;
+
+ private:
+  typedef std::map<const Procedure*, std::vector<uint64_t> > CounterMap;
+
+  // Source line of an instruction
+  static int LineOf(const Procedure*, size_t index);
+
+  CounterMap m_counter;
+
+  VCL_DISALLOW_COPY_AND_ASSIGN(ExecutionProfile);
+};
+
+}  // namespace vm
+}  // namespace vcl
+
+#endif  // EXECUTION_PROFILE_H_
@@ -0,0 +1,477 @@
+#include "jit.h"
+#include "runtime-inl.h"
+#include "runtime.h"
+#include "threaded-code.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif  // __x86_64__
+
+namespace vcl {
+namespace vm {
+
+// Bytecode that has a template , the rest is handed over to the interpreter.
+// Jump instructions are translated into native jumps directly and the rest
+// calls the helper of the same name.
+#define VCL_JIT_BYTECODE_LIST(__) \
+  __(BC_ADDIV)                    \
+  __(BC_ADDVI)                    \
+  __(BC_SUBIV)                    \
+  __(BC_SUBVI)                    \
+  __(BC_MULIV)                    \
+  __(BC_MULVI)                    \
+  __(BC_DIVIV)                    \
+  __(BC_DIVVI)                    \
+  __(BC_MODIV)                    \
+  __(BC_MODVI)                    \
+  __(BC_LTVI)                     \
+  __(BC_LTIV)                     \
+  __(BC_LEVI)                     \
+  __(BC_LEIV)                     \
+  __(BC_GTVI)                     \
+  __(BC_GTIV)                     \
+  __(BC_GEVI)                     \
+  __(BC_GEIV)                     \
+  __(BC_EQIV)                     \
+  __(BC_EQVI)                     \
+  __(BC_NEIV)                     \
+  __(BC_NEVI)                     \
+  __(BC_ADD)                      \
+  __(BC_SUB)                      \
+  __(BC_MUL)                      \
+  __(BC_DIV)                      \
+  __(BC_MOD)                      \
+  __(BC_SADD)                     \
+  __(BC_SSUB)                     \
+  __(BC_SMUL)                     \
+  __(BC_SDIV)                     \
+  __(BC_SMOD)                     \
+  __(BC_UNSET)                    \
+  __(BC_LT)                       \
+  __(BC_LE)                       \
+  __(BC_GT)                       \
+  __(BC_GE)                       \
+  __(BC_EQ)                       \
+  __(BC_NE)                       \
+  __(BC_MATCH)                    \
+  __(BC_NOT_MATCH)                \
+  __(BC_NEGATE)                   \
+  __(BC_TEST)                     \
+  __(BC_FLIP)                     \
+  __(BC_LINT)                     \
+  __(BC_LREAL)                    \
+  __(BC_LTRUE)                    \
+  __(BC_LFALSE)                   \
+  __(BC_LNULL)                    \
+  __(BC_LSTR)                     \
+  __(BC_LSIZE)                    \
+  __(BC_LDURATION)                \
+  __(BC_LACL)                     \
+  __(BC_SLOAD)                    \
+  __(BC_SSTORE)                   \
+  __(BC_SPOP)                     \
+  __(BC_JT)                       \
+  __(BC_JF)                       \
+  __(BC_BRT)                      \
+  __(BC_BRF)                      \
+  __(BC_PGET)                     \
+  __(BC_PSET)                     \
+  __(BC_AGET)                     \
+  __(BC_ASET)                     \
+  __(BC_IGET)                     \
+  __(BC_ISET)                     \
+  __(BC_GLOAD)                    \
+  __(BC_GSET)                     \
+  __(BC_FORPREP)                  \
+  __(BC_FOREND)                   \
+  __(BC_ITERK)                    \
+  __(BC_ITERV)                    \
+  __(BC_SCAT)                     \
+  __(BC_CONCAT)                   \
+  __(BC_DEBUG)
+
+// Helpers called by the native code. Each one is a wrapper of the operation
+// of the same bytecode which is shared with Runtime::Main , see
+// runtime-inl.h. The jump is done by the native code when the helper returns
+// JIT_BRANCH.
+class JitHelper {
+ public:
+  typedef JitCode::State State;
+  typedef int (*Function)(State*, const ThreadedInstruction*);
+
+  // Helper of a bytecode , NULL means it has no template
+  static Function Get(Bytecode);
+
+  // Whether the helper may return JIT_BRANCH
+  static bool IsBranch(Bytecode bc) {
+    switch (bc) {
+      case BC_JT:
+      case BC_JF:
+      case BC_BRT:
+      case BC_BRF:
+      case BC_FORPREP:
+      case BC_FOREND:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Hand the instruction over to the interpreter
+  static int Interpret(State* s, const ThreadedInstruction* ip) {
+    s->runtime->CurrentFrame()->pc = s->code->IndexOf(ip);
+    return JitCode::JIT_INTERPRET;
+  }
+
+ private:
+  static int Fail(State* s, const ThreadedInstruction* ip) {
+    MethodStatus* result = s->result;
+    if (result->status() == MethodStatus::METHOD_YIELD ||
+        result->status() == MethodStatus::METHOD_TERMINATE) {
+      result->set_fail("invalid method return status %s in operator function!",
+                       result->status_name());
+    }
+    s->runtime->CurrentFrame()->pc = s->code->IndexOf(ip);
+    return JitCode::JIT_FAIL;
+  }
+
+#define verify(XX)                                               \
+  do {                                                           \
+    if ((*s->result = (XX)).status() != MethodStatus::METHOD_OK) \
+      return Fail(s, ip);                                        \
+  } while (false)
+
+#define JIT_HELPER(BC) \
+  static int BC##_Helper(State* s, const ThreadedInstruction* ip)
+
+  // Operation that may fail
+#define DO(BC, OP)                      \
+  JIT_HELPER(BC) {                      \
+    verify(s->runtime->OP);             \
+    return JitCode::JIT_NEXT;           \
+  }
+
+  DO(BC_ADD, OpAdd())
+  DO(BC_SUB, OpSub())
+  DO(BC_MUL, OpMul())
+  DO(BC_DIV, OpDiv())
+  DO(BC_MOD, OpMod())
+
+  DO(BC_ADDIV, OpAddIV(ip))
+  DO(BC_SUBIV, OpSubIV(ip))
+  DO(BC_MULIV, OpMulIV(ip))
+  DO(BC_DIVIV, OpDivIV(ip))
+  DO(BC_MODIV, OpModIV(ip))
+  DO(BC_ADDVI, OpAddVI(ip))
+  DO(BC_SUBVI, OpSubVI(ip))
+  DO(BC_MULVI, OpMulVI(ip))
+  DO(BC_DIVVI, OpDivVI(ip))
+  DO(BC_MODVI, OpModVI(ip))
+
+  DO(BC_LTIV, OpLtIV(ip))
+  DO(BC_LEIV, OpLeIV(ip))
+  DO(BC_GTIV, OpGtIV(ip))
+  DO(BC_GEIV, OpGeIV(ip))
+  DO(BC_EQIV, OpEqIV(ip))
+  DO(BC_NEIV, OpNeIV(ip))
+  DO(BC_LTVI, OpLtVI(ip))
+  DO(BC_LEVI, OpLeVI(ip))
+  DO(BC_GTVI, OpGtVI(ip))
+  DO(BC_GEVI, OpGeVI(ip))
+  DO(BC_EQVI, OpEqVI(ip))
+  DO(BC_NEVI, OpNeVI(ip))
+
+  DO(BC_SADD, OpSAdd(ip, s->base))
+  DO(BC_SSUB, OpSSub(ip, s->base))
+  DO(BC_SMUL, OpSMul(ip, s->base))
+  DO(BC_SDIV, OpSDiv(ip, s->base))
+  DO(BC_SMOD, OpSMod(ip, s->base))
+  DO(BC_UNSET, OpUnset(ip, s->base))
+
+  DO(BC_LT, OpLt())
+  DO(BC_LE, OpLe())
+  DO(BC_GT, OpGt())
+  DO(BC_GE, OpGe())
+  DO(BC_EQ, OpEq())
+  DO(BC_NE, OpNe())
+  DO(BC_MATCH, OpMatch())
+  DO(BC_NOT_MATCH, OpNotMatch())
+
+  DO(BC_NEGATE, OpNegate())
+  DO(BC_TEST, OpTest())
+  DO(BC_FLIP, OpFlip())
+
+  DO(BC_PGET, OpPGet(ip))
+  DO(BC_PSET, OpPSet(ip))
+  DO(BC_AGET, OpAGet(ip))
+  DO(BC_ASET, OpASet(ip))
+  DO(BC_IGET, OpIGet())
+  DO(BC_ISET, OpISet())
+
+  DO(BC_GLOAD, OpGLoad(ip))
+
+  DO(BC_SCAT, OpSCat(ip))
+  DO(BC_CONCAT, OpConcat(ip))
+
+#undef DO  // DO
+
+  // Operation that never fails
+#define DO(BC, OP)                      \
+  JIT_HELPER(BC) {                      \
+    VCL_UNUSED(ip);                     \
+    s->runtime->OP;                     \
+    return JitCode::JIT_NEXT;           \
+  }
+
+  DO(BC_LINT, OpLiteral(ip))
+  DO(BC_LREAL, OpLiteral(ip))
+  DO(BC_LSTR, OpLiteral(ip))
+  DO(BC_LSIZE, OpLiteral(ip))
+  DO(BC_LDURATION, OpLiteral(ip))
+  DO(BC_LACL, OpLiteral(ip))
+  DO(BC_LTRUE, Push(Value(true)))
+  DO(BC_LFALSE, Push(Value(false)))
+  DO(BC_LNULL, Push(Value()))
+
+  DO(BC_SLOAD, OpSLoad(ip, s->base))
+  DO(BC_SSTORE, OpSStore(ip, s->base))
+  DO(BC_SPOP, Pop(ip->arg))
+
+  DO(BC_GSET, OpGSet(ip))
+
+  DO(BC_ITERK, OpIterK())
+  DO(BC_ITERV, OpIterV())
+
+  DO(BC_DEBUG, OpDebug(ip))
+
+#undef DO  // DO
+
+  // Branch
+#define DO(BC, OP)                                          \
+  JIT_HELPER(BC) {                                          \
+    bool jump;                                              \
+    verify(s->runtime->OP(&jump));                          \
+    return jump ? JitCode::JIT_BRANCH : JitCode::JIT_NEXT;  \
+  }
+
+  DO(BC_JT, OpJT)
+  DO(BC_JF, OpJF)
+  DO(BC_BRT, OpBRT)
+  DO(BC_BRF, OpBRF)
+  DO(BC_FORPREP, OpForPrep)
+
+#undef DO  // DO
+
+  // Loop back edge is a safepoint , the VM resumes from the loop body
+  JIT_HELPER(BC_FOREND) {
+    Runtime* rt = s->runtime;
+    if (!rt->OpForEnd()) return JitCode::JIT_NEXT;
+    if (rt->m_sample) rt->TakeSample(s->code->IndexOf(ip->target));
+    if (--*s->budget < 0 || rt->m_yield) {
+      rt->CurrentFrame()->pc = s->code->IndexOf(ip->target);
+      return JitCode::JIT_YIELD;
+    }
+    return JitCode::JIT_BRANCH;
+  }
+
+#undef JIT_HELPER  // JIT_HELPER
+#undef verify      // verify
+};
+
+JitHelper::Function JitHelper::Get(Bytecode bc) {
+  switch (bc) {
+#define __(A) \
+  case A:     \
+    return &JitHelper::A##_Helper;
+    VCL_JIT_BYTECODE_LIST(__)
+#undef __  // __
+    default:
+      return NULL;
+  }
+}
+
+#if defined(__x86_64__)
+
+namespace {
+
+// Just enough of an x86-64 assembler for the templates
+class Assembler {
+ public:
+  Assembler() : m_buffer() {}
+
+  void Emit(uint8_t byte) { m_buffer.push_back(byte); }
+
+  void Emit(const uint8_t* bytes, size_t size) {
+    m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+  }
+
+  void Emit32(uint32_t value) {
+    for (int i = 0; i < 4; ++i) Emit(static_cast<uint8_t>(value >> (i * 8)));
+  }
+
+  void Emit64(uint64_t value) {
+    for (int i = 0; i < 8; ++i) Emit(static_cast<uint8_t>(value >> (i * 8)));
+  }
+
+  // Relative 32 bits displacement to position , it is counted from the end
+  // of the displacement itself
+  void EmitRel32(size_t position) {
+    Emit32(static_cast<uint32_t>(static_cast<int64_t>(position) -
+                                 static_cast<int64_t>(size() + 4)));
+  }
+
+  void PatchRel32(size_t at, size_t position) {
+    uint32_t value = static_cast<uint32_t>(static_cast<int64_t>(position) -
+                                           static_cast<int64_t>(at + 4));
+    for (int i = 0; i < 4; ++i)
+      m_buffer[at + i] = static_cast<uint8_t>(value >> (i * 8));
+  }
+
+  size_t size() const { return m_buffer.size(); }
+  const uint8_t* data() const { return vcl::util::VectorAsArray(m_buffer); }
+
+ private:
+  std::vector<uint8_t> m_buffer;
+};
+
+}  // namespace
+
+bool JitCode::IsSupported() { return true; }
+
+// The native code is a function int (*)(State* state, const void* start). It
+// saves rbx which holds the state for the whole function , then jumps to the
+// template of the start instruction. Each template calls its helper with
+// ( state , instruction ) and goes to the shared epilogue with the status as
+// return value when it is neither JIT_NEXT nor JIT_BRANCH.
+JitCode* JitCode::Compile(const ThreadedCode& tc) {
+  static const uint8_t kPrologue[] = {
+      0x53,              // push rbx , also aligns rsp to 16 bytes
+      0x48, 0x89, 0xfb,  // mov rbx, rdi
+      0xff, 0xe6         // jmp rsi
+  };
+  static const uint8_t kEpilogue[] = {
+      0x5b,  // pop rbx
+      0xc3   // ret
+  };
+
+  Assembler a;
+  a.Emit(kPrologue, sizeof(kPrologue));
+  const size_t exit = a.size();
+  a.Emit(kEpilogue, sizeof(kEpilogue));
+
+  std::vector<uint32_t> entry(tc.size());
+  // Position of the displacement and the index of the target instruction
+  std::vector<std::pair<size_t, size_t> > fixup;
+
+  for (size_t i = 0; i < tc.size(); ++i) {
+    const ThreadedInstruction* ip = tc.At(i);
+    const Bytecode bc = BytecodeUnfuse(ip->bytecode);
+    entry[i] = static_cast<uint32_t>(a.size());
+
+    if (bc == BC_JMP || bc == BC_BRK || bc == BC_CONT) {
+      a.Emit(0xe9);  // jmp rel32
+      fixup.push_back(std::make_pair(a.size(), tc.IndexOf(ip->target)));
+      a.Emit32(0);
+      continue;
+    }
+
+    JitHelper::Function helper = JitHelper::Get(bc);
+    if (!helper) helper = &JitHelper::Interpret;
+
+    static const uint8_t kCall[] = {
+        0x48, 0x89, 0xdf,  // mov rdi, rbx
+        0x48, 0xbe         // mov rsi, imm64
+    };
+    a.Emit(kCall, sizeof(kCall));
+    a.Emit64(reinterpret_cast<uint64_t>(ip));
+    a.Emit(0x48);  // mov rax, imm64
+    a.Emit(0xb8);
+    a.Emit64(reinterpret_cast<uint64_t>(helper));
+    a.Emit(0xff);  // call rax
+    a.Emit(0xd0);
+
+    if (helper == &JitHelper::Interpret) {
+      a.Emit(0xe9);  // jmp exit
+      a.EmitRel32(exit);
+    } else if (JitHelper::IsBranch(bc)) {
+      static const uint8_t kBranch[] = {
+          0x83, 0xf8, JIT_BRANCH,  // cmp eax, JIT_BRANCH
+          0x0f, 0x84               // je target
+      };
+      a.Emit(kBranch, sizeof(kBranch));
+      fixup.push_back(std::make_pair(a.size(), tc.IndexOf(ip->target)));
+      a.Emit32(0);
+      a.Emit(0x0f);  // ja exit
+      a.Emit(0x87);
+      a.EmitRel32(exit);
+    } else {
+      static const uint8_t kNext[] = {
+          0x85, 0xc0,  // test eax, eax
+          0x0f, 0x85   // jnz exit
+      };
+      a.Emit(kNext, sizeof(kNext));
+      a.EmitRel32(exit);
+    }
+  }
+
+  // The bytecode always ends with a return , nothing falls off the end
+  a.Emit(0x0f);  // ud2
+  a.Emit(0x0b);
+
+  for (size_t i = 0; i < fixup.size(); ++i) {
+    a.PatchRel32(fixup[i].first, entry[fixup[i].second]);
+  }
+
+  // Map the code as writable first and then flip it to executable
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t size = (a.size() + page - 1) / page * page;
+  void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) return NULL;
+  memcpy(memory, a.data(), a.size());
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, size);
+    return NULL;
+  }
+
+  JitCode* code = new JitCode();
+  code->m_code = static_cast<uint8_t*>(memory);
+  code->m_size = size;
+  code->m_entry.swap(entry);
+  return code;
+}
+
+int JitCode::Run(State* state, size_t pc) const {
+  DCHECK(pc < m_entry.size());
+  typedef int (*Entry)(State*, const void*);
+  Entry entry = reinterpret_cast<Entry>(m_code);
+  return entry(state, m_code + m_entry[pc]);
+}
+
+JitCode::~JitCode() { munmap(m_code, m_size); }
+
+#else
+
+bool JitCode::IsSupported() { return false; }
+
+JitCode* JitCode::Compile(const ThreadedCode& tc) {
+  VCL_UNUSED(tc);
+  return NULL;
+}
+
+int JitCode::Run(State* state, size_t pc) const {
+  VCL_UNUSED(state);
+  VCL_UNUSED(pc);
+  VCL_UNREACHABLE();
+  return JIT_INTERPRET;
+}
+
+JitCode::~JitCode() {}
+
+#endif  // __x86_64__
+
+}  // namespace vm
+}  // namespace vcl
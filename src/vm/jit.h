@@ -0,0 +1,80 @@
+#ifndef JIT_H_
+#define JIT_H_
+#include <vcl/vcl.h>
+#include <vector>
+
+namespace vcl {
+namespace vm {
+class Runtime;
+class ThreadedCode;
+
+// Baseline template JIT for the stack virtual machine. The ThreadedCode of a
+// hot Procedure is translated into x86-64 machine code , one template per
+// instruction. A template is just a call into a helper function which does
+// the same thing as the interpreter's handler , so all the slow paths of
+// Value/Object are shared. What we save is the dispatch , jumps are native
+// jumps and straight line code runs without any indirect branch.
+//
+// The native code uses exactly the same Frame and value stack as the
+// interpreter , so it can hand the execution back to the interpreter at any
+// instruction boundary. It does so for the instructions that change the
+// frame ( call , return and terminate ) , the instructions that have no
+// template and when the VM needs to yield. The interpreter enters the native
+// code again at its next safepoint , see Runtime::Main.
+class JitCode {
+ public:
+  // Status returned by helpers and by the native code
+  enum {
+    // Go on with the next instruction
+    JIT_NEXT = 0,
+    // Conditional jump is taken
+    JIT_BRANCH,
+    // Interpreter continues from Frame::pc
+    JIT_INTERPRET,
+    // Error happened , the status is set and Frame::pc is where it happened
+    JIT_FAIL,
+    // Safepoint is hit and the VM should yield , resume from Frame::pc
+    JIT_YIELD
+  };
+
+  // Execution state shared by the native code and helpers
+  struct State {
+    Runtime* runtime;
+    const ThreadedCode* code;
+    // Frame base of the procedure
+    size_t base;
+    // Safepoint budget of Runtime::Main
+    int64_t* budget;
+    // Status of a failed instruction
+    MethodStatus* result;
+  };
+
+  // Whether the JIT is able to generate code on this platform
+  static bool IsSupported();
+
+  // Translate the linked code of a Procedure , return NULL when it is not
+  // supported or the executable memory cannot be allocated
+  static JitCode* Compile(const ThreadedCode&);
+
+  // Run the native code from the instruction at index pc
+  int Run(State* state, size_t pc) const;
+
+  ~JitCode();
+
+ private:
+  JitCode() : m_code(NULL), m_size(0), m_entry() {}
+
+  // Executable memory
+  uint8_t* m_code;
+  size_t m_size;
+
+  // Offset of each instruction's template inside of m_code
+  std::vector<uint32_t> m_entry;
+
+  VCL_DISALLOW_COPY_AND_ASSIGN(JitCode);
+};
+
+}  // namespace vm
+}  // namespace vcl
+
+#endif  // JIT_H_
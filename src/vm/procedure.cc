@@ -1,29 +1,51 @@
 #include "procedure.h"
+#include "jit.h"
+#include "register-code.h"
+#include "threaded-code.h"
 #include "vcl-pri.h"
 #include "zone.h"
 
 namespace vcl {
 namespace vm {
-namespace {
-struct StringComparator {
-  bool operator()(const vcl::String* left,
-                  const zone::ZoneString* right) const {
-    return *left == right->data();
+
+Procedure::~Procedure() {
+  delete m_register_code;
+  delete m_threaded_code;
+  delete m_jit_code;
+  for (size_t i = 0; i < m_shape_array.size(); ++i) delete m_shape_array[i];
+}
+
+void Procedure::set_register_code(RegisterCode* code) {
+  delete m_register_code;
+  m_register_code = code;
+}
+
+void Procedure::set_threaded_code(ThreadedCode* code) {
+  delete m_threaded_code;
+  m_threaded_code = code;
+}
+
+const vcl::util::CodeLocation& Procedure::code_location(size_t pc) const {
+  if (m_register_code) {
+    pc = m_register_code->stack_pc(pc);
+  } else if (m_threaded_code) {
+    pc = m_threaded_code->offset(pc);
   }
-};
+  return m_code_buffer.code_location(pc);
+}
 
-struct StringStdStringComparator {
-  bool operator()(const vcl::String* left, const std::string& right) const {
-    return *left == right;
+void Procedure::InstallJitCode(JitCode* code) {
+  JitCode* expect = NULL;
+  if (code && !__sync_bool_compare_and_swap(&m_jit_code, expect, code)) {
+    delete code;  // Someone else was faster
   }
-};
-}  // namespace
+}
 
 int Procedure::Add(vcl::ImmutableGC* gc, zone::ZoneString* string) {
-  int index = Find<vcl::String*, zone::ZoneString*, StringComparator>(string);
+  int index = FindString(string->data());
   if (index < 0) {
     vcl::String* s = gc->NewString(string->data());
-    m_lit_array.push_back(detail::Value(s));
+    m_lit_array.push_back(vcl::Value(s));
     return static_cast<int>(m_lit_array.size() - 1);
   } else {
     return index;
@@ -32,11 +54,10 @@ int Procedure::Add(vcl::ImmutableGC* gc, zone::ZoneString* string) {
 
 // Just do a stupid copy and paste here
 int Procedure::Add(vcl::ImmutableGC* gc, const std::string& string) {
-  int index =
-      Find<vcl::String*, const std::string&, StringStdStringComparator>(string);
+  int index = FindString(string);
   if (index < 0) {
     vcl::String* s = gc->NewString(string);
-    m_lit_array.push_back(detail::Value(s));
+    m_lit_array.push_back(vcl::Value(s));
     return static_cast<int>(m_lit_array.size() - 1);
   } else {
     return index;
@@ -46,7 +67,36 @@ int Procedure::Add(vcl::ImmutableGC* gc, const std::string& string) {
 int Procedure::Add(vcl::ImmutableGC* gc, IPPattern* pattern) {
   vcl::InternalAllocator allocator(gc);
   vcl::ACL* new_acl = allocator.NewACL(pattern);
-  m_lit_array.push_back(detail::Value(new_acl));
+  m_lit_array.push_back(vcl::Value(new_acl));
+  return static_cast<int>(m_lit_array.size() - 1);
+}
+
+int Procedure::AddPrimitive(const vcl::Value& value) {
+  DCHECK(value.IsPrimitive());
+  for (size_t i = 0; i < m_lit_array.size(); ++i) {
+    const vcl::Value& v = m_lit_array[i];
+    if (v.type() != value.type()) continue;
+    bool equal = false;
+    switch (v.type()) {
+      case TYPE_INTEGER:
+        equal = v.GetInteger() == value.GetInteger();
+        break;
+      case TYPE_REAL:
+        equal = v.GetReal() == value.GetReal();
+        break;
+      case TYPE_SIZE:
+        equal = v.GetSize() == value.GetSize();
+        break;
+      case TYPE_DURATION:
+        equal = v.GetDuration() == value.GetDuration();
+        break;
+      default:
+        VCL_UNREACHABLE();
+        break;
+    }
+    if (equal) return static_cast<int>(i);
+  }
+  m_lit_array.push_back(value);
   return static_cast<int>(m_lit_array.size() - 1);
 }
 
@@ -54,24 +104,24 @@ void Procedure::Dump(std::ostream& output) const {
   output << "Protocol:" << m_protocol << "\n\n";
   // Const literal dump
   for (size_t i = 0; i < m_lit_array.size(); ++i) {
-    const detail::Value& v = m_lit_array[i];
-    switch (v.which()) {
-      case detail::VALUE_TYPE_INTEGER:
-        output << (i) << ". " << boost::get<int32_t>(v) << '\n';
+    const vcl::Value& v = m_lit_array[i];
+    switch (v.type()) {
+      case TYPE_INTEGER:
+        output << (i) << ". " << v.GetInteger() << '\n';
         break;
-      case detail::VALUE_TYPE_REAL:
-        output << (i) << ". " << boost::get<double>(v) << '\n';
+      case TYPE_REAL:
+        output << (i) << ". " << v.GetReal() << '\n';
         break;
-      case detail::VALUE_TYPE_STRING:
-        output << (i) << ". " << boost::get<vcl::String*>(v)->data() << '\n';
+      case TYPE_STRING:
+        output << (i) << ". " << v.GetString()->data() << '\n';
         break;
-      case detail::VALUE_TYPE_SIZE:
-        output << (i) << ". " << boost::get<vcl::util::Size>(v) << '\n';
+      case TYPE_SIZE:
+        output << (i) << ". " << v.GetSize() << '\n';
         break;
-      case detail::VALUE_TYPE_DURATION:
-        output << (i) << ". " << boost::get<vcl::util::Duration>(v) << '\n';
+      case TYPE_DURATION:
+        output << (i) << ". " << v.GetDuration() << '\n';
         break;
-      case detail::VALUE_TYPE_ACL:
+      case TYPE_ACL:
         output << (i) << ". "
                << "__acl__\n";
         break;
@@ -80,8 +130,22 @@ void Procedure::Dump(std::ostream& output) const {
         return;
     }
   }
+  // Shape of dict literal dump
+  for (size_t i = 0; i < m_shape_array.size(); ++i) {
+    const vcl::DictShape* shape = m_shape_array[i];
+    output << "shape " << (i) << ". ";
+    for (size_t j = 0; j < shape->size(); ++j) {
+      output << shape->key(j)->data() << ' ';
+    }
+    output << '\n';
+  }
   output << '\n';
   m_code_buffer.Serialize(output);
+
+  if (m_register_code) {
+    output << '\n';
+    m_register_code->Serialize(output);
+  }
 }
 
 }  // namespace vm
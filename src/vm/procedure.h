@@ -1,79 +1,23 @@
 #ifndef PROCEDURE_H_
 #define PROCEDURE_H_
-#include <boost/variant.hpp>
 #include <string>
 #include <vector>
 
-#include <vcl/util.h>
+#include <vcl/vcl.h>
 #include "bytecode.h"
 
 namespace vcl {
-class String;
-class ImmutableGC;
-class ACL;
-
 namespace vm {
 class Compiler;
 class IPPattern;
+class JitCode;
+class RegisterCode;
+class ThreadedCode;
 
 namespace zone {
 class ZoneString;
 }  // namespace zone
 
-namespace detail {
-
-typedef boost::variant<int32_t,
-                       double,
-                       vcl::String*,
-                       vcl::util::Size,
-                       vcl::util::Duration,
-                       vcl::ACL*>
-    Value;
-enum {
-  VALUE_TYPE_INTEGER,
-  VALUE_TYPE_REAL,
-  VALUE_TYPE_STRING,
-  VALUE_TYPE_SIZE,
-  VALUE_TYPE_DURATION,
-  VALUE_TYPE_ACL
-};
-
-template <typename T>
-struct type_to_id {
-  static const int value = -1;
-};
-
-template <typename T>
-struct type_to_rtype {
-  typedef T return_type;
-};
-
-#define DEFINE_TYPE_MAP(T, TT, RT) \
-  template <>                      \
-  struct type_to_id<T> {           \
-    static const int value = TT;   \
-  };                               \
-  template <>                      \
-  struct type_to_rtype<T> {        \
-    typedef RT return_type;        \
-  };
-
-DEFINE_TYPE_MAP(int32_t, VALUE_TYPE_INTEGER, int32_t)
-DEFINE_TYPE_MAP(double, VALUE_TYPE_REAL, double)
-DEFINE_TYPE_MAP(vcl::String*, VALUE_TYPE_STRING, vcl::String*)
-DEFINE_TYPE_MAP(vcl::util::Size, VALUE_TYPE_SIZE, const vcl::util::Size&)
-DEFINE_TYPE_MAP(vcl::util::Duration,
-                VALUE_TYPE_DURATION,
-                const vcl::util::Duration&)
-DEFINE_TYPE_MAP(vcl::ACL*, VALUE_TYPE_ACL, vcl::ACL*)
-
-#undef DEFINE_TYPE_MAP  // DEFINE_TYPE_MAP
-
-template <typename T>
-struct PrimitiveComparator {
-  bool operator()(const T& l, const T& r) const { return l == r; }
-};
-}  // namespace detail
 
 // Procedure is the implementation of SubRoutine object. SubRoutine object is
 // just
@@ -95,7 +39,15 @@ class Procedure {
         m_code_buffer(),
         m_protocol(protocol),
         m_arg_count(arg_count),
-        m_lit_array() {}
+        m_lit_array(),
+        m_shape_array(),
+        m_max_stack_size(0),
+        m_register_code(NULL),
+        m_threaded_code(NULL),
+        m_jit_code(NULL),
+        m_hotness(0) {}
+
+  ~Procedure();
 
  public:  // Protocol related
   const std::string& name() const { return m_name; }
@@ -107,85 +59,119 @@ class Procedure {
 
   const BytecodeBuffer& code_buffer() const { return m_code_buffer; }
 
+  // Source code location of an instruction. The pc is an index of the code
+  // the Procedure is running with , the register code when it is lowered ,
+  // the ThreadedCode otherwise , just like Frame::pc of Runtime
+  const vcl::util::CodeLocation& code_location(size_t pc) const;
+
+  // Maximum depth of the value stack counted from the frame base , including
+  // the arguments. It is computed by the compiler and reserved by Runtime
+  // when a frame of this procedure is entered.
+  size_t max_stack_size() const { return m_max_stack_size; }
+  void set_max_stack_size(size_t size) { m_max_stack_size = size; }
+
+  // Register code lowered from the stack bytecode. It is only available when
+  // the Engine is configured to run the register virtual machine, otherwise
+  // it is NULL.
+  RegisterCode* register_code() const { return m_register_code; }
+  void set_register_code(RegisterCode* code);
+
+  // Pre-decoded bytecode used by the stack virtual machine , see
+  // threaded-code.h
+  const ThreadedCode* threaded_code() const { return m_threaded_code; }
+  void set_threaded_code(ThreadedCode* code);
+
+  // Native code generated by the baseline JIT , see jit.h. A Procedure is
+  // shared by all the Contexts of a CompiledCode which may run in different
+  // threads , so the code is installed only once and is never replaced.
+  const JitCode* jit_code() const {
+    return __atomic_load_n(&m_jit_code, __ATOMIC_ACQUIRE);
+  }
+  void InstallJitCode(JitCode* code);
+
+  // How many times the Procedure is entered , returns the new count
+  uint32_t IncreaseHotness() { return __sync_add_and_fetch(&m_hotness, 1); }
+
   // Dump the code to output
   void Dump(std::ostream& output) const;
 
  public:
   int Add(vcl::ImmutableGC* gc, zone::ZoneString* str);
   int Add(vcl::ImmutableGC* gc, const std::string&);
-  int Add(int32_t value) {
-    return AddImpl<int32_t, detail::PrimitiveComparator<int32_t> >(value);
-  }
-  int Add(double value) {
-    return AddImpl<double, detail::PrimitiveComparator<double> >(value);
-  }
+  int Add(int32_t value) { return AddPrimitive(vcl::Value(value)); }
+  int Add(double value) { return AddPrimitive(vcl::Value(value)); }
   int Add(const vcl::util::Size& value) {
-    return AddImpl<vcl::util::Size,
-                   detail::PrimitiveComparator<vcl::util::Size> >(value);
+    return AddPrimitive(vcl::Value(value));
   }
   int Add(const vcl::util::Duration& value) {
-    return AddImpl<vcl::util::Duration,
-                   detail::PrimitiveComparator<vcl::util::Duration> >(value);
+    return AddPrimitive(vcl::Value(value));
   }
   int Add(vcl::ImmutableGC*, IPPattern*);
 
+  // Take the ownership of a DictShape of a dict literal , returns its index
+  int AddShape(vcl::DictShape* shape) {
+    m_shape_array.push_back(shape);
+    return static_cast<int>(m_shape_array.size() - 1);
+  }
+
  public:
-  template <typename T>
-  typename detail::type_to_rtype<T>::return_type Index(int index) const {
+  // Literals are stored as Value object directly , so the interpreter can
+  // just copy it onto the stack
+  const vcl::Value& IndexLiteral(int index) const {
     DCHECK(index < static_cast<int>(m_lit_array.size()));
-    DCHECK(detail::type_to_id<T>::value != -1);
-    const detail::Value& v = m_lit_array[index];
-    DCHECK(v.which() == detail::type_to_id<T>::value);
-    return boost::get<T>(v);
+    return m_lit_array[index];
   }
 
-  int32_t IndexInteger(int index) const { return Index<int32_t>(index); }
+  int32_t IndexInteger(int index) const {
+    return IndexLiteral(index).GetInteger();
+  }
 
-  double IndexReal(int index) const { return Index<double>(index); }
+  double IndexReal(int index) const { return IndexLiteral(index).GetReal(); }
 
   vcl::String* IndexString(int index) const {
-    return Index<vcl::String*>(index);
+    return IndexLiteral(index).GetString();
   }
 
-  const vcl::util::Size& IndexSize(int index) const {
-    return Index<vcl::util::Size>(index);
+  vcl::util::Size IndexSize(int index) const {
+    return IndexLiteral(index).GetSize();
   }
 
-  const vcl::util::Duration& IndexDuration(int index) const {
-    return Index<vcl::util::Duration>(index);
+  vcl::util::Duration IndexDuration(int index) const {
+    return IndexLiteral(index).GetDuration();
   }
 
-  vcl::ACL* IndexACL(int index) const { return Index<vcl::ACL*>(index); }
+  vcl::ACL* IndexACL(int index) const { return IndexLiteral(index).GetACL(); }
+
+  const vcl::DictShape* IndexShape(int index) const {
+    DCHECK(index < static_cast<int>(m_shape_array.size()));
+    return m_shape_array[index];
+  }
 
  private:
-  template <typename T, typename IT, typename CMP>
-  int Find(IT value) {
+  // Find a string literal that equals to the input
+  template <typename T>
+  int FindString(const T& string) const {
     for (size_t i = 0; i < m_lit_array.size(); ++i) {
-      detail::Value& v = m_lit_array[i];
-      if (v.which() == detail::type_to_id<T>::value &&
-          CMP()(boost::get<T>(v), value))
-        return static_cast<int>(i);
+      const vcl::Value& v = m_lit_array[i];
+      if (v.IsString() && *v.GetString() == string) return static_cast<int>(i);
     }
     return -1;
   }
 
-  template <typename T, typename CMP>
-  int AddImpl(T value) {
-    int index = Find<T, T, CMP>(value);
-    if (index < 0) {
-      m_lit_array.push_back(detail::Value(value));
-      return static_cast<int>(m_lit_array.size() - 1);
-    } else {
-      return index;
-    }
-  }
+  int AddPrimitive(const vcl::Value&);
 
   std::string m_name;
   BytecodeBuffer m_code_buffer;
   std::string m_protocol;
   size_t m_arg_count;
-  typedef std::vector<detail::Value> LiteralArray;
+  typedef std::vector<vcl::Value> LiteralArray;
   LiteralArray m_lit_array;
+  std::vector<vcl::DictShape*> m_shape_array;
+  size_t m_max_stack_size;
+  RegisterCode* m_register_code;
+  ThreadedCode* m_threaded_code;
+  JitCode* m_jit_code;
+  uint32_t m_hotness;
   friend class Compiler;
 };
 
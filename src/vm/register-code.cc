@@ -0,0 +1,48 @@
+#include "register-code.h"
+
+namespace vcl {
+namespace vm {
+
+const char* RegisterBytecodeGetName(RegisterBytecode bc) {
+  switch (bc) {
+#define __(A, B) \
+  case A:        \
+    return #B;
+    VCL_REGISTER_BYTECODE_LIST(__)
+    default:
+      return NULL;
+#undef __  // __
+  }
+}
+
+namespace {
+
+void SerializeRK(std::ostream& output, uint32_t rk) {
+  if (RKIsConstant(rk))
+    output << "K" << RKIndex(rk);
+  else
+    output << "R" << rk;
+}
+
+}  // namespace
+
+void RegisterCode::Serialize(std::ostream& output) const {
+  output << "Registers:" << m_register_size << '\n';
+  for (size_t i = 0; i < m_constants.size(); ++i) {
+    output << "K" << i << ". ";
+    m_constants[i].ToDisplay(NULL, &output);
+    output << '\n';
+  }
+
+  for (size_t i = 0; i < m_instructions.size(); ++i) {
+    const Instruction& instr = m_instructions[i];
+    output << i << "  " << RegisterBytecodeGetName(instr.opcode()) << "  ";
+    SerializeRK(output, instr.a);
+    output << ' ';
+    SerializeRK(output, instr.b);
+    output << ' ' << instr.c << '\n';
+  }
+}
+
+}  // namespace vm
+}  // namespace vcl
@@ -0,0 +1,234 @@
+#ifndef REGISTER_CODE_H_
+#define REGISTER_CODE_H_
+#include <vcl/vcl.h>
+#include <iostream>
+#include <vector>
+
+namespace vcl {
+namespace vm {
+
+// Register based instruction set. This is an alternative to the stack based
+// bytecode inside of bytecode.h. Instead of pushing and popping the operand
+// stack for every single operation, each instruction names its operands
+// directly as slots inside of the current frame , so a statement like
+// "set x = a + b" becomes one instruction instead of four.
+//
+// The register code is *not* generated from AST directly but lowered from
+// the stack bytecode of each Procedure. The stack bytecode is well structured,
+// so each stack position at each pc has a static depth and we simply use that
+// depth as the register number. Loads of locals and literals are delayed on
+// a virtual stack during lowering and folded into the operands of the user
+// instruction , which is where the dispatch saving comes from.
+//
+// Each instruction has a fixed layout with 3 operands:
+//
+// ------------------------------
+// | OP  |  A    |  B   |  C    |
+// ------------------------------
+// | 4   |  4    |  4   |  4    |
+// ------------------------------
+//
+// An operand documented as RK can be either a register or a constant. When
+// the kRKConstant bit is set the rest of the bits is an index into the
+// constant table of the RegisterCode object, otherwise it is a register index
+// relative to the frame base. An operand documented as S is an index of the
+// string literal of the Procedure , and G is the global variable slot , see
+// CompiledCode::global_slot_size.
+
+#define VCL_REGISTER_BYTECODE_LIST(__)                    \
+  /* R(A) = RK(B) */                                      \
+  __(RBC_MOVE, move)                                      \
+  /* R(A) = RK(B) op RK(C) */                             \
+  __(RBC_ADD, add)                                        \
+  __(RBC_SUB, sub)                                        \
+  __(RBC_MUL, mul)                                        \
+  __(RBC_DIV, div)                                        \
+  __(RBC_MOD, mod)                                        \
+  __(RBC_LT, lt)                                          \
+  __(RBC_LE, le)                                          \
+  __(RBC_GT, gt)                                          \
+  __(RBC_GE, ge)                                          \
+  __(RBC_EQ, eq)                                          \
+  __(RBC_NE, ne)                                          \
+  __(RBC_MATCH, match)                                    \
+  __(RBC_NOT_MATCH, nmatch)                               \
+  /* R(A) = op RK(B) */                                   \
+  __(RBC_NEGATE, negate)                                  \
+  __(RBC_TEST, test)                                      \
+  __(RBC_FLIP, flip)                                      \
+  __(RBC_CSTR, cstr)                                      \
+  __(RBC_CINT, cint)                                      \
+  __(RBC_CREAL, creal)                                    \
+  __(RBC_CBOOL, cbool)                                    \
+  __(RBC_TYPE, type)                                      \
+  /* R(A) op= RK(B) */                                    \
+  __(RBC_SADD, sadd)                                      \
+  __(RBC_SSUB, ssub)                                      \
+  __(RBC_SMUL, smul)                                      \
+  __(RBC_SDIV, sdiv)                                      \
+  __(RBC_SMOD, smod)                                      \
+  __(RBC_UNSET, unset)                                    \
+  /* R(A) = literal built from R(A) ... R(A+C) */         \
+  __(RBC_LDICT, ldict)                                    \
+  __(RBC_LLIST, llist)                                    \
+  __(RBC_LEXT, lext)                                      \
+  __(RBC_SCAT, scat)                                      \
+  __(RBC_CONCAT, concat)                                  \
+  /* R(A) = Dict of shape C with values R(A) ... */       \
+  __(RBC_LSDICT, lsdict)                                  \
+  /* Jump, B is the target */                             \
+  __(RBC_JMP, jmp)                                        \
+  __(RBC_JT, jt)                                          \
+  __(RBC_JF, jf)                                          \
+  __(RBC_BRT, brt)                                        \
+  __(RBC_BRF, brf)                                        \
+  /* Property , R(A) = RK(B).S(C) and RK(B).S(C) = RK(A) */ \
+  __(RBC_PGET, pget)                                      \
+  __(RBC_PSET, pset)                                      \
+  __(RBC_PSADD, psadd)                                    \
+  __(RBC_PSSUB, pssub)                                    \
+  __(RBC_PSMUL, psmul)                                    \
+  __(RBC_PSDIV, psdiv)                                    \
+  __(RBC_PSMOD, psmod)                                    \
+  __(RBC_PUNSET, punset)                                  \
+  /* Attribute */                                         \
+  __(RBC_AGET, aget)                                      \
+  __(RBC_ASET, aset)                                      \
+  __(RBC_ASADD, asadd)                                    \
+  __(RBC_ASSUB, assub)                                    \
+  __(RBC_ASMUL, asmul)                                    \
+  __(RBC_ASDIV, asdiv)                                    \
+  __(RBC_ASMOD, asmod)                                    \
+  __(RBC_AUNSET, aunset)                                  \
+  /* Index , R(A) = RK(B)[RK(C)] and RK(B)[RK(C)] = RK(A) */ \
+  __(RBC_IGET, iget)                                      \
+  __(RBC_ISET, iset)                                      \
+  __(RBC_ISADD, isadd)                                    \
+  __(RBC_ISSUB, issub)                                    \
+  __(RBC_ISMUL, ismul)                                    \
+  __(RBC_ISDIV, isdiv)                                    \
+  __(RBC_ISMOD, ismod)                                    \
+  __(RBC_IUNSET, iunset)                                  \
+  /* Global , R(A) = G[C] and G[C] = RK(A) */             \
+  __(RBC_GLOAD, gload)                                    \
+  __(RBC_GSET, gset)                                      \
+  __(RBC_GSADD, gsadd)                                    \
+  __(RBC_GSSUB, gssub)                                    \
+  __(RBC_GSMUL, gsmul)                                    \
+  __(RBC_GSDIV, gsdiv)                                    \
+  __(RBC_GSMOD, gsmod)                                    \
+  __(RBC_GUNSET, gunset)                                  \
+  /* Loop , R(A) is the iterator slot */                  \
+  __(RBC_FORPREP, forprep)                                \
+  __(RBC_FOREND, forend)                                  \
+  __(RBC_ITERK, iterk)                                    \
+  __(RBC_ITERV, iterv)                                    \
+  /* Misc */                                              \
+  __(RBC_DEBUG, debug)                                    \
+  __(RBC_IMPORT, import)                                  \
+  __(RBC_CALL, call)                                      \
+  __(RBC_TAILCALL, tailcall)                              \
+  __(RBC_TERM, term)                                      \
+  __(RBC_RET, ret)                                        \
+  __(RBC_GSUB, gsub)                                      \
+  __(RBC_LSUB, lsub)
+
+enum RegisterBytecode {
+#define __(A, B) A,
+  VCL_REGISTER_BYTECODE_LIST(__) SIZE_OF_REGISTER_BYTECODE
+#undef __  // __
+};
+
+const char* RegisterBytecodeGetName(RegisterBytecode);
+
+// Bit used to mark an RK operand as constant table index
+static const uint32_t kRKConstant = 0x80000000;
+
+inline bool RKIsConstant(uint32_t rk) { return (rk & kRKConstant) != 0; }
+inline uint32_t RKConstant(uint32_t index) { return index | kRKConstant; }
+inline uint32_t RKIndex(uint32_t rk) { return rk & ~kRKConstant; }
+
+class RegisterCode {
+ public:
+  struct Instruction {
+    uint32_t op;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+
+    RegisterBytecode opcode() const {
+      return static_cast<RegisterBytecode>(op);
+    }
+  };
+
+  RegisterCode()
+      : m_instructions(), m_stack_pc(), m_constants(), m_register_size(0) {}
+
+ public:
+  size_t Emit(size_t stack_pc,
+              RegisterBytecode op,
+              uint32_t a = 0,
+              uint32_t b = 0,
+              uint32_t c = 0) {
+    Instruction instr = {static_cast<uint32_t>(op), a, b, c};
+    m_instructions.push_back(instr);
+    m_stack_pc.push_back(stack_pc);
+    return m_instructions.size() - 1;
+  }
+
+  uint32_t AddConstant(const Value& value) {
+    m_constants.push_back(value);
+    return static_cast<uint32_t>(m_constants.size() - 1);
+  }
+
+ public:  // Accessors
+  size_t size() const { return m_instructions.size(); }
+
+  Instruction& Index(size_t pc) {
+    DCHECK(pc < m_instructions.size());
+    return m_instructions[pc];
+  }
+
+  const Instruction& Index(size_t pc) const {
+    DCHECK(pc < m_instructions.size());
+    return m_instructions[pc];
+  }
+
+  const Instruction* instructions() const {
+    return vcl::util::VectorAsArray(m_instructions);
+  }
+
+  const Value* constants() const {
+    return m_constants.empty() ? NULL : vcl::util::VectorAsArray(m_constants);
+  }
+
+  size_t constant_size() const { return m_constants.size(); }
+
+  // Map a register instruction back to the stack bytecode it is lowered from,
+  // which is where the source code location information lives.
+  size_t stack_pc(size_t pc) const {
+    return pc < m_stack_pc.size() ? m_stack_pc[pc] : 0;
+  }
+
+  // How many registers ( value slots ) the frame needs
+  size_t register_size() const { return m_register_size; }
+  void set_register_size(size_t size) { m_register_size = size; }
+
+  void Serialize(std::ostream& output) const;
+
+ private:
+  std::vector<Instruction> m_instructions;
+  std::vector<size_t> m_stack_pc;
+
+  // Constant table. All object inside of it are allocated from ImmutableGC
+  // so we don't need to mark it.
+  std::vector<Value> m_constants;
+  size_t m_register_size;
+
+  VCL_DISALLOW_COPY_AND_ASSIGN(RegisterCode);
+};
+
+}  // namespace vm
+}  // namespace vcl
+
+#endif  // REGISTER_CODE_H_
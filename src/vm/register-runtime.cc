@@ -0,0 +1,792 @@
+#include "runtime.h"
+#include "register-code.h"
+
+namespace vcl {
+namespace vm {
+
+#define verify(XX)                                                   \
+  do {                                                               \
+    switch ((XX).status()) {                                         \
+      case MethodStatus::METHOD_OK:                                  \
+        break;                                                       \
+      case MethodStatus::METHOD_FAIL:                                \
+        goto fail;                                                   \
+      case MethodStatus::METHOD_YIELD:                               \
+      case MethodStatus::METHOD_TERMINATE:                           \
+        result.set_fail(                                             \
+            "invalid method return status %s in operator function!", \
+            (XX).status_name());                                     \
+        goto fail;                                                   \
+      case MethodStatus::METHOD_UNIMPLEMENTED:                       \
+        goto fail;                                                   \
+    }                                                                \
+  } while (false)
+
+// Interpreter for register code. It shares the Frame layout , the value stack
+// and the calling convention with the stack virtual machine inside of
+// runtime.cc : a frame's registers are just the value stack slots starting at
+// the frame base , the arguments are the first few registers. The only
+// difference is that the value stack of a frame is sized to register_size()
+// once the frame is entered instead of growing and shrinking on each bytecode.
+MethodStatus Runtime::RegisterMain(Value* output, int64_t instr_count) {
+  DCHECK(instr_count > 0);
+  detail::VMGuard guard(this);
+
+  // Result of execution
+  MethodStatus result = MethodStatus::kOk;
+
+  // CompiledCode object for current context
+  CompiledCode* cc = context()->compiled_code();
+
+  // Current executed SubRoutine object
+  SubRoutine* sub_routine = CurrentFrame()->sub_routine();
+
+  // Current Procedure object
+  Procedure* procedure = sub_routine->procedure();
+
+  // Register code of the current Procedure
+  RegisterCode* rc = procedure->register_code();
+  DCHECK(rc);
+
+  // Instruction array and current instruction position
+  const RegisterCode::Instruction* code = rc->instructions();
+  size_t pc = CurrentFrame()->pc;
+
+  // Constant table
+  const Value* constants = rc->constants();
+
+  // Base pointer for current execution frame
+  size_t base = CurrentFrame()->base;
+
+  ReserveStack(base + rc->register_size());
+  SetStackSize(base + rc->register_size());
+
+  // Jump table for threading interpretation
+  static void* kLabels[] = {
+#define __(A, B) &&LABEL_##A,
+      VCL_REGISTER_BYTECODE_LIST(__) NULL};
+#undef __  // __
+
+#define A (code[pc].a)
+#define B (code[pc].b)
+#define C (code[pc].c)
+
+#define R(X) (StackBegin()[base + (X)])
+#define RK(X) (RKIsConstant(X) ? constants[RKIndex(X)] : R(X))
+
+#define dispatch()                                                  \
+  do {                                                              \
+    DCHECK(pc < rc->size());                                        \
+    const void* target = kLabels[static_cast<size_t>(code[pc].op)]; \
+    goto* target;                                                   \
+  } while (false)
+
+// Yield and instruction budget check , same as Runtime::Main it is only done
+// at jump , call and return. RBC_JMP is checked since break and continue are
+// lowered into it
+#define safepoint()                     \
+  do {                                  \
+    if (m_sample) {                     \
+      TakeSample(pc);                   \
+    }                                   \
+    if (--instr_count < 0 || m_yield) { \
+      goto yield;                       \
+    }                                   \
+  } while (false)
+
+#define next()   \
+  do {           \
+    ++pc;        \
+    dispatch();  \
+  } while (false)
+
+#define jump(TARGET) \
+  do {               \
+    pc = (TARGET);   \
+    dispatch();      \
+  } while (false)
+
+// Flush all the cached frame status , used after function call/return
+#define reload_frame()                               \
+  do {                                               \
+    sub_routine = CurrentFrame()->sub_routine();     \
+    procedure = sub_routine->procedure();            \
+    rc = procedure->register_code();                 \
+    DCHECK(rc);                                      \
+    code = rc->instructions();                       \
+    constants = rc->constants();                     \
+    pc = CurrentFrame()->pc;                         \
+    base = CurrentFrame()->base;                     \
+    ReserveStack(base + rc->register_size());        \
+    SetStackSize(base + rc->register_size());        \
+  } while (false)
+
+  dispatch();
+
+#define vm_instr(BYTECODE) LABEL_##BYTECODE:
+
+  vm_instr(RBC_MOVE) {
+    R(A) = RK(B);
+    next();
+  }
+
+#define NONZERO(X) ((X) != 0)
+#define ANY(X) ((void)(X), true)
+
+#define XX(RBC, METHOD, OPER, PRED)                                 \
+  vm_instr(RBC) {                                                   \
+    const Value& lhs = RK(B);                                       \
+    const Value& rhs = RK(C);                                       \
+    if (lhs.IsInteger() && rhs.IsInteger() && PRED(rhs.GetInteger())) { \
+      R(A).SetInteger(lhs.GetInteger() OPER rhs.GetInteger());      \
+    } else {                                                        \
+      verify((result = lhs.METHOD(context(), rhs, &m_v0)));         \
+      R(A) = m_v0;                                                  \
+    }                                                               \
+    next();                                                         \
+  }
+
+  XX(RBC_ADD, Add, +, ANY)
+  XX(RBC_SUB, Sub, -, ANY)
+  XX(RBC_MUL, Mul, *, ANY)
+  XX(RBC_DIV, Div, /, NONZERO)
+  XX(RBC_MOD, Mod, %, NONZERO)
+
+#undef XX       // XX
+#undef ANY      // ANY
+#undef NONZERO  // NONZERO
+
+#define XX(RBC, METHOD, OPER)                                \
+  vm_instr(RBC) {                                            \
+    const Value& lhs = RK(B);                                \
+    const Value& rhs = RK(C);                                \
+    bool v;                                                  \
+    if (lhs.IsInteger() && rhs.IsInteger()) {                \
+      v = lhs.GetInteger() OPER rhs.GetInteger();            \
+    } else {                                                 \
+      verify((result = lhs.METHOD(context(), rhs, &v)));     \
+    }                                                        \
+    R(A).SetBoolean(v);                                      \
+    next();                                                  \
+  }
+
+  XX(RBC_LT, Less, <)
+  XX(RBC_LE, LessEqual, <=)
+  XX(RBC_GT, Greater, >)
+  XX(RBC_GE, GreaterEqual, >=)
+  XX(RBC_EQ, Equal, ==)
+  XX(RBC_NE, NotEqual, !=)
+
+#undef XX  // XX
+
+  vm_instr(RBC_MATCH) {
+    bool v;
+    verify((result = RK(B).Match(context(), RK(C), &v)));
+    R(A).SetBoolean(v);
+    next();
+  }
+
+  vm_instr(RBC_NOT_MATCH) {
+    bool v;
+    verify((result = RK(B).NotMatch(context(), RK(C), &v)));
+    R(A).SetBoolean(v);
+    next();
+  }
+
+  vm_instr(RBC_NEGATE) {
+    const Value& v = RK(B);
+    if (v.IsInteger()) {
+      R(A).SetInteger(-v.GetInteger());
+    } else if (v.IsReal()) {
+      R(A).SetReal(-v.GetReal());
+    } else {
+      result.set_fail("type %s doesn't support unary operator \"-\".",
+                      v.type_name());
+      goto fail;
+    }
+    next();
+  }
+
+  vm_instr(RBC_TEST) {
+    bool b;
+    verify((result = RK(B).ToBoolean(context(), &b)));
+    R(A).SetBoolean(b);
+    next();
+  }
+
+  vm_instr(RBC_FLIP) {
+    bool b;
+    verify((result = RK(B).ToBoolean(context(), &b)));
+    R(A).SetBoolean(!b);
+    next();
+  }
+
+  vm_instr(RBC_CSTR) {
+    m_v0 = RK(B);
+    String* pstring;
+    if (!Value::ConvertToString(context(), m_v0, &pstring)) {
+      result = MethodStatus::NewFail("type %s cannot be converted to string",
+                                     m_v0.type_name());
+      goto fail;
+    }
+    R(A).SetString(pstring);
+    next();
+  }
+
+  vm_instr(RBC_CINT) {
+    m_v0 = RK(B);
+    int32_t val;
+    if (!Value::ConvertToInteger(context(), m_v0, &val)) {
+      result = MethodStatus::NewFail("type %s cannot be converted to boolean",
+                                     m_v0.type_name());
+      goto fail;
+    }
+    R(A).SetInteger(val);
+    next();
+  }
+
+  vm_instr(RBC_CREAL) {
+    m_v0 = RK(B);
+    double val;
+    if (!Value::ConvertToReal(context(), m_v0, &val)) {
+      result = MethodStatus::NewFail("type %s cannot be converted to real",
+                                     m_v0.type_name());
+      goto fail;
+    }
+    R(A).SetReal(val);
+    next();
+  }
+
+  vm_instr(RBC_CBOOL) {
+    m_v0 = RK(B);
+    bool val;
+    if (!Value::ConvertToBoolean(context(), m_v0, &val)) {
+      result = MethodStatus::NewFail("type %s cannot be converted to boolean",
+                                     m_v0.type_name());
+      goto fail;
+    }
+    R(A).SetBoolean(val);
+    next();
+  }
+
+  vm_instr(RBC_TYPE) {
+    String* name = gc()->NewString(RK(B).type_name());
+    R(A).SetString(name);
+    next();
+  }
+
+#define XX(RBC, METHOD)                                     \
+  vm_instr(RBC) {                                           \
+    m_v0 = RK(B);                                           \
+    verify((result = R(A).METHOD(context(), m_v0)));        \
+    next();                                                 \
+  }
+
+  XX(RBC_SADD, SelfAdd)
+  XX(RBC_SSUB, SelfSub)
+  XX(RBC_SMUL, SelfMul)
+  XX(RBC_SDIV, SelfDiv)
+  XX(RBC_SMOD, SelfMod)
+
+#undef XX  // XX
+
+  vm_instr(RBC_UNSET) {
+    verify((result = R(A).Unset(context())));
+    next();
+  }
+
+  vm_instr(RBC_LDICT) {
+    Dict* dict = gc()->NewDict();
+    m_v0.SetDict(dict);
+
+    for (uint32_t i = 0; i < C; ++i) {
+      const Value& k = R(A + 2 * i);
+      const Value& v = R(A + 2 * i + 1);
+      if (k.IsString()) {
+        dict->InsertOrUpdate(*k.GetString(), v);
+      } else {
+        result.set_fail("dictionary's key must be string!");
+        goto fail;
+      }
+    }
+    R(A) = m_v0;
+    next();
+  }
+
+  vm_instr(RBC_LSDICT) {
+    const DictShape* shape = procedure->IndexShape(C);
+    Dict* dict = gc()->NewDict(shape);
+    m_v0.SetDict(dict);
+
+    for (size_t i = 0; i < shape->size(); ++i) {
+      dict->shape_value(i) = R(A + i);
+    }
+    R(A) = m_v0;
+    next();
+  }
+
+  vm_instr(RBC_LLIST) {
+    List* list = gc()->NewList(C);
+    m_v0.SetList(list);
+
+    for (uint32_t i = 0; i < C; ++i) {
+      list->Push(R(A + i));
+    }
+    R(A) = m_v0;
+    next();
+  }
+
+  vm_instr(RBC_LEXT) {
+    const Value& ext_name = R(A);
+    DCHECK(ext_name.IsString());
+    ExtensionFactory* factory = GetExtensionFactory(*ext_name.GetString());
+    if (!factory) {
+      result.set_fail("cannot find extension type %s!",
+                      ext_name.GetString()->data());
+      goto fail;
+    }
+
+    {
+      Extension* ext = factory->NewExtension(context());
+      if (!ext) {
+        result.set_fail("cannot new extension with type %s!",
+                        ext_name.GetString()->data());
+        goto fail;
+      }
+      m_v0.SetExtension(ext);
+      for (uint32_t i = 0; i < C; ++i) {
+        const Value& k = R(A + 2 * i + 1);
+        const Value& v = R(A + 2 * i + 2);
+        DCHECK(k.IsString());
+        verify((result = ext->SetProperty(context(), *k.GetString(), v)));
+      }
+    }
+    R(A) = m_v0;
+    next();
+  }
+
+  // Same as BC_SCAT and BC_CONCAT , the pieces are formatted into m_concat
+  vm_instr(RBC_SCAT) {
+    m_concat.clear();
+    for (uint32_t i = 0; i < C; ++i) {
+      verify((result = AppendString(R(A + i), true)));
+    }
+    R(A).SetString(gc()->NewString(m_concat));
+    next();
+  }
+
+  vm_instr(RBC_CONCAT) {
+    m_concat.clear();
+    for (uint32_t i = 0; i < C; ++i) {
+      verify((result = AppendString(R(A + i), false)));
+    }
+    R(A).SetString(gc()->NewString(m_concat));
+    next();
+  }
+
+  vm_instr(RBC_JMP) {
+    pc = B;
+    safepoint();
+    dispatch();
+  }
+
+  vm_instr(RBC_JT) {
+    bool b;
+    verify((result = RK(A).ToBoolean(context(), &b)));
+    if (b) jump(B);
+    next();
+  }
+
+  vm_instr(RBC_JF) {
+    bool b;
+    verify((result = RK(A).ToBoolean(context(), &b)));
+    if (!b) jump(B);
+    next();
+  }
+
+  vm_instr(RBC_BRT) {
+    bool b;
+    verify((result = R(A).ToBoolean(context(), &b)));
+    if (b) {
+      R(A).SetTrue();
+      jump(B);
+    }
+    next();
+  }
+
+  vm_instr(RBC_BRF) {
+    bool b;
+    verify((result = R(A).ToBoolean(context(), &b)));
+    if (!b) {
+      R(A).SetFalse();
+      jump(B);
+    }
+    next();
+  }
+
+  // Property and attribute , the key is the string literal C of Procedure
+  vm_instr(RBC_PGET) {
+    String* key = procedure->IndexString(C);
+    verify((result = RK(B).GetProperty(context(), *key, &m_v0)));
+    R(A) = m_v0;
+    next();
+  }
+
+  vm_instr(RBC_PSET) {
+    String* key = procedure->IndexString(C);
+    m_v1 = RK(B);
+    verify((result = m_v1.SetProperty(context(), *key, RK(A))));
+    next();
+  }
+
+  vm_instr(RBC_AGET) {
+    String* key = procedure->IndexString(C);
+    verify((result = RK(B).GetAttribute(context(), *key, &m_v0)));
+    R(A) = m_v0;
+    next();
+  }
+
+  vm_instr(RBC_ASET) {
+    String* key = procedure->IndexString(C);
+    m_v1 = RK(B);
+    verify((result = m_v1.SetAttribute(context(), *key, RK(A))));
+    next();
+  }
+
+#define XX(RBC, GETTER, SETTER, METHOD)                              \
+  vm_instr(RBC) {                                                    \
+    String* key = procedure->IndexString(C);                         \
+    m_v1 = RK(B);                                                    \
+    verify((result = m_v1.GETTER(context(), *key, &m_v0)));          \
+    Object* before = ObjectOf(m_v0);                                 \
+    verify((result = m_v0.METHOD(context(), RK(A))));                \
+    if (IsReplaced(m_v0, before)) {                                  \
+      verify((result = m_v1.SETTER(context(), *key, m_v0)));         \
+    }                                                                \
+    next();                                                          \
+  }
+
+  XX(RBC_PSADD, GetProperty, SetProperty, SelfAdd)
+  XX(RBC_PSSUB, GetProperty, SetProperty, SelfSub)
+  XX(RBC_PSMUL, GetProperty, SetProperty, SelfMul)
+  XX(RBC_PSDIV, GetProperty, SetProperty, SelfDiv)
+  XX(RBC_PSMOD, GetProperty, SetProperty, SelfMod)
+
+  XX(RBC_ASADD, GetAttribute, SetAttribute, SelfAdd)
+  XX(RBC_ASSUB, GetAttribute, SetAttribute, SelfSub)
+  XX(RBC_ASMUL, GetAttribute, SetAttribute, SelfMul)
+  XX(RBC_ASDIV, GetAttribute, SetAttribute, SelfDiv)
+  XX(RBC_ASMOD, GetAttribute, SetAttribute, SelfMod)
+
+#undef XX  // XX
+
+#define XX(RBC, GETTER, SETTER)                                      \
+  vm_instr(RBC) {                                                    \
+    String* key = procedure->IndexString(C);                         \
+    m_v1 = RK(B);                                                    \
+    verify((result = m_v1.GETTER(context(), *key, &m_v0)));          \
+    Object* before = ObjectOf(m_v0);                                 \
+    verify((result = m_v0.Unset(context())));                        \
+    if (IsReplaced(m_v0, before)) {                                  \
+      verify((result = m_v1.SETTER(context(), *key, m_v0)));         \
+    }                                                                \
+    next();                                                          \
+  }
+
+  XX(RBC_PUNSET, GetProperty, SetProperty)
+  XX(RBC_AUNSET, GetAttribute, SetAttribute)
+
+#undef XX  // XX
+
+  vm_instr(RBC_IGET) {
+    verify((result = RK(B).GetIndex(context(), RK(C), &m_v0)));
+    R(A) = m_v0;
+    next();
+  }
+
+  vm_instr(RBC_ISET) {
+    m_v1 = RK(B);
+    verify((result = m_v1.SetIndex(context(), RK(C), RK(A))));
+    next();
+  }
+
+#define XX(RBC, METHOD)                                         \
+  vm_instr(RBC) {                                               \
+    m_v1 = RK(B);                                               \
+    verify((result = m_v1.GetIndex(context(), RK(C), &m_v0)));  \
+    Object* before = ObjectOf(m_v0);                            \
+    verify((result = m_v0.METHOD(context(), RK(A))));           \
+    if (IsReplaced(m_v0, before)) {                             \
+      verify((result = m_v1.SetIndex(context(), RK(C), m_v0))); \
+    }                                                           \
+    next();                                                     \
+  }
+
+  XX(RBC_ISADD, SelfAdd)
+  XX(RBC_ISSUB, SelfSub)
+  XX(RBC_ISMUL, SelfMul)
+  XX(RBC_ISDIV, SelfDiv)
+  XX(RBC_ISMOD, SelfMod)
+
+#undef XX  // XX
+
+  vm_instr(RBC_IUNSET) {
+    m_v1 = RK(B);
+    verify((result = m_v1.GetIndex(context(), RK(C), &m_v0)));
+    Object* before = ObjectOf(m_v0);
+    verify((result = m_v0.Unset(context())));
+    if (IsReplaced(m_v0, before)) {
+      verify((result = m_v1.SetIndex(context(), RK(C), m_v0)));
+    }
+    next();
+  }
+
+  vm_instr(RBC_GLOAD) {
+    if (!GetGlobalVariable(C, &m_v0)) {
+      result.set_fail("global variable \"%s\" not found",
+                      GetGlobalVariableName(C).data());
+      goto fail;
+    }
+    R(A) = m_v0;
+    next();
+  }
+
+  vm_instr(RBC_GSET) {
+    SetGlobalVariable(C, RK(A));
+    next();
+  }
+
+#define XX(RBC, METHOD)                                       \
+  vm_instr(RBC) {                                             \
+    if (!GetGlobalVariable(C, &m_v0)) {                       \
+      result.set_fail("global variable \"%s\" not found",     \
+                      GetGlobalVariableName(C).data());       \
+      goto fail;                                              \
+    }                                                         \
+    m_v0.METHOD(context(), RK(A));                            \
+    SetGlobalVariable(C, m_v0);                               \
+    next();                                                   \
+  }
+
+  XX(RBC_GSADD, SelfAdd)
+  XX(RBC_GSSUB, SelfSub)
+  XX(RBC_GSMUL, SelfMul)
+  XX(RBC_GSDIV, SelfDiv)
+  XX(RBC_GSMOD, SelfMod)
+
+#undef XX  // XX
+
+  vm_instr(RBC_GUNSET) {
+    if (!GetGlobalVariable(C, &m_v0)) {
+      result.set_fail("global variable \"%s\" not found",
+                      GetGlobalVariableName(C).data());
+      goto fail;
+    }
+    verify((result = m_v0.Unset(context())));
+    SetGlobalVariable(C, m_v0);
+    next();
+  }
+
+  vm_instr(RBC_FORPREP) {
+    Iterator* iterator;
+    m_v0 = R(A);
+    if (m_v0.IsIterator()) {
+      iterator = m_v0.GetIterator();
+    } else {
+      verify((result = m_v0.NewIterator(context(), &iterator)));
+      DCHECK(iterator);
+    }
+    m_v1.SetIterator(iterator);
+
+    if (!iterator->Has(context())) jump(B);
+    R(A) = m_v1;
+    next();
+  }
+
+  vm_instr(RBC_FOREND) {
+    DCHECK(R(A).IsIterator());
+    Iterator* iterator = R(A).GetIterator();
+    if (iterator->Next(context())) {
+      pc = B;
+      safepoint();  // Loop back edge
+      dispatch();
+    }
+    next();
+  }
+
+  vm_instr(RBC_ITERK) {
+    DCHECK(R(B).IsIterator());
+    Iterator* iterator = R(B).GetIterator();
+    iterator->GetKey(context(), &m_v1);
+    R(A) = m_v1;
+    next();
+  }
+
+  vm_instr(RBC_ITERV) {
+    DCHECK(R(B).IsIterator());
+    Iterator* iterator = R(B).GetIterator();
+    iterator->GetValue(context(), &m_v1);
+    R(A) = m_v1;
+    next();
+  }
+
+  vm_instr(RBC_DEBUG) {
+    CurrentFrame()->source_index = C;
+    next();
+  }
+
+  vm_instr(RBC_IMPORT) {
+    String* key = procedure->IndexString(C);
+    Module* module = GetModule(*key);
+    if (!module) {
+      result.set_fail("module \"%s\" not found", key->data());
+      goto fail;
+    }
+    context()->AddOrUpdateGlobalVariable(*key, Value(module));
+    next();
+  }
+
+  vm_instr(RBC_GSUB) {
+    SubRoutine* sub_routine = InternalAllocator(gc()).NewSubRoutine(
+        CompiledCodeBuilder(cc).IndexSubRoutine(C));
+    m_v1.SetSubRoutine(sub_routine);
+
+    String* sub_name = gc()->NewString(sub_routine->name());
+    m_v0.SetString(sub_name);
+
+    context()->AddOrUpdateGlobalVariable(*sub_name, Value(sub_routine));
+    next();
+  }
+
+  vm_instr(RBC_LSUB) {
+    SubRoutine* sub_routine = InternalAllocator(gc()).NewSubRoutine(
+        CompiledCodeBuilder(cc).IndexSubRoutine(C));
+    R(A).SetSubRoutine(sub_routine);
+    next();
+  }
+
+  // Function call , callable is R(A) and arguments are R(A+1) ... R(A+C)
+  vm_instr(RBC_CALL) {
+    CurrentFrame()->pc = pc + 1;
+
+    // Shrink the value stack to make the arguments sit at the top of it,
+    // which is what the calling convention expects
+    SetStackSize(base + A + C + 1);
+
+    int status = EnterFunction(R(A), C, &result);
+    switch (status) {
+      case FUNC_FAILED:
+        goto fail;
+      case FUNC_CPP:
+        switch (result.status()) {
+          case MethodStatus::METHOD_FAIL:
+            goto fail;
+          case MethodStatus::METHOD_YIELD:
+            SetStackSize(base + rc->register_size());
+            ++pc;
+            m_yield = true;
+            goto yield;
+          case MethodStatus::METHOD_OK:
+            SetStackSize(base + rc->register_size());
+            ++pc;
+            safepoint();
+            dispatch();
+          case MethodStatus::METHOD_UNIMPLEMENTED:
+            goto fail;
+          case MethodStatus::METHOD_TERMINATE:
+            goto terminate;
+          default:
+            VCL_UNREACHABLE();
+        }
+      default:
+        reload_frame();
+        safepoint();
+        dispatch();
+        break;
+    }
+  }
+
+  // Tail call , see BC_TAILCALL
+  vm_instr(RBC_TAILCALL) {
+    if (!R(A).IsSubRoutine()) goto LABEL_RBC_CALL;
+
+    SetStackSize(base + A + C + 1);
+    if (!EnterTailCall(C, &result)) goto fail;
+    reload_frame();
+    safepoint();
+    dispatch();
+  }
+
+  vm_instr(RBC_RET) {
+    m_v0 = RK(A);
+    if (!ExitFunction(m_v0)) {
+      goto done;
+    }
+    reload_frame();
+    safepoint();
+    dispatch();
+  }
+
+  vm_instr(RBC_TERM) {
+    if (static_cast<ActionType>(C) == ACT_EXTENSION) {
+      m_v0 = RK(A);
+    } else {
+      m_v0.SetAction(gc()->NewAction(static_cast<ActionType>(C)));
+    }
+    goto terminate;
+  }
+
+done:
+  *output = m_v0;
+  m_v0.SetNull();
+
+  DCHECK(!m_yield);
+  DCHECK(result);
+  DCHECK(m_frame.empty());
+  DCHECK(StackSize() == 0);
+
+  return result;
+
+yield:
+  DCHECK(!m_frame.empty());
+  CurrentFrame()->pc = pc;
+  m_v0.SetNull();
+  m_yield = true;
+  return MethodStatus::kYield;
+
+terminate:
+  *output = m_v0;
+
+  DCHECK(!m_yield);
+  DCHECK(result);
+
+  Reset();
+  result.set_terminate();
+  return result;
+
+fail:
+  m_v0.SetNull();
+
+  DCHECK(result.is_fail() || result.is_unimplemented());
+  CurrentFrame()->pc = pc;
+  result =
+      ReportError(result.is_fail() ? result.fail() : result.unimplemented());
+  Reset();
+  return result;
+}
+
+#undef reload_frame  // reload_frame
+#undef jump          // jump
+#undef dispatch      // dispatch
+#undef safepoint     // safepoint
+#undef next          // next
+#undef vm_instr      // vm_instr
+#undef verify        // verify
+#undef RK            // RK
+#undef R             // R
+#undef C             // C
+#undef B             // B
+#undef A             // A
+
+}  // namespace vm
+}  // namespace vcl
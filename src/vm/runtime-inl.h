@@ -0,0 +1,432 @@
+#ifndef RUNTIME_INL_H_
+#define RUNTIME_INL_H_
+#include "runtime.h"
+#include "threaded-code.h"
+
+namespace vcl {
+namespace vm {
+
+// Operations of the bytecode shared by Runtime::Main and the helpers of the
+// JIT , see the comments in runtime.h. Any change of the semantic of a
+// bytecode that has an operation here must be done here.
+
+#define DO(NAME, OP, OPER)                                  \
+  inline MethodStatus Runtime::NAME() {                     \
+    Value& lhs = Top(1);                                    \
+    Value& rhs = Top(0);                                    \
+    if (lhs.IsInteger() && rhs.IsInteger()) {               \
+      Value v(lhs.GetInteger() OPER rhs.GetInteger());      \
+      Pop(2);                                               \
+      Push(v);                                              \
+      return MethodStatus::kOk;                             \
+    }                                                       \
+    MethodStatus status = lhs.OP(context(), rhs, &m_v0);    \
+    if (status.is_ok()) {                                   \
+      Pop(2);                                               \
+      Push(m_v0);                                           \
+    }                                                       \
+    return status;                                          \
+  }
+
+DO(OpAdd, Add, +)
+DO(OpSub, Sub, -)
+DO(OpMul, Mul, *)
+
+#undef DO  // DO
+
+#define DO(NAME, OP)                                              \
+  inline MethodStatus Runtime::NAME() {                           \
+    MethodStatus status = Top(1).OP(context(), Top(0), &m_v0);    \
+    if (status.is_ok()) {                                         \
+      Pop(2);                                                     \
+      Push(m_v0);                                                 \
+    }                                                             \
+    return status;                                                \
+  }
+
+DO(OpDiv, Div)
+DO(OpMod, Mod)
+
+#undef DO  // DO
+
+// ================================================================
+// Integer type specialized , the literal is always an integer
+// ================================================================
+
+#define VERIFY_ARGUMENT(X)                                       \
+  do {                                                           \
+    if ((X) == 0) return MethodStatus::NewFail("divide zero!"); \
+  } while (false)
+
+#define VERIFY_EMPTY(X) (void)(X)
+
+#define DO(NAME, OP, OPER, PRED)                                        \
+  inline MethodStatus Runtime::NAME(const ThreadedInstruction* ip) {   \
+    int32_t lhs = ip->literal->GetInteger();                           \
+    m_v0 = Top(0);                                                     \
+    if (m_v0.IsInteger()) {                                            \
+      PRED(m_v0.GetInteger());                                         \
+      Replace(Value(lhs OPER m_v0.GetInteger()));                      \
+      return MethodStatus::kOk;                                        \
+    }                                                                  \
+    MethodStatus status = Value(lhs).OP(context(), m_v0, &m_v1);       \
+    if (status.is_ok()) Replace(m_v1);                                 \
+    return status;                                                     \
+  }
+
+DO(OpAddIV, Add, +, VERIFY_EMPTY)
+DO(OpSubIV, Sub, -, VERIFY_EMPTY)
+DO(OpMulIV, Mul, *, VERIFY_EMPTY)
+DO(OpDivIV, Div, /, VERIFY_ARGUMENT)
+DO(OpModIV, Mod, %, VERIFY_ARGUMENT)
+
+#undef DO  // DO
+
+#define DO(NAME, OP, OPER, PRED)                                        \
+  inline MethodStatus Runtime::NAME(const ThreadedInstruction* ip) {   \
+    int32_t rhs = ip->literal->GetInteger();                           \
+    m_v0 = Top(0);                                                     \
+    if (m_v0.IsInteger()) {                                            \
+      PRED(rhs);                                                       \
+      Replace(Value(m_v0.GetInteger() OPER rhs));                      \
+      return MethodStatus::kOk;                                        \
+    }                                                                  \
+    MethodStatus status = m_v0.OP(context(), Value(rhs), &m_v1);       \
+    if (status.is_ok()) Replace(m_v1);                                 \
+    return status;                                                     \
+  }
+
+DO(OpAddVI, Add, +, VERIFY_EMPTY)
+DO(OpSubVI, Sub, -, VERIFY_EMPTY)
+DO(OpMulVI, Mul, *, VERIFY_EMPTY)
+DO(OpDivVI, Div, /, VERIFY_ARGUMENT)
+DO(OpModVI, Mod, %, VERIFY_ARGUMENT)
+
+#undef DO               // DO
+#undef VERIFY_EMPTY     // VERIFY_EMPTY
+#undef VERIFY_ARGUMENT  // VERIFY_ARGUMENT
+
+#define DO(NAME, OP, OPER)                                              \
+  inline MethodStatus Runtime::NAME(const ThreadedInstruction* ip) {   \
+    int32_t lhs = ip->literal->GetInteger();                           \
+    m_v0 = Top(0);                                                     \
+    if (m_v0.IsInteger()) {                                            \
+      Replace(Value(lhs OPER m_v0.GetInteger()));                      \
+      return MethodStatus::kOk;                                        \
+    }                                                                  \
+    bool bret;                                                         \
+    MethodStatus status = Value(lhs).OP(context(), m_v0, &bret);       \
+    if (status.is_ok()) Replace(Value(bret));                          \
+    return status;                                                     \
+  }
+
+DO(OpLtIV, Less, <)
+DO(OpLeIV, LessEqual, <=)
+DO(OpGtIV, Greater, >)
+DO(OpGeIV, GreaterEqual, >=)
+DO(OpEqIV, Equal, ==)
+DO(OpNeIV, NotEqual, !=)
+
+#undef DO  // DO
+
+#define DO(NAME, OP, OPER)                                              \
+  inline MethodStatus Runtime::NAME(const ThreadedInstruction* ip) {   \
+    int32_t rhs = ip->literal->GetInteger();                           \
+    m_v0 = Top(0);                                                     \
+    if (m_v0.IsInteger()) {                                            \
+      Replace(Value(m_v0.GetInteger() OPER rhs));                      \
+      return MethodStatus::kOk;                                        \
+    }                                                                  \
+    bool bret;                                                         \
+    MethodStatus status = m_v0.OP(context(), Value(rhs), &bret);       \
+    if (status.is_ok()) Replace(Value(bret));                          \
+    return status;                                                     \
+  }
+
+DO(OpLtVI, Less, <)
+DO(OpLeVI, LessEqual, <=)
+DO(OpGtVI, Greater, >)
+DO(OpGeVI, GreaterEqual, >=)
+DO(OpEqVI, Equal, ==)
+DO(OpNeVI, NotEqual, !=)
+
+#undef DO  // DO
+
+// ================================================================
+// Local variable
+// ================================================================
+
+#define DO(NAME, OP)                                                  \
+  inline MethodStatus Runtime::NAME(const ThreadedInstruction* ip,   \
+                                    size_t base) {                   \
+    MethodStatus status = Back(base, ip->arg).OP(context(), Top(0)); \
+    if (status.is_ok()) Pop(1);                                      \
+    return status;                                                   \
+  }
+
+DO(OpSAdd, SelfAdd)
+DO(OpSSub, SelfSub)
+DO(OpSMul, SelfMul)
+DO(OpSDiv, SelfDiv)
+DO(OpSMod, SelfMod)
+
+#undef DO  // DO
+
+inline MethodStatus Runtime::OpUnset(const ThreadedInstruction* ip,
+                                     size_t base) {
+  return Back(base, ip->arg).Unset(context());
+}
+
+inline void Runtime::OpSLoad(const ThreadedInstruction* ip, size_t base) {
+  Push(Back(base, ip->arg));
+}
+
+inline void Runtime::OpSStore(const ThreadedInstruction* ip, size_t base) {
+  Back(base, ip->arg) = Top(0);
+  Pop(1);
+}
+
+// Literals are resolved by the linker
+inline void Runtime::OpLiteral(const ThreadedInstruction* ip) {
+  Push(*ip->literal);
+}
+
+// ================================================================
+// Comparison and unary operator
+// ================================================================
+
+#define DO(NAME, OP, OPER)                                   \
+  inline MethodStatus Runtime::NAME() {                      \
+    Value& lhs = Top(1);                                     \
+    Value& rhs = Top(0);                                     \
+    bool v;                                                  \
+    if (lhs.IsInteger() && rhs.IsInteger()) {                \
+      v = lhs.GetInteger() OPER rhs.GetInteger();            \
+    } else {                                                 \
+      MethodStatus status = lhs.OP(context(), rhs, &v);      \
+      if (!status.is_ok()) return status;                    \
+    }                                                        \
+    Pop(2);                                                  \
+    Push(Value(v));                                          \
+    return MethodStatus::kOk;                                \
+  }
+
+DO(OpLt, Less, <)
+DO(OpLe, LessEqual, <=)
+DO(OpGt, Greater, >)
+DO(OpGe, GreaterEqual, >=)
+DO(OpEq, Equal, ==)
+DO(OpNe, NotEqual, !=)
+
+#undef DO  // DO
+
+#define DO(NAME, OP)                                             \
+  inline MethodStatus Runtime::NAME() {                          \
+    bool v;                                                      \
+    MethodStatus status = Top(1).OP(context(), Top(0), &v);      \
+    if (status.is_ok()) {                                        \
+      Pop(2);                                                    \
+      Push(Value(v));                                            \
+    }                                                            \
+    return status;                                               \
+  }
+
+DO(OpMatch, Match)
+DO(OpNotMatch, NotMatch)
+
+#undef DO  // DO
+
+inline MethodStatus Runtime::OpNegate() {
+  Value& top = Top(0);
+  if (top.IsInteger()) {
+    Replace(Value(-top.GetInteger()));
+  } else if (top.IsReal()) {
+    Replace(Value(-top.GetReal()));
+  } else {
+    return MethodStatus::NewFail(
+        "type %s doesn't support unary operator \"-\".", top.type_name());
+  }
+  return MethodStatus::kOk;
+}
+
+inline MethodStatus Runtime::OpTest() {
+  bool b;
+  MethodStatus status = Top(0).ToBoolean(context(), &b);
+  if (status.is_ok()) Replace(Value(b));
+  return status;
+}
+
+inline MethodStatus Runtime::OpFlip() {
+  bool b;
+  MethodStatus status = Top(0).ToBoolean(context(), &b);
+  if (status.is_ok()) Replace(Value(!b));
+  return status;
+}
+
+// ================================================================
+// Branch. The condition is popped , except BC_BRT/BC_BRF leave the
+// result of the logic expression on the stack when it jumps
+// ================================================================
+
+#define DO(NAME, JUMP_IF, KEEP)                                   \
+  inline MethodStatus Runtime::NAME(bool* jump) {                 \
+    bool b;                                                       \
+    MethodStatus status = Top(0).ToBoolean(context(), &b);        \
+    if (!status.is_ok()) return status;                           \
+    *jump = (b == JUMP_IF);                                       \
+    if (*jump && KEEP) {                                          \
+      Replace(Value(b));                                          \
+    } else {                                                      \
+      Pop(1);                                                     \
+    }                                                             \
+    return status;                                                \
+  }
+
+DO(OpJT, true, false)
+DO(OpJF, false, false)
+DO(OpBRT, true, true)
+DO(OpBRF, false, true)
+
+#undef DO  // DO
+
+// ================================================================
+// Property , attribute and index
+// ================================================================
+
+inline MethodStatus Runtime::OpPGet(const ThreadedInstruction* ip) {
+  MethodStatus status =
+      GetProperty(ip->arg, Top(0), *ip->literal->GetString(), &m_v0);
+  if (status.is_ok()) Replace(m_v0);
+  return status;
+}
+
+inline MethodStatus Runtime::OpPSet(const ThreadedInstruction* ip) {
+  MethodStatus status =
+      Top(0).SetProperty(context(), *ip->literal->GetString(), Top(1));
+  if (status.is_ok()) Pop(2);
+  return status;
+}
+
+inline MethodStatus Runtime::OpAGet(const ThreadedInstruction* ip) {
+  MethodStatus status =
+      GetAttribute(ip->arg, Top(0), *ip->literal->GetString(), &m_v0);
+  if (status.is_ok()) Replace(m_v0);
+  return status;
+}
+
+inline MethodStatus Runtime::OpASet(const ThreadedInstruction* ip) {
+  MethodStatus status =
+      Top(0).SetAttribute(context(), *ip->literal->GetString(), Top(1));
+  if (status.is_ok()) Pop(2);
+  return status;
+}
+
+inline MethodStatus Runtime::OpIGet() {
+  MethodStatus status = Top(1).GetIndex(context(), Top(0), &m_v0);
+  if (status.is_ok()) {
+    Pop(2);
+    Push(m_v0);
+  }
+  return status;
+}
+
+inline MethodStatus Runtime::OpISet() {
+  MethodStatus status = Top(1).SetIndex(context(), Top(0), Top(2));
+  if (status.is_ok()) Pop(3);
+  return status;
+}
+
+// ================================================================
+// Global variable
+// ================================================================
+
+inline MethodStatus Runtime::OpGLoad(const ThreadedInstruction* ip) {
+  if (!GetGlobalVariable(ip->arg, &m_v0)) {
+    return MethodStatus::NewFail("global variable \"%s\" not found",
+                                 GetGlobalVariableName(ip->arg).data());
+  }
+  Push(m_v0);
+  return MethodStatus::kOk;
+}
+
+inline void Runtime::OpGSet(const ThreadedInstruction* ip) {
+  SetGlobalVariable(ip->arg, Top(0));
+  Pop(1);
+}
+
+// ================================================================
+// Loop. When the iterator is empty BC_FORPREP jumps out of the loop
+// without replacing the value with the iterator. BC_FOREND only tells
+// whether it loops back , the loop back edge is a safepoint which is
+// left to the caller
+// ================================================================
+
+inline MethodStatus Runtime::OpForPrep(bool* jump) {
+  Iterator* iterator;
+  m_v0 = Top(0);
+  if (m_v0.IsIterator()) {
+    iterator = m_v0.GetIterator();
+  } else {
+    MethodStatus status = m_v0.NewIterator(context(), &iterator);
+    if (!status.is_ok()) return status;
+    DCHECK(iterator);
+  }
+  m_v1.SetIterator(iterator);
+  *jump = !iterator->Has(context());
+  if (!*jump) Replace(m_v1);
+  return MethodStatus::kOk;
+}
+
+inline bool Runtime::OpForEnd() {
+  m_v0 = Top(0);
+  DCHECK(m_v0.IsIterator());
+  return m_v0.GetIterator()->Next(context());
+}
+
+inline void Runtime::OpIterK() {
+  m_v0 = Top(0);
+  DCHECK(m_v0.IsIterator());
+  m_v0.GetIterator()->GetKey(context(), &m_v1);
+  Push(m_v1);
+}
+
+inline void Runtime::OpIterV() {
+  m_v0 = Top(1);
+  DCHECK(m_v0.IsIterator());
+  m_v0.GetIterator()->GetValue(context(), &m_v1);
+  Push(m_v1);
+}
+
+// ================================================================
+// String concatenation. All the pieces are formatted into m_concat
+// directly and only the result String is allocated. The pieces stay on
+// the stack until the result is created , so they are reachable if GC
+// kicks in
+// ================================================================
+
+#define DO(NAME, CONVERT)                                              \
+  inline MethodStatus Runtime::NAME(const ThreadedInstruction* ip) {  \
+    m_concat.clear();                                                 \
+    for (int i = static_cast<int>(ip->arg) - 1; i >= 0; --i) {        \
+      MethodStatus status = AppendString(Top(i), CONVERT);            \
+      if (!status.is_ok()) return status;                             \
+    }                                                                 \
+    m_v0.SetString(context()->gc()->NewString(m_concat));             \
+    Pop(ip->arg);                                                     \
+    Push(m_v0);                                                       \
+    return MethodStatus::kOk;                                         \
+  }
+
+DO(OpSCat, true)
+DO(OpConcat, false)
+
+#undef DO  // DO
+
+inline void Runtime::OpDebug(const ThreadedInstruction* ip) {
+  CurrentFrame()->source_index = ip->arg;
+}
+
+}  // namespace vm
+}  // namespace vcl
+
+#endif  // RUNTIME_INL_H_
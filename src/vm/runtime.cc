@@ -1,4 +1,12 @@
 #include "runtime.h"
+#include "bytecode-profile.h"
+#include "jit.h"
+#include "register-code.h"
+#include "runtime-inl.h"
+#include "sampling-profiler.h"
+#include "threaded-code.h"
+
+#include <cstdio>
 
 namespace vcl {
 namespace vm {
@@ -12,7 +20,21 @@ int Runtime::EnterFunction(const Value& callable,
     return FUNC_FAILED;
   }
 
-  // 2. Check whether the too many calls
+  // 2. Leaf function is called directly with the arguments on the stack and
+  // its result replaces the callable and arguments , no frame is needed
+  if (callable.IsFunction() && callable.GetFunction()->is_leaf()) {
+    const size_t base = StackSize() - argument_size;
+    LeafFunction* function = static_cast<LeafFunction*>(callable.GetFunction());
+    *status = function->Call(
+        context(), Arguments(StackBegin() + base, argument_size), &m_v0);
+    if (status->is_ok() || status->is_yield()) {
+      SetStackSize(base - 1);
+      Push(m_v0);
+    }
+    return FUNC_CPP;
+  }
+
+  // 3. Check whether the too many calls
   if (m_frame.size() == static_cast<size_t>(m_max_calling_stack_size)) {
     status->set_fail(
         "too deep function call, we allow %d recursive function call",
@@ -20,7 +42,7 @@ int Runtime::EnterFunction(const Value& callable,
     return FUNC_FAILED;
   }
 
-  // 3. Check argument size for sub routine
+  // 4. Check argument size for sub routine
   if (callable.IsSubRoutine()) {
     SubRoutine* sub_routine = callable.GetSubRoutine();
     if (sub_routine->argument_size() != argument_size) {
@@ -33,13 +55,15 @@ int Runtime::EnterFunction(const Value& callable,
 
     // Now generate the frame into the frame status and return caller
     // that we need to continue executing with *new* frame status
-    m_frame.push_back(
-        Frame(m_stack.size() - argument_size, argument_size, callable));
+    const size_t base = StackSize() - argument_size;
+    m_frame.push_back(Frame(base, argument_size, callable));
 
+    // Reserve the whole stack the procedure needs , callable may refer to
+    // the stack so it must be done after the frame is pushed
+    ReserveStack(base + sub_routine->procedure()->max_stack_size());
     return FUNC_SCRIPT;
   } else {
-    m_frame.push_back(
-        Frame(m_stack.size() - argument_size, argument_size, callable));
+    m_frame.push_back(Frame(StackSize() - argument_size, argument_size, callable));
 
     Function* function = callable.GetFunction();
 
@@ -55,6 +79,28 @@ int Runtime::EnterFunction(const Value& callable,
   }
 }
 
+bool Runtime::EnterTailCall(size_t argument_size, MethodStatus* status) {
+  DCHECK(Top(argument_size).IsSubRoutine());
+  SubRoutine* sub_routine = Top(argument_size).GetSubRoutine();
+  if (sub_routine->argument_size() != argument_size) {
+    status->set_fail("sub %s accept %zu argument , but got %zu",
+                     sub_routine->name().c_str(),
+                     sub_routine->argument_size(),
+                     argument_size);
+    return false;
+  }
+
+  // The frame below the current one only cares about the slot of callable ,
+  // which is where the return value goes , so overwrite the current frame
+  const size_t base = CurrentFrame()->base;
+  std::copy(m_sp - argument_size - 1, m_sp, StackBegin() + base - 1);
+  SetStackSize(base + argument_size);
+  *CurrentFrame() = Frame(base, argument_size, StackBegin()[base - 1]);
+
+  ReserveStack(base + sub_routine->procedure()->max_stack_size());
+  return true;
+}
+
 bool Runtime::ExitFunction(const Value& output) {
   DCHECK(!m_frame.empty());
   size_t rsp_position = CurrentFrame()->base - 1;
@@ -62,12 +108,12 @@ bool Runtime::ExitFunction(const Value& output) {
   m_frame.pop_back();  // Pop the current calling frame
 
   if (!m_frame.empty()) {
-    DCHECK(rsp_position < m_stack.size());
-    m_stack.resize(rsp_position);
+    DCHECK(rsp_position < StackSize());
+    SetStackSize(rsp_position);
     Push(output);  // Push the return value onto the stack
     return true;
   } else {
-    m_stack.clear();
+    SetStackSize(0);
   }
 
   return false;
@@ -91,12 +137,86 @@ bool Runtime::ExitFunction(const Value& output) {
     }                                                                \
   } while (false)
 
+// Bytecode sequence profiling , see BytecodeProfile
+#ifdef VCL_BYTECODE_PROFILE
+#define profile_enter() BytecodeProfile::Get()->Enter()
+#define profile_bytecode(XX) BytecodeProfile::Get()->Record(XX)
+#else
+#define profile_enter() (void)0
+#define profile_bytecode(XX) (void)(XX)
+#endif  // VCL_BYTECODE_PROFILE
+
+// Execution profiling , see ExecutionProfile
+#ifdef VCL_EXECUTION_PROFILE
+#define profile_procedure() profile_counter = m_profile.Counter(procedure)
+#define profile_instruction() ++profile_counter[tc->IndexOf(ip)]
+#else
+#define profile_procedure() (void)0
+#define profile_instruction() (void)0
+#endif  // VCL_EXECUTION_PROFILE
+
+namespace {
+
+// Dispatch table exported by Runtime::Main , see GetDispatchTable
+const void* const* kDispatchTable = NULL;
+
+// Runtime running on this thread
+__thread Runtime* kCurrentRuntime = NULL;
+
+}  // namespace
+
+namespace detail {
+
+VMGuard::VMGuard(Runtime* runtime)
+    : m_runtime(runtime), m_previous(kCurrentRuntime) {
+  runtime->m_vm_running = true;
+  kCurrentRuntime = runtime;
+}
+
+VMGuard::~VMGuard() {
+  m_runtime->m_vm_running = false;
+  kCurrentRuntime = m_previous;
+}
+
+}  // namespace detail
+
+Runtime* Runtime::Current() { return kCurrentRuntime; }
+
 // A typical threaded interpreter in C/C++ code. To implement it I will
 // have to use non-portable feature computed goto in GCC , and this is
 // also supported by clang. To my best knowledge, MSVC doesn't support
 // it but no one will port it to Windows.
+//
+// The interpreter doesn't run BytecodeBuffer directly but the ThreadedCode
+// linked from it , each instruction already has its handler address and
+// decoded operand so dispatch is just one indirect jump.
 MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
+  // Jump table for threading interpretation
+  static const void* kLabels[] = {
+#define __(A, B, C) &&LABEL_##A,
+      VCL_BYTECODE_LIST(__) NULL};
+#undef __  // __
+
+  // Called by GetDispatchTable to export the label address , since label
+  // address is only visible inside of this function
+  if (!output) {
+    kDispatchTable = kLabels;
+    return MethodStatus::kOk;
+  }
+
   DCHECK(instr_count > 0);
+
+  if (m_global_slot.size() != context()->compiled_code()->global_slot_size())
+    SyncGlobalSlot();
+
+  if (m_inline_cache.size() != context()->compiled_code()->inline_cache_size())
+    m_inline_cache.resize(context()->compiled_code()->inline_cache_size());
+
+  // Procedures lowered to register code are interpreted by register machine
+  if (CurrentFrame()->sub_routine()->procedure()->register_code()) {
+    return RegisterMain(output, instr_count);
+  }
+
   detail::VMGuard guard(this);
 
   // Argument holder for VM's instruction immediate number
@@ -114,77 +234,111 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
   // Current Procedure object
   Procedure* procedure = sub_routine->procedure();
 
-  // Instruction iterator
-  BytecodeBuffer::Iterator code =
-      procedure->code_buffer().BeginAt(CurrentFrame()->pc);
+  // Linked code of current Procedure
+  const ThreadedCode* tc = GetThreadedCode(procedure);
+
+  // Instruction pointer
+  const ThreadedInstruction* ip = tc->At(CurrentFrame()->pc);
 
   // Base pointer for current execution frame , cached here for avoiding
   // cache miss purpose
   size_t base = CurrentFrame()->base;
 
-  // Jump table for threading interpretation
-  static void* kLabels[] = {
-#define __(A, B, C) &&LABEL_##A,
-      VCL_BYTECODE_LIST(__) NULL};
-#undef __  // __
+#ifdef VCL_EXECUTION_PROFILE
+  // Counter array of current Procedure
+  uint64_t* profile_counter = NULL;
+#endif  // VCL_EXECUTION_PROFILE
+
+#define dispatch()                        \
+  do {                                    \
+    DCHECK(tc->IndexOf(ip) < tc->size()); \
+    profile_bytecode(ip->bytecode);       \
+    profile_instruction();                \
+    goto* ip->handler;                    \
+  } while (false)
 
-#define dispatch(BYTECODE)                                                    \
-  do {                                                                        \
-    --instr_count;                                                            \
-    DCHECK(code != procedure->code_buffer().End());                           \
-    /* Checking if user set us to be yieled , this typically happened when */ \
-    /* user want to do some sort of preemptive scheduling for execution and   \
-     * signal */                                                              \
-    /* us that we should be yielded inside of signal handler */               \
-    if (instr_count < 0 || m_yield) {                                         \
-      goto yield;                                                             \
-    }                                                                         \
-    const void* target = kLabels[static_cast<size_t>(BYTECODE)];              \
-    goto* target;                                                             \
+// Safepoint checks whether user set us to be yielded , this typically
+// happened when user want to do some sort of preemptive scheduling for
+// execution and signal us that we should be yielded inside of signal handler.
+// It is only placed at loop back edge , call and return , straight line code
+// always runs to one of them in bounded time , so dispatch doesn't need to
+// check anything. The instruction budget is also counted at safepoint , and
+// the stack sample requested by SamplingProfiler is taken here.
+#define safepoint()                     \
+  do {                                  \
+    if (m_sample) {                     \
+      TakeSample(tc->IndexOf(ip));      \
+    }                                   \
+    if (--instr_count < 0 || m_yield) { \
+      goto yield;                       \
+    }                                   \
+    if (procedure->jit_code()) {        \
+      goto jit;                         \
+    }                                   \
   } while (false)
 
-#define next()       \
-  do {               \
-    ++code;          \
-    dispatch(*code); \
+#define next()  \
+  do {          \
+    ++ip;       \
+    dispatch(); \
   } while (false)
 
-  dispatch(*code);
+  profile_enter();
+  profile_procedure();
+  CountEntry(procedure);
+  if (procedure->jit_code()) goto jit;
+  dispatch();
 
 #define vm_instr(BYTECODE) LABEL_##BYTECODE:
 
+// Quickening , a generic arithmetic or comparison instruction rewrites itself
+// to the typed version once both operands have the same type , unless it has
+// been deoptimized before , see ThreadedCode::Quicken
+#define quicken(BC)                                   \
+  do {                                                \
+    if (!ThreadedCode::IsDeoptimized(ip)) {           \
+      if (Top(1).IsInteger() && Top(0).IsInteger())   \
+        ThreadedCode::Quicken(ip, kLabels[BC##_INT]);  \
+      else if (Top(1).IsReal() && Top(0).IsReal())    \
+        ThreadedCode::Quicken(ip, kLabels[BC##_REAL]); \
+    }                                                 \
+  } while (false)
+
+#define quicken_equal(BC)                             \
+  do {                                                \
+    if (!ThreadedCode::IsDeoptimized(ip)) {           \
+      if (Top(1).IsString() && Top(0).IsString())     \
+        ThreadedCode::Quicken(ip, kLabels[BC##_STR]);  \
+      else                                            \
+        quicken(BC);                                  \
+    }                                                 \
+  } while (false)
+
   vm_instr(BC_ADD) {
-    verify((result = Top(1).Add(context(), Top(0), &m_v0)));
-    Pop(2);
-    Push(m_v0);
+    quicken(BC_ADD);
+    verify((result = OpAdd()));
     next();
   }
 
   vm_instr(BC_SUB) {
-    verify((result = Top(1).Sub(context(), Top(0), &m_v0)));
-    Pop(2);
-    Push(m_v0);
+    quicken(BC_SUB);
+    verify((result = OpSub()));
     next();
   }
 
   vm_instr(BC_MUL) {
-    verify((result = Top(1).Mul(context(), Top(0), &m_v0)));
-    Pop(2);
-    Push(m_v0);
+    quicken(BC_MUL);
+    verify((result = OpMul()));
     next();
   }
 
   vm_instr(BC_DIV) {
-    verify((result = Top(1).Div(context(), Top(0), &m_v0)));
-    Pop(2);
-    Push(m_v0);
+    verify((result = OpDiv()));
     next();
   }
 
   vm_instr(BC_MOD) {
-    verify((result = Top(1).Mod(context(), Top(0), &m_v0)));
-    Pop(2);
-    Push(m_v0);
+    verify((result = OpMod()));
     next();
   }
 
@@ -192,248 +346,121 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
 // Bytecode for integer type speicalized and optimization
 // ================================================================
 
-#define VERIFY_ARGUMENT(X)                            \
-  do {                                                \
-    if ((X) == 0) {                                   \
-      result = MethodStatus::NewFail("divide zero!"); \
-      goto fail;                                      \
-    }                                                 \
-  } while (false)
-
-#define VERIFY_EMPTY(X) (void)(X)
-
-#define DO(BC, OP, OPER, PRED)                                  \
-  vm_instr(BC) {                                                \
-    arg = code.arg();                                           \
-    int32_t lhs = procedure->IndexInteger(arg);                 \
-    m_v0 = Top(0);                                              \
-    if (m_v0.IsInteger()) {                                     \
-      PRED(m_v0.GetInteger());                                  \
-      Replace(Value(lhs OPER m_v0.GetInteger()));               \
-    } else {                                                    \
-      verify((result = Value(lhs).OP(context(), m_v0, &m_v1))); \
-      Replace(m_v1);                                            \
-    }                                                           \
-    next();                                                     \
-  }
-
-  DO(BC_ADDIV, Add, +, VERIFY_EMPTY)
-  DO(BC_SUBIV, Sub, -, VERIFY_EMPTY)
-  DO(BC_MULIV, Mul, *, VERIFY_EMPTY)
-  DO(BC_DIVIV, Div, /, VERIFY_ARGUMENT)
-  DO(BC_MODIV, Mod, %, VERIFY_ARGUMENT)
-
-#undef DO  // DO
-
-#define DO(BC, OP, OPER, PRED)                                  \
-  vm_instr(BC) {                                                \
-    arg = code.arg();                                           \
-    int32_t rhs = procedure->IndexInteger(arg);                 \
-    m_v0 = Top(0);                                              \
-    if (m_v0.IsInteger()) {                                     \
-      PRED(rhs);                                                \
-      Replace(Value(m_v0.GetInteger() OPER rhs));               \
-    } else {                                                    \
-      verify((result = m_v0.OP(context(), Value(rhs), &m_v1))); \
-      Replace(m_v1);                                            \
-    }                                                           \
-    next();                                                     \
-  }
-
-  DO(BC_ADDVI, Add, +, VERIFY_EMPTY)
-  DO(BC_SUBVI, Sub, -, VERIFY_EMPTY)
-  DO(BC_MULVI, Mul, *, VERIFY_EMPTY)
-  DO(BC_DIVVI, Div, /, VERIFY_ARGUMENT)
-  DO(BC_MODVI, Mod, %, VERIFY_ARGUMENT)
-
-#undef DO               // DO
-#undef VERIFY_EMPTY     // VERIFY_EMPTY
-#undef VERIFY_ARGUMENT  // VERIFY_ARGUMENT
-
-#define DO(BC, OP, OPER)                                        \
-  vm_instr(BC) {                                                \
-    arg = code.arg();                                           \
-    int32_t lhs = procedure->IndexInteger(arg);                 \
-    m_v0 = Top(0);                                              \
-    if (m_v0.IsInteger()) {                                     \
-      Replace(Value(lhs OPER m_v0.GetInteger()));               \
-    } else {                                                    \
-      bool bret;                                                \
-      verify((result = Value(lhs).OP(context(), m_v0, &bret))); \
-      Replace(Value(bret));                                     \
-    }                                                           \
-    next();                                                     \
-  }
-
-  DO(BC_LTIV, Less, <)
-  DO(BC_LEIV, LessEqual, <=)
-  DO(BC_GTIV, Greater, >)
-  DO(BC_GEIV, GreaterEqual, >=)
-  DO(BC_EQIV, Equal, ==)
-  DO(BC_NEIV, NotEqual, !=)
+#define DO(BC, OP)                      \
+  vm_instr(BC) {                        \
+    verify((result = OP(ip)));          \
+    next();                             \
+  }
+
+  DO(BC_ADDIV, OpAddIV)
+  DO(BC_SUBIV, OpSubIV)
+  DO(BC_MULIV, OpMulIV)
+  DO(BC_DIVIV, OpDivIV)
+  DO(BC_MODIV, OpModIV)
+  DO(BC_ADDVI, OpAddVI)
+  DO(BC_SUBVI, OpSubVI)
+  DO(BC_MULVI, OpMulVI)
+  DO(BC_DIVVI, OpDivVI)
+  DO(BC_MODVI, OpModVI)
+
+  DO(BC_LTIV, OpLtIV)
+  DO(BC_LEIV, OpLeIV)
+  DO(BC_GTIV, OpGtIV)
+  DO(BC_GEIV, OpGeIV)
+  DO(BC_EQIV, OpEqIV)
+  DO(BC_NEIV, OpNeIV)
+  DO(BC_LTVI, OpLtVI)
+  DO(BC_LEVI, OpLeVI)
+  DO(BC_GTVI, OpGtVI)
+  DO(BC_GEVI, OpGeVI)
+  DO(BC_EQVI, OpEqVI)
+  DO(BC_NEVI, OpNeVI)
 
 #undef DO  // DO
 
-#define DO(BC, OP, OPER)                                        \
-  vm_instr(BC) {                                                \
-    arg = code.arg();                                           \
-    int32_t rhs = procedure->IndexInteger(arg);                 \
-    m_v0 = Top(0);                                              \
-    if (m_v0.IsInteger()) {                                     \
-      Replace(Value(m_v0.GetInteger() OPER rhs));               \
-    } else {                                                    \
-      bool bret;                                                \
-      verify((result = m_v0.OP(context(), Value(rhs), &bret))); \
-      Replace(Value(bret));                                     \
-    }                                                           \
-    next();                                                     \
-  }
-
-  DO(BC_LTVI, Less, <)
-  DO(BC_LEVI, LessEqual, <=)
-  DO(BC_GTVI, Greater, >)
-  DO(BC_GEVI, GreaterEqual, >=)
-  DO(BC_EQVI, Equal, ==)
-  DO(BC_NEVI, NotEqual, !=)
-
-#undef DO  // DO
-
-  vm_instr(BC_SADD) {
-    verify((result = Back(base, code.arg()).SelfAdd(context(), Top(0))));
-    Pop(1);
-    next();
+#define DO(BC, OP)                      \
+  vm_instr(BC) {                        \
+    verify((result = OP(ip, base)));    \
+    next();                             \
   }
 
-  vm_instr(BC_SSUB) {
-    verify((result = Back(base, code.arg()).SelfSub(context(), Top(0))));
-    Pop(1);
-    next();
-  }
+  DO(BC_SADD, OpSAdd)
+  DO(BC_SSUB, OpSSub)
+  DO(BC_SMUL, OpSMul)
+  DO(BC_SDIV, OpSDiv)
+  DO(BC_SMOD, OpSMod)
+  DO(BC_UNSET, OpUnset)
 
-  vm_instr(BC_SMUL) {
-    verify((result = Back(base, code.arg()).SelfMul(context(), Top(0))));
-    Pop(1);
-    next();
-  }
-
-  vm_instr(BC_SDIV) {
-    verify((result = Back(base, code.arg()).SelfDiv(context(), Top(0))));
-    Pop(1);
-    next();
-  }
-
-  vm_instr(BC_SMOD) {
-    verify((result = Back(base, code.arg()).SelfMod(context(), Top(0))));
-    Pop(1);
-    next();
-  }
-
-  vm_instr(BC_UNSET) {
-    verify((result = Back(base, code.arg()).Unset(context())));
-    next();
-  }
+#undef DO  // DO
 
   vm_instr(BC_LT) {
-    bool v;
-    verify((result = Top(1).Less(context(), Top(0), &v)));
-    Pop(2);
-    Push(Value(v));
+    quicken(BC_LT);
+    verify((result = OpLt()));
     next();
   }
 
   vm_instr(BC_LE) {
-    bool v;
-    verify((result = Top(1).LessEqual(context(), Top(0), &v)));
-    Pop(2);
-    Push(Value(v));
+    quicken(BC_LE);
+    verify((result = OpLe()));
     next();
   }
 
   vm_instr(BC_GT) {
-    bool v;
-    verify((result = Top(1).Greater(context(), Top(0), &v)));
-    Pop(2);
-    Push(Value(v));
+    quicken(BC_GT);
+    verify((result = OpGt()));
     next();
   }
 
   vm_instr(BC_GE) {
-    bool v;
-    verify((result = Top(1).GreaterEqual(context(), Top(0), &v)));
-    Pop(2);
-    Push(Value(v));
+    quicken(BC_GE);
+    verify((result = OpGe()));
     next();
   }
 
   vm_instr(BC_EQ) {
-    bool v;
-    verify((result = Top(1).Equal(context(), Top(0), &v)));
-    Pop(2);
-    Push(Value(v));
+    quicken_equal(BC_EQ);
+    verify((result = OpEq()));
     next();
   }
 
   vm_instr(BC_NE) {
-    bool v;
-    verify((result = Top(1).NotEqual(context(), Top(0), &v)));
-    Pop(2);
-    Push(Value(v));
+    quicken_equal(BC_NE);
+    verify((result = OpNe()));
     next();
   }
 
   vm_instr(BC_MATCH) {
-    bool v;
-    verify((result = Top(1).Match(context(), Top(0), &v)));
-    Pop(2);
-    Push(Value(v));
+    verify((result = OpMatch()));
     next();
   }
 
   vm_instr(BC_NOT_MATCH) {
-    bool v;
-    verify((result = Top(1).NotMatch(context(), Top(0), &v)));
-    Pop(2);
-    Push(Value(v));
+    verify((result = OpNotMatch()));
     next();
   }
 
   vm_instr(BC_NEGATE) {
-    Value& top = Top(0);
-    if (top.IsInteger()) {
-      Replace(Value(-top.GetInteger()));
-    } else if (top.IsReal()) {
-      Replace(Value(-top.GetReal()));
-    } else {
-      result.set_fail("type %s doesn't support unary operator \"-\".",
-                      top.type_name());
-      goto fail;
-    }
+    verify((result = OpNegate()));
     next();
   }
 
   vm_instr(BC_TEST) {
-    Value& top = Top(0);
-    bool b;
-    verify((result = top.ToBoolean(context(), &b)));
-    Replace(Value(b));
+    verify((result = OpTest()));
     next();
   }
 
   vm_instr(BC_FLIP) {
-    Value& top = Top(0);
-    bool b;
-    verify((result = top.ToBoolean(context(), &b)));
-    Replace(Value(!b));
+    verify((result = OpFlip()));
     next();
   }
 
   vm_instr(BC_LINT) {
-    Push(Value(procedure->IndexInteger(code.arg())));
+    OpLiteral(ip);
     next();
   }
 
   vm_instr(BC_LREAL) {
-    Push(Value(procedure->IndexReal(code.arg())));
+    OpLiteral(ip);
     next();
   }
 
@@ -453,22 +480,22 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
   }
 
   vm_instr(BC_LSTR) {
-    Push(Value(procedure->IndexString(code.arg())));
+    OpLiteral(ip);
     next();
   }
 
   vm_instr(BC_LSIZE) {
-    Push(Value(procedure->IndexSize(code.arg())));
+    OpLiteral(ip);
     next();
   }
 
   vm_instr(BC_LDURATION) {
-    Push(Value(procedure->IndexDuration(code.arg())));
+    OpLiteral(ip);
     next();
   }
 
   vm_instr(BC_LDICT) {
-    int len = static_cast<int>(code.arg());
+    int len = static_cast<int>(ip->arg);
     Dict* dict = gc()->NewDict();
     m_v0.SetDict(dict);
 
@@ -488,8 +515,23 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
     next();
   }
 
+  vm_instr(BC_LSDICT) {
+    const DictShape* shape = ip->shape;
+    size_t len = shape->size();
+    Dict* dict = gc()->NewDict(shape);
+    m_v0.SetDict(dict);
+
+    // Values are pushed in the order of the shape's keys
+    for (size_t i = 0; i < len; ++i) {
+      dict->shape_value(i) = Top(len - i - 1);
+    }
+    Pop(len);
+    Push(m_v0);
+    next();
+  }
+
   vm_instr(BC_LLIST) {
-    int len = static_cast<int>(code.arg());
+    int len = static_cast<int>(ip->arg);
     List* list = gc()->NewList(len);
     m_v0.SetList(list);
 
@@ -503,7 +545,7 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
   }
 
   vm_instr(BC_LEXT) {
-    arg = code.arg();
+    arg = ip->arg;
     Value& ext_name = Top(arg * 2);
     DCHECK(ext_name.IsString());
     ExtensionFactory* factory = GetExtensionFactory(*ext_name.GetString());
@@ -536,120 +578,68 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
   }
 
   vm_instr(BC_LACL) {
-    Push(Value(procedure->IndexACL(code.arg())));
+    OpLiteral(ip);
     next();
   }
 
   vm_instr(BC_SLOAD) {
-    Push(Back(base, code.arg()));
+    OpSLoad(ip, base);
     next();
   }
 
   vm_instr(BC_SSTORE) {
-    Back(base, code.arg()) = Top(0);
-    Pop(1);
+    OpSStore(ip, base);
     next();
   }
 
   vm_instr(BC_SPOP) {
-    Pop(code.arg());
+    Pop(ip->arg);
     next();
   }
 
   vm_instr(BC_JMP) {
-    code = procedure->code_buffer().BeginAt(code.arg());
-    dispatch(*code);
-  }
-
-  vm_instr(BC_JF) {
-    arg = code.arg();
-    bool b;
-    verify((result = Top(0).ToBoolean(context(), &b)));
-
-    if (!b) {
-      code = procedure->code_buffer().BeginAt(arg);
-      Pop(1);
-      dispatch(*code);
-    } else {
-      Pop(1);
-      next();
-    }
+    ip = ip->target;
+    dispatch();
   }
 
-  vm_instr(BC_JT) {
-    arg = code.arg();
-    bool b;
-    verify((result = Top(0).ToBoolean(context(), &b)));
-
-    if (b) {
-      code = procedure->code_buffer().BeginAt(arg);
-      Pop(1);
-      dispatch(*code);
-    } else {
-      Pop(1);
-      next();
-    }
+#define DO(BC, OP)                     \
+  vm_instr(BC) {                       \
+    bool jump;                         \
+    verify((result = OP(&jump)));      \
+    if (jump) {                        \
+      ip = ip->target;                 \
+      dispatch();                      \
+    }                                  \
+    next();                            \
   }
 
-  vm_instr(BC_BRT) {
-    arg = code.arg();
-    bool b;
-    verify((result = Top(0).ToBoolean(context(), &b)));
-
-    if (b) {
-      code = procedure->code_buffer().BeginAt(arg);
-      Replace(Value(true));
-      dispatch(*code);
-    } else {
-      Pop(1);
-      next();
-    }
-  }
+  DO(BC_JF, OpJF)
+  DO(BC_JT, OpJT)
+  DO(BC_BRT, OpBRT)
+  DO(BC_BRF, OpBRF)
 
-  vm_instr(BC_BRF) {
-    arg = code.arg();
-    bool b;
-    verify((result = Top(0).ToBoolean(context(), &b)));
-
-    if (!b) {
-      code = procedure->code_buffer().BeginAt(arg);
-      Replace(Value(false));
-      dispatch(*code);
-    } else {
-      Pop(1);
-      next();
-    }
-  }
+#undef DO  // DO
 
   vm_instr(BC_PGET) {
-    arg = code.arg();
-    String* key = procedure->IndexString(arg);
-    verify((result = Top(0).GetProperty(context(), *key, &m_v0)));
-
-    Replace(m_v0);
+    verify((result = OpPGet(ip)));
     next();
   }
 
   vm_instr(BC_PSET) {
-    arg = code.arg();
-    String* key = procedure->IndexString(arg);
-    Value& v = Top(1);
-    Value& obj = Top(0);
-    verify((result = obj.SetProperty(context(), *key, v)));
-
-    Pop(2);
+    verify((result = OpPSet(ip)));
     next();
   }
 
 #define XX(BC, METHOD)                                           \
   vm_instr(BC) {                                                 \
-    arg = code.arg();                                            \
-    String* key = procedure->IndexString(arg);                   \
+    arg = ip->arg;                                               \
+    String* key = ip->literal->GetString();                      \
     Value& v = Top(1);                                           \
     Value& obj = Top(0);                                         \
     verify((result = obj.GetProperty(context(), *key, &m_v0)));  \
+    Object* before = ObjectOf(m_v0);                             \
     verify((result = m_v0.METHOD(context(), v)));                \
-    if (!m_v0.IsObject()) {                                      \
+    if (IsReplaced(m_v0, before)) {                              \
       verify((result = obj.SetProperty(context(), *key, m_v0))); \
     }                                                            \
     Pop(2);                                                      \
@@ -665,45 +655,39 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
 #undef XX  // XX
 
   vm_instr(BC_PUNSET) {
-    arg = code.arg();
-    String* key = procedure->IndexString(arg);
+    arg = ip->arg;
+    String* key = ip->literal->GetString();
     Value& obj = Top(0);
     verify((result = obj.GetProperty(context(), *key, &m_v0)));
+    Object* before = ObjectOf(m_v0);
     verify((result = m_v0.Unset(context())));
-    if (!m_v0.IsObject()) {
+    if (IsReplaced(m_v0, before)) {
       verify((result = obj.SetProperty(context(), *key, m_v0)));
     }
-    Pop(2);
+    Pop(1);
     next();
   }
 
   vm_instr(BC_AGET) {
-    arg = code.arg();
-    String* key = procedure->IndexString(arg);
-    verify((result = Top(0).GetAttribute(context(), *key, &m_v0)));
-    Replace(m_v0);
+    verify((result = OpAGet(ip)));
     next();
   }
 
   vm_instr(BC_ASET) {
-    arg = code.arg();
-    String* key = procedure->IndexString(arg);
-    Value& v = Top(1);
-    Value& obj = Top(0);
-    verify((result = obj.SetAttribute(context(), *key, v)));
-    Pop(2);
+    verify((result = OpASet(ip)));
     next();
   }
 
 #define XX(BC, METHOD)                                            \
   vm_instr(BC) {                                                  \
-    arg = code.arg();                                             \
-    String* key = procedure->IndexString(arg);                    \
+    arg = ip->arg;                                                \
+    String* key = ip->literal->GetString();                       \
     Value& v = Top(1);                                            \
     Value& obj = Top(0);                                          \
     verify((result = obj.GetAttribute(context(), *key, &m_v0)));  \
+    Object* before = ObjectOf(m_v0);                              \
     verify((result = m_v0.METHOD(context(), v)));                 \
-    if (!m_v0.IsObject()) {                                       \
+    if (IsReplaced(m_v0, before)) {                               \
       verify((result = obj.SetAttribute(context(), *key, m_v0))); \
     }                                                             \
     Pop(2);                                                       \
@@ -719,33 +703,26 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
 #undef XX  // XX
 
   vm_instr(BC_AUNSET) {
-    arg = code.arg();
-    String* key = procedure->IndexString(arg);
+    arg = ip->arg;
+    String* key = ip->literal->GetString();
     Value& obj = Top(0);
     verify((result = obj.GetAttribute(context(), *key, &m_v0)));
+    Object* before = ObjectOf(m_v0);
     verify((result = m_v0.Unset(context())));
-    if (!m_v0.IsObject()) {
+    if (IsReplaced(m_v0, before)) {
       verify((result = obj.SetAttribute(context(), *key, m_v0)));
     }
-    Pop(2);
+    Pop(1);
     next();
   }
 
   vm_instr(BC_IGET) {
-    Value& obj = Top(1);
-    Value& key = Top(0);
-    verify((result = obj.GetIndex(context(), key, &m_v0)));
-    Pop(2);
-    Push(m_v0);
+    verify((result = OpIGet()));
     next();
   }
 
   vm_instr(BC_ISET) {
-    Value& val = Top(2);
-    Value& obj = Top(1);
-    Value& key = Top(0);
-    verify((result = obj.SetIndex(context(), key, val)));
-    Pop(3);
+    verify((result = OpISet()));
     next();
   }
 
@@ -755,8 +732,9 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
     Value& obj = Top(1);                                     \
     Value& key = Top(0);                                     \
     verify((result = obj.GetIndex(context(), key, &m_v0)));  \
+    Object* before = ObjectOf(m_v0);                         \
     verify((result = m_v0.METHOD(context(), val)));          \
-    if (!m_v0.IsObject()) {                                  \
+    if (IsReplaced(m_v0, before)) {                          \
       verify((result = obj.SetIndex(context(), key, m_v0))); \
     }                                                        \
     Pop(3);                                                  \
@@ -775,8 +753,9 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
     Value& obj = Top(1);
     Value& key = Top(0);
     verify((result = obj.GetIndex(context(), key, &m_v0)));
+    Object* before = ObjectOf(m_v0);
     verify((result = m_v0.Unset(context())));
-    if (!m_v0.IsObject()) {
+    if (IsReplaced(m_v0, before)) {
       verify((result = obj.SetIndex(context(), key, m_v0)));
     }
     Pop(2);
@@ -784,36 +763,27 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
   }
 
   vm_instr(BC_GLOAD) {
-    arg = code.arg();
-    String* key = procedure->IndexString(arg);
-    if (!GetGlobalVariable(*key, &m_v0)) {
-      result.set_fail("global variable \"%s\" not found", key->data());
-      goto fail;
-    }
-    Push(m_v0);
+    verify((result = OpGLoad(ip)));
     next();
   }
 
   vm_instr(BC_GSET) {
-    arg = code.arg();
-    String* key = procedure->IndexString(arg);
-    context()->AddOrUpdateGlobalVariable(*key, Top(0));
-    Pop(1);
+    OpGSet(ip);
     next();
   }
 
-#define XX(BC, METHOD)                                                  \
-  vm_instr(BC) {                                                        \
-    String* key = procedure->IndexString(code.arg());                   \
-    Value& val = Top(0);                                                \
-    if (!GetGlobalVariable(*key, &m_v0)) {                              \
-      result.set_fail("global variable \"%s\" not found", key->data()); \
-      goto fail;                                                        \
-    }                                                                   \
-    m_v0.METHOD(context(), val);                                        \
-    context()->AddOrUpdateGlobalVariable(*key, m_v0);                   \
-    Pop(1);                                                             \
-    next();                                                             \
+#define XX(BC, METHOD)                                           \
+  vm_instr(BC) {                                                 \
+    Value& val = Top(0);                                         \
+    if (!GetGlobalVariable(ip->arg, &m_v0)) {                    \
+      result.set_fail("global variable \"%s\" not found",        \
+                      GetGlobalVariableName(ip->arg).data());    \
+      goto fail;                                                 \
+    }                                                            \
+    m_v0.METHOD(context(), val);                                 \
+    SetGlobalVariable(ip->arg, m_v0);                            \
+    Pop(1);                                                      \
+    next();                                                      \
   }
 
   XX(BC_GSADD, SelfAdd)
@@ -825,24 +795,24 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
 #undef XX  // XX
 
   vm_instr(BC_GUNSET) {
-    String* key = procedure->IndexString(code.arg());
-    if (!GetGlobalVariable(*key, &m_v0)) {
-      result.set_fail("global variable \"%s\" not found", key->data());
+    if (!GetGlobalVariable(ip->arg, &m_v0)) {
+      result.set_fail("global variable \"%s\" not found",
+                      GetGlobalVariableName(ip->arg).data());
       goto fail;
     }
     verify((result = m_v0.Unset(context())));
 
-    context()->AddOrUpdateGlobalVariable(*key, m_v0);
+    SetGlobalVariable(ip->arg, m_v0);
     next();
   }
 
   vm_instr(BC_DEBUG) {
-    CurrentFrame()->source_index = code.arg();
+    OpDebug(ip);
     next();
   }
 
   vm_instr(BC_IMPORT) {
-    String* key = procedure->IndexString(code.arg());
+    String* key = ip->literal->GetString();
     Module* module = GetModule(*key);
     if (!module) {
       result.set_fail("module \"%s\" not found", key->data());
@@ -854,7 +824,7 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
 
   vm_instr(BC_GSUB) {
     SubRoutine* sub_routine = InternalAllocator(gc()).NewSubRoutine(
-        CompiledCodeBuilder(cc).IndexSubRoutine(code.arg()));
+        CompiledCodeBuilder(cc).IndexSubRoutine(ip->arg));
     m_v1.SetSubRoutine(sub_routine);
 
     String* sub_name = gc()->NewString(sub_routine->name());
@@ -866,7 +836,7 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
 
   vm_instr(BC_LSUB) {
     SubRoutine* sub_routine = InternalAllocator(gc()).NewSubRoutine(
-        CompiledCodeBuilder(cc).IndexSubRoutine(code.arg()));
+        CompiledCodeBuilder(cc).IndexSubRoutine(ip->arg));
     m_v0.SetSubRoutine(sub_routine);
     Push(m_v0);
     next();
@@ -874,11 +844,11 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
 
   // Function call
   vm_instr(BC_CALL) {
-    arg = code.arg();
+    arg = ip->arg;
     Value& callable = Top(arg);
 
     // Write the instruction position back to the Frame object
-    CurrentFrame()->pc = code.next_available();
+    CurrentFrame()->pc = tc->IndexOf(ip) + 1;
 
     // Start to interpreting the function call
     int status = EnterFunction(callable, arg, &result);
@@ -890,11 +860,13 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
           case MethodStatus::METHOD_FAIL:
             goto fail;
           case MethodStatus::METHOD_YIELD:
-            ++code;
+            ++ip;
             m_yield = true;
             goto yield;
           case MethodStatus::METHOD_OK:
-            next();
+            ++ip;
+            safepoint();
+            dispatch();
           case MethodStatus::METHOD_UNIMPLEMENTED:
             goto fail;
           case MethodStatus::METHOD_TERMINATE:
@@ -907,13 +879,35 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
         // fact we have a new frame because a new function call
         sub_routine = CurrentFrame()->sub_routine();
         procedure = sub_routine->procedure();
-        code = procedure->code_buffer().BeginAt(CurrentFrame()->pc);
+        tc = GetThreadedCode(procedure);
+        ip = tc->At(CurrentFrame()->pc);
         base = CurrentFrame()->base;
-        dispatch(*code);
+        profile_procedure();
+        CountEntry(procedure);
+        safepoint();
+        dispatch();
         break;
     }
   }
 
+  // Call in tail position , a sub routine reuses the current frame. Any other
+  // callable is called as normal and the following BC_RET returns its result
+  vm_instr(BC_TAILCALL) {
+    arg = ip->arg;
+    if (!Top(arg).IsSubRoutine()) goto LABEL_BC_CALL;
+
+    if (!EnterTailCall(arg, &result)) goto fail;
+    sub_routine = CurrentFrame()->sub_routine();
+    procedure = sub_routine->procedure();
+    tc = GetThreadedCode(procedure);
+    ip = tc->At(CurrentFrame()->pc);
+    base = CurrentFrame()->base;
+    profile_procedure();
+    CountEntry(procedure);
+    safepoint();
+    dispatch();
+  }
+
   vm_instr(BC_RET) {
     m_v0 = Top(0);
     if (!ExitFunction(m_v0)) {
@@ -921,13 +915,16 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
     }
     sub_routine = CurrentFrame()->sub_routine();
     procedure = sub_routine->procedure();
-    code = procedure->code_buffer().BeginAt(CurrentFrame()->pc);
+    tc = GetThreadedCode(procedure);
+    ip = tc->At(CurrentFrame()->pc);
     base = CurrentFrame()->base;
-    dispatch(*code);
+    profile_procedure();
+    safepoint();
+    dispatch();
   }
 
   vm_instr(BC_TERM) {
-    arg = code.arg();
+    arg = ip->arg;
     if (static_cast<ActionType>(arg) == ACT_EXTENSION) {
       m_v0 = Top(0);
     } else {
@@ -937,69 +934,46 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
   }
 
   vm_instr(BC_FORPREP) {
-    Iterator* iterator;
-    arg = code.arg();
-    m_v0 = Top(0);
-    if (m_v0.IsIterator()) {
-      iterator = m_v0.GetIterator();
-    } else {
-      verify((result = m_v0.NewIterator(context(), &iterator)));
-      DCHECK(iterator);
-    }
-    m_v1.SetIterator(iterator);
-
-    if (!iterator->Has(context())) {
+    bool jump;
+    verify((result = OpForPrep(&jump)));
+    if (jump) {
       // Now the iterator doesn't have any value here, then just do a directly
       // jump to the point where we can directly skip the whole freaking body
-      code = procedure->code_buffer().BeginAt(arg);
-      dispatch(*code);
-    } else {
-      Replace(m_v1);
-      next();
+      ip = ip->target;
+      dispatch();
     }
+    next();
   }
 
   vm_instr(BC_FOREND) {
-    arg = code.arg();
-    m_v0 = Top(0);
-    DCHECK(m_v0.IsIterator());
-    Iterator* iterator = m_v0.GetIterator();
-    if (iterator->Next(context())) {
-      code = procedure->code_buffer().BeginAt(arg);
-      dispatch(*code);
-    } else {
-      next();
+    if (OpForEnd()) {
+      ip = ip->target;
+      safepoint();  // Loop back edge
+      dispatch();
     }
+    next();
   }
 
   vm_instr(BC_ITERK) {
-    m_v0 = Top(0);
-    DCHECK(m_v0.IsIterator());
-    Iterator* iterator = m_v0.GetIterator();
-    iterator->GetKey(context(), &m_v1);
-    Push(m_v1);
+    OpIterK();
     next();
   }
 
   vm_instr(BC_ITERV) {
-    m_v0 = Top(1);
-    DCHECK(m_v0.IsIterator());
-    Iterator* iterator = m_v0.GetIterator();
-    iterator->GetValue(context(), &m_v1);
-    Push(m_v1);
+    OpIterV();
     next();
   }
 
   vm_instr(BC_BRK) {
-    arg = code.arg();
-    code = procedure->code_buffer().BeginAt(arg);
-    dispatch(*code);
+    arg = ip->arg;
+    ip = ip->target;
+    dispatch();
   }
 
   vm_instr(BC_CONT) {
-    arg = code.arg();
-    code = procedure->code_buffer().BeginAt(arg);
-    dispatch(*code);
+    arg = ip->arg;
+    ip = ip->target;
+    dispatch();
   }
 
   vm_instr(BC_CSTR) {
@@ -1061,25 +1035,142 @@ MethodStatus Runtime::Main(Value* output, int64_t instr_count) {
   }
 
   vm_instr(BC_SCAT) {
-    arg = code.arg();
-    {
-      // Forms a lexical scope to avoid memory leak inside of std::string due
-      // to the *next* call which will jumps over the std::string's destructor
-      std::string buf;
-      buf.reserve(128);
-      int i = static_cast<int>(arg) - 1;
-      for (; i >= 0; --i) {
-        m_v0 = Top(i);
-        String* pstring = m_v0.GetString();
-        buf.append(pstring->data());
-      }
-      Handle<String> str(context()->gc()->NewString(buf), context()->gc());
-      Pop(arg);
-      Push(Value(str));
+    verify((result = OpSCat(ip)));
+    next();
+  }
+
+  vm_instr(BC_CONCAT) {
+    verify((result = OpConcat(ip)));
+    next();
+  }
+
+  // ================================================================
+  // Quickened bytecode. The guard checks the operand types , when it fails
+  // the instruction is deoptimized and the generic one is executed instead.
+  // ================================================================
+
+#define DO(BC, GENERIC, TYPE, OPER)                                      \
+  vm_instr(BC) {                                                         \
+    if (Top(1).Is##TYPE() && Top(0).Is##TYPE()) {                        \
+      Value v(Top(1).Get##TYPE() OPER Top(0).Get##TYPE());               \
+      Pop(2);                                                            \
+      Push(v);                                                           \
+      next();                                                            \
+    }                                                                    \
+    ThreadedCode::Deoptimize(ip, kLabels[GENERIC]);                      \
+    goto LABEL_##GENERIC;                                                \
+  }
+
+  DO(BC_ADD_INT, BC_ADD, Integer, +)
+  DO(BC_ADD_REAL, BC_ADD, Real, +)
+  DO(BC_SUB_INT, BC_SUB, Integer, -)
+  DO(BC_SUB_REAL, BC_SUB, Real, -)
+  DO(BC_MUL_INT, BC_MUL, Integer, *)
+  DO(BC_MUL_REAL, BC_MUL, Real, *)
+  DO(BC_LT_INT, BC_LT, Integer, <)
+  DO(BC_LT_REAL, BC_LT, Real, <)
+  DO(BC_LE_INT, BC_LE, Integer, <=)
+  DO(BC_LE_REAL, BC_LE, Real, <=)
+  DO(BC_GT_INT, BC_GT, Integer, >)
+  DO(BC_GT_REAL, BC_GT, Real, >)
+  DO(BC_GE_INT, BC_GE, Integer, >=)
+  DO(BC_GE_REAL, BC_GE, Real, >=)
+  DO(BC_EQ_INT, BC_EQ, Integer, ==)
+  DO(BC_EQ_REAL, BC_EQ, Real, ==)
+  DO(BC_NE_INT, BC_NE, Integer, !=)
+  DO(BC_NE_REAL, BC_NE, Real, !=)
+
+#undef DO  // DO
+
+#define DO(BC, GENERIC, OPER)                                            \
+  vm_instr(BC) {                                                         \
+    if (Top(1).IsString() && Top(0).IsString()) {                        \
+      Value v(*Top(1).GetString() OPER * Top(0).GetString());            \
+      Pop(2);                                                            \
+      Push(v);                                                           \
+      next();                                                            \
+    }                                                                    \
+    ThreadedCode::Deoptimize(ip, kLabels[GENERIC]);                      \
+    goto LABEL_##GENERIC;                                                \
+  }
+
+  DO(BC_EQ_STR, BC_EQ, ==)
+  DO(BC_NE_STR, BC_NE, !=)
+
+#undef DO  // DO
+
+  // ================================================================
+  // Superinstructions. The trailing components are still in the code
+  // array , ip is moved onto each component before executing it so its
+  // operand is at hand and an error is reported at the right location.
+  // ================================================================
+
+  vm_instr(BC_SLOAD_PGET) {
+    m_v0 = Back(base, ip->arg);
+    ++ip;  // BC_PGET
+    verify((result = GetProperty(ip->arg, m_v0, *ip->literal->GetString(),
+                                 &m_v0)));
+    Push(m_v0);
+    next();
+  }
+
+  vm_instr(BC_SLOAD_EQVI) {
+    const Value& lhs = Back(base, ip->arg);
+    ++ip;  // BC_EQVI
+    int32_t rhs = ip->literal->GetInteger();
+    if (lhs.IsInteger()) {
+      Push(Value(lhs.GetInteger() == rhs));
+    } else {
+      bool bret;
+      verify((result = lhs.Equal(context(), Value(rhs), &bret)));
+      Push(Value(bret));
+    }
+    next();
+  }
+
+  vm_instr(BC_GLOAD_PGET) {
+    if (!GetGlobalVariable(ip->arg, &m_v0)) {
+      result.set_fail("global variable \"%s\" not found",
+                      GetGlobalVariableName(ip->arg).data());
+      goto fail;
     }
+    ++ip;  // BC_PGET
+    verify((result = GetProperty(ip->arg, m_v0, *ip->literal->GetString(),
+                                 &m_v0)));
+    Push(m_v0);
     next();
   }
 
+  vm_instr(BC_GLOAD_PGET_CALL) {
+    if (!GetGlobalVariable(ip->arg, &m_v0)) {
+      result.set_fail("global variable \"%s\" not found",
+                      GetGlobalVariableName(ip->arg).data());
+      goto fail;
+    }
+    ++ip;  // BC_PGET
+    verify((result = GetProperty(ip->arg, m_v0, *ip->literal->GetString(),
+                                 &m_v0)));
+    Push(m_v0);
+    ++ip;  // BC_CALL or BC_TAILCALL , it is too large to be duplicated
+    if (ip->bytecode == BC_TAILCALL) goto LABEL_BC_TAILCALL;
+    goto LABEL_BC_CALL;
+  }
+
+  vm_instr(BC_LSTR_MATCH_JF) {
+    const Value& pattern = *ip->literal;
+    bool b;
+    ++ip;  // BC_MATCH , the pattern doesn't need to go through the stack
+    verify((result = Top(0).Match(context(), pattern, &b)));
+    Pop(1);
+    ++ip;  // BC_JF
+    if (!b) {
+      ip = ip->target;
+      dispatch();
+    } else {
+      next();
+    }
+  }
+
 done:
   // When we reach here, it means we have succesfully finish all function
   // execution and m_frame.size() == 0.
@@ -1089,13 +1180,31 @@ done:
   DCHECK(!m_yield);
   DCHECK(result);
   DCHECK(m_frame.empty());
-  DCHECK(m_stack.empty());
+  DCHECK(StackSize() == 0);
 
   return result;
 
+// Native code of the current Procedure runs from ip until it hits something
+// it cannot handle , the interpreter then continues from the Frame's pc
+jit: {
+  CurrentFrame()->pc = tc->IndexOf(ip);
+  JitCode::State state = {this, tc, base, &instr_count, &result};
+  int status = procedure->jit_code()->Run(&state, CurrentFrame()->pc);
+  ip = tc->At(CurrentFrame()->pc);
+  switch (status) {
+    case JitCode::JIT_INTERPRET:
+      dispatch();
+    case JitCode::JIT_YIELD:
+      goto yield;
+    default:
+      DCHECK(status == JitCode::JIT_FAIL);
+      goto fail;
+  }
+}
+
 yield:
   DCHECK(!m_frame.empty());
-  CurrentFrame()->pc = code.index();
+  CurrentFrame()->pc = tc->IndexOf(ip);
   m_v0.SetNull();
   m_yield = true;
   return MethodStatus::kYield;
@@ -1114,17 +1223,27 @@ fail:
   m_v0.SetNull();
 
   DCHECK(result.is_fail() || result.is_unimplemented());
-  CurrentFrame()->pc = code.index();
+  CurrentFrame()->pc = tc->IndexOf(ip);
   result =
       ReportError(result.is_fail() ? result.fail() : result.unimplemented());
   Reset();
   return result;
 }
 
-#undef dispatch  // dispatch
-#undef next      // next
-#undef vm_instr  // vm_instr
-#undef verify    // verify
+#undef dispatch   // dispatch
+#undef safepoint  // safepoint
+#undef next       // next
+#undef vm_instr   // vm_instr
+#undef verify     // verify
+
+#undef quicken        // quicken
+#undef quicken_equal  // quicken_equal
+
+#undef profile_enter     // profile_enter
+#undef profile_bytecode  // profile_bytecode
+
+#undef profile_procedure    // profile_procedure
+#undef profile_instruction  // profile_instruction
 
 void Runtime::UnwindStack(std::ostringstream* output) const {
   int count = 0;
@@ -1140,9 +1259,7 @@ void Runtime::UnwindStack(std::ostringstream* output) const {
       (*output) << " frame-base:" << frame.base;
       (*output) << " pc:" << frame.pc << '\n';
     } else {
-      vcl::util::CodeLocation location =
-          frame.sub_routine()->procedure()->code_buffer().code_location(
-              frame.pc);
+      vcl::util::CodeLocation location = GetCodeLocation(frame);
 
       boost::shared_ptr<SourceCodeInfo> source_code =
           m_context->compiled_code()->IndexSourceCodeInfo(frame.source_index);
@@ -1161,6 +1278,119 @@ void Runtime::UnwindStack(std::ostringstream* output) const {
   }
 }
 
+vcl::util::CodeLocation Runtime::GetCodeLocation(const Frame& frame) const {
+  return frame.sub_routine()->procedure()->code_location(frame.pc);
+}
+
+const void* const* Runtime::GetDispatchTable() {
+  if (!kDispatchTable) {
+    Runtime runtime(NULL, 0);
+    runtime.Main(NULL);
+  }
+  return kDispatchTable;
+}
+
+void Runtime::CountEntry(Procedure* procedure) {
+  if (procedure->jit_code() || ExecutionProfile::IsEnabled()) return;
+  Engine* e = engine();
+  if (!e || !e->option().jit || !JitCode::IsSupported()) return;
+  // Threshold 0 compiles a Procedure at its first entry just like 1
+  const uint32_t threshold = std::max<uint32_t>(e->option().jit_threshold, 1);
+  if (procedure->IncreaseHotness() == threshold) {
+    procedure->InstallJitCode(JitCode::Compile(*GetThreadedCode(procedure)));
+  }
+}
+
+MethodStatus Runtime::AppendString(const Value& value, bool convert) {
+  char buffer[32];
+  switch (value.type()) {
+    case TYPE_STRING: {
+      const String* string = value.GetString();
+      m_concat.append(string->data(), string->size());
+      return MethodStatus::kOk;
+    }
+    case TYPE_INTEGER:
+      if (!convert) break;
+      snprintf(buffer, sizeof(buffer), "%d", value.GetInteger());
+      m_concat.append(buffer);
+      return MethodStatus::kOk;
+    case TYPE_REAL:
+      if (!convert) break;
+      m_concat.append(vcl::util::RealToString(value.GetReal()));
+      return MethodStatus::kOk;
+    case TYPE_NULL:
+      if (!convert) break;
+      m_concat.append("null");
+      return MethodStatus::kOk;
+    case TYPE_BOOLEAN:
+      if (!convert) break;
+      m_concat.append(value.GetBoolean() ? "true" : "false");
+      return MethodStatus::kOk;
+    case TYPE_DURATION:
+      if (!convert) break;
+      m_concat.append(vcl::util::Duration::ToString(value.GetDuration()));
+      return MethodStatus::kOk;
+    case TYPE_SIZE:
+      if (!convert) break;
+      m_concat.append(vcl::util::Size::ToString(value.GetSize()));
+      return MethodStatus::kOk;
+    default: {
+      DCHECK(value.IsObject());
+      std::string temp;
+      MethodStatus result = value.ToString(context(), &temp);
+      if (!result) {
+        if (!convert) return result;
+        break;
+      }
+      m_concat.append(temp);
+      return MethodStatus::kOk;
+    }
+  }
+  if (convert) {
+    return MethodStatus::NewFail("type %s cannot be converted to string",
+                                 value.type_name());
+  }
+  return MethodStatus::NewFail("type %s cannot convert to string",
+                               value.type_name());
+}
+
+void Runtime::TakeSample(size_t pc) {
+  m_sample = false;
+  SamplingProfiler* profiler = SamplingProfiler::Current();
+  if (!profiler) return;
+
+  SamplingProfiler::Sample sample;
+  sample.depth = 0;
+  for (std::vector<Frame>::const_reverse_iterator itr = m_frame.rbegin();
+       itr != m_frame.rend() && sample.depth < SamplingProfiler::kMaxDepth;
+       ++itr) {
+    SamplingProfiler::Sample::Frame& frame = sample.frame[sample.depth];
+    if (itr->IsScriptFunction()) {
+      frame.procedure = itr->sub_routine()->procedure();
+      // A caller's pc points to the instruction after the call
+      frame.pc = sample.depth ? (itr->pc ? itr->pc - 1 : 0) : pc;
+    } else {
+      frame.procedure = NULL;
+      frame.pc = 0;
+    }
+    ++sample.depth;
+  }
+  profiler->Push(sample);
+}
+
+void Runtime::SyncGlobalSlot() {
+  const CompiledCode* cc = context()->compiled_code();
+  for (size_t i = m_global_slot.size(); i < cc->global_slot_size(); ++i) {
+    m_global_slot.push_back(context()->ReserveGlobalSlot(
+        cc->global_slot_name(static_cast<uint32_t>(i))));
+  }
+}
+
+void Runtime::Link(Procedure* procedure, uint32_t inline_cache_base) {
+  procedure->set_threaded_code(ThreadedCode::Link(
+      *procedure, GetDispatchTable(), inline_cache_base));
+}
+
 MethodStatus Runtime::ReportError(const std::string& error) const {
   std::ostringstream unwind_stk;
   std::string prefix;
@@ -1172,9 +1402,7 @@ MethodStatus Runtime::ReportError(const std::string& error) const {
     std::ostringstream formatter;
     const Frame& frame = m_frame.back();
     if (frame.IsScriptFunction()) {
-      vcl::util::CodeLocation location =
-          frame.sub_routine()->procedure()->code_buffer().code_location(
-              frame.pc);
+      vcl::util::CodeLocation location = GetCodeLocation(frame);
 
       boost::shared_ptr<SourceCodeInfo> source_code =
           m_context->compiled_code()->IndexSourceCodeInfo(frame.source_index);
@@ -1200,9 +1428,9 @@ void Runtime::Mark() {
     m_frame[i].Mark();
   }
 
-  // Mark the value stack
-  for (size_t i = 0; i < m_stack.size(); ++i) {
-    m_stack[i].Mark();
+  // Mark the value stack , slots above the top are garbage
+  for (Value* v = StackBegin(); v != m_sp; ++v) {
+    v->Mark();
   }
 
   // Lastly scratch register
@@ -1227,12 +1455,23 @@ MethodStatus Runtime::BeginRun(SubRoutine* procedure) {
   if (is_yield()) {
     return MethodStatus::NewFail("Context is interrupted,call Resume() first!");
   } else {
+    ReserveStack(StackSize() + 1);
     Push(Value(procedure));
     return MethodStatus::kOk;
   }
 }
 
-void Runtime::AddArgument(const Value& value) { Push(value); }
+void Runtime::AddArgument(const Value& value) {
+  Value argument(value);  // value may live on the stack
+  ReserveStack(StackSize() + 1);
+  Push(argument);
+}
+
+void Runtime::GrowStack(size_t size) {
+  const size_t sp = StackSize();
+  m_stack.resize(std::max(size, m_stack.size() * 2));
+  m_sp = StackBegin() + sp;
+}
 
 MethodStatus Runtime::FinishRun(SubRoutine* routine, Value* value) {
   DCHECK(Top(routine->argument_size()).IsSubRoutine());
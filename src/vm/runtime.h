@@ -3,6 +3,7 @@
 #include <limits>
 
 #include <vcl/util.h>
+#include "execution-profile.h"
 #include "procedure.h"
 #include "vcl-pri.h"
 
@@ -12,16 +13,22 @@
 namespace vcl {
 namespace vm {
 class Runtime;
+class ThreadedCode;
+struct ThreadedInstruction;
+class JitHelper;
 
 namespace detail {
 
+// Marks the Runtime as running and as the current one of the thread , see
+// Runtime::Current
 class VMGuard {
  public:
-  inline VMGuard(Runtime* runtime);
-  inline ~VMGuard();
+  VMGuard(Runtime* runtime);
+  ~VMGuard();
 
  private:
   Runtime* m_runtime;
+  Runtime* m_previous;
 };
 
 }  // namespace detail
@@ -83,18 +90,79 @@ class Runtime {
     void Mark() { caller.Mark(); }
   };
 
+  // Polymorphic inline cache of a BC_PGET/BC_AGET site. Each site has a fixed
+  // key so an entry just maps the stamp of a Dict or Module to the address of
+  // the value slot inside of it , see Dict::stamp. A stamp is unique for the
+  // whole process so a hit means it is the same object with the same layout.
+  // The entry holds no reference to the object which is fine since the stamp
+  // of a collected object will never be seen again.
+  //
+  // A Dict in shaped form is cached by the stamp of its DictShape instead and
+  // the entry maps to the index of the key inside of the shape , so all the
+  // Dicts created by the same literal hit the same entry.
+  struct InlineCache {
+    static const size_t kSize = 4;
+
+    struct Entry {
+      uint64_t stamp;
+      union {
+        const Value* value;
+        size_t index;
+      };
+    };
+
+    Entry entry[kSize];
+    uint32_t next;
+
+    const Entry* Lookup(uint64_t stamp) const {
+      for (size_t i = 0; i < kSize; ++i) {
+        if (entry[i].stamp == stamp) return entry + i;
+      }
+      return NULL;
+    }
+
+    const Value* Find(uint64_t stamp) const {
+      const Entry* e = Lookup(stamp);
+      return e ? e->value : NULL;
+    }
+
+    // Replace entry in round robin once the site becomes megamorphic
+    void Add(uint64_t stamp, const Value* value) {
+      entry[next].stamp = stamp;
+      entry[next].value = value;
+      next = (next + 1) % kSize;
+    }
+
+    void AddIndex(uint64_t stamp, size_t index) {
+      entry[next].stamp = stamp;
+      entry[next].index = index;
+      next = (next + 1) % kSize;
+    }
+
+    InlineCache() : next(0) {
+      for (size_t i = 0; i < kSize; ++i) {
+        entry[i].stamp = 0;  // Stamp starts from 1
+        entry[i].value = NULL;
+      }
+    }
+  };
+
  public:
   Runtime(Context* context, int max_calling_stack_size)
       : m_context(context),
         m_max_calling_stack_size(max_calling_stack_size),
         m_frame(),
-        m_stack(),
+        m_stack(kDefaultValueStackSize),
+        m_sp(vcl::util::VectorAsArray(m_stack)),
         m_v0(),
         m_v1(),
+        m_concat(),
+        m_global_slot(),
+        m_inline_cache(),
         m_yield(false),
-        m_vm_running(false) {
-    m_stack.reserve(kDefaultValueStackSize);
-  }
+        m_sample(false),
+        m_vm_running(false),
+        m_profile() {}
 
  public:  // This a stateful APIs which is sololy used by Context object.
           // In most case you should not use the following APIs since it
@@ -127,11 +195,36 @@ class Runtime {
   bool is_yield() const { return m_yield; }
   MethodStatus Resume(Value*);
 
+  // Whether a run has frames left , it is a yielded or an outer run
+  bool is_running() const { return !m_frame.empty(); }
+
+ public:  // Sampling , see SamplingProfiler
+  // Runtime that is executing script on the calling thread , NULL if none
+  static Runtime* Current();
+
+  // Ask for a sample of the calling stack at the next safepoint , it is safe
+  // to be called inside of a signal handler just like Yield
+  void RequestSample() { m_sample = true; }
+
  public:  // GC stuff
   void Mark();
 
+ public:
+  // Link the Procedure's bytecode into ThreadedCode for the interpreter , its
+  // inline cache sites are numbered starting from inline_cache_base
+  static void Link(Procedure*, uint32_t inline_cache_base);
+
+  // Handler address table of the interpreter indexed by Bytecode
+  static const void* const* GetDispatchTable();
+
   Context* context() const { return m_context; }
   ContextGC* gc() const { return m_context->gc(); }
+
+  // Execution profile of this Runtime , NULL when it is not built with
+  // VCL_EXECUTION_PROFILE
+  ExecutionProfile* execution_profile() {
+    return ExecutionProfile::IsEnabled() ? &m_profile : NULL;
+  }
   Engine* engine() const { return m_context->engine(); }
 
  private:
@@ -140,33 +233,177 @@ class Runtime {
 
   MethodStatus ReportError(const std::string&) const;
 
+  // Get the linked code of a Procedure , all procedures are linked by the
+  // compiler
+  static const ThreadedCode* GetThreadedCode(Procedure* procedure) {
+    DCHECK(procedure->threaded_code());
+    return procedure->threaded_code();
+  }
+
+  // Source code location of the current instruction of a script frame
+  vcl::util::CodeLocation GetCodeLocation(const Frame&) const;
+
+  // Count an entry of a Procedure , it is compiled by the JIT once it is hot
+  // enough , see EngineOption::jit_threshold
+  void CountEntry(Procedure*);
+
+  // Record the calling stack into the SamplingProfiler of this thread , pc is
+  // the position of the current frame
+  void TakeSample(size_t pc);
+
+  // Append the string form of a value to m_concat for BC_SCAT and BC_CONCAT.
+  // With convert every value is converted just like BC_CSTR , otherwise only
+  // what String::Add accepts is allowed
+  MethodStatus AppendString(const Value&, bool convert);
+
   const Frame* CurrentFrame() const { return &m_frame.back(); }
   Frame* CurrentFrame() { return &m_frame.back(); }
 
-  // Helper functions
-  void Push(const Value& value) { m_stack.push_back(value); }
+  // Object of a value , NULL if it is a primitive
+  static Object* ObjectOf(const Value& value) {
+    return value.IsObject() ? value.GetObject() : NULL;
+  }
+
+  // Whether the value read from a container by a compound assignment or an
+  // unset has to be stored back. An object is changed in place , but a
+  // primitive is a copy and an atom string is replaced by a new String , see
+  // Value::SelfAdd
+  static bool IsReplaced(const Value& value, const Object* before) {
+    return !value.IsObject() || value.GetObject() != before;
+  }
+
+  // Operations of the bytecode , defined in runtime-inl.h. Each one does the
+  // whole work of the bytecode besides the dispatch , so the handler inside
+  // of Runtime::Main and the helper called by the JIT are just wrappers of
+  // it. An operation of a branch tells whether it jumps through its output
+  // argument. The stack is left untouched when an operation fails.
+  inline MethodStatus OpAdd();
+  inline MethodStatus OpSub();
+  inline MethodStatus OpMul();
+  inline MethodStatus OpDiv();
+  inline MethodStatus OpMod();
+
+  inline MethodStatus OpAddIV(const ThreadedInstruction*);
+  inline MethodStatus OpSubIV(const ThreadedInstruction*);
+  inline MethodStatus OpMulIV(const ThreadedInstruction*);
+  inline MethodStatus OpDivIV(const ThreadedInstruction*);
+  inline MethodStatus OpModIV(const ThreadedInstruction*);
+  inline MethodStatus OpAddVI(const ThreadedInstruction*);
+  inline MethodStatus OpSubVI(const ThreadedInstruction*);
+  inline MethodStatus OpMulVI(const ThreadedInstruction*);
+  inline MethodStatus OpDivVI(const ThreadedInstruction*);
+  inline MethodStatus OpModVI(const ThreadedInstruction*);
+
+  inline MethodStatus OpLtIV(const ThreadedInstruction*);
+  inline MethodStatus OpLeIV(const ThreadedInstruction*);
+  inline MethodStatus OpGtIV(const ThreadedInstruction*);
+  inline MethodStatus OpGeIV(const ThreadedInstruction*);
+  inline MethodStatus OpEqIV(const ThreadedInstruction*);
+  inline MethodStatus OpNeIV(const ThreadedInstruction*);
+  inline MethodStatus OpLtVI(const ThreadedInstruction*);
+  inline MethodStatus OpLeVI(const ThreadedInstruction*);
+  inline MethodStatus OpGtVI(const ThreadedInstruction*);
+  inline MethodStatus OpGeVI(const ThreadedInstruction*);
+  inline MethodStatus OpEqVI(const ThreadedInstruction*);
+  inline MethodStatus OpNeVI(const ThreadedInstruction*);
+
+  inline MethodStatus OpSAdd(const ThreadedInstruction*, size_t base);
+  inline MethodStatus OpSSub(const ThreadedInstruction*, size_t base);
+  inline MethodStatus OpSMul(const ThreadedInstruction*, size_t base);
+  inline MethodStatus OpSDiv(const ThreadedInstruction*, size_t base);
+  inline MethodStatus OpSMod(const ThreadedInstruction*, size_t base);
+  inline MethodStatus OpUnset(const ThreadedInstruction*, size_t base);
+
+  inline MethodStatus OpLt();
+  inline MethodStatus OpLe();
+  inline MethodStatus OpGt();
+  inline MethodStatus OpGe();
+  inline MethodStatus OpEq();
+  inline MethodStatus OpNe();
+  inline MethodStatus OpMatch();
+  inline MethodStatus OpNotMatch();
+
+  inline MethodStatus OpNegate();
+  inline MethodStatus OpTest();
+  inline MethodStatus OpFlip();
+
+  inline void OpLiteral(const ThreadedInstruction*);
+  inline void OpSLoad(const ThreadedInstruction*, size_t base);
+  inline void OpSStore(const ThreadedInstruction*, size_t base);
+
+  inline MethodStatus OpJT(bool* jump);
+  inline MethodStatus OpJF(bool* jump);
+  inline MethodStatus OpBRT(bool* jump);
+  inline MethodStatus OpBRF(bool* jump);
+
+  inline MethodStatus OpPGet(const ThreadedInstruction*);
+  inline MethodStatus OpPSet(const ThreadedInstruction*);
+  inline MethodStatus OpAGet(const ThreadedInstruction*);
+  inline MethodStatus OpASet(const ThreadedInstruction*);
+  inline MethodStatus OpIGet();
+  inline MethodStatus OpISet();
+
+  inline MethodStatus OpGLoad(const ThreadedInstruction*);
+  inline void OpGSet(const ThreadedInstruction*);
+
+  inline MethodStatus OpForPrep(bool* jump);
+  inline bool OpForEnd();
+  inline void OpIterK();
+  inline void OpIterV();
+
+  inline MethodStatus OpSCat(const ThreadedInstruction*);
+  inline MethodStatus OpConcat(const ThreadedInstruction*);
+
+  inline void OpDebug(const ThreadedInstruction*);
+
+  // Helper functions. The value stack is a raw array , its capacity is
+  // reserved when a frame is entered based on Procedure::max_stack_size , so
+  // none of them checks the capacity.
+  Value* StackBegin() const {
+    return const_cast<Value*>(vcl::util::VectorAsArray(m_stack));
+  }
+  size_t StackSize() const { return static_cast<size_t>(m_sp - StackBegin()); }
+  // Slots above the stack pointer are not cleared when popped , so when the
+  // stack is extended the exposed slots are reset to null , otherwise the GC
+  // will mark stale values
+  void SetStackSize(size_t size) {
+    DCHECK(size <= m_stack.size());
+    Value* sp = StackBegin() + size;
+    for (; m_sp < sp; ++m_sp) m_sp->SetNull();
+    m_sp = sp;
+  }
+
+  // Make sure the stack is able to hold size values , this may reallocate the
+  // stack so no reference into the stack should be held across it
+  void ReserveStack(size_t size) {
+    if (size > m_stack.size()) GrowStack(size);
+  }
+  void GrowStack(size_t);
+
+  void Push(const Value& value) {
+    DCHECK(StackSize() < m_stack.size());
+    *m_sp++ = value;
+  }
   void Pop(size_t count) {
-    DCHECK(count <= m_stack.size());
-    m_stack.resize(m_stack.size() - count);
+    DCHECK(count <= StackSize());
+    m_sp -= count;
   }
-  void Replace(const Value& value) { m_stack.back() = value; }
+  void Replace(const Value& value) { m_sp[-1] = value; }
   Value& Back(size_t base, size_t index) {
-    DCHECK(index + base < m_stack.size());
-    return m_stack[index + base];
+    DCHECK(index + base < StackSize());
+    return StackBegin()[index + base];
   }
   Value& Top(size_t index) {
-    DCHECK(index < m_stack.size());
-    const size_t idx = (m_stack.size() - index - 1);
-    return m_stack[idx];
+    DCHECK(index < StackSize());
+    return m_sp[-static_cast<ptrdiff_t>(index) - 1];
   }
   const Value& Back(size_t base, size_t index) const {
-    DCHECK(index + base < m_stack.size());
-    return m_stack[index + base];
+    DCHECK(index + base < StackSize());
+    return StackBegin()[index + base];
   }
   const Value& Top(size_t index) const {
-    DCHECK(index < m_stack.size());
-    const size_t idx = (m_stack.size() - index - 1);
-    return m_stack[idx];
+    DCHECK(index < StackSize());
+    return m_sp[-static_cast<ptrdiff_t>(index) - 1];
   }
 
   // Helper class for resolving those dependencies
@@ -186,17 +423,103 @@ class Runtime {
     return module;
   }
 
-  bool GetGlobalVariable(const String& name, Value* output) const {
-    if (!context()->GetGlobalVariable(name, output))
-      return engine()->GetGlobalVariable(name, output);
+  // Global variable resolved to slot by compiler , the Context's slot is
+  // checked first and then falls back to the Engine's slot
+  bool GetGlobalVariable(uint32_t slot, Value* output) const {
+    DCHECK(slot < m_global_slot.size());
+    const Value* value = context()->GetGlobalSlot(m_global_slot[slot]);
+    if (!value) {
+      uint32_t engine_slot =
+          context()->compiled_code()->engine_global_slot(slot);
+      if (engine_slot == CompiledCode::kInvalidGlobalSlot) return false;
+      if (!(value = engine()->GetGlobalSlot(engine_slot))) return false;
+    }
+    *output = *value;
     return true;
   }
 
+  void SetGlobalVariable(uint32_t slot, const Value& value) {
+    DCHECK(slot < m_global_slot.size());
+    context()->SetGlobalSlot(m_global_slot[slot], value);
+  }
+
+  // Reserve the Context's slot for all the global slots of CompiledCode
+  void SyncGlobalSlot();
+
+  const String& GetGlobalVariableName(uint32_t slot) const {
+    return context()->compiled_code()->global_slot_name(slot);
+  }
+
+  // Property and attribute lookup of an instruction site that goes through
+  // the inline cache. Only Dict and Module are cached since their lookup is a
+  // plain hash table lookup , the rest goes through the virtual function.
+  MethodStatus GetProperty(uint32_t site,
+                           const Value& object,
+                           const String& key,
+                           Value* output) {
+    DCHECK(site < m_inline_cache.size());
+    InlineCache& ic = m_inline_cache[site];
+    const Value* value = NULL;
+    if (object.IsDict()) {
+      value = LookupDict(&ic, *object.GetDict(), key);
+    } else if (object.IsModule()) {
+      const Module* module = object.GetModule();
+      if (!(value = ic.Find(module->stamp())) &&
+          (value = module->LookupProperty(key)))
+        ic.Add(module->stamp(), value);
+    }
+    if (value) {
+      *output = *value;
+      return MethodStatus::kOk;
+    }
+    return object.GetProperty(context(), key, output);
+  }
+
+  MethodStatus GetAttribute(uint32_t site,
+                            const Value& object,
+                            const String& key,
+                            Value* output) {
+    DCHECK(site < m_inline_cache.size());
+    InlineCache& ic = m_inline_cache[site];
+    const Value* value = NULL;
+    if (object.IsDict()) value = LookupDict(&ic, *object.GetDict(), key);
+    if (value) {
+      *output = *value;
+      return MethodStatus::kOk;
+    }
+    return object.GetAttribute(context(), key, output);
+  }
+
+  // Lookup a Dict through the inline cache , NULL if the key is not existed
+  static const Value* LookupDict(InlineCache* ic,
+                                 const Dict& dict,
+                                 const String& key) {
+    const Value* value;
+    if (const DictShape* shape = dict.shape()) {
+      const InlineCache::Entry* e = ic->Lookup(shape->stamp());
+      if (e) return &dict.shape_value(e->index);
+      size_t index = shape->Find(key);
+      if (index == DictShape::kNotFound) return NULL;
+      ic->AddIndex(shape->stamp(), index);
+      return &dict.shape_value(index);
+    }
+    if (!(value = ic->Find(dict.stamp())) && (value = dict.Lookup(key)))
+      ic->Add(dict.stamp(), value);
+    return value;
+  }
+
   // Calling stack manipulation
   enum { FUNC_SCRIPT, FUNC_CPP, FUNC_FAILED };
 
   int EnterFunction(const Value&, size_t, MethodStatus* status);
 
+  // Tail call the sub routine sitting on top of the stack with the given
+  // number of arguments. The current frame is reused , the callable and the
+  // arguments are moved down to where the current callable lives , so a chain
+  // of tail calls runs in constant frame and stack space. Return false when
+  // the argument size doesn't match
+  bool EnterTailCall(size_t, MethodStatus* status);
+
   // Return true means continue interpreting, otherwise we are exit
   // from the outermost function, so should really exit from the current
   // frame
@@ -205,15 +528,19 @@ class Runtime {
   // Reset the internal status of VM , this can only be called internally
   void Reset() {
     m_frame.clear();
-    m_stack.clear();
+    SetStackSize(0);
     m_v0.SetNull();
   }
 
  private:
-  // virtual machine entry
+  // virtual machine entry , count is the budget of safepoints ( loop back
+  // edge , call and return ) before the VM yields
   MethodStatus Main(Value*,
                     int64_t count = std::numeric_limits<int64_t>::max());
 
+  // register virtual machine entry , see register-runtime.cc
+  MethodStatus RegisterMain(Value*, int64_t);
+
   // Context that is belonged to this Runtime object
   Context* m_context;
 
@@ -223,8 +550,10 @@ class Runtime {
   // Function call's frame
   std::vector<Frame> m_frame;
 
-  // Value stack
+  // Value stack , the vector's size is the capacity of the stack and m_sp
+  // points to one past the top value. Slots above m_sp are garbage.
   std::vector<Value> m_stack;
+  Value* m_sp;
 
   // Single scratch register simulation. Also it gets GCed, so anything
   // inside of m_v0 is safe to be used by C++ side code
@@ -233,24 +562,35 @@ class Runtime {
   // Another scratch register sololy for faster Scanning phase if GC kicks in
   Value m_v1;
 
+  // Buffer for string concatenation , it is kept to avoid allocation of the
+  // temporary buffer on each concatenation
+  std::string m_concat;
+
+  // The Context's global variable slot for each global slot of CompiledCode.
+  // The Context can be created before compilation and user can add global
+  // variables at any time , so the slot index cannot be shared directly.
+  std::vector<uint32_t> m_global_slot;
+
+  // Inline cache for each BC_PGET/BC_AGET site of CompiledCode. It is per
+  // Runtime since CompiledCode can be shared by Contexts of different thread
+  std::vector<InlineCache> m_inline_cache;
+
   // Flag to tell whether we are yielded or not
   bool m_yield;
 
+  // Flag to tell whether a sample is requested
+  bool m_sample;
+
   // Flag to tell whether the VM is still running or not
   bool m_vm_running;
 
+  // Instructions executed by Runtime::Main , see ExecutionProfile
+  ExecutionProfile m_profile;
+
   friend class detail::VMGuard;
+  friend class JitHelper;
 };
 
-namespace detail {
-
-inline VMGuard::VMGuard(Runtime* runtime) : m_runtime(runtime) {
-  runtime->m_vm_running = true;
-}
-
-inline VMGuard::~VMGuard() { m_runtime->m_vm_running = false; }
-
-}  // namespace detail
 }  // namespace vm
 }  // namespace vcl
 
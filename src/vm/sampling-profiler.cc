@@ -0,0 +1,150 @@
+#include "sampling-profiler.h"
+#include "procedure.h"
+#include "runtime.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Older glibc doesn't name the thread id field of sigevent
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif  // sigev_notify_thread_id
+#endif  // __linux__
+
+namespace vcl {
+namespace vm {
+
+namespace {
+
+// Profiler running on this thread
+__thread SamplingProfiler* kProfiler = NULL;
+
+#if defined(__linux__)
+void OnSignal(int) {
+  int saved = errno;
+  Runtime* runtime = Runtime::Current();
+  if (runtime) runtime->RequestSample();
+  errno = saved;
+}
+#endif  // __linux__
+
+}  // namespace
+
+SamplingProfiler::SamplingProfiler(size_t capacity)
+    : m_buffer(capacity ? capacity : 1),
+      m_head(0),
+      m_tail(0),
+      m_dropped(0),
+      m_timer(),
+      m_running(false) {}
+
+SamplingProfiler* SamplingProfiler::Current() { return kProfiler; }
+
+#if defined(__linux__)
+
+bool SamplingProfiler::Start(uint32_t interval) {
+  if (m_running || kProfiler || !interval) return false;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = OnSignal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  if (sigaction(SIGPROF, &action, NULL) != 0) return false;
+
+  struct sigevent event;
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SIGPROF;
+  event.sigev_notify_thread_id = static_cast<pid_t>(syscall(SYS_gettid));
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &m_timer) != 0)
+    return false;
+
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = interval / 1000000;
+  spec.it_interval.tv_nsec = (interval % 1000000) * 1000;
+  spec.it_value = spec.it_interval;
+  if (timer_settime(m_timer, 0, &spec, NULL) != 0) {
+    timer_delete(m_timer);
+    return false;
+  }
+
+  // Also makes sure the thread local storage is allocated before the first
+  // signal arrives
+  kProfiler = this;
+  m_running = true;
+  return true;
+}
+
+void SamplingProfiler::Stop() {
+  if (!m_running) return;
+  DCHECK(kProfiler == this);
+  timer_delete(m_timer);
+  kProfiler = NULL;
+  m_running = false;
+}
+
+#else
+
+bool SamplingProfiler::Start(uint32_t interval) {
+  VCL_UNUSED(interval);
+  return false;
+}
+
+void SamplingProfiler::Stop() {}
+
+#endif  // __linux__
+
+bool SamplingProfiler::Push(const Sample& sample) {
+  const size_t tail = m_tail;
+  if (tail - __atomic_load_n(&m_head, __ATOMIC_ACQUIRE) == m_buffer.size()) {
+    __atomic_add_fetch(&m_dropped, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  m_buffer[tail % m_buffer.size()] = sample;
+  __atomic_store_n(&m_tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool SamplingProfiler::Pop(Sample* sample) {
+  const size_t head = m_head;
+  if (head == __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE)) return false;
+  *sample = m_buffer[head % m_buffer.size()];
+  __atomic_store_n(&m_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+void SamplingProfiler::Fold(std::ostream& output) {
+  std::map<std::string, uint64_t> stacks;
+  Sample sample;
+  while (Pop(&sample)) {
+    std::ostringstream stack;
+    for (size_t i = sample.depth; i > 0; --i) {
+      const Sample::Frame& frame = sample.frame[i - 1];
+      if (i != sample.depth) stack << ';';
+      if (frame.procedure) {
+        stack << frame.procedure->name() << ':'
+              << frame.procedure->code_location(frame.pc).line;
+      } else {
+        stack << "[native]";
+      }
+    }
+    ++stacks[stack.str()];
+  }
+
+  for (std::map<std::string, uint64_t>::const_iterator itr = stacks.begin();
+       itr != stacks.end();
+       ++itr) {
+    output << itr->first << ' ' << itr->second << '\n';
+  }
+}
+
+}  // namespace vm
+}  // namespace vcl
@@ -0,0 +1,108 @@
+#ifndef SAMPLING_PROFILER_H_
+#define SAMPLING_PROFILER_H_
+#include <vcl/util.h>
+#include <time.h>
+#include <iostream>
+#include <vector>
+
+namespace vcl {
+namespace vm {
+class Procedure;
+class Runtime;
+
+// Sampling profiler for VCL stacks. A timer on the CPU time of the thread
+// that starts the profiler sends SIGPROF on each interval. The signal handler
+// does nothing but asks the Runtime running on the thread for a sample , just
+// like Context::Yield does. The Runtime captures its stack at the next
+// safepoint , where every Frame's pc is exact and the frame array is never in
+// the middle of an update , so the stack walk itself needs no care about
+// signal safety. A sample is biased to the safepoints which is fine since
+// straight line code always reaches one in bounded time.
+//
+// Samples are put into a single producer and single consumer ring buffer
+// without lock. The producer is the thread being profiled and the consumer
+// can be any thread calling Fold. When the buffer is full the sample is
+// dropped and counted.
+//
+// A sample refers to the Procedure , so the CompiledCode must be alive until
+// the samples are folded.
+class SamplingProfiler {
+ public:
+  // Max frames recorded in a sample , deeper frames are cut off
+  static const size_t kMaxDepth = 32;
+
+  static const size_t kDefaultCapacity = 1024;
+
+  struct Sample {
+    struct Frame {
+      // NULL for a native function frame
+      const Procedure* procedure;
+      // Instruction being executed , see Procedure::code_location
+      size_t pc;
+    };
+
+    // Frames from the innermost one
+    Frame frame[kMaxDepth];
+    size_t depth;
+  };
+
+  explicit SamplingProfiler(size_t capacity = kDefaultCapacity);
+
+  ~SamplingProfiler() { Stop(); }
+
+  // Start to sample the calling thread every interval microseconds of its CPU
+  // time. Only one profiler can run on a thread , returns false when another
+  // one is running or the timer cannot be created. The SIGPROF handler of the
+  // process is replaced , and it is only supported on Linux
+  bool Start(uint32_t interval);
+
+  // Stop sampling , it must be called on the thread that starts it. Samples
+  // already taken are kept
+  void Stop();
+
+  bool is_running() const { return m_running; }
+
+  // Profiler running on the calling thread , NULL if none
+  static SamplingProfiler* Current();
+
+ public:
+  // Called by Runtime at safepoint , returns false when the sample is dropped
+  bool Push(const Sample&);
+
+  // Take the oldest sample , returns false when there is none
+  bool Pop(Sample*);
+
+  // Drain all the samples and write them in folded stack format , one stack
+  // per line from the outermost frame with its count , which is what
+  // flamegraph.pl expects :
+  //   test:12;foo:3 42
+  void Fold(std::ostream& output);
+
+  // Samples dropped since the buffer was full
+  uint64_t dropped() const {
+    return __atomic_load_n(&m_dropped, __ATOMIC_RELAXED);
+  }
+
+ private:
+  std::vector<Sample> m_buffer;
+
+  // Next sample to pop , written by the consumer
+  size_t m_head;
+
+  // Next slot to push , written by the producer
+  size_t m_tail;
+
+  uint64_t m_dropped;
+
+  // Timer sends SIGPROF to the profiled thread
+  timer_t m_timer;
+
+  bool m_running;
+
+  VCL_DISALLOW_COPY_AND_ASSIGN(SamplingProfiler);
+};
+
+}  // namespace vm
+}  // namespace vcl
+
+#endif  // SAMPLING_PROFILER_H_
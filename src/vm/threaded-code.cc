@@ -0,0 +1,126 @@
+#include "threaded-code.h"
+#include "procedure.h"
+
+#include <map>
+
+namespace vcl {
+namespace vm {
+
+namespace {
+
+enum { OPERAND_NONE, OPERAND_LITERAL, OPERAND_JUMP, OPERAND_SHAPE };
+
+// Superinstruction's operand belongs to its first component
+int GetOperandKind(Bytecode bc) {
+  switch (BytecodeUnfuse(bc)) {
+    case BC_LINT:
+    case BC_LREAL:
+    case BC_LSTR:
+    case BC_LSIZE:
+    case BC_LDURATION:
+    case BC_LACL:
+    case BC_ADDIV:
+    case BC_SUBIV:
+    case BC_MULIV:
+    case BC_DIVIV:
+    case BC_MODIV:
+    case BC_LTIV:
+    case BC_LEIV:
+    case BC_GTIV:
+    case BC_GEIV:
+    case BC_EQIV:
+    case BC_NEIV:
+    case BC_ADDVI:
+    case BC_SUBVI:
+    case BC_MULVI:
+    case BC_DIVVI:
+    case BC_MODVI:
+    case BC_LTVI:
+    case BC_LEVI:
+    case BC_GTVI:
+    case BC_GEVI:
+    case BC_EQVI:
+    case BC_NEVI:
+    case BC_PGET:
+    case BC_PSET:
+    case BC_PSADD:
+    case BC_PSSUB:
+    case BC_PSMUL:
+    case BC_PSDIV:
+    case BC_PSMOD:
+    case BC_PUNSET:
+    case BC_AGET:
+    case BC_ASET:
+    case BC_ASADD:
+    case BC_ASSUB:
+    case BC_ASMUL:
+    case BC_ASDIV:
+    case BC_ASMOD:
+    case BC_AUNSET:
+    case BC_IMPORT:
+      return OPERAND_LITERAL;
+    case BC_JMP:
+    case BC_JT:
+    case BC_JF:
+    case BC_BRT:
+    case BC_BRF:
+    case BC_FORPREP:
+    case BC_FOREND:
+    case BC_BRK:
+    case BC_CONT:
+      return OPERAND_JUMP;
+    case BC_LSDICT:
+      return OPERAND_SHAPE;
+    default:
+      return OPERAND_NONE;
+  }
+}
+
+}  // namespace
+
+ThreadedCode* ThreadedCode::Link(const Procedure& procedure,
+                                 const void* const* table,
+                                 uint32_t inline_cache_base) {
+  const BytecodeBuffer& bb = procedure.code_buffer();
+  ThreadedCode* tc = new ThreadedCode();
+
+  // Bytecode offset to instruction index
+  std::map<size_t, size_t> position;
+
+  // 1. Decode all the instructions
+  for (BytecodeBuffer::Iterator itr = bb.Begin(); itr != bb.End(); ++itr) {
+    Bytecode bc = *itr;
+    ThreadedInstruction instr;
+    instr.handler = table[bc];
+    instr.literal = NULL;
+    instr.arg = BytecodeHasOperand(bc) ? itr.arg() : 0;
+    instr.bytecode = bc;
+
+    if (GetOperandKind(bc) == OPERAND_LITERAL)
+      instr.literal = &procedure.IndexLiteral(instr.arg);
+    else if (GetOperandKind(bc) == OPERAND_SHAPE)
+      instr.shape = procedure.IndexShape(instr.arg);
+
+    if (bc == BC_PGET || bc == BC_AGET)
+      instr.arg = inline_cache_base + tc->m_inline_cache_size++;
+
+    position[itr.index()] = tc->m_code.size();
+    tc->m_code.push_back(instr);
+    tc->m_offset.push_back(itr.index());
+  }
+  position[bb.size()] = tc->m_code.size();
+
+  // 2. Resolve jump target to pointer. The code array will not grow anymore
+  for (size_t i = 0; i < tc->m_code.size(); ++i) {
+    ThreadedInstruction& instr = tc->m_code[i];
+    if (GetOperandKind(instr.bytecode) == OPERAND_JUMP) {
+      std::map<size_t, size_t>::const_iterator itr = position.find(instr.arg);
+      CHECK(itr != position.end());
+      instr.target = tc->Begin() + itr->second;
+    }
+  }
+  return tc;
+}
+
+}  // namespace vm
+}  // namespace vcl
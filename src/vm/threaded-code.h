@@ -0,0 +1,119 @@
+#ifndef THREADED_CODE_H_
+#define THREADED_CODE_H_
+#include <vcl/vcl.h>
+#include <vector>
+
+#include "bytecode.h"
+
+namespace vcl {
+namespace vm {
+class Procedure;
+
+// Pre-decoded form of a Procedure's bytecode used by the stack interpreter.
+// The BytecodeBuffer is a compact byte stream with 3 bytes little endian
+// operand , decoding it on each instruction costs a few loads and shifts and
+// the dispatch has to go through the label table. After compilation each
+// Procedure is linked into an array of ThreadedInstruction , the handler
+// address is resolved to the label inside of Runtime::Main , the operand is
+// decoded and the literal or jump target it refers to is resolved to a
+// pointer. So the interpreter just does "goto *ip->handler".
+//
+// The instruction index inside of ThreadedCode is what the Frame's pc stores
+// for a stack frame , use offset() to map it back to the BytecodeBuffer for
+// source code location.
+struct ThreadedInstruction {
+  // Label address of the handler inside of Runtime::Main
+  const void* handler;
+
+  union {
+    // Literal this instruction refers to , for literal load and all the
+    // instructions whose operand is a string literal index
+    const Value* literal;
+
+    // Jump target
+    const ThreadedInstruction* target;
+
+    // Shape of the dict literal for BC_LSDICT
+    const DictShape* shape;
+  };
+
+  // Decoded operand. For BC_PGET and BC_AGET it is replaced by the index of
+  // the inline cache site since the key is already resolved as literal. The
+  // quickenable instructions have no operand so it is used as the flag that
+  // the instruction has been deoptimized , see ThreadedCode::Quicken
+  uint32_t arg;
+
+  // Opcode , kept for debugging purpose
+  Bytecode bytecode;
+};
+
+class ThreadedCode {
+ public:
+  // Link the Procedure's bytecode with the dispatch table of the interpreter
+  // which is indexed by Bytecode. The inline cache sites are numbered starting
+  // from inline_cache_base
+  static ThreadedCode* Link(const Procedure&,
+                            const void* const* table,
+                            uint32_t inline_cache_base);
+
+ public:
+  const ThreadedInstruction* Begin() const {
+    return vcl::util::VectorAsArray(m_code);
+  }
+
+  const ThreadedInstruction* At(size_t index) const {
+    DCHECK(index < m_code.size());
+    return Begin() + index;
+  }
+
+  size_t IndexOf(const ThreadedInstruction* instr) const {
+    return static_cast<size_t>(instr - Begin());
+  }
+
+  size_t size() const { return m_code.size(); }
+
+ public:  // Quickening
+  // Rewrite the handler of a generic instruction to its typed version. The
+  // code is shared by all the Runtime of a CompiledCode which may run in
+  // different threads , but every handler of an instruction computes the
+  // same result so a racing reader is fine with either the old or new one
+  static void Quicken(const ThreadedInstruction* instr, const void* handler) {
+    ThreadedInstruction* i = const_cast<ThreadedInstruction*>(instr);
+    __atomic_store_n(&i->handler, handler, __ATOMIC_RELAXED);
+  }
+
+  // The guard of a typed version fails , rewrite it back to the generic one
+  // and never quicken it again
+  static void Deoptimize(const ThreadedInstruction* instr,
+                         const void* handler) {
+    ThreadedInstruction* i = const_cast<ThreadedInstruction*>(instr);
+    __atomic_store_n(&i->arg, 1u, __ATOMIC_RELAXED);
+    __atomic_store_n(&i->handler, handler, __ATOMIC_RELAXED);
+  }
+
+  static bool IsDeoptimized(const ThreadedInstruction* instr) {
+    return __atomic_load_n(&instr->arg, __ATOMIC_RELAXED) != 0;
+  }
+
+  // Number of inline cache sites inside of this code
+  uint32_t inline_cache_size() const { return m_inline_cache_size; }
+
+  // Offset inside of the BytecodeBuffer for a certain instruction
+  size_t offset(size_t index) const {
+    return index < m_offset.size() ? m_offset[index] : 0;
+  }
+
+ private:
+  ThreadedCode() : m_code(), m_offset(), m_inline_cache_size(0) {}
+
+  std::vector<ThreadedInstruction> m_code;
+  std::vector<size_t> m_offset;
+  uint32_t m_inline_cache_size;
+
+  VCL_DISALLOW_COPY_AND_ASSIGN(ThreadedCode);
+};
+
+}  // namespace vm
+}  // namespace vcl
+
+#endif  // THREADED_CODE_H_
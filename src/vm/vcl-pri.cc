@@ -121,6 +121,23 @@ int CompiledCodeBuilder::GetSubRoutineIndex(vm::zone::ZoneString* name) const {
   return -1;
 }
 
+uint32_t CompiledCodeBuilder::AddGlobalSlot(vm::zone::ZoneString* name) {
+  const size_t len = m_cc->m_global_slot.size();
+
+  for (size_t i = 0; i < len; ++i) {
+    if (*m_cc->m_global_slot[i].name == name->data()) {
+      return static_cast<uint32_t>(i);
+    }
+  }
+
+  vcl::String* string = m_cc->gc()->NewString(name->data());
+  uint32_t engine_slot = m_cc->engine()
+                             ? m_cc->engine()->ReserveGlobalSlot(name->data())
+                             : CompiledCode::kInvalidGlobalSlot;
+  m_cc->m_global_slot.push_back(CompiledCode::GlobalSlot(string, engine_slot));
+  return static_cast<uint32_t>(len);
+}
+
 vm::Procedure* InternalAllocator::NewEntryProcedure() {
   vm::Procedure* procedure =
       new vm::Procedure(kEntryProcName, kEntryProcProtocol, 0);
@@ -98,6 +98,14 @@ class CompiledCodeBuilder {
   // Get the SubRoutine index from this CompiledCode object
   int GetSubRoutineIndex(vm::zone::ZoneString*) const;
 
+  // Resolve a global variable name to its slot , a new slot is added if the
+  // name is not used before
+  uint32_t AddGlobalSlot(vm::zone::ZoneString* name);
+
+  void set_inline_cache_size(uint32_t size) {
+    m_cc->m_inline_cache_size = size;
+  }
+
   // Index a specific SubRoutine
   vm::Procedure* IndexSubRoutine(uint32_t index) const {
     if (index < m_cc->m_sub_routine_list.size())
@@ -395,6 +395,35 @@ TEST(Compiler,MethodCall) {
     );
 }
 
+size_t MaxStackSize( Context* context , const char* name ) {
+  CompiledCodeBuilder builder(context->compiled_code());
+  Procedure* procedure;
+  for( uint32_t i = 0 ; (procedure = builder.IndexSubRoutine(i)) ; ++i ) {
+    if(procedure->name() == name) return procedure->max_stack_size();
+  }
+  return 0;
+}
+
+TEST(Compiler,MaxStackSize) {
+  boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+          vcl 4.0;
+          sub leaf(a,b) { return {a}; }
+          sub nested(a) { return { f(1,g(2,3)) }; }
+          sub loop(a) {
+            new sum = 0;
+            for( k , v : a ) {
+              if(v == 3) break;
+              set sum += v;
+            }
+            return {sum};
+          }
+          )));
+  ASSERT_TRUE(context.get());
+  ASSERT_EQ(3u,MaxStackSize(context.get(),"leaf"));
+  ASSERT_EQ(6u,MaxStackSize(context.get(),"nested"));
+  // argument , sum , iterator , key and value , then the comparison
+  ASSERT_LE(5u,MaxStackSize(context.get(),"loop"));
+}
 
 } // namespace vm
 } // namespace vcl
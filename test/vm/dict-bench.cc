@@ -0,0 +1,130 @@
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vcl/vcl.h>
+
+// Benchmark of StringDict with 4 , 32 and 10k entries , which are the sizes
+// of a typical dict literal , a module and a big lookup table. Each operation
+// is measured in nanoseconds and std::unordered_map keyed by std::string is
+// shown as a reference.
+
+namespace vcl {
+namespace {
+
+class Timer {
+ public:
+  Timer() : m_start(boost::posix_time::microsec_clock::local_time()) {}
+
+  // Nanoseconds per operation
+  double Stop(size_t ops) const {
+    int64_t us = (boost::posix_time::microsec_clock::local_time() - m_start)
+                     .total_microseconds();
+    return static_cast<double>(us) * 1000.0 / static_cast<double>(ops);
+  }
+
+ private:
+  boost::posix_time::ptime m_start;
+};
+
+// Keep the compiler from dropping the lookup
+size_t kSink = 0;
+
+void Bench(ContextGC* gc, ImmutableGC* atom, size_t size, size_t ops) {
+  std::vector<String*> keys;
+  std::vector<String*> atoms;
+  std::vector<String*> misses;
+  std::vector<std::string> raw;
+  for (size_t i = 0; i < size; ++i) {
+    std::string name("property_" + boost::lexical_cast<std::string>(i));
+    raw.push_back(name);
+    keys.push_back(gc->NewString(name));
+    atoms.push_back(atom->NewString(name));
+    misses.push_back(gc->NewString(name + "_miss"));
+  }
+  const size_t rounds = ops / size + 1;
+  const size_t total = rounds * size;
+
+  // Insert into a fresh dict , rounds are done on new dict each time
+  double insert;
+  {
+    Timer timer;
+    for (size_t r = 0; r < rounds; ++r) {
+      StringDict<size_t> dict;
+      for (size_t i = 0; i < size; ++i) dict.Insert(*keys[i], i);
+      kSink += dict.size();
+    }
+    insert = timer.Stop(total);
+  }
+
+  StringDict<size_t> dict;
+  for (size_t i = 0; i < size; ++i) dict.Insert(*atoms[i], i);
+
+  double find_string;
+  {
+    Timer timer;
+    for (size_t r = 0; r < rounds; ++r) {
+      for (size_t i = 0; i < size; ++i) kSink += *dict.Find(*keys[i]);
+    }
+    find_string = timer.Stop(total);
+  }
+
+  double find_atom;
+  {
+    Timer timer;
+    for (size_t r = 0; r < rounds; ++r) {
+      for (size_t i = 0; i < size; ++i) kSink += *dict.Find(*atoms[i]);
+    }
+    find_atom = timer.Stop(total);
+  }
+
+  double find_raw;
+  {
+    Timer timer;
+    for (size_t r = 0; r < rounds; ++r) {
+      for (size_t i = 0; i < size; ++i) kSink += *dict.Find(raw[i].c_str());
+    }
+    find_raw = timer.Stop(total);
+  }
+
+  double miss;
+  {
+    Timer timer;
+    for (size_t r = 0; r < rounds; ++r) {
+      for (size_t i = 0; i < size; ++i) kSink += dict.Find(*misses[i]) != NULL;
+    }
+    miss = timer.Stop(total);
+  }
+
+  double std_find;
+  {
+    std::unordered_map<std::string, size_t> map;
+    for (size_t i = 0; i < size; ++i) map[raw[i]] = i;
+    Timer timer;
+    for (size_t r = 0; r < rounds; ++r) {
+      for (size_t i = 0; i < size; ++i) kSink += map.find(raw[i])->second;
+    }
+    std_find = timer.Stop(total);
+  }
+
+  std::cerr << size << " entries: insert " << insert << "ns find(String) "
+            << find_string << "ns find(atom) " << find_atom
+            << "ns find(char*) " << find_raw << "ns miss " << miss
+            << "ns std::unordered_map " << std_find << "ns\n";
+}
+
+}  // namespace
+}  // namespace vcl
+
+int main(int argc, char* argv[]) {
+  vcl::InitVCL(argv[0]);
+  size_t ops = argc >= 2 ? atoi(argv[1]) : 10000000;
+  vcl::ContextGC gc(static_cast<size_t>(-1), 1.0, NULL);
+  vcl::ImmutableGC atom;
+  vcl::Bench(&gc, &atom, 4, ops);
+  vcl::Bench(&gc, &atom, 32, ops);
+  vcl::Bench(&gc, &atom, 10000, ops);
+  return vcl::kSink == 0 ? -1 : 0;
+}
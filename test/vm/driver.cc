@@ -53,10 +53,10 @@ bool IsValidVCLFile( const boost::filesystem::path& p ) {
   }
 }
 
-void Driver( const char* folder ) {
+void Driver( const char* folder , const EngineOption& option ) {
   size_t count = 0;
   size_t ok = 0;
-  Engine engine;
+  Engine engine(option);
 
   if( boost::filesystem::status(folder).type() == boost::filesystem::regular_file ) {
     boost::scoped_ptr<Context> context(CompileCode(&engine,folder));
@@ -68,6 +68,7 @@ void Driver( const char* folder ) {
       if(!status) { std::cerr<<"test function failed:"<<status.fail()<<'\n'; }
       else { ++ok; }
       (void)v;
+      context->DumpExecutionProfile(std::cerr);
     }
   } else {
     for( boost::filesystem::directory_iterator itr(folder) ; itr !=
@@ -86,6 +87,7 @@ void Driver( const char* folder ) {
             if(!status) { std::cerr<<"test function failed:"<<status.fail()<<'\n'; }
             else { ++ok; }
             (void)v;
+            context->DumpExecutionProfile(std::cerr);
           }
         } else {
           std::cerr<<"Skipping file "<<itr->path().filename().string()<<'\n';
@@ -109,11 +111,17 @@ void Driver( const char* folder ) {
 
 int main( int argc , char* argv[] ) {
   vcl::InitVCL( argv[0] );
-  if(argc != 2) {
-    std::cerr<<"Usage <path>\n";
+  vcl::EngineOption option;
+  if(argc == 3 && std::string(argv[2]) == "register") {
+    option.vm_type = vcl::VM_REGISTER;
+  } else if(argc == 3 && std::string(argv[2]) == "jit") {
+    // Compile every procedure at its first entry
+    option.jit = true;
+    option.jit_threshold = 0;
+  } else if(argc != 2) {
+    std::cerr<<"Usage <path> [register|jit]\n";
     return -1;
-  } else {
-    vcl::vm::Driver(argv[1]);
-    return 0;
   }
+  vcl::vm::Driver(argv[1],option);
+  return 0;
 }
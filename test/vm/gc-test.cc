@@ -7,8 +7,11 @@
 #include <vm/procedure.h>
 #include <boost/scoped_ptr.hpp>
 #include <vcl/vcl.h>
+#include <boost/lexical_cast.hpp>
 #include <iostream>
 
+#define STRINGIFY(...) #__VA_ARGS__
+
 namespace vcl {
 
 TEST(GC,Basic) {
@@ -181,17 +184,299 @@ TEST(GC,Module) {
   }
 }
 
+// Generational ==================================================
+
+TEST(GC,Generational) {
+  ContextGC gc(1000000,0.5,NULL,16);
+  {
+    // Garbage dies in the nursery
+    Handle<String> live(gc.NewString("live"),&gc);
+    for( size_t i = 0 ; i < 100 ; ++i ) gc.NewString("garbage");
+    gc.ForceMinorCollect();
+    ASSERT_EQ(0,gc.gc_times());
+    ASSERT_TRUE(gc.minor_gc_times() > 0);
+    ASSERT_EQ(0,gc.young_size());
+    ASSERT_EQ(1,gc.gc_size());
+    ASSERT_EQ(*live,"live");
+  }
+  gc.ForceCollect();
+  ASSERT_EQ(0,gc.gc_size());
+
+  {
+    // Young objects stored into promoted List and Dict survive through
+    // the remembered set
+    Handle<List> l(gc.NewList(),&gc);
+    Handle<Dict> d(gc.NewDict(),&gc);
+    gc.ForceMinorCollect();
+    ASSERT_EQ(0,gc.young_size());
+    ASSERT_EQ(2,gc.gc_size());
+
+    l->Push(Value(gc.NewString("a")));
+    d->InsertOrUpdate(*gc.NewString("k"),Value(gc.NewString("v")));
+    for( size_t i = 0 ; i < 100 ; ++i ) gc.NewList();
+    gc.ForceMinorCollect();
+    ASSERT_EQ(5,gc.gc_size());
+
+    // Store into a promoted List that is not remembered anymore
+    l->Set(0,Value(gc.NewString("b")));
+    for( size_t i = 0 ; i < 100 ; ++i ) gc.NewDict();
+    gc.ForceMinorCollect();
+    // "a" is old garbage now , only a full collection frees it
+    ASSERT_EQ(6,gc.gc_size());
+    ASSERT_EQ(*l->Index(0).GetString(),"b");
+    Value v;
+    ASSERT_TRUE(d->Find("k",&v));
+    ASSERT_EQ(*v.GetString(),"v");
+
+    // Small Dict grows into hash form
+    for( size_t i = 0 ; i < Dict::kSmallSize * 2 ; ++i ) {
+      std::string key(1,static_cast<char>('A' + i));
+      d->InsertOrUpdate(*gc.NewString(key),Value(gc.NewString(key)));
+      gc.ForceMinorCollect();
+    }
+    ASSERT_TRUE(d->Find("A",&v));
+    ASSERT_EQ(*v.GetString(),"A");
+    ASSERT_TRUE(d->Find("k",&v));
+    ASSERT_EQ(*v.GetString(),"v");
+  }
+  gc.ForceCollect();
+  ASSERT_EQ(0,gc.gc_size());
+
+  {
+    // Objects without write barrier are always traced once promoted
+    Handle<Module> m(gc.NewModule("m"),&gc);
+    gc.ForceMinorCollect();
+    m->AddProperty(*gc.NewString("a"),Value(gc.NewString("b")));
+    gc.ForceMinorCollect();
+    ASSERT_EQ(3,gc.gc_size());
+    Value v;
+    ASSERT_TRUE(m->GetProperty(NULL,*gc.NewString("a"),&v));
+    ASSERT_EQ(*v.GetString(),"b");
+  }
+  gc.ForceCollect();
+  ASSERT_EQ(0,gc.gc_size());
+
+  // Turning the nursery off
+  {
+    Handle<String> live(gc.NewString("live"),&gc);
+    gc.set_nursery_size(0);
+    ASSERT_EQ(0,gc.young_size());
+    gc.NewString("garbage");
+    ASSERT_EQ(0,gc.young_size());
+    gc.ForceCollect();
+    ASSERT_EQ(1,gc.gc_size());
+  }
+}
+
+// Incremental ==================================================
+
+TEST(GC,Incremental) {
+  ContextGC gc(1000000,0.5,NULL,0,2);
+  const size_t kCount = 50;
+  const size_t kRound = 200;
+  {
+    Handle<List> l(gc.NewList(),&gc);
+    Handle<Dict> d(gc.NewDict(),&gc);
+    for( size_t i = 0 ; i < kCount ; ++i ) l->Push(Value(gc.NewString("x")));
+
+    // Start a cycle , each allocation traces at most 2 objects
+    gc.set_next_gc_trigger(1);
+    ASSERT_TRUE(gc.TryCollect());
+    ASSERT_TRUE(gc.marking());
+    ASSERT_TRUE(gc.TryCollect());
+    ASSERT_TRUE(gc.marking());
+
+    // Objects stored into the containers during the cycle are found by
+    // the write barrier , the garbage dies
+    for( size_t i = 0 ; i < kRound ; ++i ) {
+      std::string key = boost::lexical_cast<std::string>(i);
+      gc.NewString("garbage");
+      Handle<String> k(gc.NewString(key),&gc);
+      d->InsertOrUpdate(*k,Value(gc.NewString(key)));
+      l->Push(Value(gc.NewString(key)));
+    }
+    while(gc.marking()) gc.TryCollect();
+    ASSERT_TRUE(gc.gc_times() > 0);
+
+    gc.ForceCollect();
+    ASSERT_EQ(2 + kCount + kRound * 3,gc.gc_size());
+    ASSERT_EQ(kCount + kRound,l->size());
+    ASSERT_EQ(kRound,d->size());
+    for( size_t i = 0 ; i < kRound ; ++i ) {
+      std::string key = boost::lexical_cast<std::string>(i);
+      Value v;
+      ASSERT_TRUE(d->Find(key,&v));
+      ASSERT_EQ(*v.GetString(),key);
+      ASSERT_EQ(*l->Index(kCount + i).GetString(),key);
+    }
+
+    // ForceCollect abandons a running cycle
+    gc.set_next_gc_trigger(1);
+    ASSERT_TRUE(gc.TryCollect());
+    ASSERT_TRUE(gc.marking());
+    l->Clear();
+    gc.ForceCollect();
+    ASSERT_FALSE(gc.marking());
+    ASSERT_EQ(2 + kRound * 2,gc.gc_size());
+  }
+  gc.ForceCollect();
+  ASSERT_EQ(0,gc.gc_size());
+}
+
+// Mark stack ===================================================
+
+namespace {
+
+// An extension that reports its references through GCVisitor
+class Pair : public Extension {
+ public:
+  Pair( const Value& first , const Value& second ) :
+    Extension("pair"),
+    m_first(first),
+    m_second(second)
+  {}
+
+  const Value& first() const { return m_first; }
+
+ protected:
+  virtual void Trace( GCVisitor* visitor ) {
+    visitor->Visit(m_first);
+    visitor->Visit(m_second);
+  }
+
+ private:
+  Value m_first;
+  Value m_second;
+};
+
+} // namespace
+
+TEST(GC,MarkStack) {
+  ContextGC gc(1000000,0.5,NULL);
+  {
+    // A deeply nested structure doesn't recurse on the C stack
+    const size_t kDepth = 1000000;
+    Handle<List> root(gc.NewList(),&gc);
+    List* l = root.get();
+    for( size_t i = 0 ; i < kDepth ; ++i ) {
+      List* child = gc.NewList();
+      l->Push(Value(child));
+      l = child;
+    }
+    gc.ForceCollect();
+    ASSERT_EQ(kDepth + 1,gc.gc_size());
+  }
+  gc.ForceCollect();
+  ASSERT_EQ(0,gc.gc_size());
+
+  {
+    // A wide List overflows the mark stack
+    const size_t kWidth = 200000;
+    Handle<List> root(gc.NewList(),&gc);
+    for( size_t i = 0 ; i < kWidth ; ++i ) {
+      Pair* p = gc.New<Pair>(Value(gc.NewString("a")),Value(gc.NewList()));
+      root->Push(Value(p));
+      gc.NewString("garbage");
+    }
+    gc.ForceCollect();
+    ASSERT_EQ(kWidth * 3 + 1,gc.gc_size());
+    for( size_t i = 0 ; i < kWidth ; i += 1000 ) {
+      Pair* p = static_cast<Pair*>(root->Index(i).GetExtension());
+      ASSERT_EQ(*p->first().GetString(),"a");
+    }
+  }
+  gc.ForceCollect();
+  ASSERT_EQ(0,gc.gc_size());
+}
+
+// Slab =========================================================
+
+namespace {
+
+// Counts the blocks allocated by the GC
+class CountingHook : public AllocatorHook {
+ public:
+  CountingHook( size_t* live ) : m_live(live) {}
+
+  virtual void* Malloc( Context* , size_t size ) {
+    ++*m_live;
+    return ::malloc(size);
+  }
+
+  virtual void Free( Context* , void* ptr ) {
+    --*m_live;
+    ::free(ptr);
+  }
+
+ private:
+  size_t* m_live;
+};
+
+class Large : public Extension {
+ public:
+  Large() : Extension("large") {}
+ private:
+  char m_data[1024];
+};
+
+} // namespace
+
+TEST(GC,Slab) {
+  size_t live = 0;
+  {
+    ContextGC gc(1000000,0.5,NULL);
+    gc.SetAllocatorHook(new CountingHook(&live));
+    const size_t kCount = 10000;
+    size_t pages = 0;
+    for( size_t round = 0 ; round < 2 ; ++round ) {
+      {
+        Handle<List> l(gc.NewList(),&gc);
+        for( size_t i = 0 ; i < kCount ; ++i ) {
+          l->Push(Value(gc.NewString("slab")));
+        }
+        // Objects of a size class share pages , freed slots are reused
+        ASSERT_TRUE(gc.slab_pages() < kCount / 10);
+        if(round) {
+          ASSERT_EQ(pages,gc.slab_pages());
+        }
+        pages = gc.slab_pages();
+        ASSERT_EQ(pages,live);
+      }
+      gc.ForceCollect();
+      ASSERT_EQ(0,gc.gc_size());
+      // Only the last page of each class is kept
+      ASSERT_TRUE(gc.slab_pages() <= 2);
+      ASSERT_EQ(gc.slab_pages(),live);
+    }
+
+    // Large objects bypass the slabs
+    {
+      Handle<Large> large(gc.New<Large>(),&gc);
+      ASSERT_EQ(gc.slab_pages() + 1,live);
+    }
+    gc.ForceCollect();
+    ASSERT_EQ(gc.slab_pages(),live);
+  }
+  ASSERT_EQ(0,live);
+}
+
 // ===================================================================
 // Runtime based GC testing
 // ===================================================================
 
 using namespace vm;
 
-Context* CompileCode( const char* source , size_t trigger = 1 , double ratio = 0.5 ) {
+Context* CompileCode( const char* source , size_t trigger = 1 , double ratio = 0.5 ,
+                      size_t nursery = ContextGC::kDefaultNurserySize ,
+                      size_t step_budget = ContextGC::kDefaultStepBudget ,
+                      size_t region = 0 ) {
   boost::shared_ptr<CompiledCode> cc( new CompiledCode( NULL ) );
   ContextOption opt;
   opt.gc_trigger = trigger;
   opt.gc_ratio = ratio;
+  opt.gc_nursery_size = nursery;
+  opt.gc_step_budget = step_budget;
+  opt.gc_region_size = region;
 
   Context* context = new Context( opt , cc );
   CompilationUnit cu;
@@ -328,6 +613,113 @@ TEST(GC,Runtime2) {
 }
 
 
+const char* kGenerationalSource = STRINGIFY(vcl 4.0;
+        global d = {};
+        global l = [ "" , "" , "" ];
+        sub run {
+          for( i , v : ["1","2","3","4","5","6","7","8","9","10",
+                        "11","12","13","14","15","16","17","18","19","20"] ) {
+            new s = "v" + v;
+            set d[ "k" + v ] = s + "!";
+            set l[ i % 3 ] = s + "?";
+          }
+          return { d["k20"] + l[0] + l[1] + l[2] };
+        }
+        );
+
+void CheckGenerationalSource( Context* ctx ) {
+  ASSERT_TRUE(ctx);
+  ASSERT_TRUE(ctx->Construct());
+  Value result;
+  ASSERT_TRUE( CallFunc(ctx,"run",&result) );
+  ASSERT_TRUE( result.IsString() );
+  ASSERT_EQ( *result.GetString() , "v20!v19?v20?v18?" );
+
+  Value d;
+  ASSERT_TRUE( ctx->GetGlobalVariable("d",&d) );
+  ASSERT_EQ( 20 , d.GetDict()->size() );
+  for( int i = 1 ; i <= 20 ; ++i ) {
+    Value v;
+    ASSERT_TRUE( d.GetDict()->Find("k" + boost::lexical_cast<std::string>(i),&v) );
+    ASSERT_EQ( *v.GetString() , "v" + boost::lexical_cast<std::string>(i) + "!" );
+  }
+}
+
+TEST(GC,RuntimeGenerational) {
+  // A tiny nursery makes the script run many minor collections
+  boost::scoped_ptr<Context> ctx(
+      CompileCode(kGenerationalSource,1000000,0.5,4,0));
+  CheckGenerationalSource(ctx.get());
+  ASSERT_TRUE( ctx->gc()->minor_gc_times() > 0 );
+}
+
+TEST(GC,RuntimeIncremental) {
+  // A tiny trigger and budget keep a cycle running while the script mutates
+  // the globals , with and without nursery
+  for( size_t nursery = 0 ; nursery <= 4 ; nursery += 4 ) {
+    boost::scoped_ptr<Context> ctx(
+        CompileCode(kGenerationalSource,1,0.5,nursery,1));
+    CheckGenerationalSource(ctx.get());
+    ASSERT_TRUE( ctx->gc()->gc_times() > 0 );
+  }
+}
+
+TEST(GC,RuntimeRegion) {
+  // Each run collects its region when it returns , only the global and the
+  // returned value survive
+  boost::scoped_ptr<Context> ctx(CompileCode(STRINGIFY(vcl 4.0;
+        global keep = {};
+        sub run {
+          new s = "";
+          for( i , v : ["a","b","c","d","e","f","g","h"] ) {
+            set s = s + v;
+          }
+          set keep["last"] = s;
+          return { s + "!" };
+        }
+        sub term {
+          new s = "ok";
+          return (ok);
+        }
+        ),1000000,0.5,0,0,100000));
+  ASSERT_TRUE(ctx.get());
+  ASSERT_TRUE(ctx->Construct());
+  ASSERT_EQ(0,ctx->gc()->young_size());
+  const size_t base = ctx->gc()->gc_size();
+
+  for( size_t i = 0 ; i < 4 ; ++i ) {
+    Value result;
+    ASSERT_TRUE( CallFunc(ctx.get(),"run",&result) );
+    ASSERT_EQ(0,ctx->gc()->young_size());
+    ASSERT_EQ(i + 2,ctx->gc()->minor_gc_times());
+    ASSERT_EQ(0,ctx->gc()->gc_times());
+    // The string kept by the last run is old garbage now
+    ASSERT_TRUE(ctx->gc()->gc_size() <= base + 3 * (i + 1));
+    ASSERT_EQ(*result.GetString(),"abcdefgh!");
+
+    Value keep;
+    ASSERT_TRUE( ctx->GetGlobalVariable("keep",&keep) );
+    Value last;
+    ASSERT_TRUE( keep.GetDict()->Find("last",&last) );
+    ASSERT_EQ(*last.GetString(),"abcdefgh");
+  }
+
+  // A terminated run returns an Action allocated inside the region
+  {
+    Value result;
+    MethodStatus status = CallFunc(ctx.get(),"term",&result);
+    ASSERT_TRUE(status.is_terminate());
+    ASSERT_TRUE(result.IsAction());
+    ASSERT_EQ(ACT_OK,result.GetAction()->action_code());
+    Handle<Value> root(result,ctx->gc());
+    for( size_t i = 0 ; i < 16 ; ++i ) {
+      ctx->gc()->NewAction(ACT_PIPE);
+      ctx->gc()->NewString("garbage");
+    }
+    ASSERT_EQ(ACT_OK,result.GetAction()->action_code());
+  }
+}
+
 } // namespace vcl
 
 int main( int argc , char* argv[] ) {
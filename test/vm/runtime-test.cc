@@ -5,7 +5,11 @@
 #include <vm/compilation-unit.h>
 #include <vm/parser.h>
 #include <vm/procedure.h>
+#include <vm/threaded-code.h>
+#include <vm/execution-profile.h>
+#include <vm/sampling-profiler.h>
 #include <boost/scoped_ptr.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include <string>
 #include <iostream>
@@ -15,7 +19,7 @@
 namespace vcl {
 namespace vm {
 
-Context* CompileCode( const char* source ) {
+Context* CompileCode( const char* source , bool register_code = false ) {
   boost::shared_ptr<CompiledCode> cc( new CompiledCode( NULL ) );
   Context* context = new Context( ContextOption() , cc );
   CompilationUnit cu;
@@ -46,6 +50,12 @@ Context* CompileCode( const char* source ) {
     return NULL;
   }
 
+  if(register_code && !CompileRegisterCode(cc.get())) {
+    delete context;
+    std::cerr<<"cannot lower to register code";
+    return NULL;
+  }
+
   return context;
 }
 
@@ -899,6 +909,32 @@ class TerminateFunc : public Function {
   TerminateFunc():Function("TerminateFunc"){}
 };
 
+class LeafSub : public LeafFunction {
+ public:
+  virtual MethodStatus Call( Context* context , const Arguments& args ,
+                                                Value* output ) {
+    VCL_UNUSED(context);
+    if(args.size() != 2 || !args[0].IsInteger() || !args[1].IsInteger())
+      return MethodStatus::NewFail("function::LeafSub expects 2 integers");
+    output->SetInteger(args[0].GetInteger() - args[1].GetInteger());
+    return MethodStatus::kOk;
+  }
+  LeafSub():LeafFunction("LeafSub"){}
+};
+
+class DictRemove : public LeafFunction {
+ public:
+  virtual MethodStatus Call( Context* context , const Arguments& args ,
+                                                Value* output ) {
+    VCL_UNUSED(context);
+    if(args.size() != 2 || !args[0].IsDict() || !args[1].IsString())
+      return MethodStatus::NewFail("function::DictRemove expects dict and string");
+    output->SetBoolean(args[0].GetDict()->Remove(*args[1].GetString(),NULL));
+    return MethodStatus::kOk;
+  }
+  DictRemove():LeafFunction("DictRemove"){}
+};
+
 // Wired functions
 TEST(VM,Function) {
   {
@@ -945,6 +981,38 @@ TEST(VM,Function) {
   }
 }
 
+TEST(VM,LeafFunction) {
+  {
+    boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+            vcl 4.0;
+            sub twice(a,b) { return {LeafSub(a,b)*2}; }
+            global a = LeafSub(10,LeafSub(5,2));
+            global b = twice(LeafSub(3,1),Add(1,LeafSub(1,1)));
+            global c = [LeafSub(2,1),LeafSub(4,2)];
+            )));
+    context->AddOrUpdateGlobalVariable("LeafSub",Value( context->gc()->New<LeafSub>()));
+    context->AddOrUpdateGlobalVariable("Add",Value( context->gc()->New<Add>()));
+    CTX(context);
+    GVAR(Integer,"a",7);
+    GVAR(Integer,"b",2);
+    Value c;
+    ASSERT_TRUE(context->GetGlobalVariable("c",&c));
+    ASSERT_EQ(2u,c.GetList()->size());
+    ASSERT_EQ(1,c.GetList()->Index(0).GetInteger());
+    ASSERT_EQ(2,c.GetList()->Index(1).GetInteger());
+  }
+  {
+    boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+            vcl 4.0;
+            global a = LeafSub(1);
+            global b = c + d; /* will not execute */
+            )));
+    context->AddOrUpdateGlobalVariable("LeafSub",Value( context->gc()->New<LeafSub>()));
+    MethodStatus result = context->Construct();
+    ASSERT_TRUE( result.is_fail() );
+  }
+}
+
 // Modules
 TEST(VM,Module) {
   {
@@ -1070,6 +1138,637 @@ TEST(VM,DeclareOrNew) {
   }
 }
 
+// =========================================================================
+// Register VM
+// =========================================================================
+TEST(VM,RegisterCode) {
+  {
+    boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+            vcl 4.0;
+            sub fib(n) {
+              if(n < 2) return {n};
+              return { fib(n-1) + fib(n-2) };
+            }
+            sub sum(l) {
+              new s = 0;
+              for( _ , v : l ) {
+                if(v == 3) continue;
+                if(v > 5) break;
+                set s += v * 2;
+              }
+              return {s};
+            }
+            sub pick(a,b) {
+              new c = if(a > b, a - b, b - a);
+              set c = c + if(a == b, 1000, 0);
+              return { c * 10 + if(a < b || b == 0 , 1 , 0) };
+            }
+            sub swap(a,b) {
+              new t = a;
+              set a = b;
+              set b = t;
+              return { a * 10 + b };
+            }
+            global r1 = fib(15);
+            global r2 = sum([1,2,3,4,5,6,7]);
+            global r3 = pick(1,5);
+            global r4 = pick(7,7);
+            global r5 = swap(1,2);
+            global d = { "a" : [1,2,fib(5)] };
+            global r6 = d["a"][2];
+            global r7 = "a" + "b";
+            ),true));
+    CTX(context);
+    GVAR(Integer,"r1",610);
+    GVAR(Integer,"r2",24);
+    GVAR(Integer,"r3",41);
+    GVAR(Integer,"r4",10000);
+    GVAR(Integer,"r5",21);
+    GVAR(Integer,"r6",5);
+    GVAR(String,"r7","ab");
+  }
+}
+
+bool HasBytecode( const Procedure* procedure , Bytecode bc ) {
+  const BytecodeBuffer& bb = procedure->code_buffer();
+  for( BytecodeBuffer::Iterator itr = bb.Begin() ; itr != bb.End() ; ++itr ) {
+    if(*itr == bc) return true;
+    if(BytecodeHasOperand(*itr)) itr.arg();
+  }
+  return false;
+}
+
+bool SubHasBytecode( Context* context , const char* name , Bytecode bc ) {
+  Value v;
+  if(!context->GetGlobalVariable(name,&v) || !v.IsSubRoutine()) return false;
+  return HasBytecode(v.GetSubRoutine()->procedure(),bc);
+}
+
+TEST(VM,Superinstruction) {
+  {
+    boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+            vcl 4.0;
+            global d = { a : 1 , b : { c : "xyz" } , f : sub { return {42}; } };
+            sub route(h,o) {
+              if(h ~ "^api") {
+                return {1};
+              }
+              if(o.n == 2) {
+                return {2};
+              }
+              return {3};
+            }
+            sub count(n) {
+              if(n == 3) return {d.a};
+              return {0};
+            }
+            sub invoke {
+              return { d.f() };
+            }
+            global r1 = route("api.example.com",{ n : 2 });
+            global r2 = route("www.example.com",{ n : 2 });
+            global r3 = route("www.example.com",{ n : 1 });
+            global r4 = count(3);
+            global r5 = count(4);
+            global r6 = invoke();
+            global r7 = d.b.c;
+            )));
+    CTX(context);
+    GVAR(Integer,"r1",1);
+    GVAR(Integer,"r2",2);
+    GVAR(Integer,"r3",3);
+    GVAR(Integer,"r4",1);
+    GVAR(Integer,"r5",0);
+    GVAR(Integer,"r6",42);
+    GVAR(String,"r7","xyz");
+    ASSERT_TRUE(SubHasBytecode(context.get(),"route",BC_LSTR_MATCH_JF));
+    ASSERT_TRUE(SubHasBytecode(context.get(),"route",BC_SLOAD_PGET));
+    ASSERT_TRUE(SubHasBytecode(context.get(),"count",BC_SLOAD_EQVI));
+    ASSERT_TRUE(SubHasBytecode(context.get(),"count",BC_GLOAD_PGET));
+    ASSERT_TRUE(SubHasBytecode(context.get(),"invoke",BC_GLOAD_PGET_CALL));
+  }
+  {
+    // Jump into the middle of a fused sequence
+    boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+            vcl 4.0;
+            sub pick(a,b) {
+              if(b ~ if(a,"^x","^y")) {
+                return {true};
+              }
+              return {false};
+            }
+            global r1 = pick(false,"y");
+            global r2 = pick(true,"y");
+            global r3 = pick(true,"x");
+            )));
+    CTX(context);
+    ASSERT_TRUE(SubHasBytecode(context.get(),"pick",BC_LSTR_MATCH_JF));
+    GVAR(Boolean,"r1",true);
+    GVAR(Boolean,"r2",false);
+    GVAR(Boolean,"r3",true);
+  }
+}
+
+bool InvokeSub( Context* context , const char* name , Value* output ) {
+  Value v;
+  if(!context->GetGlobalVariable(name,&v) || !v.IsSubRoutine()) return false;
+  return context->Invoke(v.GetSubRoutine(),output);
+}
+
+TEST(VM,GlobalSlot) {
+  Engine engine;
+  engine.AddOrUpdateGlobalVariable("eg",Value(1));
+
+  std::string error;
+  boost::shared_ptr<CompiledCode> cc(engine.LoadString(":test",STRINGIFY(
+          vcl 4.0;
+          sub get_eg { return {eg}; }
+          sub get_late { return {late}; }
+          sub get_cg { return {cg}; }
+          sub bump { set cg += 1; return {cg}; }
+          ),ScriptOption(),&error));
+  ASSERT_TRUE(cc.get()) << error;
+
+  // Engine global variable added after compilation
+  engine.AddOrUpdateGlobalVariable("late",Value(2));
+
+  Context context(ContextOption(),cc);
+  context.AddOrUpdateGlobalVariable("cg",Value(3));
+  ASSERT_TRUE(context.Construct());
+
+  Value v;
+  ASSERT_TRUE(InvokeSub(&context,"get_eg",&v));
+  ASSERT_EQ(1,v.GetInteger());
+  ASSERT_TRUE(InvokeSub(&context,"get_late",&v));
+  ASSERT_EQ(2,v.GetInteger());
+  ASSERT_TRUE(InvokeSub(&context,"bump",&v));
+  ASSERT_EQ(4,v.GetInteger());
+  ASSERT_TRUE(context.GetGlobalVariable("cg",&v));
+  ASSERT_EQ(4,v.GetInteger());
+
+  // Update from C++ side
+  context.AddOrUpdateGlobalVariable("cg",Value(10));
+  ASSERT_TRUE(InvokeSub(&context,"get_cg",&v));
+  ASSERT_EQ(10,v.GetInteger());
+
+  // Context's global variable shadows the Engine's
+  context.AddOrUpdateGlobalVariable("eg",Value(5));
+  ASSERT_TRUE(InvokeSub(&context,"get_eg",&v));
+  ASSERT_EQ(5,v.GetInteger());
+  ASSERT_TRUE(context.RemoveGlobalVariable("eg"));
+  ASSERT_TRUE(InvokeSub(&context,"get_eg",&v));
+  ASSERT_EQ(1,v.GetInteger());
+
+  // Removed global variable
+  ASSERT_TRUE(context.RemoveGlobalVariable("cg"));
+  ASSERT_FALSE(context.GetGlobalVariable("cg",&v));
+  ASSERT_FALSE(InvokeSub(&context,"get_cg",&v));
+}
+
+TEST(VM,TailCall) {
+  boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+          vcl 4.0;
+          sub sum(n,acc) {
+            if(n == 0) return {acc};
+            return {sum(n-1,acc+n)};
+          }
+          sub wrap(n) { return {1 + sum(n,0)}; }
+          global r1 = sum(100,0);
+          global r2 = wrap(10);
+          )));
+  CTX(context);
+  GVAR(Integer,"r1",5050);
+  GVAR(Integer,"r2",56);
+  ASSERT_TRUE(SubHasBytecode(context.get(),"sum",BC_TAILCALL));
+  ASSERT_FALSE(SubHasBytecode(context.get(),"wrap",BC_TAILCALL));
+}
+
+// Handler of the first instruction whose opcode is bc inside of a sub
+const void* SubHandler( Context* context , const char* name , Bytecode bc ) {
+  Value v;
+  if(!context->GetGlobalVariable(name,&v) || !v.IsSubRoutine()) return NULL;
+  const ThreadedCode* tc = v.GetSubRoutine()->procedure()->threaded_code();
+  for( size_t i = 0 ; i < tc->size() ; ++i ) {
+    if(tc->At(i)->bytecode == bc) return tc->At(i)->handler;
+  }
+  return NULL;
+}
+
+TEST(VM,Quickening) {
+  boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+          vcl 4.0;
+          sub add(a,b) { return {a+b}; }
+          sub radd(a,b) { return {a+b}; }
+          sub mixed(a,b) { return {a+b}; }
+          sub less(a,b) { return {a<b}; }
+          sub equal(a,b) { return {a==b}; }
+          global r1 = add(1,2);
+          global r2 = add(3,4);
+          global r3 = radd(1.5,2.0);
+          global r4 = mixed(1,2);
+          global r5 = mixed(1.5,2);
+          global r6 = mixed(1,2);
+          global r7 = less(1,2);
+          global r8 = less(2,1);
+          global r9 = equal("a","a");
+          global r10 = equal("a","b");
+          global r11 = equal(1,1);
+          )));
+  CTX(context);
+  GVAR(Integer,"r1",3);
+  GVAR(Integer,"r2",7);
+  GVAR(Real,"r3",3.5);
+  GVAR(Integer,"r4",3);
+  GVAR(Real,"r5",3.5);
+  GVAR(Integer,"r6",3);
+  GVAR(Boolean,"r7",true);
+  GVAR(Boolean,"r8",false);
+  GVAR(Boolean,"r9",true);
+  GVAR(Boolean,"r10",false);
+  GVAR(Boolean,"r11",true);
+
+  const void* const* table = Runtime::GetDispatchTable();
+  ASSERT_EQ(table[BC_ADD_INT],SubHandler(context.get(),"add",BC_ADD));
+  ASSERT_EQ(table[BC_ADD_REAL],SubHandler(context.get(),"radd",BC_ADD));
+  ASSERT_EQ(table[BC_LT_INT],SubHandler(context.get(),"less",BC_LT));
+  // Guard failure sends the site back to generic for good
+  ASSERT_EQ(table[BC_ADD],SubHandler(context.get(),"mixed",BC_ADD));
+  ASSERT_EQ(table[BC_EQ],SubHandler(context.get(),"equal",BC_EQ));
+}
+
+TEST(VM,ExecutionProfile) {
+  // Not STRINGIFY since the profile is counted per source line
+  boost::scoped_ptr<Context> context(CompileCode(
+          "vcl 4.0;\n"
+          "sub loop(n) {\n"
+          "  new sum = 0;\n"
+          "  for( k , v : n ) {\n"
+          "    set sum += v;\n"
+          "  }\n"
+          "  return {sum};\n"
+          "}\n"
+          "global r1 = loop([1,2,3]);\n"));
+  CTX(context);
+  GVAR(Integer,"r1",6);
+
+  Value v;
+  ASSERT_TRUE(context->GetGlobalVariable("loop",&v));
+  const Procedure* procedure = v.GetSubRoutine()->procedure();
+  const ThreadedCode* tc = procedure->threaded_code();
+
+  ExecutionProfile manual;
+  ExecutionProfile* profile = context->execution_profile();
+  if(ExecutionProfile::IsEnabled()) {
+    ASSERT_TRUE(profile != NULL);
+    ASSERT_EQ(3u,profile->opcode(BC_FOREND));
+    ASSERT_EQ(3u,profile->opcode(BC_SADD));
+  } else {
+    ASSERT_TRUE(profile == NULL);
+    // Without the interpreter counting , the report is still checked with
+    // counts filled by hand , one for each instruction
+    profile = &manual;
+    uint64_t* counter = profile->Counter(procedure);
+    for( size_t i = 0 ; i < tc->size() ; ++i ) counter[i] = 1;
+    ASSERT_EQ(tc->size(),profile->total());
+    ASSERT_EQ(1u,profile->opcode(BC_FOREND));
+  }
+
+  // Each instruction belongs to one source line
+  uint64_t sum = 0;
+  for( int line = 1 ; line <= 9 ; ++line ) sum += profile->line(procedure,line);
+  ASSERT_EQ(profile->procedure(procedure),sum);
+  ASSERT_TRUE(profile->line(procedure,5) > 0);
+
+  std::ostringstream report;
+  profile->Dump(report);
+  ASSERT_TRUE(report.str().find("loop:5") != std::string::npos);
+
+  profile->Clear();
+  ASSERT_EQ(0u,profile->total());
+}
+
+TEST(VM,SamplingProfiler) {
+  boost::scoped_ptr<Context> context(CompileCode(
+          "vcl 4.0;\n"
+          "sub spin(n) {\n"
+          "  new sum = 0;\n"
+          "  for( k , v : n ) {\n"
+          "    set sum += v;\n"
+          "  }\n"
+          "  return {sum};\n"
+          "}\n"
+          "sub test(n) { return {1 + spin(n)}; }\n"));
+  CTX(context);
+
+  // Ring buffer drops samples once it is full
+  {
+    SamplingProfiler profiler(2);
+    SamplingProfiler::Sample sample;
+    sample.depth = 0;
+    ASSERT_TRUE(profiler.Push(sample));
+    ASSERT_TRUE(profiler.Push(sample));
+    ASSERT_FALSE(profiler.Push(sample));
+    ASSERT_EQ(1u,profiler.dropped());
+    ASSERT_TRUE(profiler.Pop(&sample));
+    ASSERT_TRUE(profiler.Push(sample));
+  }
+
+  SamplingProfiler profiler;
+  if(!profiler.Start(200)) return;  // Not supported
+  ASSERT_FALSE(SamplingProfiler().Start(200));
+
+  Handle<List> list(context->gc()->NewList(),context->gc());
+  for( int i = 0 ; i < 1000 ; ++i ) list->Push(Value(i));
+
+  // Spin until some samples are taken , CPU time is what is sampled
+  std::string folded;
+  for( int i = 0 ; i < 10000 && folded.empty() ; ++i ) {
+    Value output;
+    ASSERT_TRUE(CallFunc(context.get(),"test",Value(list),&output));
+    ASSERT_EQ(1 + 499500,output.GetInteger());
+    std::ostringstream formatter;
+    profiler.Fold(formatter);
+    folded = formatter.str();
+  }
+  profiler.Stop();
+  ASSERT_FALSE(profiler.is_running());
+  ASSERT_TRUE(SamplingProfiler::Current() == NULL);
+
+  // Stack is folded from the outermost frame
+  ASSERT_EQ(0u,folded.find("test:9;spin:"));
+}
+
+TEST(VM,StringConcat) {
+  // Stack and register virtual machine
+  for( int i = 0 ; i < 2 ; ++i ) {
+    boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+            vcl 4.0;
+            sub interp(a,b) { return {'${a}-${b}'}; }
+            sub chain(a,b) { return { "x" + a + "y" + b }; }
+            sub nested(a) { return {'<${a}>' + ("(" + a + ")")}; }
+            sub bad(a) { return { "x" + a + "y" }; }
+            ),i == 1));
+    CTX(context);
+    if(i == 0) {
+      ASSERT_TRUE(SubHasBytecode(context.get(),"chain",BC_CONCAT));
+      ASSERT_FALSE(SubHasBytecode(context.get(),"chain",BC_ADD));
+      ASSERT_FALSE(SubHasBytecode(context.get(),"interp",BC_CSTR));
+    }
+
+    Value output;
+    ASSERT_TRUE(CallFunc(context.get(),"interp",Value(1),Value(2.5),&output));
+    ASSERT_TRUE(output.IsString());
+    ASSERT_EQ("1-2.5",output.GetString()->ToStdString());
+    ASSERT_TRUE(CallFunc(context.get(),"interp",Value(true),Value(-1),&output));
+    ASSERT_EQ("true--1",output.GetString()->ToStdString());
+    ASSERT_TRUE(CallFunc(context.get(),"interp",Value(),
+          Value(context->gc()->NewString("s")),&output));
+    ASSERT_EQ("null-s",output.GetString()->ToStdString());
+
+    ASSERT_TRUE(CallFunc(context.get(),"chain",
+          Value(context->gc()->NewString("a")),
+          Value(context->gc()->NewString("b")),&output));
+    ASSERT_EQ("xayb",output.GetString()->ToStdString());
+    ASSERT_TRUE(CallFunc(context.get(),"nested",
+          Value(context->gc()->NewString("a")),&output));
+    ASSERT_EQ("<a>(a)",output.GetString()->ToStdString());
+
+    // Same as String::Add , a primitive is not converted
+    ASSERT_TRUE(CallFunc(context.get(),"bad",Value(1),&output).is_fail());
+  }
+}
+
+TEST(VM,StringAtom) {
+  // Stack and register virtual machine
+  for( int i = 0 ; i < 2 ; ++i ) {
+    boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+            vcl 4.0;
+            sub test(a) {
+              new x = "lit";
+              set x += a;
+              return { x };
+            }
+            sub other() { return { "lit" }; }
+            ),i == 1));
+    CTX(context);
+
+    // Literal is an atom and it is shared with other sub routine
+    Value a , b;
+    ASSERT_TRUE(CallFunc(context.get(),"other",&a));
+    ASSERT_TRUE(a.IsString() && a.GetString()->is_atom());
+
+    Value output;
+    ASSERT_TRUE(CallFunc(context.get(),"test",
+          Value(context->gc()->NewString("A")),&output));
+    ASSERT_EQ("litA",output.GetString()->ToStdString());
+    ASSERT_TRUE(CallFunc(context.get(),"test",
+          Value(context->gc()->NewString("B")),&output));
+    ASSERT_EQ("litB",output.GetString()->ToStdString());
+
+    ASSERT_TRUE(CallFunc(context.get(),"other",&b));
+    ASSERT_EQ(a.GetString(),b.GetString());
+    ASSERT_EQ("lit",b.GetString()->ToStdString());
+  }
+}
+
+TEST(VM,InlineCache) {
+  boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+          vcl 4.0;
+          import test;
+          sub get(o) { return {o.x}; }
+          sub attr(o) { return {o:x}; }
+          sub mget { return {test.value}; }
+          )));
+  Module* module = context->AddModule("test");
+  module->AddProperty(*context->gc()->NewString("value"),Value(1));
+  ASSERT_TRUE(context->Construct());
+
+  Value get, attr, mget, v;
+  ASSERT_TRUE(context->GetGlobalVariable("get",&get));
+  ASSERT_TRUE(context->GetGlobalVariable("attr",&attr));
+  ASSERT_TRUE(context->GetGlobalVariable("mget",&mget));
+
+  Dict* d = context->gc()->NewDict();
+  context->AddOrUpdateGlobalVariable("d",Value(d));
+  d->InsertOrUpdate(*context->gc()->NewString("x"),Value(1));
+  ASSERT_TRUE(context->Invoke(get.GetSubRoutine(),Value(d),&v));
+  ASSERT_EQ(1,v.GetInteger());
+  ASSERT_TRUE(context->Invoke(attr.GetSubRoutine(),Value(d),&v));
+  ASSERT_EQ(1,v.GetInteger());
+
+  // Update of an existed key is seen through the cached slot
+  d->InsertOrUpdate(*context->gc()->NewString("x"),Value(2));
+  ASSERT_TRUE(context->Invoke(get.GetSubRoutine(),Value(d),&v));
+  ASSERT_EQ(2,v.GetInteger());
+
+  // Rehash moves the slot
+  for( int i = 0 ; i < 64 ; ++i ) {
+    d->InsertOrUpdate(*context->gc()->NewString(
+          boost::lexical_cast<std::string>(i)),Value(i));
+  }
+  d->InsertOrUpdate(*context->gc()->NewString("x"),Value(3));
+  ASSERT_TRUE(context->Invoke(get.GetSubRoutine(),Value(d),&v));
+  ASSERT_EQ(3,v.GetInteger());
+  ASSERT_TRUE(context->Invoke(attr.GetSubRoutine(),Value(d),&v));
+  ASSERT_EQ(3,v.GetInteger());
+
+  // Removed key
+  ASSERT_TRUE(d->Remove(*context->gc()->NewString("x"),NULL));
+  ASSERT_FALSE(context->Invoke(get.GetSubRoutine(),Value(d),&v));
+  ASSERT_FALSE(context->Invoke(attr.GetSubRoutine(),Value(d),&v));
+
+  // Polymorphic site
+  std::vector<Dict*> dicts;
+  for( int i = 0 ; i < 6 ; ++i ) {
+    Dict* e = context->gc()->NewDict();
+    context->AddOrUpdateGlobalVariable(
+        ("e" + boost::lexical_cast<std::string>(i)).c_str(),Value(e));
+    for( int j = 0 ; j < i ; ++j ) {
+      e->InsertOrUpdate(*context->gc()->NewString(
+            boost::lexical_cast<std::string>(j)),Value(j));
+    }
+    e->InsertOrUpdate(*context->gc()->NewString("x"),Value(100+i));
+    dicts.push_back(e);
+  }
+  for( int round = 0 ; round < 2 ; ++round ) {
+    for( size_t i = 0 ; i < dicts.size() ; ++i ) {
+      ASSERT_TRUE(context->Invoke(get.GetSubRoutine(),Value(dicts[i]),&v));
+      ASSERT_EQ(static_cast<int>(100+i),v.GetInteger());
+    }
+  }
+
+  // Module property replaced after the site is cached
+  ASSERT_TRUE(context->Invoke(mget.GetSubRoutine(),&v));
+  ASSERT_EQ(1,v.GetInteger());
+  module->AddProperty(*context->gc()->NewString("value"),Value(2));
+  ASSERT_TRUE(context->Invoke(mget.GetSubRoutine(),&v));
+  ASSERT_EQ(2,v.GetInteger());
+  ASSERT_TRUE(module->RemoveProperty(*context->gc()->NewString("value")));
+  ASSERT_FALSE(context->Invoke(mget.GetSubRoutine(),&v));
+}
+
+TEST(VM,DictShape) {
+  for( int reg = 0 ; reg < 2 ; ++reg ) {
+    boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+            vcl 4.0;
+            sub make(a,b) { return {{ server : a , number : b , ["tls"] : false }}; }
+            sub get(o) { return {o.number}; }
+            sub dup { return {{ a : 1 , a : 2 }}; }
+            sub dynamic(k) { return {{ [k] : 1 , b : 2 }}; }
+            sub keys(o) {
+              new s = "";
+              for( k , _ : o ) { set s = s + k; }
+              return {s};
+            }
+            global d1 = make("a.com",80);
+            global d2 = make("b.com",443);
+            global p1 = get(d1);
+            global p2 = get(d2);
+            global r1 = keys(d1);
+            global r2 = dup().a;
+            global r3 = dynamic("x").x;
+            ),reg == 1));
+    CTX(context);
+    GVAR(Integer,"p1",80);
+    GVAR(Integer,"p2",443);
+    GVAR(String,"r1","servernumbertls");
+    GVAR(Integer,"r2",2);
+    GVAR(Integer,"r3",1);
+    ASSERT_TRUE(SubHasBytecode(context.get(),"make",BC_LSDICT));
+    ASSERT_FALSE(SubHasBytecode(context.get(),"dup",BC_LSDICT));
+    ASSERT_FALSE(SubHasBytecode(context.get(),"dynamic",BC_LSDICT));
+
+    Value d1, d2, port, v;
+    ASSERT_TRUE(context->GetGlobalVariable("d1",&d1));
+    ASSERT_TRUE(context->GetGlobalVariable("d2",&d2));
+    ASSERT_TRUE(context->GetGlobalVariable("get",&port));
+    ASSERT_TRUE(d1.GetDict()->shape() != NULL);
+    ASSERT_EQ(d1.GetDict()->shape(),d2.GetDict()->shape());
+    ASSERT_EQ(3,d1.GetDict()->size());
+
+    // A shaped Dict reads its keys from the shape and only stores values
+    ASSERT_EQ(sizeof(Dict) + 3 * sizeof(Value),d1.GetDict()->footprint());
+    ASSERT_EQ(d1.GetDict()->shape()->key(0),d1.GetDict()->Begin().key());
+
+    // Update of an existed key keeps the shape
+    d1.GetDict()->InsertOrUpdate(*context->gc()->NewString("number"),Value(8080));
+    ASSERT_TRUE(d1.GetDict()->shape() != NULL);
+    ASSERT_TRUE(context->Invoke(port.GetSubRoutine(),d1,&v));
+    ASSERT_EQ(8080,v.GetInteger());
+
+    // New key moves the Dict into hash form , the other one is not affected
+    d1.GetDict()->InsertOrUpdate(*context->gc()->NewString("path"),Value(1));
+    ASSERT_TRUE(d1.GetDict()->shape() == NULL);
+    ASSERT_EQ(4,d1.GetDict()->size());
+    ASSERT_TRUE(context->Invoke(port.GetSubRoutine(),d1,&v));
+    ASSERT_EQ(8080,v.GetInteger());
+    ASSERT_TRUE(context->Invoke(port.GetSubRoutine(),d2,&v));
+    ASSERT_EQ(443,v.GetInteger());
+
+    // Removing a key
+    ASSERT_TRUE(d2.GetDict()->Remove(*context->gc()->NewString("number"),&v));
+    ASSERT_EQ(443,v.GetInteger());
+    ASSERT_TRUE(d2.GetDict()->shape() == NULL);
+    ASSERT_EQ(sizeof(Dict) + 3 * (sizeof(Value) + sizeof(String*)),
+              d2.GetDict()->footprint());
+    ASSERT_EQ(2,d2.GetDict()->size());
+    ASSERT_FALSE(context->Invoke(port.GetSubRoutine(),d2,&v));
+    ASSERT_TRUE(d2.GetDict()->Find("server",&v));
+    ASSERT_EQ(std::string("b.com"),v.GetString()->ToStdString());
+    ASSERT_TRUE(d2.GetDict()->Find("tls",&v));
+    ASSERT_FALSE(v.GetBoolean());
+  }
+}
+
+TEST(VM,DictIterate) {
+  // The loop body changes the Dict it iterates
+  for( int reg = 0 ; reg < 2 ; ++reg ) {
+    boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+            vcl 4.0;
+            sub remove_current {
+              new d = { a : 1 , b : 2 , c : 3 };
+              new s = "";
+              new r = false;
+              for( k , v : d ) {
+                set s = s + k;
+                set r = DictRemove(d,k);
+              }
+              return {s};
+            }
+            sub remove_last(last) {
+              new d = { a : 1 , b : 2 , c : 3 };
+              new s = "";
+              new r = false;
+              for( k , v : d ) {
+                set s = s + k;
+                if( k == last ) { set r = DictRemove(d,"c"); }
+              }
+              return {s};
+            }
+            sub grow {
+              new d = { a : 1 , b : 2 , c : 3 , d : 4 , e : 5 , f : 6 , g : 7 , h : 8 };
+              new s = "";
+              for( k , v : d ) {
+                set s = s + k;
+                set d[k + "x"] = v;
+              }
+              return {s};
+            }
+            global r1 = remove_current();
+            global r2 = remove_last("a");
+            global r3 = remove_last("c");
+            global r4 = grow();
+            ),reg == 1));
+    context->AddOrUpdateGlobalVariable("DictRemove",Value( context->gc()->New<DictRemove>()));
+    CTX(context);
+    GVAR(String,"r1","abc");
+    GVAR(String,"r2","ab");
+    GVAR(String,"r3","abc");
+    // Moving into hash form stops the iteration
+    GVAR(String,"r4","a");
+  }
+}
+
 TEST(VM,If) {
   {
     boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
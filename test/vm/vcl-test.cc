@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include <vcl/vcl.h>
 #include <string>
+#include <sstream>
 #include <cstdlib>
 #include <unordered_map>
 #include <time.h>
@@ -357,6 +358,77 @@ TEST(VCL,StringDict) {
   }
 }
 
+TEST(VCL,StringDictTombstone) {
+  ContextGC gc(100000000,1.0,NULL);
+  std::vector<String*> keys;
+  for( size_t i = 0 ; i < 10000 ; ++i ) {
+    keys.push_back(gc.NewString("key_" + std::to_string(i)));
+  }
+
+  StringDict<size_t> dict;
+  for( size_t i = 0 ; i < keys.size() ; ++i ) {
+    ASSERT_TRUE(dict.Insert(*keys[i],i));
+  }
+  ASSERT_EQ(keys.size(),dict.size());
+
+  for( size_t i = 0 ; i < keys.size() ; i += 2 ) {
+    size_t v;
+    ASSERT_TRUE(dict.Remove(*keys[i],&v));
+    ASSERT_EQ(i,v);
+  }
+  ASSERT_EQ(keys.size()/2,dict.size());
+
+  for( size_t i = 0 ; i < keys.size() ; ++i ) {
+    if(i % 2) {
+      ASSERT_EQ(i,*dict.Find(*keys[i]));
+      ASSERT_EQ(i,*dict.Find(keys[i]->data()));
+    } else {
+      ASSERT_TRUE(dict.Find(*keys[i]) == NULL);
+    }
+  }
+
+  size_t count = 0;
+  const StringDict<size_t>& cdict = dict;
+  for( StringDict<size_t>::ConstIterator itr = cdict.Begin() ;
+       itr != cdict.End() ; ++itr ) {
+    ASSERT_EQ(1,itr->second % 2);
+    ++count;
+  }
+  ASSERT_EQ(dict.size(),count);
+
+  // Churn doesn't grow the table since tombstones are dropped by rehash
+  const size_t capacity = dict.capacity();
+  for( size_t n = 0 ; n < 10 ; ++n ) {
+    for( size_t i = 0 ; i < keys.size() ; i += 2 ) {
+      ASSERT_TRUE(dict.Insert(*keys[i],i));
+    }
+    for( size_t i = 0 ; i < keys.size() ; i += 2 ) {
+      ASSERT_TRUE(dict.Remove(*keys[i],NULL));
+    }
+  }
+  ASSERT_EQ(capacity,dict.capacity());
+  ASSERT_EQ(keys.size()/2,dict.size());
+
+  // A full table which is smaller than a group
+  StringDict<size_t> small(4);
+  for( size_t i = 0 ; i < 4 ; ++i ) ASSERT_TRUE(small.Insert(*keys[i],i));
+  ASSERT_EQ(4,small.capacity());
+  ASSERT_TRUE(small.Find("none") == NULL);
+  ASSERT_TRUE(small.Remove(*keys[0],NULL));
+  ASSERT_TRUE(small.Insert(*keys[4],4));
+  ASSERT_EQ(4,small.capacity());
+  ASSERT_EQ(4,*small.Find(*keys[4]));
+
+  // Cached hash is dropped when the string is changed
+  Context context(ContextOption() , boost::shared_ptr<CompiledCode>(
+        new CompiledCode(NULL)));
+  String* string = context.gc()->NewString("key_1");
+  ASSERT_EQ(1,*dict.Find(*string));
+  ASSERT_TRUE(string->SelfAdd(&context,Value(context.gc()->NewString("1"))));
+  ASSERT_EQ(11,*dict.Find(*string));
+  ASSERT_EQ(detail::DefaultStringHasher()("key_11",6),string->hash());
+}
+
 TEST(VCL,Value) {
   ContextGC gc(10000,1.0,NULL);
   {
@@ -976,6 +1048,66 @@ TEST(VCL,String) {
 #undef XX // XX
 }
 
+TEST(VCL,Atom) {
+  Engine engine;
+  boost::shared_ptr<CompiledCode> cc(new CompiledCode(&engine));
+  Context context(ContextOption() , cc);
+  {
+    ImmutableGC gc;
+    String* a = gc.NewString("Hello");
+    ASSERT_TRUE(a->is_atom());
+    ASSERT_EQ(a,gc.NewString(std::string("Hello")));
+    ASSERT_NE(a,gc.NewString("World"));
+    ASSERT_EQ(2,gc.atom_size());
+    ASSERT_EQ(detail::DefaultStringHasher()("Hello",5),a->hash());
+
+    // Embedded '\0' is part of the atom
+    String* z = gc.NewString(std::string("a\0b",3));
+    ASSERT_EQ(3,z->size());
+    ASSERT_NE(z,gc.NewString("a"));
+    ASSERT_EQ(z,gc.NewString(std::string("a\0b",3)));
+    ASSERT_EQ(4,gc.atom_size());
+
+    // Shares the atom table of another ImmutableGC
+    ImmutableGC child(&gc);
+    ASSERT_EQ(a,child.NewString("Hello"));
+    ASSERT_EQ(4,child.atom_size());
+    ASSERT_EQ(0,child.gc_size());
+  }
+
+  // CompiledCode uses atoms of its Engine
+  {
+    String* a = engine.gc()->NewString("key");
+    ASSERT_EQ(a,cc->gc()->NewString("key"));
+    ASSERT_FALSE(context.gc()->NewString("key")->is_atom());
+
+    // Atom key and string key find each other
+    StringDict<int> dict;
+    ASSERT_TRUE(dict.Insert(*a,1));
+    ASSERT_EQ(1,*dict.Find(*context.gc()->NewString("key")));
+    ASSERT_EQ(1,*dict.Find("key"));
+    ASSERT_TRUE(dict.Insert(*context.gc()->NewString("other"),2));
+    ASSERT_EQ(2,*dict.Find(*engine.gc()->NewString("other")));
+    ASSERT_TRUE(*a == *context.gc()->NewString("key"));
+    ASSERT_TRUE(*a != *engine.gc()->NewString("kez"));
+  }
+
+  // Atom is never changed in place
+  {
+    String* a = engine.gc()->NewString("Hello");
+    Value v(a);
+    ASSERT_TRUE(v.SelfAdd(&context,Value(context.gc()->NewString("World"))));
+    ASSERT_TRUE(v.IsString());
+    ASSERT_EQ(*v.GetString(),"HelloWorld");
+    ASSERT_EQ(*a,"Hello");
+
+    v.SetString(a);
+    ASSERT_TRUE(v.Unset(&context));
+    ASSERT_TRUE(v.GetString()->empty());
+    ASSERT_EQ(*a,"Hello");
+  }
+}
+
 TEST(VCL,List) {
   Context context(ContextOption() , boost::shared_ptr<CompiledCode>(
         new CompiledCode(NULL)));
@@ -1018,6 +1150,87 @@ TEST(VCL,List) {
   }
 }
 
+TEST(VCL,PackedList) {
+  Context context(ContextOption() , boost::shared_ptr<CompiledCode>(
+        new CompiledCode(NULL)));
+  ContextGC* gc = context.gc();
+  {
+    List* l = gc->NewList(4);
+    ASSERT_EQ(List::KIND_EMPTY,l->kind());
+    l->Push(Value(1));
+    l->Push(Value(2));
+    l->Push(Value(3));
+    ASSERT_EQ(List::KIND_INTEGER,l->kind());
+    ASSERT_EQ(3,l->size());
+    ASSERT_EQ(2,l->integer_array()[1]);
+    ASSERT_EQ(3,l->Index(2).GetInteger());
+
+    Value v;
+    ASSERT_TRUE( l->SetIndex(NULL,Value(0),Value(10)) );
+    ASSERT_EQ(List::KIND_INTEGER,l->kind());
+    ASSERT_TRUE( l->GetIndex(NULL,Value(0),&v) );
+    ASSERT_EQ(10,v.GetInteger());
+
+    // A value of another type generalizes the list
+    ASSERT_TRUE( l->SetIndex(NULL,Value(1),Value(true)) );
+    ASSERT_EQ(List::KIND_GENERIC,l->kind());
+    ASSERT_EQ(10,l->Index(0).GetInteger());
+    ASSERT_TRUE(l->Index(1).IsBoolean());
+    ASSERT_EQ(3,l->Index(2).GetInteger());
+    l->Push(Value(4));
+    ASSERT_EQ(List::KIND_GENERIC,l->kind());
+    ASSERT_EQ(4,l->size());
+
+    // Clear lets the list pick a kind again
+    l->Clear();
+    ASSERT_EQ(List::KIND_EMPTY,l->kind());
+    l->Push(Value(1.5));
+    ASSERT_EQ(List::KIND_REAL,l->kind());
+    ASSERT_EQ(1.5,l->real_array()[0]);
+    l->Push(Value(2));
+    ASSERT_EQ(List::KIND_GENERIC,l->kind());
+    ASSERT_TRUE(l->Index(0).IsReal());
+    ASSERT_TRUE(l->Index(1).IsInteger());
+  }
+  {
+    List* l = gc->NewList();
+    l->Push(Value(gc->NewString("a")));
+    l->Push(Value(gc->NewString("b")));
+    ASSERT_EQ(List::KIND_STRING,l->kind());
+    ASSERT_TRUE( *l->string_array()[1] == "b" );
+
+    // Iterator reads the packed storage
+    Iterator* itr;
+    ASSERT_TRUE( l->NewIterator(&context,&itr) );
+    std::string keys , values;
+    for( ; itr->Has(&context) ; itr->Next(&context) ) {
+      Value k , v;
+      itr->GetKey(&context,&k);
+      itr->GetValue(&context,&v);
+      keys += static_cast<char>('0' + k.GetInteger());
+      values += v.GetString()->ToStdString();
+    }
+    ASSERT_EQ("01",keys);
+    ASSERT_EQ("ab",values);
+
+    // Growing with null generalizes , shrinking keeps the kind
+    l->Resize(1);
+    ASSERT_EQ(List::KIND_STRING,l->kind());
+    ASSERT_EQ(1,l->size());
+    l->Resize(3);
+    ASSERT_EQ(List::KIND_GENERIC,l->kind());
+    ASSERT_TRUE(l->Index(0).IsString());
+    ASSERT_TRUE(l->Index(2).IsNull());
+  }
+  {
+    // Strings in a packed list are kept alive by the list
+    Handle<List> l(gc->NewList(),gc);
+    l->Push(Value(gc->NewString("alive")));
+    gc->ForceCollect();
+    ASSERT_TRUE( *l->Index(0).GetString() == "alive" );
+  }
+}
+
 TEST(VCL,Dict) {
   Context context(ContextOption(),boost::shared_ptr<CompiledCode>(
         new CompiledCode(NULL)));
@@ -1086,6 +1299,121 @@ TEST(VCL,Dict) {
   }
 }
 
+TEST(VCL,SmallDict) {
+  Context context(ContextOption(),boost::shared_ptr<CompiledCode>(
+        new CompiledCode(NULL)));
+  ContextGC* gc = context.gc();
+  const size_t kSmallSize = Dict::kSmallSize;
+  {
+    Dict* d = gc->NewDict();
+    for( size_t i = 0 ; i < kSmallSize ; ++i ) {
+      std::stringstream key; key << "Key" << i;
+      ASSERT_TRUE( d->Insert( *gc->NewString(key.str()) , Value((int32_t)i) ) );
+      ASSERT_TRUE( d->is_small() );
+    }
+    ASSERT_FALSE( d->Insert( *gc->NewString("Key0") , Value(100) ) );
+    ASSERT_EQ(kSmallSize,d->size());
+
+    // Small form iterates in insertion order
+    {
+      size_t i = 0;
+      for( Dict::Iterator itr = d->Begin() ; itr != d->End() ; ++itr , ++i ) {
+        std::stringstream key; key << "Key" << i;
+        ASSERT_TRUE( *itr.key() == key.str() );
+        ASSERT_EQ( (int32_t)i , itr.value().GetInteger() );
+      }
+      ASSERT_EQ(kSmallSize,i);
+    }
+
+    // Removing keeps the order of the rest
+    {
+      Value v;
+      ASSERT_TRUE( d->Remove( *gc->NewString("Key1") , &v ) );
+      ASSERT_EQ(1,v.GetInteger());
+      ASSERT_FALSE( d->Remove( *gc->NewString("Key1") , &v ) );
+      ASSERT_EQ(kSmallSize-1,d->size());
+      Dict::Iterator itr = d->Begin();
+      ASSERT_TRUE( *itr.key() == "Key0" ); ++itr;
+      ASSERT_TRUE( *itr.key() == "Key2" );
+      ASSERT_TRUE( d->Insert( *gc->NewString("Key1") , Value(1) ) );
+      ASSERT_TRUE( d->is_small() );
+    }
+
+    // One more key moves it into the hash form
+    uint64_t stamp = d->stamp();
+    d->InsertOrUpdate( *gc->NewString("Extra") , Value(-1) );
+    ASSERT_FALSE( d->is_small() );
+    ASSERT_NE( stamp , d->stamp() );
+    ASSERT_EQ(kSmallSize+1,d->size());
+    for( size_t i = 0 ; i < kSmallSize ; ++i ) {
+      std::stringstream key; key << "Key" << i;
+      Value v;
+      ASSERT_TRUE( d->Find(key.str(),&v) );
+      ASSERT_EQ( (int32_t)i , v.GetInteger() );
+    }
+    {
+      Value v;
+      ASSERT_TRUE( d->Find("Extra",&v) );
+      ASSERT_EQ( -1 , v.GetInteger() );
+    }
+    {
+      size_t count = 0;
+      for( Dict::ConstIterator itr = static_cast<const Dict*>(d)->Begin() ;
+           itr != static_cast<const Dict*>(d)->End() ; ++itr )
+        ++count;
+      ASSERT_EQ(kSmallSize+1,count);
+    }
+
+    // Clear goes back to the small form
+    d->Clear();
+    ASSERT_TRUE( d->empty() );
+    ASSERT_TRUE( d->is_small() );
+    ASSERT_TRUE( d->Begin() == d->End() );
+  }
+  {
+    // Keys set by index are the same as keys set by property
+    Dict* d = gc->NewDict();
+    ASSERT_TRUE( d->SetIndex(&context,Value(gc->NewString("a")),Value(1)) );
+    ASSERT_TRUE( d->SetProperty(&context,*gc->NewString("a"),Value(2)) );
+    ASSERT_EQ(1,d->size());
+    Value v;
+    ASSERT_TRUE( d->GetIndex(&context,Value(gc->NewString("a")),&v) );
+    ASSERT_EQ(2,v.GetInteger());
+  }
+  {
+    // Large reservation starts in the hash form
+    Dict* d = gc->NewDict(100);
+    ASSERT_FALSE( d->is_small() );
+    ASSERT_TRUE( d->empty() );
+  }
+  {
+    // The entries are stored outside of the Dict and grow with the keys
+    ASSERT_TRUE( sizeof(Dict) <= 96 );
+    const size_t slot = sizeof(Value) + sizeof(String*);
+    Dict* d = gc->NewDict();
+    ASSERT_EQ(sizeof(Dict),d->footprint());
+    ASSERT_TRUE( d->Insert( *gc->NewString("a") , Value(1) ) );
+    ASSERT_EQ(sizeof(Dict) + 2 * slot,d->footprint());
+    for( size_t i = 1 ; i < kSmallSize ; ++i ) {
+      std::stringstream key; key << "Key" << i;
+      ASSERT_TRUE( d->Insert( *gc->NewString(key.str()) , Value(0) ) );
+    }
+    ASSERT_TRUE( d->is_small() );
+    ASSERT_EQ(sizeof(Dict) + kSmallSize * slot,d->footprint());
+
+    // A removed slot is reused instead of growing
+    Value v;
+    ASSERT_TRUE( d->Remove( *gc->NewString("a") , &v ) );
+    ASSERT_TRUE( d->Insert( *gc->NewString("b") , Value(2) ) );
+    ASSERT_TRUE( d->is_small() );
+    ASSERT_EQ(sizeof(Dict) + kSmallSize * slot,d->footprint());
+
+    d->Clear();
+    ASSERT_EQ(sizeof(Dict),d->footprint());
+    ASSERT_EQ(sizeof(Dict) + 3 * slot,gc->NewDict(3)->footprint());
+  }
+}
+
 TEST(VCL,Module) {
   Context context(ContextOption(),boost::shared_ptr<CompiledCode>(
         new CompiledCode(NULL)));
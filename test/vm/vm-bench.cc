@@ -0,0 +1,129 @@
+#include <boost/scoped_ptr.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <iostream>
+#include <vcl/vcl.h>
+#include <vm/procedure.h>
+#include <vm/bytecode-profile.h>
+
+// Run the test function of every VCL file under a folder with both the stack
+// virtual machine , the register virtual machine and the stack virtual machine
+// with every procedure compiled by the JIT , compare the result and show how
+// long each one takes. When built with VCL_BYTECODE_PROFILE , it
+// also dumps the bytecode sequence profile of the stack virtual machine.
+
+namespace vcl {
+namespace vm {
+
+class Assert : public Function {
+ public:
+  virtual MethodStatus Invoke( Context* context , Value* output ) {
+    bool value;
+    CHECK( context->GetArgument(0).ToBoolean(context,&value) );
+    output->SetNull();
+    return value ? MethodStatus::kOk : MethodStatus::kFail;
+  }
+
+  Assert() : Function("assert") {}
+};
+
+struct BenchResult {
+  bool ok;
+  bool lowered;
+  std::string output;
+  int64_t time;
+  BenchResult():ok(false),lowered(false),output(),time(0) {}
+};
+
+BenchResult Bench( Engine* engine , const char* path , int times ) {
+  BenchResult ret;
+  std::string error;
+  boost::shared_ptr<CompiledCode> cc( engine->LoadFile(path,ScriptOption(),&error) );
+  if(!cc.get()) { std::cerr<<error<<std::endl; return ret; }
+  ret.lowered = cc->entry()->register_code() != NULL;
+
+  ContextOption copt;
+  copt.gc_trigger = 1024;
+  copt.gc_ratio = 0.5;
+  Context context(copt,cc);
+  context.AddOrUpdateGlobalVariable("assert",Value(context.gc()->New<Assert>()));
+  if(!context.Construct()) return ret;
+
+  Value f;
+  if(!context.GetGlobalVariable("test",&f) || !f.IsSubRoutine()) return ret;
+
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+  for( int i = 0 ; i < times ; ++i ) {
+    Value v;
+    if(!context.Invoke(f.GetSubRoutine(),&v)) return ret;
+    if(i == 0) {
+      std::ostringstream formatter;
+      v.ToDisplay(&context,&formatter);
+      ret.output = formatter.str();
+    }
+  }
+  ret.time = (boost::posix_time::microsec_clock::local_time() - start).total_microseconds();
+  ret.ok = true;
+  return ret;
+}
+
+bool IsValidVCLFile( const boost::filesystem::path& p ) {
+  std::string name = p.filename().string();
+  if( name.empty() || name[0] == '.' ) return false;
+  return boost::filesystem::extension(p) == ".vcl";
+}
+
+int Run( const char* folder , int times ) {
+  EngineOption stack_option;
+  EngineOption register_option;
+  EngineOption jit_option;
+  register_option.vm_type = VM_REGISTER;
+  jit_option.jit = true;
+  jit_option.jit_threshold = 0;
+  Engine stack_engine(stack_option);
+  Engine register_engine(register_option);
+  Engine jit_engine(jit_option);
+  int mismatch = 0;
+
+  for( boost::filesystem::directory_iterator itr(folder) ; itr !=
+      boost::filesystem::directory_iterator() ; ++itr ) {
+    if(!boost::filesystem::is_regular_file( itr->status() ) ||
+       !IsValidVCLFile(*itr))
+      continue;
+    const char* path = itr->path().c_str();
+    BenchResult s = Bench(&stack_engine,path,times);
+    BenchResult r = Bench(&register_engine,path,times);
+    BenchResult j = Bench(&jit_engine,path,times);
+    std::cerr<<itr->path().filename().string()<<": ";
+    if(!s.ok) {
+      std::cerr<<"skipped\n";
+      continue;
+    }
+    if(!r.ok || s.output != r.output || !j.ok || s.output != j.output) {
+      std::cerr<<"MISMATCH\n";
+      ++mismatch;
+      continue;
+    }
+    std::cerr<<"stack "<<s.time<<"us register "<<r.time<<"us"
+             <<(r.lowered ? "" : " (not lowered)")
+             <<" jit "<<j.time<<"us\n";
+  }
+  return mismatch;
+}
+
+} // namespace vm
+} // namespace vcl
+
+int main( int argc , char* argv[] ) {
+  vcl::InitVCL( argv[0] );
+  if(argc < 2) {
+    std::cerr<<"Usage <path> [times]\n";
+    return -1;
+  }
+  int times = argc >= 3 ? atoi(argv[2]) : 100;
+  int mismatch = vcl::vm::Run(argv[1],times);
+#ifdef VCL_BYTECODE_PROFILE
+  vcl::vm::BytecodeProfile::Get()->Dump(std::cerr);
+#endif // VCL_BYTECODE_PROFILE
+  return mismatch == 0 ? 0 : -1;
+}
@@ -5,6 +5,7 @@
 #include <vm/compilation-unit.h>
 #include <vm/parser.h>
 #include <vm/procedure.h>
+#include <vm/jit.h>
 #include <boost/scoped_ptr.hpp>
 
 #define STRINGIFY(...) #__VA_ARGS__
@@ -12,8 +13,8 @@
 namespace vcl {
 namespace vm {
 
-Context* CompileCode( const char* source ) {
-  boost::shared_ptr<CompiledCode> cc( new CompiledCode( NULL ) );
+Context* CompileCode( const char* source , Engine* engine = NULL ) {
+  boost::shared_ptr<CompiledCode> cc( new CompiledCode( engine ) );
   Context* context = new Context( ContextOption() , cc );
   CompilationUnit cu;
   std::string error;
@@ -123,6 +124,91 @@ TEST(Yield,Function) {
   }
 }
 
+// Request a yield like a signal handler does , the VM yields at the next
+// safepoint which is right after the call returns
+class FunctionPreempt : public Function {
+ public:
+  virtual MethodStatus Invoke( Context* context , Value* output ) {
+    EXPECT_TRUE(context->Yield());
+    output->SetNull();
+    return MethodStatus::kOk;
+  }
+  FunctionPreempt() : Function("preempt") {}
+};
+
+TEST(Yield,Safepoint) {
+  boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+          vcl 4.0;
+          sub spin {
+            new sum = 0;
+            for( _ , v : [1,2,3] ) {
+              preempt();
+              set sum += v;
+            }
+            return { sum };
+          }
+          )));
+
+  ASSERT_TRUE(context.get());
+  {
+    Handle<String> key( context->gc()->NewString("preempt") ,
+                        context->gc() );
+    Handle<Function> val( context->gc()->New<FunctionPreempt>() ,
+                          context->gc() );
+    context->AddOrUpdateGlobalVariable( *key , Value(val) );
+  }
+  ASSERT_TRUE(context->Construct());
+
+  Value output;
+  ASSERT_TRUE( CallFunc(context.get(),"spin",&output).is_yield() );
+  ASSERT_TRUE( context->Resume(&output).is_yield() );
+  ASSERT_TRUE( context->Resume(&output).is_yield() );
+  ASSERT_TRUE( context->Resume(&output).is_ok() );
+  ASSERT_TRUE( output.IsInteger() );
+  ASSERT_EQ( 6 , output.GetInteger() );
+}
+
+// Same as above but the sub routine runs as native code , the loop back edge
+// inside of the native code is also a safepoint
+TEST(Yield,Jit) {
+  if(!JitCode::IsSupported()) return;
+  EngineOption option;
+  option.jit = true;
+  option.jit_threshold = 0;
+  Engine engine(option);
+
+  boost::scoped_ptr<Context> context(CompileCode(STRINGIFY(
+          vcl 4.0;
+          sub spin {
+            new sum = 0;
+            for( _ , v : [1,2,3] ) {
+              set sum += v;
+              if(sum == 3) { preempt(); }
+            }
+            return { sum };
+          }
+          ),&engine));
+
+  ASSERT_TRUE(context.get());
+  {
+    Handle<String> key( context->gc()->NewString("preempt") ,
+                        context->gc() );
+    Handle<Function> val( context->gc()->New<FunctionPreempt>() ,
+                          context->gc() );
+    context->AddOrUpdateGlobalVariable( *key , Value(val) );
+  }
+  ASSERT_TRUE(context->Construct());
+
+  Value f;
+  ASSERT_TRUE(context->GetGlobalVariable("spin",&f));
+  Value output;
+  ASSERT_TRUE( CallFunc(context.get(),"spin",&output).is_yield() );
+  ASSERT_TRUE( f.GetSubRoutine()->procedure()->jit_code() != NULL );
+  ASSERT_TRUE( context->Resume(&output).is_ok() );
+  ASSERT_TRUE( output.IsInteger() );
+  ASSERT_EQ( 6 , output.GetInteger() );
+}
+
 } // namespace vm
 } // namespace vcl
 